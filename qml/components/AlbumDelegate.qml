@@ -30,6 +30,7 @@ MediaContainerSelectionDelegate {
     title: Theme.highlightText(model.displayedAlbum, searchPanel.searchText, Theme.highlightColor)
     secondDescription: model.year
     mediaArt: model.mediaArt
+    Component.onDestruction: albumsModel.releaseMediaArt(model.albumId)
 
     menu: Component {
         ContextMenu {
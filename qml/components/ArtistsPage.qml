@@ -118,6 +118,7 @@ Page {
             title: Theme.highlightText(model.displayedArtist, searchPanel.searchText, Theme.highlightColor)
             description: qsTranslate("unplayer", "%n album(s)", String(), model.albumsCount)
             mediaArt: model.mediaArt
+            Component.onDestruction: artistsModel.releaseMediaArt(model.artistId)
             menu: Component {
                 ContextMenu {
                     MenuItem {
@@ -62,7 +62,7 @@ SilicaListView {
         anchors.horizontalCenter: parent.horizontalCenter
         y: Math.round(page.isPortrait ? Screen.height/4 : Screen.width/4) + placeholder.verticalOffset
         size: BusyIndicatorSize.Large
-        running: sourceModel.loading
+        running: sourceModel.loading && !listView.count
     }
 
     VerticalScrollDecorator { }
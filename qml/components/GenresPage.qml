@@ -116,6 +116,7 @@ Page {
             title: Theme.highlightText(model.genre, searchPanel.searchText, Theme.highlightColor)
             description: qsTranslate("unplayer", "%n track(s), %1", String(), model.tracksCount).arg(Unplayer.Utils.formatDuration(model.duration))
             mediaArt: model.mediaArt
+            Component.onDestruction: genresModel.releaseMediaArt(model.genreId)
             menu: Component {
                 ContextMenu {
                     MenuItem {
@@ -36,6 +36,12 @@ Page {
                 text: qsTranslate("unplayer", "Update Library")
                 onClicked: Unplayer.LibraryUtils.updateDatabase()
             }
+
+            MenuItem {
+                visible: Unplayer.LibraryUtils.searchAvailable
+                text: qsTranslate("unplayer", "Search")
+                onClicked: pageStack.push("LibrarySearchPage.qml")
+            }
         }
 
         Column {
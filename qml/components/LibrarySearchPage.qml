@@ -0,0 +1,116 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2019 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+import QtQuick 2.2
+import Sailfish.Silica 1.0
+
+import harbour.unplayer 0.1 as Unplayer
+
+Page {
+    id: librarySearchPage
+
+    SilicaListView {
+        id: listView
+
+        anchors.fill: parent
+
+        header: SearchField {
+            width: listView.width
+            placeholderText: qsTranslate("unplayer", "Search")
+            onTextChanged: searchModel.query = text.trim()
+            Component.onCompleted: forceActiveFocus()
+        }
+
+        model: Unplayer.LibrarySearchModel {
+            id: searchModel
+        }
+
+        delegate: ListItem {
+            contentHeight: Theme.itemSizeMedium
+
+            Column {
+                anchors {
+                    left: parent.left
+                    leftMargin: Theme.horizontalPageMargin
+                    right: parent.right
+                    rightMargin: Theme.horizontalPageMargin
+                    verticalCenter: parent.verticalCenter
+                }
+
+                Label {
+                    width: parent.width
+                    color: highlighted ? Theme.highlightColor : Theme.primaryColor
+                    text: model.title
+                    truncationMode: TruncationMode.Fade
+                }
+
+                Label {
+                    width: parent.width
+                    color: highlighted ? Theme.secondaryHighlightColor : Theme.secondaryColor
+                    font.pixelSize: Theme.fontSizeExtraSmall
+                    text: {
+                        switch (model.type) {
+                        case Unplayer.LibrarySearchModel.Track:
+                            return model.subtitle ? qsTranslate("unplayer", "Track · %1").arg(model.subtitle)
+                                                  : qsTranslate("unplayer", "Track")
+                        case Unplayer.LibrarySearchModel.Artist:
+                            return qsTranslate("unplayer", "Artist")
+                        case Unplayer.LibrarySearchModel.Album:
+                            return model.subtitle ? qsTranslate("unplayer", "Album · %1").arg(model.subtitle)
+                                                  : qsTranslate("unplayer", "Album")
+                        case Unplayer.LibrarySearchModel.Genre:
+                            return qsTranslate("unplayer", "Genre")
+                        }
+                        return String()
+                    }
+                    truncationMode: TruncationMode.Fade
+                }
+            }
+
+            onClicked: {
+                switch (model.type) {
+                case Unplayer.LibrarySearchModel.Track:
+                    Unplayer.Player.queue.addTracksFromUrls([model.filePath], true, 0)
+                    break
+                case Unplayer.LibrarySearchModel.Artist:
+                    pageStack.push("TracksPage.qml", {pageTitle: model.title,
+                                                      queryMode: Unplayer.TracksModel.QueryArtistTracks,
+                                                      artistId: model.id})
+                    break
+                case Unplayer.LibrarySearchModel.Album:
+                    pageStack.push("TracksPage.qml", {pageTitle: model.title,
+                                                      queryMode: Unplayer.TracksModel.QueryAlbumTracksForAllArtists,
+                                                      albumId: model.id})
+                    break
+                case Unplayer.LibrarySearchModel.Genre:
+                    pageStack.push("TracksPage.qml", {pageTitle: model.title,
+                                                      queryMode: Unplayer.TracksModel.QueryGenreTracks,
+                                                      genreId: model.id})
+                    break
+                }
+            }
+        }
+
+        ViewPlaceholder {
+            enabled: !searchModel.loading && searchModel.query.length > 0 && !listView.count
+            text: qsTranslate("unplayer", "Nothing found")
+        }
+
+        VerticalScrollDecorator { }
+    }
+}
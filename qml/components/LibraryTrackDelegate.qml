@@ -61,7 +61,10 @@ BaseTrackDelegate {
                     Unplayer.Player.play()
                 }
             } else {
-                Unplayer.Player.queue.addTracksFromLibrary(tracksModel.getTracks(tracksProxyModel.sourceIndexes), true, model.index)
+                var index = model.index
+                tracksModel.requestTracks(tracksProxyModel.sourceIndexes, function(tracks) {
+                    Unplayer.Player.queue.addTracksFromLibrary(tracks, true, index)
+                })
             }
         }
     }
@@ -20,9 +20,11 @@ import QtQuick 2.2
 import Sailfish.Silica 1.0
 
 Item {
+    id: mediaArtItem
+
     property bool highlighted
     property int size
-    property alias source: mediaArtImage.source
+    property string source
     property string fallbackIcon: "image://theme/icon-m-music"
 
     width: size
@@ -57,6 +59,9 @@ Item {
         anchors.fill: parent
         asynchronous: true
         fillMode: Image.PreserveAspectCrop
+        // Files are loaded as thumbnails of the nearest size
+        source: (!mediaArtItem.source || mediaArtItem.source.indexOf("image://") === 0) ? mediaArtItem.source
+                                                                                       : "image://thumbnail/" + encodeURIComponent(mediaArtItem.source)
         sourceSize.height: size
         visible: status === Image.Ready
 
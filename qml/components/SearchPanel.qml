@@ -25,6 +25,12 @@ DockedPanel {
     id: searchPanel
 
     property string searchText: searchField.text.trim()
+    // If false, searchText should be used to filter model directly
+    property bool filterModel: true
+
+    function updateFilter() {
+        listView.model.filterText = filterModel ? searchField.text.trim() : String()
+    }
 
     function focusSearchField() {
         searchField.forceActiveFocus()
@@ -40,6 +46,8 @@ DockedPanel {
     opacity: open ? 1 : 0
     dock: Dock.Top
 
+    onFilterModelChanged: updateFilter()
+
     onOpenChanged: {
         if (open)
             focusSearchField()
@@ -67,7 +75,7 @@ DockedPanel {
             }
             enabled: open
 
-            onTextChanged: listView.model.filterRegExp = new RegExp(Unplayer.Utils.escapeRegExp(text.trim()), "i")
+            onTextChanged: updateFilter()
         }
 
         IconButton {
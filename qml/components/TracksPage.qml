@@ -29,6 +29,7 @@ Page {
     property alias queryMode: tracksModel.queryMode
     property alias artistId: tracksModel.artistId
     property alias genreId: tracksModel.genreId
+    property alias albumId: tracksModel.albumId
 
     readonly property bool singleArtist: {
         switch (queryMode) {
@@ -42,6 +43,7 @@ Page {
 
     SearchPanel {
         id: searchPanel
+        filterModel: !tracksModel.windowed
     }
 
     RemorsePopup {
@@ -57,7 +59,9 @@ Page {
                 enabled: tracksProxyModel.hasSelection
                 text: qsTranslate("unplayer", "Replace queue")
                 onClicked: {
-                    Unplayer.Player.queue.addTracksFromLibrary(tracksModel.getTracks(tracksProxyModel.selectedSourceIndexes), true)
+                    tracksModel.requestTracks(tracksProxyModel.selectedSourceIndexes, function(tracks) {
+                        Unplayer.Player.queue.addTracksFromLibrary(tracks, true)
+                    })
                     selectionPanel.showPanel = false
                 }
             }
@@ -66,7 +70,9 @@ Page {
                 enabled: tracksProxyModel.hasSelection
                 text: qsTranslate("unplayer", "Add to queue")
                 onClicked: {
-                    Unplayer.Player.queue.addTracksFromLibrary(tracksModel.getTracks(tracksProxyModel.selectedSourceIndexes))
+                    tracksModel.requestTracks(tracksProxyModel.selectedSourceIndexes, function(tracks) {
+                        Unplayer.Player.queue.addTracksFromLibrary(tracks)
+                    })
                     selectionPanel.showPanel = false
                 }
             }
@@ -74,13 +80,16 @@ Page {
             MenuItem {
                 enabled: tracksProxyModel.hasSelection
                 text: qsTranslate("unplayer", "Add to playlist")
-                onClicked: pageStack.push(addToPlaylistPage)
+                onClicked: {
+                    tracksModel.requestTracks(tracksProxyModel.selectedSourceIndexes, function(tracks) {
+                        pageStack.push(addToPlaylistPage, {tracks: tracks})
+                    })
+                }
 
                 Component {
                     id: addToPlaylistPage
 
                     AddToPlaylistPage {
-                        tracks: tracksModel.getTracks(tracksProxyModel.selectedSourceIndexes)
                         Component.onDestruction: {
                             if (added) {
                                 selectionPanel.showPanel = false
@@ -93,7 +102,11 @@ Page {
             MenuItem {
                 enabled: tracksProxyModel.hasSelection
                 text: qsTranslate("unplayer", "Edit tags")
-                onClicked: pageStack.push("TagEditDialog.qml", {files: tracksModel.getTrackPaths(tracksProxyModel.selectedSourceIndexes)})
+                onClicked: {
+                    tracksModel.requestTrackPaths(tracksProxyModel.selectedSourceIndexes, function(paths) {
+                        pageStack.push("TagEditDialog.qml", {files: paths})
+                    })
+                }
             }
 
             MenuItem {
@@ -142,6 +155,7 @@ Page {
             filterRole: Unplayer.TracksModel.TitleRole
             sourceModel: Unplayer.TracksModel {
                 id: tracksModel
+                titleFilter: windowed ? searchPanel.searchText : String()
             }
         }
         section {
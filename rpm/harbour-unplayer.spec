@@ -16,6 +16,7 @@ BuildRequires: pkgconfig(Qt5DBus)
 BuildRequires: pkgconfig(Qt5Multimedia)
 BuildRequires: pkgconfig(Qt5Quick)
 BuildRequires: pkgconfig(Qt5Sql)
+BuildRequires: pkgconfig(sqlite3)
 BuildRequires: pkgconfig(sailfishapp)
 BuildRequires: pkgconfig(nemonotifications-qt5)
 BuildRequires: cmake
@@ -18,21 +18,48 @@
 
 #include "abstractlibrarymodel.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
 #include <memory>
+#include <unordered_map>
 
 #include <QDebug>
+#include <QFutureInterface>
+#include <QFutureWatcher>
 #include <QSqlError>
 #include <QSqlQuery>
 #include <QUuid>
-#include <QtConcurrentRun>
 
+#include "libraryquerycache.h"
 #include "libraryutils.h"
 #include "qscopeguard.h"
 #include "sqlutils.h"
-#include "utilsfunctions.h"
+#include "threadpool.h"
 
 namespace unplayer
 {
+    namespace
+    {
+        // First chunk should be enough to fill the screen, following ones grow up to maxChunkSize
+        const size_t firstChunkSize = 50;
+        const size_t maxChunkSize = 5000;
+    }
+
+    template<typename Item>
+    AbstractLibraryModel<Item>::AbstractLibraryModel()
+    {
+        QObject::connect(LibraryUtils::instance(), &LibraryUtils::libraryChanged, this, [this](const LibraryChanges& changes) {
+            onLibraryChanged(changes);
+        });
+    }
+
+    template<typename Item>
+    AbstractLibraryModel<Item>::~AbstractLibraryModel()
+    {
+        cancelQuery();
+    }
+
     template<typename Item>
     int AbstractLibraryModel<Item>::rowCount(const QModelIndex&) const
     {
@@ -57,49 +84,345 @@ namespace unplayer
     {
         removeRows(0, rowCount());
 
+        // New query will see all changes
+        mUpdateQueued = false;
+        mQueuedChangedIds.clear();
+
+        const QString queryString(makeQueryString());
+
+        if (const auto cached = LibraryQueryCache::instance().find<Item>(queryString)) {
+            // Running query is superseded, and model is marked as loaded
+            cancelQuery();
+            if (!cached->empty()) {
+                beginInsertRows(QModelIndex(), 0, static_cast<int>(cached->size()) - 1);
+                mItems = *cached;
+                endInsertRows();
+            }
+            setLoading(false);
+            return;
+        }
+
         setLoading(true);
 
-        auto queryString(makeQueryString());
-        auto itemFactory = createItemFactory();
-        auto future(QtConcurrent::run([itemFactory, queryString = std::move(queryString)] {
-            auto items(std::make_shared<std::vector<Item>>());
+        const quint64 generation = LibraryUtils::instance()->databaseGeneration();
+        runQuery(queryString, [this](std::vector<Item>&& items) {
+            const int first = rowCount();
+            beginInsertRows(QModelIndex(), first, first + static_cast<int>(items.size()) - 1);
+            if (mItems.empty()) {
+                mItems = std::move(items);
+            } else {
+                mItems.insert(mItems.end(), std::make_move_iterator(items.begin()), std::make_move_iterator(items.end()));
+            }
+            endInsertRows();
+        }, [this, queryString, generation] {
+            // Result is cached only if library didn't change while query was running
+            if (!mUpdateQueued && generation == LibraryUtils::instance()->databaseGeneration()) {
+                LibraryQueryCache::instance().insert(queryString, generation, mItems);
+            }
+            setLoading(false);
+        });
+    }
+
+    template<typename Item>
+    void AbstractLibraryModel<Item>::onLibraryChanged(const LibraryChanges& changes)
+    {
+        // Model wasn't loaded yet
+        if (mQueryId == 0) {
+            return;
+        }
 
+        if (changes.reset) {
+            execQuery();
+            return;
+        }
+
+        if (!isAffectedBy(changes)) {
+            return;
+        }
+
+        const LibraryChanges::Ids& ids = changedItemIds(changes);
+        std::unordered_set<int> changedIds(ids.added);
+        changedIds.insert(ids.modified.begin(), ids.modified.end());
+
+        if (mQueryRunning) {
+            // Running query may not see these changes, update after it is finished
+            mUpdateQueued = true;
+            mQueuedChangedIds.insert(changedIds.begin(), changedIds.end());
+            return;
+        }
+
+        updateItems(std::move(changedIds));
+    }
+
+    template<typename Item>
+    void AbstractLibraryModel<Item>::updateItems(std::unordered_set<int>&& changedIds)
+    {
+        // Differences can be found only with complete result
+        const auto items(std::make_shared<std::vector<Item>>());
+        const QString queryString(makeQueryString());
+        const quint64 generation = LibraryUtils::instance()->databaseGeneration();
+        runQuery(queryString, [items](std::vector<Item>&& chunk) {
+            items->insert(items->end(), std::make_move_iterator(chunk.begin()), std::make_move_iterator(chunk.end()));
+        }, [this, items, queryString, generation, changedIds = std::move(changedIds)] {
+            if (!mUpdateQueued && generation == LibraryUtils::instance()->databaseGeneration()) {
+                LibraryQueryCache::instance().insert(queryString, generation, *items);
+            }
+            applyItems(std::move(*items), changedIds);
+        });
+    }
+
+    template<typename Item>
+    void AbstractLibraryModel<Item>::cancelQuery()
+    {
+        mQueryFuture.cancel();
+        if (mQueryCancellationToken) {
+            mQueryCancellationToken->cancel();
+            mQueryCancellationToken.reset();
+        }
+        ++mQueryId;
+        mQueryRunning = false;
+        mUpdateQueued = false;
+        mQueuedChangedIds.clear();
+    }
+
+    template<typename Item>
+    void AbstractLibraryModel<Item>::applyItems(std::vector<Item>&& items, const std::unordered_set<int>& changedIds)
+    {
+        // Items are matched by id and number of preceding items with the same id,
+        // since the same track can appear several times
+        const auto makeKeys = [](const std::vector<Item>& list) {
+            std::vector<uint64_t> keys;
+            keys.reserve(list.size());
+            std::unordered_map<int, uint32_t> occurrences;
+            for (const Item& item : list) {
+                keys.push_back((static_cast<uint64_t>(static_cast<uint32_t>(item.id)) << 32) | occurrences[item.id]++);
+            }
+            return keys;
+        };
+
+        std::unordered_map<uint64_t, int> newIndexes;
+        {
+            const std::vector<uint64_t> newKeys(makeKeys(items));
+            newIndexes.reserve(newKeys.size());
+            for (size_t i = 0, max = newKeys.size(); i < max; ++i) {
+                newIndexes.emplace(newKeys[i], static_cast<int>(i));
+            }
+        }
+
+        // Positions of current items in new list, -1 if item was removed
+        std::vector<int> positions;
+        {
+            const std::vector<uint64_t> oldKeys(makeKeys(mItems));
+            positions.reserve(oldKeys.size());
+            for (uint64_t key : oldKeys) {
+                const auto found(newIndexes.find(key));
+                positions.push_back(found == newIndexes.end() ? -1 : found->second);
+            }
+        }
+
+        // Longest increasing subsequence of positions is kept in place,
+        // other items are removed and then inserted at their new positions
+        std::vector<bool> keep(positions.size(), false);
+        {
+            std::vector<int> tails;
+            std::vector<int> previous(positions.size(), -1);
+            for (int i = 0, max = static_cast<int>(positions.size()); i < max; ++i) {
+                const int position = positions[static_cast<size_t>(i)];
+                if (position < 0) {
+                    continue;
+                }
+                const auto found(std::lower_bound(tails.begin(), tails.end(), position, [&](int index, int value) {
+                    return positions[static_cast<size_t>(index)] < value;
+                }));
+                if (found != tails.begin()) {
+                    previous[static_cast<size_t>(i)] = *(found - 1);
+                }
+                if (found == tails.end()) {
+                    tails.push_back(i);
+                } else {
+                    *found = i;
+                }
+            }
+            for (int i = tails.empty() ? -1 : tails.back(); i != -1; i = previous[static_cast<size_t>(i)]) {
+                keep[static_cast<size_t>(i)] = true;
+            }
+        }
+
+        // Remove rows, starting from the end
+        std::vector<int> keptPositions;
+        for (int last = static_cast<int>(positions.size()) - 1; last >= 0;) {
+            if (keep[static_cast<size_t>(last)]) {
+                keptPositions.push_back(positions[static_cast<size_t>(last)]);
+                --last;
+                continue;
+            }
+            int first = last;
+            while (first > 0 && !keep[static_cast<size_t>(first - 1)]) {
+                --first;
+            }
+            removeRows(first, last - first + 1);
+            last = first - 1;
+        }
+        std::reverse(keptPositions.begin(), keptPositions.end());
+
+        // Insert new rows and replace changed ones. Kept rows are already in the right order,
+        // so after processing new item at index i it is located at row i
+        std::vector<int> changedRows;
+        auto kept(keptPositions.cbegin());
+        for (int i = 0, max = static_cast<int>(items.size()); i < max;) {
+            if (kept != keptPositions.cend() && *kept == i) {
+                Item& item = items[static_cast<size_t>(i)];
+                if (changedIds.count(item.id) != 0) {
+                    mItems[static_cast<size_t>(i)] = std::move(item);
+                    changedRows.push_back(i);
+                }
+                ++kept;
+                ++i;
+            } else {
+                const int end = (kept == keptPositions.cend()) ? max : *kept;
+                beginInsertRows(QModelIndex(), i, end - 1);
+                mItems.insert(mItems.begin() + i,
+                              std::make_move_iterator(items.begin() + i),
+                              std::make_move_iterator(items.begin() + end));
+                endInsertRows();
+                i = end;
+            }
+        }
+
+        for (size_t i = 0, max = changedRows.size(); i < max;) {
+            size_t last = i;
+            while ((last + 1) < max && changedRows[last + 1] == changedRows[last] + 1) {
+                ++last;
+            }
+            emit dataChanged(index(changedRows[i]), index(changedRows[last]));
+            i = last + 1;
+        }
+    }
+
+    template<typename Item>
+    template<typename ChunkCallback, typename FinishedCallback>
+    void AbstractLibraryModel<Item>::runQuery(const QString& queryString, const ChunkCallback& onChunk, const FinishedCallback& onFinished)
+    {
+        // Previous query is interrupted even if SQLite is still preparing its first row
+        cancelQuery();
+
+        const int queryId = mQueryId;
+        mQueryRunning = true;
+        const auto cancellationToken(std::make_shared<QueryCancellationToken>());
+        mQueryCancellationToken = cancellationToken;
+
+        QFutureInterface<ItemsChunk> futureInterface;
+        futureInterface.reportStarted();
+        mQueryFuture = futureInterface.future();
+
+        auto watcher = new QFutureWatcher<ItemsChunk>(this);
+        QObject::connect(watcher, &QFutureWatcherBase::resultsReadyAt, this, [this, watcher, queryId, onChunk](int begin, int end) {
+            if (queryId != mQueryId) {
+                return;
+            }
+            for (int i = begin; i < end; ++i) {
+                const ItemsChunk chunk(watcher->resultAt(i));
+                onChunk(std::move(*chunk));
+            }
+        });
+        QObject::connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher, queryId, onFinished] {
+            watcher->deleteLater();
+
+            if (queryId != mQueryId) {
+                return;
+            }
+
+            mQueryRunning = false;
+            // Query failed, incomplete result is neither applied nor cached
+            if (watcher->isCanceled()) {
+                setLoading(false);
+            } else {
+                onFinished();
+            }
+
+            if (mUpdateQueued) {
+                mUpdateQueued = false;
+                updateItems(std::move(mQueuedChangedIds));
+                mQueuedChangedIds.clear();
+            }
+        });
+        watcher->setFuture(mQueryFuture);
+
+        ThreadPool::interactive()->run([futureInterface, cancellationToken, itemFactory = createItemFactory(), queryString]() mutable {
             std::unique_ptr<AbstractItemFactory> itemFactoryUnique(itemFactory);
 
+            // Query is successful only if it reaches the end
+            bool succeeded = false;
+            const auto finishGuard(qScopeGuard([&futureInterface, &succeeded] {
+                if (!succeeded) {
+                    futureInterface.reportCanceled();
+                }
+                futureInterface.reportFinished();
+            }));
+
+            if (cancellationToken->isCancelled()) {
+                return;
+            }
+
             const DatabaseConnectionGuard databaseGuard(QUuid::createUuid().toString());
             if (!databaseGuard.db.isOpen()) {
-                return items;
+                return;
+            }
+
+            if (!cancellationToken->attach(databaseGuard.db)) {
+                return;
             }
+            const auto detachGuard(qScopeGuard([&] {
+                cancellationToken->detach(databaseGuard.db);
+            }));
 
+            // Forward only query doesn't make QtSql cache all rows
             QSqlQuery query(databaseGuard.db);
+            query.setForwardOnly(true);
             if (!query.prepare(queryString)) {
                 qWarning() << "Prepare failed:" << query.lastError();
                 qWarning() << "Query:" << queryString;
-                return items;
+                return;
+            }
+
+            if (!query.exec()) {
+                if (!cancellationToken->isCancelled()) {
+                    qWarning() << "Exec failed: " << query.lastError();
+                    qWarning() << "Query:" << queryString;
+                }
+                return;
             }
 
-            if (query.exec()) {
-                if (reserveFromQuery(*items, query) > 0) {
-                    while (query.next()) {
-                        items->push_back(itemFactory->itemFromQuery(query));
+            int chunkIndex = 0;
+            size_t chunkSize = firstChunkSize;
+            auto chunk(std::make_shared<std::vector<Item>>());
+            chunk->reserve(chunkSize);
+            while (query.next()) {
+                chunk->push_back(itemFactory->itemFromQuery(query));
+                if (chunk->size() == chunkSize) {
+                    if (cancellationToken->isCancelled()) {
+                        return;
                     }
+                    futureInterface.reportResult(chunk, chunkIndex);
+                    ++chunkIndex;
+                    chunkSize = std::min(chunkSize * 4, maxChunkSize);
+                    chunk = std::make_shared<std::vector<Item>>();
+                    chunk->reserve(chunkSize);
                 }
-            } else {
-                qWarning() << "Exec failed: " << query.lastError();
+            }
+            // If statement was interrupted or failed, next() returns false as if there were no more rows
+            if (cancellationToken->isCancelled()) {
+                return;
+            }
+            if (query.lastError().isValid()) {
+                qWarning() << "Fetching rows failed:" << query.lastError();
                 qWarning() << "Query:" << queryString;
+                return;
             }
-
-            return items;
-        }));
-
-        onFutureFinished(future, this, [this](std::shared_ptr<std::vector<Item>>&& items) {
-            removeRows(0, rowCount());
-            if (!items->empty()) {
-                beginInsertRows(QModelIndex(), 0, static_cast<int>(items->size()) - 1);
-                mItems = std::move(*items);
-                endInsertRows();
+            if (!chunk->empty()) {
+                futureInterface.reportResult(chunk, chunkIndex);
             }
-            setLoading(false);
+            succeeded = true;
         });
     }
 }
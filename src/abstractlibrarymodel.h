@@ -19,9 +19,15 @@
 #ifndef UNPLAYER_ABSTRACTLIBRARYMODEL_H
 #define UNPLAYER_ABSTRACTLIBRARYMODEL_H
 
+#include <memory>
+#include <unordered_set>
 #include <vector>
 
+#include <QFuture>
+
 #include "asyncloadingmodel.h"
+#include "librarychanges.h"
+#include "querycancellationtoken.h"
 
 class QSqlQuery;
 
@@ -31,6 +37,9 @@ namespace unplayer
     class AbstractLibraryModel : public AsyncLoadingModel
     {
     public:
+        AbstractLibraryModel();
+        ~AbstractLibraryModel() override;
+
         int rowCount(const QModelIndex& parent = QModelIndex()) const override;
         bool removeRows(int row, int count, const QModelIndex& parent = QModelIndex()) override;
 
@@ -47,11 +56,48 @@ namespace unplayer
             virtual Item itemFromQuery(const QSqlQuery& query) = 0;
         };
 
-        void execQuery();
+        virtual void execQuery();
+        /**
+         * @brief Executes query again and applies difference with current items
+         * as row removals, insertions and data changes
+         * @param changedIds Ids of items which data should be replaced
+         */
+        virtual void updateItems(std::unordered_set<int>&& changedIds);
+        /**
+         * @brief Cancels running query, its results won't be applied
+         */
+        void cancelQuery();
+
         virtual QString makeQueryString() = 0;
         virtual AbstractItemFactory* createItemFactory() = 0;
 
+        virtual bool isAffectedBy(const LibraryChanges& changes) const = 0;
+        virtual const LibraryChanges::Ids& changedItemIds(const LibraryChanges& changes) const = 0;
+
         std::vector<Item> mItems;
+
+    private:
+        void onLibraryChanged(const LibraryChanges& changes);
+        void applyItems(std::vector<Item>&& items, const std::unordered_set<int>& changedIds);
+
+        using ItemsChunk = std::shared_ptr<std::vector<Item>>;
+
+        /**
+         * @brief Executes query in background thread, delivering items in chunks
+         * as they are read from database. Previous query is cancelled.
+         * onFinished is not called if query failed
+         * @param queryString Result of makeQueryString(), which must be called before createItemFactory()
+         */
+        template<typename ChunkCallback, typename FinishedCallback>
+        void runQuery(const QString& queryString, const ChunkCallback& onChunk, const FinishedCallback& onFinished);
+
+        QFuture<ItemsChunk> mQueryFuture;
+        std::shared_ptr<QueryCancellationToken> mQueryCancellationToken;
+        // Results of superseded queries are ignored
+        int mQueryId = 0;
+        bool mQueryRunning = false;
+        bool mUpdateQueued = false;
+        std::unordered_set<int> mQueuedChangedIds;
     };
 }
 
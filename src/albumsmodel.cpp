@@ -29,8 +29,8 @@
 #include "librarytrack.h"
 #include "libraryutils.h"
 #include "mediaartutils.h"
-#include "modelutils.h"
 #include "settings.h"
+#include "sqliteutils.h"
 #include "tracksmodel.h"
 
 #include "abstractlibrarymodel.cpp"
@@ -158,9 +158,9 @@ namespace unplayer
         case MediaArtRole:
             if (!album.requestedMediaArt) {
                 if (mAllArtists) {
-                    MediaArtUtils::instance()->getRandomMediaArtForAlbum(album.id);
+                    MediaArtUtils::instance()->getRandomMediaArtForAlbum(album.id, this);
                 } else {
-                    MediaArtUtils::instance()->getRandomMediaArtForArtistAndAlbum(mArtistId, album.id);
+                    MediaArtUtils::instance()->getRandomMediaArtForArtistAndAlbum(mArtistId, album.id, this);
                 }
                 album.requestedMediaArt = true;
             }
@@ -305,22 +305,26 @@ namespace unplayer
 
     void AlbumsModel::removeAlbums(const std::vector<int>& indexes, bool deleteFiles)
     {
-        if (LibraryUtils::instance()->isRemovingFiles()) {
-            return;
-        }
-
         std::vector<int> albums;
         albums.reserve(indexes.size());
         for (int index : indexes) {
             albums.push_back(mAlbums[static_cast<size_t>(index)].id);
         }
         LibraryUtils::instance()->removeAlbums(std::move(albums), deleteFiles);
-        QObject::connect(LibraryUtils::instance(), &LibraryUtils::removingFilesChanged, this, [this, indexes] {
-            if (!LibraryUtils::instance()->isRemovingFiles()) {
-                ModelBatchRemover::removeIndexes(this, indexes);
-                QObject::disconnect(LibraryUtils::instance(), &LibraryUtils::removingFilesChanged, this, nullptr);
+    }
+
+    void AlbumsModel::releaseMediaArt(int albumId)
+    {
+        if (mAllArtists ? MediaArtUtils::instance()->cancelRandomMediaArtForAlbum(albumId, this)
+                        : MediaArtUtils::instance()->cancelRandomMediaArtForArtistAndAlbum(mArtistId, albumId, this)) {
+            // Requested again when row becomes visible
+            const auto found(std::find_if(mAlbums.begin(), mAlbums.end(), [&](const Album& album) {
+                return album.id == albumId;
+            }));
+            if (found != mAlbums.end()) {
+                found->requestedMediaArt = false;
             }
-        });
+        }
     }
 
     QHash<int, QByteArray> AlbumsModel::roleNames() const
@@ -342,17 +346,10 @@ namespace unplayer
     {
         QString queryString;
         if (mAllArtists) {
-            queryString = QLatin1String("SELECT albumId, group_concat(artistTitle0, ', ') as artistTitle, albumTitle, year, tracksCount, duration "
-                                        "FROM ("
-                                            "SELECT albums.id AS albumId, artists.title AS artistTitle0, albums.title AS albumTitle, year, COUNT(tracks.id) AS tracksCount, SUM(duration) AS duration "
-                                            "FROM tracks "
-                                            "LEFT JOIN tracks_albums ON tracks_albums.trackId = tracks.id "
-                                            "LEFT JOIN albums ON albums.id = tracks_albums.albumId "
-                                            "LEFT JOIN albums_artists ON albums_artists.albumId = albums.id "
-                                            "LEFT JOIN artists ON artists.id = albums_artists.artistId "
-                                            "GROUP BY artists.id, albums.id"
-                                        ") "
-                                        "GROUP BY albumId ");
+            // Album with id 0 stands for tracks without album
+            queryString = QLatin1String("SELECT albumId, albums_stats.artist AS artistTitle, albums.title AS albumTitle, year, tracksCount, duration "
+                                        "FROM albums_stats "
+                                        "LEFT JOIN albums ON albums.id = albumId ");
         } else {
             queryString = QLatin1String("SELECT albums.id AS albumId, artists.title AS artistTitle, albums.title AS albumTitle, year, COUNT(tracks.id) AS tracksCount, SUM(duration) AS duration "
                                         "FROM tracks "
@@ -371,19 +368,19 @@ namespace unplayer
 
         switch (mSortMode) {
         case SortAlbum:
-            queryString += QLatin1String("ORDER BY albumTitle IS NULL %1, albumTitle %1");
+            queryString += QLatin1String("ORDER BY albumTitle IS NULL %1, albumTitle COLLATE %2 %1");
             break;
         case SortYear:
-            queryString += QLatin1String("ORDER BY year %1, albumTitle IS NULL %1, albumTitle %1");
+            queryString += QLatin1String("ORDER BY year %1, albumTitle IS NULL %1, albumTitle COLLATE %2 %1");
             break;
         case SortArtistAlbum:
-            queryString += QLatin1String("ORDER BY artistTitle IS NULL %1, artistTitle %1, albumTitle IS NULL %1, albumTitle %1");
+            queryString += QLatin1String("ORDER BY artistTitle IS NULL %1, artistTitle COLLATE %2 %1, albumTitle IS NULL %1, albumTitle COLLATE %2 %1");
             break;
         case SortArtistYear:
-            queryString += QLatin1String("ORDER BY artistTitle IS NULL %1, artistTitle %1, year %1, albumTitle IS NULL %1, albumTitle %1");
+            queryString += QLatin1String("ORDER BY artistTitle IS NULL %1, artistTitle COLLATE %2 %1, year %1, albumTitle IS NULL %1, albumTitle COLLATE %2 %1");
         }
 
-        return queryString.arg(mSortDescending ? QLatin1String("DESC") : QLatin1String("ASC"));
+        return queryString.arg(mSortDescending ? QLatin1String("DESC") : QLatin1String("ASC"), sqliteutils::sortCollation());
     }
 
     AlbumsModel::AbstractItemFactory* AlbumsModel::createItemFactory()
@@ -391,6 +388,19 @@ namespace unplayer
         return new ItemFactory();
     }
 
+    bool AlbumsModel::isAffectedBy(const LibraryChanges& changes) const
+    {
+        if (mAllArtists) {
+            return !changes.albums.isEmpty();
+        }
+        return changes.artists.contains(mArtistId);
+    }
+
+    const LibraryChanges::Ids& AlbumsModel::changedItemIds(const LibraryChanges& changes) const
+    {
+        return changes.albums;
+    }
+
     Album AlbumsModel::ItemFactory::itemFromQuery(const QSqlQuery& query)
     {
         const QString artist(query.value(ArtistField).toString());
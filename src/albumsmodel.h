@@ -104,6 +104,9 @@ namespace unplayer
         Q_INVOKABLE void removeAlbum(int index, bool deleteFiles);
         Q_INVOKABLE void removeAlbums(const std::vector<int>& indexes, bool deleteFiles);
 
+        // Called when delegate is destroyed, so that rows that were scrolled away don't delay media art of visible ones
+        Q_INVOKABLE void releaseMediaArt(int albumId);
+
     protected:
         class ItemFactory final : public AbstractItemFactory
         {
@@ -116,6 +119,9 @@ namespace unplayer
         QString makeQueryString() override;
         AbstractItemFactory* createItemFactory() override;
 
+        bool isAffectedBy(const LibraryChanges& changes) const override;
+        const LibraryChanges::Ids& changedItemIds(const LibraryChanges& changes) const override;
+
     private:
         std::vector<Album>& mAlbums = mItems;
 
@@ -29,8 +29,8 @@
 #include "librarytrack.h"
 #include "libraryutils.h"
 #include "mediaartutils.h"
-#include "modelutils.h"
 #include "settings.h"
+#include "sqliteutils.h"
 #include "tracksmodel.h"
 
 #include "abstractlibrarymodel.cpp"
@@ -97,7 +97,7 @@ namespace unplayer
             return artist.duration;
         case MediaArtRole:
             if (!artist.requestedMediaArt) {
-                MediaArtUtils::instance()->getRandomMediaArtForArtist(artist.id);
+                MediaArtUtils::instance()->getRandomMediaArtForArtist(artist.id, this);
                 artist.requestedMediaArt = true;
             }
             return artist.mediaArt;
@@ -207,22 +207,25 @@ namespace unplayer
 
     void ArtistsModel::removeArtists(const std::vector<int>& indexes, bool deleteFiles)
     {
-        if (LibraryUtils::instance()->isRemovingFiles()) {
-            return;
-        }
-
         std::vector<int> artists;
         artists.reserve(indexes.size());
         for (int index : indexes) {
             artists.push_back(mArtists[static_cast<size_t>(index)].id);
         }
         LibraryUtils::instance()->removeArtists(std::move(artists), deleteFiles);
-        QObject::connect(LibraryUtils::instance(), &LibraryUtils::removingFilesChanged, this, [this, indexes] {
-            if (!LibraryUtils::instance()->isRemovingFiles()) {
-                ModelBatchRemover::removeIndexes(this, indexes);
-                QObject::disconnect(LibraryUtils::instance(), &LibraryUtils::removingFilesChanged, this, nullptr);
+    }
+
+    void ArtistsModel::releaseMediaArt(int artistId)
+    {
+        if (MediaArtUtils::instance()->cancelRandomMediaArtForArtist(artistId, this)) {
+            // Requested again when row becomes visible
+            const auto found(std::find_if(mArtists.begin(), mArtists.end(), [&](const Artist& artist) {
+                return artist.id == artistId;
+            }));
+            if (found != mArtists.end()) {
+                found->requestedMediaArt = false;
             }
-        });
+        }
     }
 
     QHash<int, QByteArray> ArtistsModel::roleNames() const
@@ -238,23 +241,15 @@ namespace unplayer
 
     QString ArtistsModel::makeQueryString()
     {
-        QString queryString(QLatin1String("SELECT artists.id, artists.title, COUNT(DISTINCT CASE WHEN albums.id IS NULL THEN 0 ELSE albums.id END), COUNT(tracks.id), SUM(duration) "
-                                          "FROM tracks "));
-        if (Settings::instance()->useAlbumArtist()) {
-            queryString += QLatin1String("LEFT JOIN tracks_albums ON tracks_albums.trackId = tracks.id "
-                                         "LEFT JOIN albums ON albums.id = tracks_albums.albumId "
-                                         "LEFT JOIN albums_artists ON albums_artists.albumId = albums.id "
-                                         "LEFT JOIN artists ON artists.id = albums_artists.artistId ");
-        } else {
-            queryString += QLatin1String("LEFT JOIN tracks_artists ON tracks_artists.trackId = tracks.id "
-                                         "LEFT JOIN artists ON artists.id = tracks_artists.artistId "
-                                         "LEFT JOIN tracks_albums ON tracks_albums.trackId = tracks.id "
-                                         "LEFT JOIN albums ON albums.id = tracks_albums.albumId ");
-        }
-        queryString += QString::fromLatin1("GROUP BY artists.id "
-                                           "ORDER BY artists.id IS NULL %1, artists.title %1").arg(mSortDescending ? QLatin1String("DESC")
-                                                                                                                   : QLatin1String("ASC"));
-        return queryString;
+        // Artist with id 0 stands for tracks without artist
+        return QString::fromLatin1("SELECT artistId, artists.title, albumsCount, tracksCount, duration "
+                                   "FROM %1 "
+                                   "LEFT JOIN artists ON artists.id = artistId "
+                                   "ORDER BY artistId = 0 %2, artists.title COLLATE %3 %2").arg(Settings::instance()->useAlbumArtist() ? QLatin1String("album_artists_stats")
+                                                                                                                        : QLatin1String("artists_stats"),
+                                                                                 mSortDescending ? QLatin1String("DESC")
+                                                                                                 : QLatin1String("ASC"),
+                                                                                 sqliteutils::sortCollation());
     }
 
     ArtistsModel::AbstractItemFactory* ArtistsModel::createItemFactory()
@@ -262,6 +257,16 @@ namespace unplayer
         return new ItemFactory();
     }
 
+    bool ArtistsModel::isAffectedBy(const LibraryChanges& changes) const
+    {
+        return !changedItemIds(changes).isEmpty();
+    }
+
+    const LibraryChanges::Ids& ArtistsModel::changedItemIds(const LibraryChanges& changes) const
+    {
+        return Settings::instance()->useAlbumArtist() ? changes.albumArtists : changes.artists;
+    }
+
     Artist ArtistsModel::ItemFactory::itemFromQuery(const QSqlQuery& query)
     {
         const QString artist(query.value(ArtistField).toString());
@@ -70,6 +70,9 @@ namespace unplayer
 
         Q_INVOKABLE void removeArtist(int index, bool deleteFiles);
         Q_INVOKABLE void removeArtists(const std::vector<int>& indexes, bool deleteFiles);
+
+        // Called when delegate is destroyed, so that rows that were scrolled away don't delay media art of visible ones
+        Q_INVOKABLE void releaseMediaArt(int artistId);
     protected:
         class ItemFactory final : public AbstractItemFactory
         {
@@ -82,6 +85,9 @@ namespace unplayer
         QString makeQueryString() override;
         AbstractItemFactory* createItemFactory() override;
 
+        bool isAffectedBy(const LibraryChanges& changes) const override;
+        const LibraryChanges::Ids& changedItemIds(const LibraryChanges& changes) const override;
+
     private:
         std::vector<Artist>& mArtists = mItems;
         bool mSortDescending;
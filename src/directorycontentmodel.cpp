@@ -23,8 +23,8 @@
 #include <QDir>
 #include <QFileInfo>
 #include <QStandardPaths>
-#include <QtConcurrentRun>
 
+#include "threadpool.h"
 #include "utilsfunctions.h"
 
 namespace unplayer
@@ -149,7 +149,7 @@ namespace unplayer
             filters |= QDir::Files | QDir::Readable;
         }
 
-        auto future = QtConcurrent::run([=]() {
+        auto future = ThreadPool::interactive()->run([=]() {
             auto files(std::make_shared<std::vector<DirectoryContentFile>>());
             const QList<QFileInfo> fileInfos(QDir(directory).entryInfoList(nameFilters, filters));
             files->reserve(static_cast<size_t>(fileInfos.size()));
@@ -25,13 +25,13 @@
 #include <QFileInfo>
 #include <QItemSelectionModel>
 #include <QStandardPaths>
-#include <QtConcurrentRun>
 
 #include "fileutils.h"
 #include "libraryutils.h"
 #include "modelutils.h"
 #include "playlistutils.h"
 #include "settings.h"
+#include "threadpool.h"
 #include "utilsfunctions.h"
 
 namespace unplayer
@@ -183,7 +183,7 @@ namespace unplayer
             std::vector<DirectoryTrackFile> files;
             int tracksCount;
         };
-        auto future = QtConcurrent::run([directory = mDirectory, showVideoFiles = mShowVideoFiles]() {
+        auto future = ThreadPool::interactive()->run([directory = mDirectory, showVideoFiles = mShowVideoFiles]() {
             std::vector<DirectoryTrackFile> files;
             int tracksCount = 0;
             const QFileInfoList fileInfos(QDir(directory).entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot | QDir::Files | QDir::Readable));
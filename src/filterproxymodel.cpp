@@ -19,15 +19,88 @@
 #include "filterproxymodel.h"
 
 #include <algorithm>
+#include <iterator>
+
 #include <QItemSelectionModel>
+#include <QStringMatcher>
+#include <QTimer>
+
+#include "threadpool.h"
+#include "utilsfunctions.h"
 
 namespace unplayer
 {
+    namespace
+    {
+        // Collation keys and filter results for larger models are computed in background thread
+        const int asyncThreshold = 1000;
+        // Delay between last change of filter text and start of filtering
+        const int filterDelay = 150;
+        // How often filtering checks whether it was cancelled
+        const size_t filterCancelCheckInterval = 1024;
+
+        struct FilterResult
+        {
+            std::shared_ptr<const std::vector<QString>> strings;
+            std::vector<char> accepted;
+        };
+
+        FilterResult filterStrings(const QString& text,
+                                   std::shared_ptr<const std::vector<QString>> strings,
+                                   const QStringList& unfoldedStrings,
+                                   const std::atomic_bool& cancelled)
+        {
+            FilterResult result;
+            if (!strings) {
+                auto folded(std::make_shared<std::vector<QString>>());
+                folded->reserve(static_cast<size_t>(unfoldedStrings.size()));
+                for (const QString& string : unfoldedStrings) {
+                    folded->push_back(string.toCaseFolded());
+                }
+                strings = std::move(folded);
+            }
+
+            // Needle's skip table is computed once for all rows
+            const QStringMatcher matcher(text, Qt::CaseSensitive);
+            result.accepted.reserve(strings->size());
+            for (size_t i = 0, max = strings->size(); i < max; ++i) {
+                if ((i % filterCancelCheckInterval) == 0 && cancelled) {
+                    return {};
+                }
+                result.accepted.push_back(matcher.indexIn((*strings)[i]) != -1);
+            }
+
+            result.strings = std::move(strings);
+            return result;
+        }
+
+        std::vector<QCollatorSortKey> makeSortKeys(const QCollator& collator, const QStringList& strings)
+        {
+            std::vector<QCollatorSortKey> keys;
+            keys.reserve(static_cast<size_t>(strings.size()));
+            for (const QString& string : strings) {
+                keys.push_back(collator.sortKey(string));
+            }
+            return keys;
+        }
+    }
+
     FilterProxyModel::FilterProxyModel()
         : mSortEnabled(false),
-          mSelectionModel(new QItemSelectionModel(this))
+          mSelectionModel(new QItemSelectionModel(this)),
+          mSortKeysValid(false),
+          mSortKeysPending(false),
+          mSortKeysRequestId(0),
+          mFilterTimer(new QTimer(this)),
+          mFilterApplied(false),
+          mFilterRequestId(0)
     {
         mCollator.setNumericMode(true);
+
+        mFilterTimer->setSingleShot(true);
+        mFilterTimer->setInterval(filterDelay);
+        QObject::connect(mFilterTimer, &QTimer::timeout, this, &FilterProxyModel::startFiltering);
+
         QObject::connect(mSelectionModel, &QItemSelectionModel::selectionChanged, this, &FilterProxyModel::selectionChanged);
     }
 
@@ -39,6 +112,7 @@ namespace unplayer
     void FilterProxyModel::componentComplete()
     {
         if (mSortEnabled) {
+            resetSortKeys();
             sort(0);
         }
     }
@@ -116,12 +190,315 @@ namespace unplayer
         mSelectionModel->select(QItemSelection(index(0, 0), index(rowCount() - 1, 0)), QItemSelectionModel::Select);
     }
 
+    void FilterProxyModel::setSourceModel(QAbstractItemModel* sourceModel)
+    {
+        if (this->sourceModel()) {
+            QObject::disconnect(this->sourceModel(), nullptr, this, nullptr);
+        }
+
+        // Connected before QSortFilterProxyModel's own connections, so that keys and filter results
+        // match source rows when they are sorted and filtered
+        if (sourceModel) {
+            QObject::connect(sourceModel, &QAbstractItemModel::modelReset, this, &FilterProxyModel::clearSourceData);
+            QObject::connect(sourceModel, &QAbstractItemModel::layoutChanged, this, &FilterProxyModel::clearSourceData);
+            QObject::connect(sourceModel, &QAbstractItemModel::rowsMoved, this, &FilterProxyModel::clearSourceData);
+            QObject::connect(sourceModel, &QAbstractItemModel::rowsInserted, this, [this](const QModelIndex&, int first, int last) {
+                onSourceRowsInserted(first, last);
+            });
+            QObject::connect(sourceModel, &QAbstractItemModel::rowsRemoved, this, [this](const QModelIndex&, int first, int last) {
+                onSourceRowsRemoved(first, last);
+            });
+            QObject::connect(sourceModel, &QAbstractItemModel::dataChanged, this, [this](const QModelIndex& topLeft, const QModelIndex& bottomRight, const QVector<int>& roles) {
+                onSourceDataChanged(topLeft.row(), bottomRight.row(), roles);
+            });
+        }
+
+        QSortFilterProxyModel::setSourceModel(sourceModel);
+
+        // Connected after QSortFilterProxyModel's own connections, since invalidateFilter()
+        // can't be called while proxy is in the middle of handling source change
+        if (sourceModel) {
+            QObject::connect(sourceModel, &QAbstractItemModel::modelReset, this, &FilterProxyModel::onSourceReset);
+            QObject::connect(sourceModel, &QAbstractItemModel::layoutChanged, this, &FilterProxyModel::onSourceReset);
+            QObject::connect(sourceModel, &QAbstractItemModel::rowsMoved, this, &FilterProxyModel::onSourceReset);
+            QObject::connect(sourceModel, &QAbstractItemModel::rowsInserted, this, &FilterProxyModel::onSourceRowsChanged);
+            QObject::connect(sourceModel, &QAbstractItemModel::rowsRemoved, this, &FilterProxyModel::onSourceRowsChanged);
+            QObject::connect(sourceModel, &QAbstractItemModel::dataChanged, this, &FilterProxyModel::onSourceRowsChanged);
+        }
+
+        clearSourceData();
+        onSourceReset();
+    }
+
+    QString FilterProxyModel::filterText() const
+    {
+        return mFilterText;
+    }
+
+    void FilterProxyModel::setFilterText(const QString& text)
+    {
+        if (text != mFilterText) {
+            mFilterText = text;
+            // Restarted on each keystroke
+            mFilterTimer->start();
+        }
+    }
+
+    bool FilterProxyModel::filterAcceptsRow(int sourceRow, const QModelIndex& sourceParent) const
+    {
+        // Rows are shown when they can be sorted
+        if (mSortKeysPending) {
+            return false;
+        }
+        if (mFilterApplied && static_cast<size_t>(sourceRow) < mAcceptedRows.size()) {
+            return mAcceptedRows[static_cast<size_t>(sourceRow)];
+        }
+        return QSortFilterProxyModel::filterAcceptsRow(sourceRow, sourceParent);
+    }
+
     bool FilterProxyModel::lessThan(const QModelIndex& left, const QModelIndex& right) const
     {
+        if (mSortKeysValid) {
+            return (mSortKeys[static_cast<size_t>(left.row())].compare(mSortKeys[static_cast<size_t>(right.row())]) < 0);
+        }
+
         const QVariant leftVariant(left.data(sortRole()));
         if (leftVariant.type() == QVariant::String) {
             return (mCollator.compare(leftVariant.toString(), right.data(sortRole()).toString()) < 0);
         }
         return QSortFilterProxyModel::lessThan(left, right);
     }
+
+    void FilterProxyModel::resetSortKeys()
+    {
+        ++mSortKeysRequestId;
+        mSortKeys.clear();
+        mSortKeysValid = false;
+
+        if (!isSortKeysUsed()) {
+            if (mSortKeysPending) {
+                mSortKeysPending = false;
+                invalidateFilter();
+            }
+            return;
+        }
+
+        const int count = sourceModel()->rowCount();
+        QStringList strings;
+        strings.reserve(count);
+        for (int row = 0; row < count; ++row) {
+            const QVariant variant(sourceModel()->index(row, 0).data(sortRole()));
+            if (variant.type() != QVariant::String) {
+                // Non-string data is compared by QSortFilterProxyModel
+                if (mSortKeysPending) {
+                    mSortKeysPending = false;
+                    invalidateFilter();
+                }
+                return;
+            }
+            strings.push_back(variant.toString());
+        }
+
+        if (count < asyncThreshold) {
+            mSortKeys = makeSortKeys(mCollator, strings);
+            mSortKeysValid = true;
+            if (mSortKeysPending) {
+                mSortKeysPending = false;
+                invalidateFilter();
+            }
+            return;
+        }
+
+        const bool wasPending = mSortKeysPending;
+        mSortKeysPending = true;
+        if (!wasPending) {
+            invalidateFilter();
+        }
+
+        const int requestId = mSortKeysRequestId;
+        auto future(ThreadPool::interactive()->run([collator = mCollator, strings] {
+            return makeSortKeys(collator, strings);
+        }));
+        onFutureFinished(future, this, [this, requestId](const std::vector<QCollatorSortKey>& keys) {
+            if (requestId != mSortKeysRequestId) {
+                return;
+            }
+            mSortKeys = keys;
+            mSortKeysValid = true;
+            mSortKeysPending = false;
+            // Rows are inserted already sorted
+            invalidateFilter();
+        });
+    }
+
+    void FilterProxyModel::insertSortKeys(int first, int last)
+    {
+        if (!mSortKeysValid) {
+            return;
+        }
+
+        std::vector<QCollatorSortKey> keys;
+        keys.reserve(static_cast<size_t>(last - first + 1));
+        for (int row = first; row <= last; ++row) {
+            keys.push_back(mCollator.sortKey(sourceModel()->index(row, 0).data(sortRole()).toString()));
+        }
+        mSortKeys.insert(mSortKeys.begin() + first, std::make_move_iterator(keys.begin()), std::make_move_iterator(keys.end()));
+    }
+
+    void FilterProxyModel::removeSortKeys(int first, int last)
+    {
+        if (!mSortKeysValid) {
+            return;
+        }
+        mSortKeys.erase(mSortKeys.begin() + first, mSortKeys.begin() + last + 1);
+    }
+
+    void FilterProxyModel::updateSortKeys(int first, int last)
+    {
+        if (!mSortKeysValid) {
+            return;
+        }
+        for (int row = first; row <= last; ++row) {
+            mSortKeys[static_cast<size_t>(row)] = mCollator.sortKey(sourceModel()->index(row, 0).data(sortRole()).toString());
+        }
+    }
+
+    bool FilterProxyModel::isSortKeysUsed() const
+    {
+        return mSortEnabled && sourceModel();
+    }
+
+    void FilterProxyModel::clearSourceData()
+    {
+        mFilterStrings.reset();
+        mAcceptedRows.clear();
+        ++mSortKeysRequestId;
+        mSortKeys.clear();
+        mSortKeysValid = false;
+    }
+
+    void FilterProxyModel::onSourceReset()
+    {
+        if (mFilterApplied) {
+            mFilterApplied = false;
+            startFiltering();
+        }
+        resetSortKeys();
+    }
+
+    void FilterProxyModel::onSourceRowsInserted(int first, int last)
+    {
+        mFilterStrings.reset();
+        if (mFilterApplied) {
+            updateAcceptedRows(first, last, true);
+        }
+        insertSortKeys(first, last);
+    }
+
+    void FilterProxyModel::onSourceRowsRemoved(int first, int last)
+    {
+        mFilterStrings.reset();
+        if (mFilterApplied) {
+            mAcceptedRows.erase(mAcceptedRows.begin() + first, mAcceptedRows.begin() + last + 1);
+        }
+        removeSortKeys(first, last);
+    }
+
+    void FilterProxyModel::onSourceDataChanged(int first, int last, const QVector<int>& roles)
+    {
+        if (roles.isEmpty() || roles.contains(filterRole())) {
+            mFilterStrings.reset();
+            if (mFilterApplied) {
+                updateAcceptedRows(first, last, false);
+            }
+        }
+        if (roles.isEmpty() || roles.contains(sortRole())) {
+            updateSortKeys(first, last);
+        }
+    }
+
+    void FilterProxyModel::onSourceRowsChanged()
+    {
+        if (mFilterCancelled) {
+            // Running pass was started for old rows
+            startFiltering();
+        }
+        if (mSortKeysPending && !mSortKeysValid) {
+            resetSortKeys();
+        }
+    }
+
+    void FilterProxyModel::startFiltering()
+    {
+        mFilterTimer->stop();
+        ++mFilterRequestId;
+        if (mFilterCancelled) {
+            *mFilterCancelled = true;
+            mFilterCancelled.reset();
+        }
+
+        const QString text(mFilterText.toCaseFolded());
+        if (text.isEmpty() || !sourceModel()) {
+            if (mFilterApplied) {
+                mFilterApplied = false;
+                mAcceptedRows.clear();
+                mAppliedFilterText.clear();
+                invalidateFilter();
+            }
+            return;
+        }
+
+        QStringList unfoldedStrings;
+        if (!mFilterStrings) {
+            const int count = sourceModel()->rowCount();
+            unfoldedStrings.reserve(count);
+            for (int row = 0; row < count; ++row) {
+                unfoldedStrings.push_back(sourceModel()->index(row, 0).data(filterRole()).toString());
+            }
+        }
+
+        const auto apply = [this, text](FilterResult&& result) {
+            mFilterStrings = std::move(result.strings);
+            mAcceptedRows = std::move(result.accepted);
+            mAppliedFilterText = text;
+            mFilterApplied = true;
+            invalidateFilter();
+        };
+
+        const size_t count = mFilterStrings ? mFilterStrings->size() : static_cast<size_t>(unfoldedStrings.size());
+        if (count < asyncThreshold) {
+            const std::atomic_bool cancelled(false);
+            apply(filterStrings(text, mFilterStrings, unfoldedStrings, cancelled));
+            return;
+        }
+
+        const auto cancelled(std::make_shared<std::atomic_bool>(false));
+        mFilterCancelled = cancelled;
+        const int requestId = mFilterRequestId;
+        auto future(ThreadPool::interactive()->run([text, strings = mFilterStrings, unfoldedStrings, cancelled] {
+            return filterStrings(text, strings, unfoldedStrings, *cancelled);
+        }));
+        onFutureFinished(future, this, [this, requestId, apply](FilterResult&& result) {
+            if (requestId != mFilterRequestId || !result.strings) {
+                return;
+            }
+            mFilterCancelled.reset();
+            apply(std::move(result));
+        });
+    }
+
+    void FilterProxyModel::updateAcceptedRows(int first, int last, bool insert)
+    {
+        const QStringMatcher matcher(mAppliedFilterText, Qt::CaseSensitive);
+        std::vector<char> accepted;
+        accepted.reserve(static_cast<size_t>(last - first + 1));
+        for (int row = first; row <= last; ++row) {
+            accepted.push_back(matcher.indexIn(sourceModel()->index(row, 0).data(filterRole()).toString().toCaseFolded()) != -1);
+        }
+        if (insert) {
+            mAcceptedRows.insert(mAcceptedRows.begin() + first, accepted.begin(), accepted.end());
+        } else {
+            std::copy(accepted.begin(), accepted.end(), mAcceptedRows.begin() + first);
+        }
+    }
 }
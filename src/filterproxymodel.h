@@ -19,6 +19,8 @@
 #ifndef UNPLAYER_FILTERPROXYMODEL_H
 #define UNPLAYER_FILTERPROXYMODEL_H
 
+#include <atomic>
+#include <memory>
 #include <vector>
 
 #include <QCollator>
@@ -26,6 +28,7 @@
 #include <QSortFilterProxyModel>
 
 class QItemSelectionModel;
+class QTimer;
 
 namespace unplayer
 {
@@ -34,6 +37,7 @@ namespace unplayer
         Q_OBJECT
         Q_INTERFACES(QQmlParserStatus)
         Q_PROPERTY(bool sortEnabled READ isSortEnabled WRITE setSortEnabled)
+        Q_PROPERTY(QString filterText READ filterText WRITE setFilterText)
         Q_PROPERTY(std::vector<int> sourceIndexes READ sourceIndexes)
         Q_PROPERTY(QItemSelectionModel* selectionModel READ selectionModel CONSTANT)
         Q_PROPERTY(bool hasSelection READ hasSelection NOTIFY selectionChanged)
@@ -46,9 +50,15 @@ namespace unplayer
 
         std::vector<int> sourceIndexes() const;
 
+        void setSourceModel(QAbstractItemModel* sourceModel) override;
+
         bool isSortEnabled() const;
         void setSortEnabled(bool sortEnabled);
 
+        // Case insensitive substring of filterRole() data. Rows are filtered in background thread
+        QString filterText() const;
+        void setFilterText(const QString& text);
+
         Q_INVOKABLE int proxyIndex(int sourceIndex) const;
         Q_INVOKABLE int sourceIndex(int proxyIndex) const;
 
@@ -61,12 +71,58 @@ namespace unplayer
         Q_INVOKABLE void selectAll();
 
     protected:
+        bool filterAcceptsRow(int sourceRow, const QModelIndex& sourceParent) const override;
         bool lessThan(const QModelIndex& left, const QModelIndex& right) const override;
 
     private:
+        // Called before QSortFilterProxyModel handles source change, don't invalidate proxy
+        void clearSourceData();
+        void onSourceRowsInserted(int first, int last);
+        void onSourceRowsRemoved(int first, int last);
+        void onSourceDataChanged(int first, int last, const QVector<int>& roles);
+
+        // Called after QSortFilterProxyModel handles source change
+        void onSourceReset();
+        void onSourceRowsChanged();
+
+        /**
+         * @brief Recomputes collation keys for all source rows.
+         * For large models keys are computed in background thread,
+         * and rows are hidden until they can be sorted
+         */
+        void resetSortKeys();
+        void insertSortKeys(int first, int last);
+        void removeSortKeys(int first, int last);
+        void updateSortKeys(int first, int last);
+        bool isSortKeysUsed() const;
+
+        /**
+         * @brief Matches filterRole() data of all source rows against filterText() in background thread.
+         * Previous pass is cancelled, and rows are changed only when new pass is finished
+         */
+        void startFiltering();
+        void updateAcceptedRows(int first, int last, bool insert);
+
         QCollator mCollator;
         bool mSortEnabled;
         QItemSelectionModel* mSelectionModel;
+
+        // Collation keys of sortRole() data, indexed by source row
+        std::vector<QCollatorSortKey> mSortKeys;
+        bool mSortKeysValid;
+        bool mSortKeysPending;
+        int mSortKeysRequestId;
+
+        QString mFilterText;
+        QTimer* mFilterTimer;
+        // Case folded text that mAcceptedRows were matched against
+        QString mAppliedFilterText;
+        // Case folded filterRole() data, indexed by source row. Null if it should be collected again
+        std::shared_ptr<const std::vector<QString>> mFilterStrings;
+        std::vector<char> mAcceptedRows;
+        bool mFilterApplied;
+        int mFilterRequestId;
+        std::shared_ptr<std::atomic_bool> mFilterCancelled;
     signals:
         void selectionChanged();
     };
@@ -28,8 +28,8 @@
 #include "librarytrack.h"
 #include "libraryutils.h"
 #include "mediaartutils.h"
-#include "modelutils.h"
 #include "settings.h"
+#include "sqliteutils.h"
 #include "tracksmodel.h"
 
 #include "abstractlibrarymodel.cpp"
@@ -99,7 +99,7 @@ namespace unplayer
             return genre.duration;
         case MediaArtRole:
             if (!genre.requestedMediaArt) {
-                MediaArtUtils::instance()->getRandomMediaArtForGenre(genre.id);
+                MediaArtUtils::instance()->getRandomMediaArtForGenre(genre.id, this);
                 genre.requestedMediaArt = true;
             }
             return genre.mediaArt;
@@ -209,22 +209,25 @@ namespace unplayer
 
     void GenresModel::removeGenres(const std::vector<int>& indexes, bool deleteFiles)
     {
-        if (LibraryUtils::instance()->isRemovingFiles()) {
-            return;
-        }
-
         std::vector<int> genres;
         genres.reserve(indexes.size());
         for (int index : indexes) {
             genres.push_back(mGenres[static_cast<size_t>(index)].id);
         }
         LibraryUtils::instance()->removeGenres(std::move(genres), deleteFiles);
-        QObject::connect(LibraryUtils::instance(), &LibraryUtils::removingFilesChanged, this, [this, indexes] {
-            if (!LibraryUtils::instance()->isRemovingFiles()) {
-                ModelBatchRemover::removeIndexes(this, indexes);
-                QObject::disconnect(LibraryUtils::instance(), &LibraryUtils::removingFilesChanged, this, nullptr);
+    }
+
+    void GenresModel::releaseMediaArt(int genreId)
+    {
+        if (MediaArtUtils::instance()->cancelRandomMediaArtForGenre(genreId, this)) {
+            // Requested again when row becomes visible
+            const auto found(std::find_if(mGenres.begin(), mGenres.end(), [&](const Genre& genre) {
+                return genre.id == genreId;
+            }));
+            if (found != mGenres.end()) {
+                found->requestedMediaArt = false;
             }
-        });
+        }
     }
 
     QHash<int, QByteArray> GenresModel::roleNames() const
@@ -238,13 +241,12 @@ namespace unplayer
 
     QString GenresModel::makeQueryString()
     {
-        return QString::fromLatin1("SELECT genres.id, genres.title, COUNT(tracks.id), SUM(tracks.duration) "
-                                   "FROM genres "
-                                   "JOIN tracks_genres ON tracks_genres.genreId = genres.id "
-                                   "JOIN tracks ON tracks.id = tracks_genres.trackId "
-                                   "GROUP BY genres.id "
-                                   "ORDER BY genres.title %1").arg(mSortDescending ? QLatin1String("DESC")
-                                                                                   : QLatin1String("ASC"));
+        return QString::fromLatin1("SELECT genreId, genres.title, tracksCount, duration "
+                                   "FROM genres_stats "
+                                   "JOIN genres ON genres.id = genreId "
+                                   "ORDER BY genres.title COLLATE %2 %1").arg(mSortDescending ? QLatin1String("DESC")
+                                                                               : QLatin1String("ASC"),
+                                                                sqliteutils::sortCollation());
     }
 
     GenresModel::AbstractItemFactory* GenresModel::createItemFactory()
@@ -252,6 +254,16 @@ namespace unplayer
         return new ItemFactory();
     }
 
+    bool GenresModel::isAffectedBy(const LibraryChanges& changes) const
+    {
+        return !changes.genres.isEmpty();
+    }
+
+    const LibraryChanges::Ids& GenresModel::changedItemIds(const LibraryChanges& changes) const
+    {
+        return changes.genres;
+    }
+
     Genre GenresModel::ItemFactory::itemFromQuery(const QSqlQuery& query)
     {
         return {query.value(GenreIdField).toInt(),
@@ -57,6 +57,9 @@ namespace unplayer
 
         Q_INVOKABLE void removeGenre(int index, bool deleteFiles);
         Q_INVOKABLE void removeGenres(const std::vector<int>& indexes, bool deleteFiles);
+
+        // Called when delegate is destroyed, so that rows that were scrolled away don't delay media art of visible ones
+        Q_INVOKABLE void releaseMediaArt(int genreId);
     protected:
         class ItemFactory final : public AbstractItemFactory
         {
@@ -69,6 +72,9 @@ namespace unplayer
         QString makeQueryString() override;
         AbstractItemFactory* createItemFactory() override;
 
+        bool isAffectedBy(const LibraryChanges& changes) const override;
+        const LibraryChanges::Ids& changedItemIds(const LibraryChanges& changes) const override;
+
     private:
         std::vector<Genre>& mGenres = mItems;
         bool mSortDescending;
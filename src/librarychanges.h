@@ -0,0 +1,74 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2020 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_LIBRARYCHANGES_H
+#define UNPLAYER_LIBRARYCHANGES_H
+
+#include <unordered_set>
+
+#include <QMetaType>
+
+namespace unplayer
+{
+    /**
+     * @brief Ids of tracks and categories that were added, removed or modified by a library operation
+     */
+    struct LibraryChanges
+    {
+        struct Ids
+        {
+            std::unordered_set<int> added;
+            std::unordered_set<int> removed;
+            std::unordered_set<int> modified;
+
+            inline bool isEmpty() const
+            {
+                return added.empty() && removed.empty() && modified.empty();
+            }
+
+            inline bool contains(int id) const
+            {
+                return added.count(id) != 0 || removed.count(id) != 0 || modified.count(id) != 0;
+            }
+        };
+
+        Ids tracks;
+        Ids artists;
+        // Artists whose statistics as album artist have changed
+        Ids albumArtists;
+        Ids albums;
+        Ids genres;
+
+        // Whole library was replaced, ids are not tracked
+        bool reset = false;
+
+        inline bool isEmpty() const
+        {
+            return !reset &&
+                   tracks.isEmpty() &&
+                   artists.isEmpty() &&
+                   albumArtists.isEmpty() &&
+                   albums.isEmpty() &&
+                   genres.isEmpty();
+        }
+    };
+}
+
+Q_DECLARE_METATYPE(unplayer::LibraryChanges)
+
+#endif // UNPLAYER_LIBRARYCHANGES_H
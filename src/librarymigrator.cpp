@@ -31,6 +31,7 @@
 
 #include "librarytracksadder.h"
 #include "libraryutils.h"
+#include "sqliteutils.h"
 #include "stdutils.h"
 #include "tagutils.h"
 #include "utilsfunctions.h"
@@ -77,13 +78,79 @@ namespace unplayer
             switch (currentVersion) {
             case 0:
             {
-                if (!migrateFrom0()) {
+                if (migrateFrom0()) {
+                    // migrateFrom0() creates tables and indexes of the latest version
+                    currentVersion = latestVersion - 1;
+                } else {
                     abort = true;
                 }
                 break;
-            default:
+            }
+            case 1:
+            {
+                if (!migrateFrom1()) {
+                    abort = true;
+                }
+                break;
+            }
+            case 2:
+            {
+                if (!migrateFrom2()) {
+                    abort = true;
+                }
+                break;
+            }
+            case 3:
+            {
+                if (!migrateFrom3()) {
+                    abort = true;
+                }
+                break;
+            }
+            case 4:
+            {
+                if (!migrateFrom4()) {
+                    abort = true;
+                }
+                break;
+            }
+            case 5:
+            {
+                if (!migrateFrom5()) {
+                    abort = true;
+                }
+                break;
+            }
+            case 6:
+            {
+                if (!migrateFrom6()) {
+                    abort = true;
+                }
+                break;
+            }
+            case 7:
+            {
+                if (!migrateFrom7()) {
+                    abort = true;
+                }
                 break;
             }
+            case 8:
+            {
+                if (!migrateFrom8()) {
+                    abort = true;
+                }
+                break;
+            }
+            case 9:
+            {
+                if (!migrateFrom9()) {
+                    abort = true;
+                }
+                break;
+            }
+            default:
+                break;
             }
 
             if (abort) {
@@ -194,6 +261,207 @@ namespace unplayer
         return true;
     }
 
+    bool LibraryMigrator::migrateFrom1()
+    {
+        return execQueries({
+            QLatin1String("CREATE INDEX artists_titleIndex ON artists(title COLLATE BINARY)"),
+            QLatin1String("CREATE INDEX albums_titleIndex ON albums(title COLLATE BINARY)"),
+            QLatin1String("CREATE INDEX genres_titleIndex ON genres(title COLLATE BINARY)")
+        });
+    }
+
+    bool LibraryMigrator::migrateFrom2()
+    {
+        return execQueries({
+            QLatin1String("CREATE TABLE changed_artists (id INTEGER PRIMARY KEY)"),
+            QLatin1String("CREATE TABLE changed_albums (id INTEGER PRIMARY KEY)"),
+            QLatin1String("CREATE TABLE changed_genres (id INTEGER PRIMARY KEY)"),
+            QLatin1String("CREATE TABLE changed_media_art (filePath TEXT PRIMARY KEY)"),
+
+            QLatin1String("CREATE TRIGGER tracks_artists_deleted AFTER DELETE ON tracks_artists "
+                          "BEGIN INSERT OR IGNORE INTO changed_artists VALUES (OLD.artistId); END"),
+            QLatin1String("CREATE TRIGGER albums_artists_deleted AFTER DELETE ON albums_artists "
+                          "BEGIN INSERT OR IGNORE INTO changed_artists VALUES (OLD.artistId); END"),
+            QLatin1String("CREATE TRIGGER tracks_albums_deleted AFTER DELETE ON tracks_albums "
+                          "BEGIN INSERT OR IGNORE INTO changed_albums VALUES (OLD.albumId); END"),
+            QLatin1String("CREATE TRIGGER tracks_genres_deleted AFTER DELETE ON tracks_genres "
+                          "BEGIN INSERT OR IGNORE INTO changed_genres VALUES (OLD.genreId); END"),
+            QLatin1String("CREATE TRIGGER tracks_deleted AFTER DELETE ON tracks "
+                          "WHEN OLD.embeddedMediaArt IS NOT NULL "
+                          "BEGIN INSERT OR IGNORE INTO changed_media_art VALUES (OLD.embeddedMediaArt); END"),
+            QLatin1String("CREATE TRIGGER tracks_embeddedMediaArt_updated AFTER UPDATE OF embeddedMediaArt ON tracks "
+                          "WHEN OLD.embeddedMediaArt IS NOT NULL AND OLD.embeddedMediaArt IS NOT NEW.embeddedMediaArt "
+                          "BEGIN INSERT OR IGNORE INTO changed_media_art VALUES (OLD.embeddedMediaArt); END"),
+            QLatin1String("CREATE TRIGGER albums_deleted AFTER DELETE ON albums "
+                          "WHEN OLD.userMediaArt IS NOT NULL "
+                          "BEGIN INSERT OR IGNORE INTO changed_media_art VALUES (OLD.userMediaArt); END"),
+            QLatin1String("CREATE TRIGGER albums_userMediaArt_updated AFTER UPDATE OF userMediaArt ON albums "
+                          "WHEN OLD.userMediaArt IS NOT NULL AND OLD.userMediaArt IS NOT NEW.userMediaArt "
+                          "BEGIN INSERT OR IGNORE INTO changed_media_art VALUES (OLD.userMediaArt); END"),
+
+            QLatin1String("CREATE INDEX tracks_artists_artistIndex ON tracks_artists(artistId)"),
+            QLatin1String("CREATE INDEX tracks_albums_albumIndex ON tracks_albums(albumId)"),
+            QLatin1String("CREATE INDEX albums_artists_artistIndex ON albums_artists(artistId)"),
+            QLatin1String("CREATE INDEX tracks_genres_genreIndex ON tracks_genres(genreId)"),
+            QLatin1String("CREATE INDEX tracks_embeddedMediaArtIndex ON tracks(embeddedMediaArt)"),
+            QLatin1String("CREATE INDEX albums_userMediaArtIndex ON albums(userMediaArt)")
+        });
+    }
+
+    bool LibraryMigrator::migrateFrom3()
+    {
+        // Statistics for all categories are calculated in LibraryUtils::initDatabase()
+        return execQueries({
+            QLatin1String("CREATE TABLE changed_album_artists (id INTEGER PRIMARY KEY)"),
+
+            QLatin1String("CREATE TRIGGER tracks_artists_inserted AFTER INSERT ON tracks_artists "
+                          "BEGIN INSERT OR IGNORE INTO changed_artists VALUES (NEW.artistId); END"),
+            QLatin1String("CREATE TRIGGER tracks_albums_inserted AFTER INSERT ON tracks_albums "
+                          "BEGIN INSERT OR IGNORE INTO changed_albums VALUES (NEW.albumId); END"),
+            QLatin1String("CREATE TRIGGER tracks_genres_inserted AFTER INSERT ON tracks_genres "
+                          "BEGIN INSERT OR IGNORE INTO changed_genres VALUES (NEW.genreId); END"),
+            QLatin1String("CREATE TRIGGER tracks_without_artists_deleted BEFORE DELETE ON tracks "
+                          "WHEN NOT EXISTS (SELECT 1 FROM tracks_artists WHERE trackId = OLD.id) "
+                          "BEGIN INSERT OR IGNORE INTO changed_artists VALUES (0); END"),
+            QLatin1String("CREATE TRIGGER tracks_without_albums_deleted BEFORE DELETE ON tracks "
+                          "WHEN NOT EXISTS (SELECT 1 FROM tracks_albums WHERE trackId = OLD.id) "
+                          "BEGIN INSERT OR IGNORE INTO changed_albums VALUES (0); END"),
+
+            QLatin1String("CREATE TABLE artists_stats ("
+                            "artistId INTEGER PRIMARY KEY,"
+                            "albumsCount INTEGER NOT NULL,"
+                            "tracksCount INTEGER NOT NULL,"
+                            "duration INTEGER NOT NULL"
+                          ")"),
+            QLatin1String("CREATE TABLE album_artists_stats ("
+                            "artistId INTEGER PRIMARY KEY,"
+                            "albumsCount INTEGER NOT NULL,"
+                            "tracksCount INTEGER NOT NULL,"
+                            "duration INTEGER NOT NULL"
+                          ")"),
+            QLatin1String("CREATE TABLE albums_stats ("
+                            "albumId INTEGER PRIMARY KEY,"
+                            "artist TEXT COLLATE NOCASE,"
+                            "year INTEGER,"
+                            "tracksCount INTEGER NOT NULL,"
+                            "duration INTEGER NOT NULL"
+                          ")"),
+            QLatin1String("CREATE TABLE genres_stats ("
+                            "genreId INTEGER PRIMARY KEY,"
+                            "tracksCount INTEGER NOT NULL,"
+                            "duration INTEGER NOT NULL"
+                          ")"),
+
+            QLatin1String("INSERT OR IGNORE INTO changed_artists SELECT id FROM artists"),
+            QLatin1String("INSERT OR IGNORE INTO changed_artists VALUES (0)"),
+            QLatin1String("INSERT OR IGNORE INTO changed_albums SELECT id FROM albums"),
+            QLatin1String("INSERT OR IGNORE INTO changed_albums VALUES (0)"),
+            QLatin1String("INSERT OR IGNORE INTO changed_genres SELECT id FROM genres")
+        });
+    }
+
+    bool LibraryMigrator::migrateFrom4()
+    {
+        return execQueries({
+            QLatin1String("CREATE TABLE changed_tracks (id INTEGER PRIMARY KEY)"),
+            QLatin1String("CREATE TABLE added_tracks (id INTEGER PRIMARY KEY)"),
+            QLatin1String("CREATE TABLE added_artists (id INTEGER PRIMARY KEY)"),
+            QLatin1String("CREATE TABLE added_albums (id INTEGER PRIMARY KEY)"),
+            QLatin1String("CREATE TABLE added_genres (id INTEGER PRIMARY KEY)"),
+
+            QLatin1String("CREATE TRIGGER tracks_inserted AFTER INSERT ON tracks "
+                          "BEGIN INSERT OR IGNORE INTO added_tracks VALUES (NEW.id); END"),
+            QLatin1String("CREATE TRIGGER tracks_updated AFTER UPDATE ON tracks "
+                          "BEGIN INSERT OR IGNORE INTO changed_tracks VALUES (NEW.id); END"),
+            QLatin1String("CREATE TRIGGER tracks_removed AFTER DELETE ON tracks "
+                          "BEGIN INSERT OR IGNORE INTO changed_tracks VALUES (OLD.id); END"),
+            QLatin1String("CREATE TRIGGER artists_inserted AFTER INSERT ON artists "
+                          "BEGIN INSERT OR IGNORE INTO added_artists VALUES (NEW.id); END"),
+            QLatin1String("CREATE TRIGGER albums_inserted AFTER INSERT ON albums "
+                          "BEGIN INSERT OR IGNORE INTO added_albums VALUES (NEW.id); END"),
+            QLatin1String("CREATE TRIGGER genres_inserted AFTER INSERT ON genres "
+                          "BEGIN INSERT OR IGNORE INTO added_genres VALUES (NEW.id); END")
+        });
+    }
+
+    bool LibraryMigrator::migrateFrom5()
+    {
+        return execQueries({
+            QLatin1String("CREATE INDEX tracks_titleIndex ON tracks(title)")
+        });
+    }
+
+    bool LibraryMigrator::migrateFrom6()
+    {
+        return LibraryUtils::createSearchTables(mDb);
+    }
+
+    bool LibraryMigrator::migrateFrom7()
+    {
+        if (!execQueries({
+            QLatin1String("CREATE TABLE collation_locale (name TEXT NOT NULL)"),
+            QLatin1String("DROP INDEX tracks_titleIndex")
+        })) {
+            return false;
+        }
+
+        if (!LibraryUtils::createSortIndexes(mDb)) {
+            return false;
+        }
+
+        // Indexes are built with current locale, so LibraryUtils::initDatabase() won't rebuild them again
+        if (!mQuery.prepare(QLatin1String("INSERT INTO collation_locale VALUES (?)"))) {
+            qWarning() << "Failed to prepare collation locale query" << mQuery.lastError();
+            return false;
+        }
+        mQuery.addBindValue(sqliteutils::sortCollationName());
+        if (!mQuery.exec()) {
+            qWarning() << "Failed to set collation locale" << mQuery.lastError();
+            return false;
+        }
+        mQuery.finish();
+        return true;
+    }
+
+    bool LibraryMigrator::migrateFrom8()
+    {
+        if (!execQueries({
+            QLatin1String("CREATE TABLE media_art_candidates ("
+                            "category INTEGER NOT NULL,"
+                            "categoryId INTEGER NOT NULL,"
+                            "directoryMediaArt TEXT,"
+                            "embeddedMediaArt TEXT,"
+                            "albumId INTEGER"
+                          ")"),
+            QLatin1String("CREATE INDEX media_art_candidates_categoryIndex ON media_art_candidates(category, categoryId)")
+        })) {
+            return false;
+        }
+
+        return LibraryUtils::updateMediaArtCandidates(mDb,
+                                                      QLatin1String("SELECT id FROM artists UNION SELECT 0"),
+                                                      QLatin1String("SELECT id FROM albums UNION SELECT 0"),
+                                                      QLatin1String("SELECT id FROM genres"));
+    }
+
+    bool LibraryMigrator::migrateFrom9()
+    {
+        return execQueries({
+            QLatin1String("CREATE TABLE pending_media_art_check (id INTEGER PRIMARY KEY)")
+        });
+    }
+
+    bool LibraryMigrator::execQueries(std::initializer_list<QLatin1String> queries)
+    {
+        for (const QLatin1String& query : queries) {
+            if (!mQuery.exec(query)) {
+                qWarning() << "Failed to exec query" << query << mQuery.lastError();
+                return false;
+            }
+        }
+        return true;
+    }
+
     namespace
     {
         inline bool addIfNotEmpty(QStringList& list, const QString& string)
@@ -314,7 +582,7 @@ namespace unplayer
         const QRegularExpression embeddedMediaArtRegex(QLatin1String("^.*\\/\\w+-embedded\\.\\w+$"));
         embeddedMediaArtRegex.optimize();
 
-        LibraryTracksAdder adder(mDb);
+        LibraryTracksAdder adder(mDb, true);
 
         OldTrack oldTrack{};
         auto& info = oldTrack.info;
@@ -19,8 +19,10 @@
 #ifndef UNPLAYER_LIBRARYMIGRATOR_H
 #define UNPLAYER_LIBRARYMIGRATOR_H
 
+#include <initializer_list>
 #include <unordered_map>
 
+#include <QLatin1String>
 #include <QSqlDatabase>
 #include <QSqlQuery>
 
@@ -37,6 +39,16 @@ namespace unplayer
 
     private:
         bool migrateFrom0();
+        bool migrateFrom1();
+        bool migrateFrom2();
+        bool migrateFrom3();
+        bool migrateFrom4();
+        bool migrateFrom5();
+        bool migrateFrom6();
+        bool migrateFrom7();
+        bool migrateFrom8();
+        bool migrateFrom9();
+        bool execQueries(std::initializer_list<QLatin1String> queries);
         bool migrateOldTracks(std::unordered_map<int, QString>& userMediaArtHash);
 
         QSqlDatabase mDb;
@@ -0,0 +1,96 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2020 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libraryquerycache.h"
+
+#include <algorithm>
+
+#include "libraryutils.h"
+
+namespace unplayer
+{
+    const size_t LibraryQueryCache::maxCost = 8 * 1024 * 1024;
+
+    LibraryQueryCache& LibraryQueryCache::instance()
+    {
+        static LibraryQueryCache cache;
+        return cache;
+    }
+
+    std::shared_ptr<const void> LibraryQueryCache::findEntry(const QString& key)
+    {
+        const auto found(mEntries.find(key));
+        if (found == mEntries.end()) {
+            return nullptr;
+        }
+        Entry& entry = found->second;
+        if (entry.generation != LibraryUtils::instance()->databaseGeneration()) {
+            mCost -= entry.cost;
+            mEntries.erase(found);
+            return nullptr;
+        }
+        entry.lastUsed = ++mUseCounter;
+        return entry.items;
+    }
+
+    void LibraryQueryCache::insertEntry(const QString& key, quint64 generation, std::shared_ptr<const void>&& items, size_t cost)
+    {
+        // Database was changed while query was running
+        if (generation != LibraryUtils::instance()->databaseGeneration()) {
+            return;
+        }
+
+        removeStaleEntries();
+
+        const auto found(mEntries.find(key));
+        if (found != mEntries.end()) {
+            mCost -= found->second.cost;
+            mEntries.erase(found);
+        }
+
+        while (!mEntries.empty() && (mCost + cost) > maxCost) {
+            const auto leastRecentlyUsed(std::min_element(mEntries.begin(), mEntries.end(), [](const auto& first, const auto& second) {
+                return first.second.lastUsed < second.second.lastUsed;
+            }));
+            mCost -= leastRecentlyUsed->second.cost;
+            mEntries.erase(leastRecentlyUsed);
+        }
+
+        mEntries.emplace(key, Entry{std::move(items), cost, generation, ++mUseCounter});
+        mCost += cost;
+    }
+
+    void LibraryQueryCache::clear()
+    {
+        mEntries.clear();
+        mCost = 0;
+    }
+
+    void LibraryQueryCache::removeStaleEntries()
+    {
+        const quint64 generation = LibraryUtils::instance()->databaseGeneration();
+        for (auto i(mEntries.begin()); i != mEntries.end();) {
+            if (i->second.generation != generation) {
+                mCost -= i->second.cost;
+                i = mEntries.erase(i);
+            } else {
+                ++i;
+            }
+        }
+    }
+}
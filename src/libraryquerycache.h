@@ -0,0 +1,97 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2020 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_LIBRARYQUERYCACHE_H
+#define UNPLAYER_LIBRARYQUERYCACHE_H
+
+#include <memory>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+#include <QString>
+#include <QStringBuilder>
+
+#include "stdutils.h"
+
+namespace unplayer
+{
+    /**
+     * @brief Complete results of library models' queries, keyed by query string.
+     * Entries are valid only for database generation they were queried at
+     * (see LibraryUtils::databaseGeneration()), and least recently used ones are evicted
+     * when memory budget is exceeded. Must be used only from main thread
+     */
+    class LibraryQueryCache
+    {
+    public:
+        static LibraryQueryCache& instance();
+
+        template<typename Item>
+        std::shared_ptr<const std::vector<Item>> find(const QString& queryString)
+        {
+            return std::static_pointer_cast<const std::vector<Item>>(findEntry(makeKey<Item>(queryString)));
+        }
+
+        /**
+         * @param generation Database generation at the time when query was started
+         */
+        template<typename Item>
+        void insert(const QString& queryString, quint64 generation, const std::vector<Item>& items)
+        {
+            // Heap allocated data of strings is not known, use rough estimate
+            const size_t cost = items.size() * (sizeof(Item) + 128);
+            if (cost <= maxCost) {
+                insertEntry(makeKey<Item>(queryString), generation, std::make_shared<const std::vector<Item>>(items), cost);
+            }
+        }
+
+        /**
+         * @brief Must be called after database writes that don't change LibraryUtils::databaseGeneration()
+         */
+        void clear();
+
+    private:
+        struct Entry
+        {
+            std::shared_ptr<const void> items;
+            size_t cost;
+            quint64 generation;
+            unsigned int lastUsed;
+        };
+
+        static const size_t maxCost;
+
+        // Different item types can't share entries
+        template<typename Item>
+        static QString makeKey(const QString& queryString)
+        {
+            return QLatin1String(typeid(Item).name()) % QLatin1Char('\n') % queryString;
+        }
+
+        std::shared_ptr<const void> findEntry(const QString& key);
+        void insertEntry(const QString& key, quint64 generation, std::shared_ptr<const void>&& items, size_t cost);
+        void removeStaleEntries();
+
+        std::unordered_map<QString, Entry> mEntries;
+        size_t mCost = 0;
+        unsigned int mUseCounter = 0;
+    };
+}
+
+#endif // UNPLAYER_LIBRARYQUERYCACHE_H
@@ -0,0 +1,232 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2020 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "librarysearchmodel.h"
+
+#include <QDebug>
+#include <QRegularExpression>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QStringBuilder>
+#include <QUuid>
+
+#include "libraryutils.h"
+#include "qscopeguard.h"
+#include "querycancellationtoken.h"
+#include "sqlutils.h"
+#include "threadpool.h"
+#include "utilsfunctions.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        // Per type of results
+        const int resultsLimit = 50;
+
+        // Each word is quoted and matched as prefix, so that FTS5 syntax in user input is ignored
+        QString makeMatchExpression(const QString& query)
+        {
+            static const QRegularExpression whitespace(QLatin1String("\\s+"));
+            static const QLatin1Char quote('"');
+
+            QStringList words(query.split(whitespace, QString::SkipEmptyParts));
+            for (QString& word : words) {
+                word.replace(quote, QLatin1String("\"\""));
+                word = quote % word % quote % QLatin1Char('*');
+            }
+            return words.join(QLatin1Char(' '));
+        }
+
+        std::vector<LibrarySearchModel::Item> searchLibrary(const QSqlDatabase& db, const QString& matchExpression, const QueryCancellationToken& cancellationToken)
+        {
+            // Best matches of each type are selected using FTS5 index only,
+            // then joined with their tables and ranked together
+            static const QString queryString(QLatin1String(
+                "SELECT * FROM ("
+                    "SELECT 0, tracks.id, tracks.title, "
+                           "(SELECT group_concat(artists.title, ', ') FROM tracks_artists JOIN artists ON artists.id = tracks_artists.artistId WHERE tracks_artists.trackId = tracks.id), "
+                           "tracks.filePath, matches.rank "
+                    "FROM (SELECT rowid, rank FROM tracks_search WHERE tracks_search MATCH ? ORDER BY rank LIMIT ?) AS matches "
+                    "JOIN tracks ON tracks.id = matches.rowid "
+                    "UNION ALL "
+                    "SELECT 1, artists.id, artists.title, NULL, NULL, matches.rank "
+                    "FROM (SELECT rowid, rank FROM artists_search WHERE artists_search MATCH ? ORDER BY rank LIMIT ?) AS matches "
+                    "JOIN artists ON artists.id = matches.rowid "
+                    "UNION ALL "
+                    "SELECT 2, albums.id, albums.title, albums_stats.artist, NULL, matches.rank "
+                    "FROM (SELECT rowid, rank FROM albums_search WHERE albums_search MATCH ? ORDER BY rank LIMIT ?) AS matches "
+                    "JOIN albums ON albums.id = matches.rowid "
+                    "LEFT JOIN albums_stats ON albums_stats.albumId = albums.id "
+                    "UNION ALL "
+                    "SELECT 3, genres.id, genres.title, NULL, NULL, matches.rank "
+                    "FROM (SELECT rowid, rank FROM genres_search WHERE genres_search MATCH ? ORDER BY rank LIMIT ?) AS matches "
+                    "JOIN genres ON genres.id = matches.rowid"
+                ") ORDER BY 6"));
+
+            std::vector<LibrarySearchModel::Item> items;
+
+            QSqlQuery query(db);
+            query.setForwardOnly(true);
+            if (!query.prepare(queryString)) {
+                qWarning() << "Prepare failed:" << query.lastError();
+                return items;
+            }
+            for (int i = 0; i < 4; ++i) {
+                query.addBindValue(matchExpression);
+                query.addBindValue(resultsLimit);
+            }
+            if (!query.exec()) {
+                if (!cancellationToken.isCancelled()) {
+                    qWarning() << "Exec failed:" << query.lastError();
+                }
+                return items;
+            }
+
+            while (query.next()) {
+                items.push_back({static_cast<LibrarySearchModel::Type>(query.value(0).toInt()),
+                                 query.value(1).toInt(),
+                                 query.value(2).toString(),
+                                 query.value(3).toString(),
+                                 query.value(4).toString()});
+            }
+            return items;
+        }
+    }
+
+    LibrarySearchModel::LibrarySearchModel()
+        : mSearchId(0)
+    {
+        setLoading(false);
+        QObject::connect(LibraryUtils::instance(), &LibraryUtils::databaseChanged, this, [this] {
+            if (!mQuery.isEmpty()) {
+                search();
+            }
+        });
+    }
+
+    LibrarySearchModel::~LibrarySearchModel()
+    {
+        cancelSearch();
+    }
+
+    int LibrarySearchModel::rowCount(const QModelIndex&) const
+    {
+        return static_cast<int>(mItems.size());
+    }
+
+    QVariant LibrarySearchModel::data(const QModelIndex& index, int role) const
+    {
+        if (!index.isValid()) {
+            return QVariant();
+        }
+
+        const Item& item = mItems[static_cast<size_t>(index.row())];
+
+        switch (role) {
+        case TypeRole:
+            return item.type;
+        case IdRole:
+            return item.id;
+        case TitleRole:
+            return item.title;
+        case SubtitleRole:
+            return item.subtitle;
+        case FilePathRole:
+            return item.filePath;
+        default:
+            return QVariant();
+        }
+    }
+
+    QString LibrarySearchModel::query() const
+    {
+        return mQuery;
+    }
+
+    void LibrarySearchModel::setQuery(const QString& query)
+    {
+        if (query != mQuery) {
+            mQuery = query;
+            emit queryChanged();
+            search();
+        }
+    }
+
+    QHash<int, QByteArray> LibrarySearchModel::roleNames() const
+    {
+        return {{TypeRole, "type"},
+                {IdRole, "id"},
+                {TitleRole, "title"},
+                {SubtitleRole, "subtitle"},
+                {FilePathRole, "filePath"}};
+    }
+
+    void LibrarySearchModel::search()
+    {
+        cancelSearch();
+
+        // Search tables don't exist if SQLite is built without FTS5
+        const QString matchExpression(LibraryUtils::instance()->isSearchAvailable() ? makeMatchExpression(mQuery) : QString());
+        if (matchExpression.isEmpty()) {
+            if (!mItems.empty()) {
+                beginResetModel();
+                mItems.clear();
+                endResetModel();
+            }
+            setLoading(false);
+            return;
+        }
+
+        setLoading(true);
+
+        const int searchId = mSearchId;
+        mCancellationToken = std::make_shared<QueryCancellationToken>();
+        auto future(ThreadPool::interactive()->run([matchExpression, cancellationToken = mCancellationToken] {
+            if (cancellationToken->isCancelled()) {
+                return std::vector<Item>();
+            }
+            const DatabaseConnectionGuard databaseGuard(QUuid::createUuid().toString());
+            if (!databaseGuard.db.isOpen() || !cancellationToken->attach(databaseGuard.db)) {
+                return std::vector<Item>();
+            }
+            const auto detachGuard(qScopeGuard([&] {
+                cancellationToken->detach(databaseGuard.db);
+            }));
+            return searchLibrary(databaseGuard.db, matchExpression, *cancellationToken);
+        }));
+        onFutureFinished(future, this, [this, searchId](std::vector<Item>&& items) {
+            if (searchId != mSearchId) {
+                return;
+            }
+            beginResetModel();
+            mItems = std::move(items);
+            endResetModel();
+            setLoading(false);
+        });
+    }
+
+    void LibrarySearchModel::cancelSearch()
+    {
+        ++mSearchId;
+        if (mCancellationToken) {
+            mCancellationToken->cancel();
+            mCancellationToken.reset();
+        }
+    }
+}
@@ -0,0 +1,96 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2020 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_LIBRARYSEARCHMODEL_H
+#define UNPLAYER_LIBRARYSEARCHMODEL_H
+
+#include <memory>
+#include <vector>
+
+#include "asyncloadingmodel.h"
+
+namespace unplayer
+{
+    class QueryCancellationToken;
+
+    /**
+     * @brief Searches whole library using FTS5 index, without loading other models.
+     * Words of query are matched as prefixes
+     */
+    class LibrarySearchModel : public AsyncLoadingModel
+    {
+        Q_OBJECT
+        Q_PROPERTY(QString query READ query WRITE setQuery NOTIFY queryChanged)
+    public:
+        enum Role
+        {
+            TypeRole = Qt::UserRole,
+            IdRole,
+            TitleRole,
+            SubtitleRole,
+            FilePathRole
+        };
+        Q_ENUM(Role)
+
+        enum Type
+        {
+            Track,
+            Artist,
+            Album,
+            Genre
+        };
+        Q_ENUM(Type)
+
+        struct Item
+        {
+            Type type;
+            int id;
+            QString title;
+            // Artists for tracks and albums
+            QString subtitle;
+            QString filePath;
+        };
+
+        LibrarySearchModel();
+        ~LibrarySearchModel() override;
+
+        int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+        QVariant data(const QModelIndex& index, int role) const override;
+
+        QString query() const;
+        void setQuery(const QString& query);
+
+    protected:
+        QHash<int, QByteArray> roleNames() const override;
+
+    private:
+        void search();
+        void cancelSearch();
+
+        QString mQuery;
+        std::vector<Item> mItems;
+        std::shared_ptr<QueryCancellationToken> mCancellationToken;
+        // Results of superseded searches are ignored
+        int mSearchId;
+
+    signals:
+        void queryChanged();
+    };
+}
+
+#endif // UNPLAYER_LIBRARYSEARCHMODEL_H
@@ -19,6 +19,9 @@
 #ifndef UNPLAYER_LIBRARYTRACK_H
 #define UNPLAYER_LIBRARYTRACK_H
 
+#include <vector>
+
+#include <QMetaType>
 #include <QString>
 
 namespace unplayer
@@ -35,4 +38,7 @@ namespace unplayer
     };
 }
 
+Q_DECLARE_METATYPE(unplayer::LibraryTrack)
+Q_DECLARE_METATYPE(std::vector<unplayer::LibraryTrack>)
+
 #endif // UNPLAYER_LIBRARYTRACK_H
@@ -30,8 +30,20 @@
 
 namespace unplayer
 {
-    LibraryTracksAdder::LibraryTracksAdder(const QSqlDatabase& db)
-        : mDb(db)
+    namespace
+    {
+        // Below that, looking up categories one by one is cheaper than loading whole tables
+        const size_t preloadCategoriesThreshold = 500;
+    }
+
+    bool LibraryTracksAdder::shouldPreloadCategories(size_t tracksCount)
+    {
+        return tracksCount >= preloadCategoriesThreshold;
+    }
+
+    LibraryTracksAdder::LibraryTracksAdder(const QSqlDatabase& db, bool preloadCategories)
+        : mPreloadedCategories(preloadCategories),
+          mDb(db)
     {
         QSqlQuery query(db);
         if (query.exec(QLatin1String("SELECT id FROM tracks ORDER BY id DESC LIMIT 1"))) {
@@ -44,9 +56,11 @@ namespace unplayer
             qWarning() << "Failed to get last track id" << query.lastError();
         }
 
-        getArtists();
-        getAlbums();
-        getGenres();
+        if (mPreloadedCategories) {
+            getArtists();
+            getAlbums();
+            getGenres();
+        }
 
         if (!mAddTrackQuery.prepare(QLatin1String("INSERT INTO tracks (modificationTime, year, trackNumber, duration, filePath, title, discNumber, directoryMediaArt, embeddedMediaArt) "
                                                   "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)"))) {
@@ -80,13 +94,19 @@ namespace unplayer
         info.artists.append(info.albumArtists);
         info.artists.removeDuplicates();
 
+        bool addedArtist = false;
         for (const QString& artist : info.artists) {
             const int artistId = getArtistId(artist);
             if (artistId != 0) {
                 addRelationship(trackId, artistId, mArtists.addTracksRelationshipQuery);
+                addedArtist = true;
             }
         }
+        if (!addedArtist) {
+            markUnknownCategoryChanged(mArtists);
+        }
 
+        bool addedAlbum = false;
         if (!info.albums.isEmpty()) {
             if (info.albumArtists.isEmpty() && !info.artists.isEmpty()) {
                 info.albumArtists.push_back(info.artists.front());
@@ -106,9 +126,13 @@ namespace unplayer
                 const int albumId = getAlbumId(album, std::move(artistIds));
                 if (albumId != 0) {
                     addRelationship(trackId, albumId, mAlbums.addTracksRelationshipQuery);
+                    addedAlbum = true;
                 }
             }
         }
+        if (!addedAlbum) {
+            markUnknownCategoryChanged(mAlbums);
+        }
 
         for (const QString& genre : info.genres) {
             const int genreId = getGenreId(genre);
@@ -159,8 +183,7 @@ namespace unplayer
         if (query.exec(QLatin1String("SELECT id, title FROM ") % ids.table)) {
             if (reserveFromQuery(ids.ids, query) > 0) {
                 while (query.next()) {
-                    ids.lastId = query.value(IdField).toInt();
-                    ids.ids.emplace(query.value(TitleField).toString(), ids.lastId);
+                    ids.ids.emplace(query.value(TitleField).toString(), query.value(IdField).toInt());
                 }
             }
         } else {
@@ -180,22 +203,23 @@ namespace unplayer
         if (query.exec(QLatin1String("SELECT id, title, artistId "
                                      "FROM albums "
                                      "LEFT JOIN albums_artists ON albums_artists.albumId = albums.id"))) {
+            int albumId = 0;
             QString title;
             QVector<int> artistIds;
 
             const auto addAlbum = [&] {
                 std::sort(artistIds.begin(), artistIds.end());
-                mAlbums.ids.emplace(QPair<QString, QVector<int>>(title, artistIds), mAlbums.lastId);
+                mAlbums.ids.emplace(QPair<QString, QVector<int>>(title, artistIds), albumId);
                 artistIds.clear();
             };
 
             while (query.next()) {
                 const int id = query.value(IdField).toInt();
-                if (id != mAlbums.lastId) {
-                    if (mAlbums.lastId != 0) {
+                if (id != albumId) {
+                    if (albumId != 0) {
                         addAlbum();
                     }
-                    mAlbums.lastId = id;
+                    albumId = id;
                     title = query.value(TitleField).toString();
                 }
                 const int artistId = query.value(ArtistIdField).toInt();
@@ -204,7 +228,7 @@ namespace unplayer
                 }
             }
 
-            if (mAlbums.lastId != 0) {
+            if (albumId != 0) {
                 addAlbum();
             }
         } else {
@@ -230,11 +254,30 @@ namespace unplayer
         const auto& map = ids.ids;
         const auto found(map.find(title));
         if (found == map.end()) {
+            if (!mPreloadedCategories) {
+                const int id = findArtistOrGenre(title, ids);
+                if (id != 0) {
+                    ids.ids.emplace(title, id);
+                    return id;
+                }
+            }
             return addArtistOrGenre(title, ids);
         }
         return found->second;
     }
 
+    int LibraryTracksAdder::findArtistOrGenre(const QString& title, LibraryTracksAdder::ArtistsOrGenres& ids)
+    {
+        ids.findQuery.addBindValue(title);
+        if (!ids.findQuery.exec()) {
+            qWarning() << "Failed to exec query" << ids.findQuery.lastError();
+            return 0;
+        }
+        const int id = ids.findQuery.next() ? ids.findQuery.value(0).toInt() : 0;
+        ids.findQuery.finish();
+        return id;
+    }
+
     int LibraryTracksAdder::addArtistOrGenre(const QString& title, LibraryTracksAdder::ArtistsOrGenres& ids)
     {
         ids.addNewQuery.addBindValue(title);
@@ -242,9 +285,9 @@ namespace unplayer
             qWarning() << "Failed to exec query" << ids.addNewQuery.lastError();
             return 0;
         }
-        ++ids.lastId;
-        ids.ids.emplace(title, ids.lastId);
-        return ids.lastId;
+        const int id = ids.addNewQuery.lastInsertId().toInt();
+        ids.ids.emplace(title, id);
+        return id;
     }
 
     int LibraryTracksAdder::getAlbumId(const QString& title, QVector<int>&& artistIds)
@@ -255,11 +298,69 @@ namespace unplayer
         const auto& map = mAlbums.ids;
         const auto found(map.find(QPair<QString, QVector<int>>(title, artistIds)));
         if (found == map.end()) {
+            if (!mPreloadedCategories) {
+                const int id = findAlbum(title, artistIds);
+                if (id != 0) {
+                    mAlbums.ids.emplace(QPair<QString, QVector<int>>(title, std::move(artistIds)), id);
+                    return id;
+                }
+            }
             return addAlbum(title, std::move(artistIds));
         }
         return found->second;
     }
 
+    int LibraryTracksAdder::findAlbum(const QString& title, const QVector<int>& artistIds)
+    {
+        enum
+        {
+            IdField,
+            ArtistIdField
+        };
+
+        QSqlQuery& query = mAlbums.findQuery;
+        query.addBindValue(title);
+        if (!query.exec()) {
+            qWarning() << "Failed to exec query" << query.lastError();
+            return 0;
+        }
+
+        // There can be several albums with the same title, find the one with the same artists
+        int foundId = 0;
+        int albumId = 0;
+        QVector<int> albumArtistIds;
+
+        const auto checkAlbum = [&] {
+            std::sort(albumArtistIds.begin(), albumArtistIds.end());
+            if (albumArtistIds == artistIds) {
+                foundId = albumId;
+            }
+            albumArtistIds.clear();
+        };
+
+        while (foundId == 0 && query.next()) {
+            const int id = query.value(IdField).toInt();
+            if (id != albumId) {
+                if (albumId != 0) {
+                    checkAlbum();
+                }
+                albumId = id;
+            }
+            const int artistId = query.value(ArtistIdField).toInt();
+            if (artistId != 0) {
+                albumArtistIds.push_back(artistId);
+            }
+        }
+
+        if (foundId == 0 && albumId != 0) {
+            checkAlbum();
+        }
+
+        query.finish();
+
+        return foundId;
+    }
+
     int LibraryTracksAdder::addAlbum(const QString& title, QVector<int>&& artistIds)
     {
         mAlbums.addNewQuery.addBindValue(title);
@@ -268,14 +369,28 @@ namespace unplayer
             return 0;
         }
 
-        ++mAlbums.lastId;
+        const int id = mAlbums.addNewQuery.lastInsertId().toInt();
 
         for (int artistId : artistIds) {
-            addRelationship(mAlbums.lastId, artistId, mAlbums.addArtistsRelationshipQuery);
+            addRelationship(id, artistId, mAlbums.addArtistsRelationshipQuery);
         }
 
-        mAlbums.ids.emplace(QPair<QString, QVector<int>>(title, std::move(artistIds)), mAlbums.lastId);
-        return mAlbums.lastId;
+        mAlbums.ids.emplace(QPair<QString, QVector<int>>(title, std::move(artistIds)), id);
+        return id;
+    }
+
+    template<typename Categories>
+    void LibraryTracksAdder::markUnknownCategoryChanged(Categories& categories)
+    {
+        if (categories.markedUnknownChanged) {
+            return;
+        }
+        QSqlQuery query(mDb);
+        if (query.exec(QLatin1String("INSERT OR IGNORE INTO changed_") % categories.table % QLatin1String(" VALUES (0)"))) {
+            categories.markedUnknownChanged = true;
+        } else {
+            qWarning() << "Failed to exec query" << query.lastError();
+        }
     }
 
     void LibraryTracksAdder::addRelationship(int firstId, int secondId, QSqlQuery& query)
@@ -289,9 +404,14 @@ namespace unplayer
 
     LibraryTracksAdder::ArtistsOrGenres::ArtistsOrGenres(QLatin1String table, const QSqlDatabase& db)
         : table(table),
+          findQuery(db),
           addNewQuery(db),
           addTracksRelationshipQuery(db)
     {
+        // Titles are compared case-sensitively, the same way as when they are preloaded
+        if (!findQuery.prepare(QString::fromLatin1("SELECT id FROM %1 WHERE title = ? COLLATE BINARY").arg(table))) {
+            qWarning() << "Failed to prepare query" << findQuery.lastError();
+        }
         if (!addNewQuery.prepare(QString::fromLatin1("INSERT INTO %1 (title) VALUES (?)").arg(table))) {
             qWarning() << "Failed to prepare query" << addNewQuery.lastError();
         }
@@ -301,10 +421,19 @@ namespace unplayer
     }
 
     LibraryTracksAdder::Albums::Albums(const QSqlDatabase& db)
-        : addNewQuery(db),
+        : table(QLatin1String("albums")),
+          findQuery(db),
+          addNewQuery(db),
           addTracksRelationshipQuery(db),
           addArtistsRelationshipQuery(db)
     {
+        if (!findQuery.prepare(QLatin1String("SELECT id, artistId "
+                                             "FROM albums "
+                                             "LEFT JOIN albums_artists ON albums_artists.albumId = albums.id "
+                                             "WHERE title = ? COLLATE BINARY "
+                                             "ORDER BY id"))) {
+            qWarning() << "Failed to prepare query" << findQuery.lastError();
+        }
         if (!addNewQuery.prepare(QLatin1String("INSERT INTO albums (title) VALUES (?)"))) {
             qWarning() << "Failed to prepare query" << addNewQuery.lastError();
         }
@@ -44,7 +44,16 @@ namespace unplayer
     class LibraryTracksAdder
     {
     public:
-        explicit LibraryTracksAdder(const QSqlDatabase& db);
+        /**
+         * @brief Returns whether all categories should be loaded in advance when adding given number of tracks
+         */
+        static bool shouldPreloadCategories(size_t tracksCount);
+
+        /**
+         * @param preloadCategories If true, all artists, albums and genres are loaded in constructor,
+         *                          otherwise they are looked up one by one when they are needed
+         */
+        explicit LibraryTracksAdder(const QSqlDatabase& db, bool preloadCategories);
 
         void addTrackToDatabase(const QString& filePath,
                                 long long modificationTime,
@@ -61,23 +70,26 @@ namespace unplayer
             explicit ArtistsOrGenres(QLatin1String table, const QSqlDatabase& db);
 
             QLatin1String table;
+            QSqlQuery findQuery;
             QSqlQuery addNewQuery;
             QSqlQuery addTracksRelationshipQuery;
 
             std::unordered_map<QString, int> ids{};
-            int lastId = 0;
+            bool markedUnknownChanged = false;
         };
 
         struct Albums
         {
             explicit Albums(const QSqlDatabase& db);
 
+            QLatin1String table;
+            QSqlQuery findQuery;
             QSqlQuery addNewQuery;
             QSqlQuery addTracksRelationshipQuery;
             QSqlQuery addArtistsRelationshipQuery;
 
             std::unordered_map<QPair<QString, QVector<int>>, int> ids{};
-            int lastId = 0;
+            bool markedUnknownChanged = false;
         };
 
         void getArtists();
@@ -88,14 +100,21 @@ namespace unplayer
         int getArtistId(const QString& title);
         int getGenreId(const QString& title);
         int getArtistOrGenreId(const QString& title, ArtistsOrGenres& ids);
+        int findArtistOrGenre(const QString& title, ArtistsOrGenres& ids);
         int addArtistOrGenre(const QString& title, ArtistsOrGenres& ids);
 
         int getAlbumId(const QString& title, QVector<int>&& artistIds);
+        int findAlbum(const QString& title, const QVector<int>& artistIds);
         int addAlbum(const QString& title, QVector<int>&& artistIds);
 
         void addRelationship(int firstId, int secondId, QSqlQuery& query);
 
+        // Tells LibraryUtils::processChanges() to update statistics of tracks without artists or albums
+        template<typename Categories>
+        void markUnknownCategoryChanged(Categories& categories);
+
         int mLastTrackId;
+        bool mPreloadedCategories;
         const QSqlDatabase& mDb;
         QSqlQuery mAddTrackQuery{mDb};
 
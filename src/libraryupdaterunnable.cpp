@@ -20,6 +20,7 @@
 
 #include <algorithm>
 
+#include <QCoreApplication>
 #include <QDebug>
 #include <QDir>
 #include <QDirIterator>
@@ -36,12 +37,16 @@
 #include "settings.h"
 #include "sqlutils.h"
 #include "tagutils.h"
+#include "threadpool.h"
 #include "utilsfunctions.h"
 
 namespace unplayer
 {
     namespace
     {
+        // Number of files after which time spent yielding to interactive tasks is reset
+        const size_t yieldBatchSize = 100;
+
         bool isNoMediaDirectory(const QString& directory, std::unordered_map<QString, bool>& noMediaDirectories)
         {
             {
@@ -83,7 +88,7 @@ namespace unplayer
         public:
             explicit LibraryUpdater(std::atomic_bool& cancelFlag);
 
-            void update();
+            LibraryChanges update();
         private:
             struct TrackInDb
             {
@@ -154,6 +159,12 @@ namespace unplayer
              * @return Pointer to vector of existing track ids for this directory,
              *         or nullptr if this directory media art has not changed or is not in db
              */
+            /**
+             * @brief Scans filesystem and applies found changes to database,
+             * returns early if update is cancelled, leaving changes made so far
+             */
+            void updateTracks();
+
             static std::vector<int>* checkIfDirectoryMediaArtIsInDbAndChanged(const QString& directoryPath,
                                                                               const QString& newDirectoryMediaArt,
                                                                               std::unordered_map<QString, QString>& directoriesMediaArtInDb,
@@ -191,10 +202,10 @@ namespace unplayer
 
         }
 
-        void LibraryUpdater::update()
+        LibraryChanges LibraryUpdater::update()
         {
             if (mCancel) {
-                return;
+                return {};
             }
 
             qInfo("Start updating database");
@@ -205,89 +216,104 @@ namespace unplayer
             // Open database
 
             if (!mDb.isOpen()) {
-                return;
+                return {};
             }
 
-            const TransactionGuard transactionGuard(mDb);
+            // Cleared only when all extracted media art is committed or removed
+            LibraryUtils::setMediaArtCheckPending(mDb, true);
+
+            TransactionGuard transactionGuard(mDb);
 
             // Create media art directory
             if (!QDir().mkpath(MediaArtUtils::mediaArtDirectory())) {
                 qWarning() << "failed to create media art directory:" << MediaArtUtils::mediaArtDirectory();
             }
 
-            if (!LibraryUtils::dropIndexes(mDb)) {
-                qWarning("Failed to drop indexes");
+            updateTracks();
+
+            if (mCancel) {
+                qInfo("Updating was cancelled, applying changes made so far");
             }
 
-            const auto indexesGuard(qScopeGuard([&] {
-                if (!LibraryUtils::createIndexes(mDb)) {
-                    qWarning("Failed to create indexes");
-                }
-            }));
+            emit stageChanged(LibraryUtils::FinishingStage);
 
-            {
-                std::unordered_map<QByteArray, QString> embeddedMediaArtFiles(MediaArtUtils::getEmbeddedMediaArtFiles());
-                std::vector<TrackToAdd> tracksToAdd;
+            LibraryChanges changes(LibraryUtils::processChanges(mDb));
+            const std::vector<QString> unusedMediaArt(LibraryUtils::takeUnusedMediaArt(mDb));
+            if (!transactionGuard.commit()) {
+                qWarning() << "Failed to commit transaction:" << mDb.lastError();
+                transactionGuard.rollback();
+                return {};
+            }
+            LibraryUtils::removeMediaArtFiles(unusedMediaArt);
+            if (mCancel) {
+                // Media art may have been extracted for tracks that weren't added,
+                // on quit this is left for startup
+                if (!QCoreApplication::closingDown()) {
+                    LibraryUtils::removeOrphanedMediaArt(mDb);
+                    LibraryUtils::setMediaArtCheckPending(mDb, false);
+                }
+            } else {
+                LibraryUtils::setMediaArtCheckPending(mDb, false);
+            }
 
-                {
-                    std::vector<int> tracksToRemove;
-                    {
-                        TracksInDbResult tracksInDbResult(getTracksFromDatabase());
-                        auto& tracksInDb = tracksInDbResult.tracksInDb;
+            qInfo("End updating database (last stage took %.3f s)", static_cast<double>(mStageTimer.elapsed()) / 1000.0);
+            qInfo("Total time: %.3f s", static_cast<double>(timer.elapsed()) / 1000.0);
 
-                        if (mCancel) {
-                            return;
-                        }
+            return changes;
+        }
 
-                        qInfo("Tracks in database: %zd (took %.3f s)", tracksInDb.size(), static_cast<double>(mStageTimer.restart()) / 1000.0);
+        void LibraryUpdater::updateTracks()
+        {
+            std::unordered_map<QByteArray, QString> embeddedMediaArtFiles(MediaArtUtils::getEmbeddedMediaArtFiles());
+            std::vector<TrackToAdd> tracksToAdd;
 
-                        qInfo("Start scanning filesystem");
-                        emit stageChanged(LibraryUtils::ScanningStage);
+            {
+                std::vector<int> tracksToRemove;
+                {
+                    TracksInDbResult tracksInDbResult(getTracksFromDatabase());
+                    auto& tracksInDb = tracksInDbResult.tracksInDb;
 
-                        // Library directories
-                        mLibraryDirectories = prepareLibraryDirectories(Settings::instance()->libraryDirectories());
-                        mBlacklistedDirectories = prepareLibraryDirectories(Settings::instance()->blacklistedDirectories());
+                    if (mCancel) {
+                        return;
+                    }
 
-                        ScanFilesystemResult scanFilesystemResult(scanFilesystem(tracksInDbResult, embeddedMediaArtFiles));
-                        tracksToAdd = std::move(scanFilesystemResult.tracksToAdd);
+                    qInfo("Tracks in database: %zd (took %.3f s)", tracksInDb.size(), static_cast<double>(mStageTimer.restart()) / 1000.0);
 
-                        if (mCancel) {
-                            return;
-                        }
+                    qInfo("Start scanning filesystem");
+                    emit stageChanged(LibraryUtils::ScanningStage);
 
-                        if (scanFilesystemResult.tracksToRemoveFromDatabaseCount > 0) {
-                            tracksToRemove.reserve(scanFilesystemResult.tracksToRemoveFromDatabaseCount);
-                            for (const auto& i : tracksInDbResult.tracksInDb) {
-                                const TrackInDb& track = i.second;
-                                if (track.removeFromDatabase) {
-                                    tracksToRemove.push_back(track.id);
-                                }
-                            }
-                        }
+                    // Library directories
+                    mLibraryDirectories = prepareLibraryDirectories(Settings::instance()->libraryDirectories());
+                    mBlacklistedDirectories = prepareLibraryDirectories(Settings::instance()->blacklistedDirectories());
 
-                        qInfo("End scanning filesystem (took %.3f s), need to extract tags from %zu files", static_cast<double>(mStageTimer.restart()) / 1000.0, tracksToAdd.size());
+                    ScanFilesystemResult scanFilesystemResult(scanFilesystem(tracksInDbResult, embeddedMediaArtFiles));
+                    tracksToAdd = std::move(scanFilesystemResult.tracksToAdd);
 
-                        updateChangedDirectoriesMediaArt(std::move(scanFilesystemResult.changedDirectoriesMediaArt));
+                    if (mCancel) {
+                        return;
                     }
 
-                    if (!tracksToRemove.empty()) {
-                        qInfo("Tracks to remove: %zd", tracksToRemove.size());
-                        if (LibraryUtils::removeTracksFromDbByIds(tracksToRemove, mDb, mCancel)) {
-                            qInfo("Removed %zu tracks from database (took %.3f s)", tracksToRemove.size(), static_cast<double>(mStageTimer.restart()) / 1000.0);
+                    if (scanFilesystemResult.tracksToRemoveFromDatabaseCount > 0) {
+                        tracksToRemove.reserve(scanFilesystemResult.tracksToRemoveFromDatabaseCount);
+                        for (const auto& i : tracksInDbResult.tracksInDb) {
+                            const TrackInDb& track = i.second;
+                            if (track.removeFromDatabase) {
+                                tracksToRemove.push_back(track.id);
+                            }
                         }
-                        tracksToRemove.clear();
                     }
-                }
 
-                if (mCancel) {
-                    return;
+                    qInfo("End scanning filesystem (took %.3f s), need to extract tags from %zu files", static_cast<double>(mStageTimer.restart()) / 1000.0, tracksToAdd.size());
+
+                    updateChangedDirectoriesMediaArt(std::move(scanFilesystemResult.changedDirectoriesMediaArt));
                 }
 
-                if (!tracksToAdd.empty()) {
-                    qInfo("Start extracting tags from files");
-                    emit stageChanged(LibraryUtils::ExtractingStage);
-                    const int count = addTracks(std::move(tracksToAdd), embeddedMediaArtFiles);
-                    qInfo("Added %d tracks to database (took %.3f s)", count, static_cast<double>(mStageTimer.restart()) / 1000.0);
+                if (!tracksToRemove.empty()) {
+                    qInfo("Tracks to remove: %zd", tracksToRemove.size());
+                    if (LibraryUtils::removeTracksFromDbByIds(tracksToRemove, mDb, mCancel)) {
+                        qInfo("Removed %zu tracks from database (took %.3f s)", tracksToRemove.size(), static_cast<double>(mStageTimer.restart()) / 1000.0);
+                    }
+                    tracksToRemove.clear();
                 }
             }
 
@@ -295,13 +321,12 @@ namespace unplayer
                 return;
             }
 
-            emit stageChanged(LibraryUtils::FinishingStage);
-
-            LibraryUtils::removeUnusedCategories(mDb);
-            LibraryUtils::removeUnusedMediaArt(mDb, mCancel);
-
-            qInfo("End updating database (last stage took %.3f s)", static_cast<double>(mStageTimer.elapsed()) / 1000.0);
-            qInfo("Total time: %.3f s", static_cast<double>(timer.elapsed()) / 1000.0);
+            if (!tracksToAdd.empty()) {
+                qInfo("Start extracting tags from files");
+                emit stageChanged(LibraryUtils::ExtractingStage);
+                const int count = addTracks(std::move(tracksToAdd), embeddedMediaArtFiles);
+                qInfo("Added %d tracks to database (took %.3f s)", count, static_cast<double>(mStageTimer.restart()) / 1000.0);
+            }
         }
 
         LibraryUpdater::TracksInDbResult LibraryUpdater::getTracksFromDatabase()
@@ -586,12 +611,36 @@ namespace unplayer
         {
             int count = 0;
 
-            LibraryTracksAdder adder(mDb);
+            const bool preloadCategories = LibraryTracksAdder::shouldPreloadCategories(tracksToAdd.size());
+
+            // Dropping indexes makes bulk inserts faster, but small batches need them for category lookups
+            if (preloadCategories && !LibraryUtils::dropIndexes(mDb)) {
+                qWarning("Failed to drop indexes");
+            }
+
+            // Always executed, so that indexes dropped before a failure are restored too. Existing ones are skipped
+            const auto indexesGuard(qScopeGuard([&] {
+                if (!LibraryUtils::createIndexes(mDb)) {
+                    qWarning("Failed to create indexes");
+                }
+            }));
+
+            LibraryTracksAdder adder(mDb, preloadCategories);
+            long long yieldedTime = 0;
+            size_t processed = 0;
             for (TrackToAdd& track : tracksToAdd) {
                 if (mCancel) {
                     return count;
                 }
 
+                // Tag extraction is the longest part of update, let queries for visible pages run first,
+                // but don't stall for longer than maximum yield time per batch of files
+                if ((processed % yieldBatchSize) == 0) {
+                    yieldedTime = 0;
+                }
+                ++processed;
+                ThreadPool::yieldToInteractive(yieldedTime);
+
                 auto trackInfo = tagutils::getTrackInfo(track.filePath, track.extension);
                 if (trackInfo && fileutils::isAudioCodecSupported(trackInfo->audioCodec)) {
                     ++count;
@@ -630,8 +679,7 @@ namespace unplayer
         QObject::connect(&updater, &LibraryUpdater::stageChanged, this, &LibraryUpdateRunnable::stageChanged);
         QObject::connect(&updater, &LibraryUpdater::foundFilesChanged, this, &LibraryUpdateRunnable::foundFilesChanged);
         QObject::connect(&updater, &LibraryUpdater::extractedFilesChanged, this, &LibraryUpdateRunnable::extractedFilesChanged);
-        updater.update();
-        emit finished();
+        emit finished(updater.update());
     }
 }
 
@@ -42,7 +42,7 @@ namespace unplayer
         void stageChanged(unplayer::LibraryUtils::UpdateStage newStage);
         void foundFilesChanged(int found);
         void extractedFilesChanged(int extracted);
-        void finished();
+        void finished(const unplayer::LibraryChanges& changes);
     };
 }
 
@@ -33,8 +33,7 @@
 #include <QSqlQuery>
 #include <QStandardPaths>
 #include <QStringBuilder>
-#include <QThreadPool>
-#include <QtConcurrentRun>
+#include <QUuid>
 
 #include "librarymigrator.h"
 #include "librarytrack.h"
@@ -42,17 +41,25 @@
 #include "libraryupdaterunnable.h"
 #include "mediaartutils.h"
 #include "settings.h"
+#include "sqliteutils.h"
 #include "sqlutils.h"
 #include "stdutils.h"
 #include "tagutils.h"
+#include "threadpool.h"
+#include "thumbnailimageprovider.h"
 #include "utilsfunctions.h"
 
 namespace unplayer
 {
     namespace
     {
-        const QLatin1String removeFilesConnectionName("unplayer_remove");
-        const QLatin1String saveTagsConnectionName("unplayer_save");
+        // Used by library mutations, only one of them is executed at a time
+        const QLatin1String writerConnectionName("unplayer_writer");
+        const QLatin1String statsConnectionName("unplayer_stats");
+        const QLatin1String thumbnailsConnectionName("unplayer_thumbnails");
+
+        // Number of media art files which thumbnails are created in one background task
+        const size_t thumbnailsChunkSize = 20;
 
         inline QString emptyIfNull(const QString& string)
         {
@@ -62,7 +69,26 @@ namespace unplayer
             return string;
         }
 
-        const int databaseVersion = 1;
+        std::unordered_set<QString> queryUsedMediaArt(const QSqlDatabase& db, bool& ok)
+        {
+            std::unordered_set<QString> usedMediaArt;
+            QSqlQuery query(db);
+            ok = query.exec(QLatin1String("SELECT DISTINCT embeddedMediaArt FROM tracks WHERE embeddedMediaArt IS NOT NULL "
+                                          "UNION "
+                                          "SELECT DISTINCT directoryMediaArt FROM tracks WHERE directoryMediaArt IS NOT NULL "
+                                          "UNION "
+                                          "SELECT DISTINCT userMediaArt FROM albums WHERE userMediaArt IS NOT NULL"));
+            if (!ok) {
+                qWarning() << "Failed to query used media art" << query.lastError();
+                return usedMediaArt;
+            }
+            while (query.next()) {
+                usedMediaArt.insert(query.value(0).toString());
+            }
+            return usedMediaArt;
+        }
+
+        const int databaseVersion = 10;
 
         const QString& databasePath()
         {
@@ -70,6 +96,59 @@ namespace unplayer
             return path;
         }
 
+        // Indexes that use LOCALE collation are invalid when locale is changed, so they are rebuilt.
+        // They are also rebuilt with NOCASE collation if LOCALE is not available
+        void updateCollationLocale(QSqlDatabase& db)
+        {
+            const QString locale(sqliteutils::sortCollationName());
+
+            QSqlQuery query(db);
+            if (!query.exec(QLatin1String("SELECT name FROM collation_locale"))) {
+                qWarning() << "Failed to get collation locale" << query.lastError();
+                return;
+            }
+            if (query.next() && query.value(0).toString() == locale) {
+                return;
+            }
+            query.finish();
+
+            qInfo() << "Collation locale changed to" << locale << "rebuilding indexes";
+
+            if (!LibraryUtils::dropSortIndexes(db) || !LibraryUtils::createSortIndexes(db)) {
+                qWarning("Failed to rebuild indexes");
+                return;
+            }
+            if (!query.exec(QLatin1String("DELETE FROM collation_locale"))) {
+                qWarning() << "Failed to clear collation locale" << query.lastError();
+                return;
+            }
+            query.prepare(QLatin1String("INSERT INTO collation_locale VALUES (?)"));
+            query.addBindValue(locale);
+            if (!query.exec()) {
+                qWarning() << "Failed to set collation locale" << query.lastError();
+            }
+        }
+
+        bool isFts5Available(const QSqlDatabase& db)
+        {
+            QSqlQuery query(db);
+            if (!query.exec(QLatin1String("SELECT sqlite_compile_option_used('ENABLE_FTS5')")) || !query.next()) {
+                qWarning() << "Failed to check FTS5 availability" << query.lastError();
+                return false;
+            }
+            return query.value(0).toBool();
+        }
+
+        bool hasSearchTables(const QSqlDatabase& db)
+        {
+            QSqlQuery query(db);
+            if (!query.exec(QLatin1String("SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'tracks_search'"))) {
+                qWarning() << "Failed to check search tables" << query.lastError();
+                return false;
+            }
+            return query.next();
+        }
+
         void deleteFilesFromFilesystem(const std::vector<QString>& paths)
         {
             for (const QString& path : paths) {
@@ -184,6 +263,92 @@ namespace unplayer
 
             return false;
         }
+
+        bool removeTracksFromDbByCategories(const std::vector<int>& ids,
+                                            const QLatin1String& tracksTable,
+                                            const QLatin1String& idColumn,
+                                            bool getFilePaths,
+                                            std::vector<QString>& filePaths,
+                                            const QSqlDatabase& db)
+        {
+            bool abort = false;
+
+            QSqlQuery query(db);
+            const QString join(QLatin1String("LEFT JOIN ") % tracksTable % QLatin1String(" ON ") % tracksTable % QLatin1String(".trackId = id "));
+
+            batchedCount(ids.size(), LibraryUtils::maxDbVariableCount, [&](size_t first, size_t count) {
+                if (abort) {
+                    return;
+                }
+                if (!qApp) {
+                    abort = true;
+                    return;
+                }
+
+                // Id 0 stands for unknown artist or album
+                bool addNull = false;
+                QString whereString(QLatin1String("WHERE ") % idColumn % QLatin1String(" IN (") % makeInStringFromIds(ids, first, count, addNull));
+                if (addNull) {
+                    whereString += QLatin1String(" OR ") % idColumn % QLatin1String(" IS NULL");
+                }
+
+                if (getFilePaths) {
+                    if (query.exec(QLatin1String("SELECT filePath FROM tracks ") % join % whereString)) {
+                        if (reserveFromQueryAppend(filePaths, query) > 0) {
+                            while (query.next()) {
+                                filePaths.push_back(query.value(0).toString());
+                            }
+                        }
+                    } else {
+                        qWarning() << "Failed to get tracks for" << idColumn << query.lastError();
+                        abort = true;
+                        return;
+                    }
+                }
+
+                if (!query.exec(QLatin1String("DELETE FROM tracks WHERE id IN (SELECT id FROM tracks ") % join % whereString % QLatin1Char(')'))) {
+                    qWarning() << "Failed to remove tracks from database" << query.lastError();
+                    abort = true;
+                }
+            });
+
+            return !abort;
+        }
+
+        void collectChanges(QSqlQuery& query,
+                            const QLatin1String& changedTable,
+                            const QLatin1String& addedTable,
+                            const QLatin1String& table,
+                            LibraryChanges::Ids& ids)
+        {
+            enum
+            {
+                IdField,
+                AddedField,
+                ExistsField
+            };
+
+            if (!query.exec(QString::fromLatin1("SELECT id, id IN (SELECT id FROM %2), EXISTS (SELECT 1 FROM %3 WHERE %3.id = changed.id) "
+                                                "FROM (SELECT id FROM %1 UNION SELECT id FROM %2) AS changed").arg(changedTable, addedTable, table))) {
+                qWarning() << "Failed to get changes of" << table << query.lastError();
+                return;
+            }
+
+            while (query.next()) {
+                const int id = query.value(IdField).toInt();
+                const bool added = query.value(AddedField).toBool();
+                // Id 0 stands for unknown artist or album, it doesn't exist in categories tables
+                if (id == 0 || query.value(ExistsField).toBool()) {
+                    if (added) {
+                        ids.added.insert(id);
+                    } else {
+                        ids.modified.insert(id);
+                    }
+                } else if (!added) {
+                    ids.removed.insert(id);
+                }
+            }
+        }
     }
 
     const QString LibraryUtils::databaseType(QLatin1String("QSQLITE"));
@@ -195,6 +360,8 @@ namespace unplayer
         db.setDatabaseName(databasePath());
         if (!db.open()) {
             qWarning() << "Failed to open database:" << db.lastError();
+        } else {
+            sqliteutils::registerLocaleCollation(db);
         }
         QSqlQuery query(db);
         if (!query.exec(QLatin1String("PRAGMA foreign_keys = ON"))) {
@@ -237,7 +404,7 @@ namespace unplayer
         return false;
     }
 
-    void LibraryUtils::removeUnusedCategories(const QSqlDatabase& db)
+    LibraryChanges LibraryUtils::processChanges(const QSqlDatabase& db)
     {
         QSqlQuery query(db);
 
@@ -249,12 +416,26 @@ namespace unplayer
             return -1;
         };
 
+        const auto exec = [&](const QLatin1String& queryString, const char* what) {
+            if (!query.exec(queryString)) {
+                qWarning() << "Failed to update" << what << query.lastError();
+                return false;
+            }
+            return true;
+        };
+
+        // Album artists of changed albums, it must be done before removing unused albums
+        exec(QLatin1String("INSERT OR IGNORE INTO changed_album_artists "
+                           "SELECT ifnull(albums_artists.artistId, 0) "
+                           "FROM changed_albums "
+                           "LEFT JOIN albums_artists ON albums_artists.albumId = changed_albums.id"),
+             "album artists");
+
+        // Only categories that lost some of their tracks are checked, see triggers in createTables()
+        // Albums are removed first since that can make their artists unused
         if (query.exec(QLatin1String("DELETE FROM albums "
-                                     "WHERE id IN ("
-                                       "SELECT id FROM albums "
-                                       "LEFT JOIN tracks_albums ON albumId = id "
-                                       "WHERE trackId IS NULL"
-                                     ")"))) {
+                                     "WHERE id IN (SELECT id FROM changed_albums) "
+                                     "AND NOT EXISTS (SELECT 1 FROM tracks_albums WHERE albumId = albums.id)"))) {
             const int count = removed();
             if (count != 0) {
                 qInfo("Removed %d albums", count);
@@ -263,11 +444,9 @@ namespace unplayer
             qWarning() << "Failed to remove unused albums:" << query.lastError();
         }
         if (query.exec(QLatin1String("DELETE FROM artists "
-                                     "WHERE id IN ("
-                                       "SELECT id FROM artists "
-                                       "LEFT JOIN tracks_artists ON artistId = id "
-                                       "WHERE trackId IS NULL"
-                                     ")"))) {
+                                     "WHERE id IN (SELECT id FROM changed_artists) "
+                                     "AND NOT EXISTS (SELECT 1 FROM tracks_artists WHERE artistId = artists.id) "
+                                     "AND NOT EXISTS (SELECT 1 FROM albums_artists WHERE artistId = artists.id)"))) {
             const int count = removed();
             if (count != 0) {
                 qInfo("Removed %d artists", count);
@@ -276,11 +455,8 @@ namespace unplayer
             qWarning() << "Failed to remove unused artists:" << query.lastError();
         }
         if (query.exec(QLatin1String("DELETE FROM genres "
-                                     "WHERE id IN ("
-                                       "SELECT id FROM genres "
-                                       "LEFT JOIN tracks_genres ON genreId = id "
-                                       "WHERE trackId IS NULL"
-                                     ")"))) {
+                                     "WHERE id IN (SELECT id FROM changed_genres) "
+                                     "AND NOT EXISTS (SELECT 1 FROM tracks_genres WHERE genreId = genres.id)"))) {
             const int count = removed();
             if (count != 0) {
                 qInfo("Removed %d genres", count);
@@ -288,56 +464,304 @@ namespace unplayer
         } else {
             qWarning() << "Failed to remove unused genres:" << query.lastError();
         }
+
+        // Recalculate statistics of changed categories. Id 0 stands for tracks without artist or album,
+        // only calculating them requires going through all tracks
+
+        exec(QLatin1String("DELETE FROM artists_stats WHERE artistId IN (SELECT id FROM changed_artists)"), "artists statistics");
+        exec(QLatin1String("INSERT INTO artists_stats "
+                           "SELECT * FROM ("
+                             "SELECT id,"
+                                    "(SELECT COUNT(DISTINCT ifnull(tracks_albums.albumId, 0)) "
+                                     "FROM tracks_artists "
+                                     "LEFT JOIN tracks_albums ON tracks_albums.trackId = tracks_artists.trackId "
+                                     "WHERE tracks_artists.artistId = changed_artists.id),"
+                                    "(SELECT COUNT(*) FROM tracks_artists WHERE artistId = changed_artists.id) AS tracksCount,"
+                                    "(SELECT ifnull(SUM(duration), 0) "
+                                     "FROM tracks_artists "
+                                     "JOIN tracks ON tracks.id = tracks_artists.trackId "
+                                     "WHERE tracks_artists.artistId = changed_artists.id) "
+                             "FROM changed_artists "
+                             "WHERE id != 0"
+                           ") "
+                           "WHERE tracksCount > 0"),
+             "artists statistics");
+        exec(QLatin1String("INSERT INTO artists_stats "
+                           "SELECT * FROM ("
+                             "SELECT 0,"
+                                    "(SELECT COUNT(DISTINCT ifnull(tracks_albums.albumId, 0)) "
+                                     "FROM tracks "
+                                     "LEFT JOIN tracks_albums ON tracks_albums.trackId = tracks.id "
+                                     "WHERE NOT EXISTS (SELECT 1 FROM tracks_artists WHERE tracks_artists.trackId = tracks.id)),"
+                                    "COUNT(*) AS tracksCount,"
+                                    "ifnull(SUM(duration), 0) "
+                             "FROM tracks "
+                             "WHERE NOT EXISTS (SELECT 1 FROM tracks_artists WHERE tracks_artists.trackId = tracks.id)"
+                           ") "
+                           "WHERE tracksCount > 0 AND EXISTS (SELECT 1 FROM changed_artists WHERE id = 0)"),
+             "artists statistics");
+
+        exec(QLatin1String("DELETE FROM album_artists_stats WHERE artistId IN (SELECT id FROM changed_album_artists)"), "album artists statistics");
+        exec(QLatin1String("INSERT INTO album_artists_stats "
+                           "SELECT * FROM ("
+                             "SELECT changed_album_artists.id,"
+                                    "(SELECT COUNT(*) FROM albums_artists WHERE artistId = changed_album_artists.id),"
+                                    "COUNT(tracks.id) AS tracksCount,"
+                                    "ifnull(SUM(duration), 0) "
+                             "FROM changed_album_artists "
+                             "LEFT JOIN tracks ON tracks.id IN ("
+                               "SELECT tracks_albums.trackId "
+                               "FROM albums_artists "
+                               "JOIN tracks_albums ON tracks_albums.albumId = albums_artists.albumId "
+                               "WHERE albums_artists.artistId = changed_album_artists.id"
+                             ") "
+                             "WHERE changed_album_artists.id != 0 "
+                             "GROUP BY changed_album_artists.id"
+                           ") "
+                           "WHERE tracksCount > 0"),
+             "album artists statistics");
+        exec(QLatin1String("INSERT INTO album_artists_stats "
+                           "SELECT * FROM ("
+                             "SELECT 0,"
+                                    "(SELECT COUNT(DISTINCT ifnull(tracks_albums.albumId, 0)) "
+                                     "FROM tracks "
+                                     "LEFT JOIN tracks_albums ON tracks_albums.trackId = tracks.id "
+                                     "WHERE NOT EXISTS (SELECT 1 FROM tracks_albums "
+                                                       "JOIN albums_artists ON albums_artists.albumId = tracks_albums.albumId "
+                                                       "WHERE tracks_albums.trackId = tracks.id)),"
+                                    "COUNT(*) AS tracksCount,"
+                                    "ifnull(SUM(duration), 0) "
+                             "FROM tracks "
+                             "WHERE NOT EXISTS (SELECT 1 FROM tracks_albums "
+                                               "JOIN albums_artists ON albums_artists.albumId = tracks_albums.albumId "
+                                               "WHERE tracks_albums.trackId = tracks.id)"
+                           ") "
+                           "WHERE tracksCount > 0 AND EXISTS (SELECT 1 FROM changed_album_artists WHERE id = 0)"),
+             "album artists statistics");
+
+        exec(QLatin1String("DELETE FROM albums_stats WHERE albumId IN (SELECT id FROM changed_albums)"), "albums statistics");
+        exec(QLatin1String("INSERT INTO albums_stats "
+                           "SELECT * FROM ("
+                             "SELECT changed_albums.id,"
+                                    "(SELECT group_concat(title, ', ') "
+                                     "FROM albums_artists "
+                                     "JOIN artists ON artists.id = albums_artists.artistId "
+                                     "WHERE albums_artists.albumId = changed_albums.id),"
+                                    "MAX(year),"
+                                    "COUNT(tracks.id) AS tracksCount,"
+                                    "ifnull(SUM(duration), 0) "
+                             "FROM changed_albums "
+                             "LEFT JOIN tracks_albums ON tracks_albums.albumId = changed_albums.id "
+                             "LEFT JOIN tracks ON tracks.id = tracks_albums.trackId "
+                             "WHERE changed_albums.id != 0 "
+                             "GROUP BY changed_albums.id"
+                           ") "
+                           "WHERE tracksCount > 0"),
+             "albums statistics");
+        exec(QLatin1String("INSERT INTO albums_stats "
+                           "SELECT * FROM ("
+                             "SELECT 0, NULL, MAX(year), COUNT(*) AS tracksCount, ifnull(SUM(duration), 0) "
+                             "FROM tracks "
+                             "WHERE NOT EXISTS (SELECT 1 FROM tracks_albums WHERE tracks_albums.trackId = tracks.id)"
+                           ") "
+                           "WHERE tracksCount > 0 AND EXISTS (SELECT 1 FROM changed_albums WHERE id = 0)"),
+             "albums statistics");
+
+        exec(QLatin1String("DELETE FROM genres_stats WHERE genreId IN (SELECT id FROM changed_genres)"), "genres statistics");
+        exec(QLatin1String("INSERT INTO genres_stats "
+                           "SELECT * FROM ("
+                             "SELECT changed_genres.id, COUNT(tracks.id) AS tracksCount, ifnull(SUM(duration), 0) "
+                             "FROM changed_genres "
+                             "LEFT JOIN tracks_genres ON tracks_genres.genreId = changed_genres.id "
+                             "LEFT JOIN tracks ON tracks.id = tracks_genres.trackId "
+                             "GROUP BY changed_genres.id"
+                           ") "
+                           "WHERE tracksCount > 0"),
+             "genres statistics");
+
+        // Media art of categories that lost or gained tracks, and of categories of modified tracks
+        updateMediaArtCandidates(db,
+                                 QLatin1String("SELECT id FROM changed_artists "
+                                               "UNION SELECT artistId FROM tracks_artists WHERE trackId IN (SELECT id FROM changed_tracks) "
+                                               "UNION SELECT 0 FROM changed_tracks "
+                                               "WHERE NOT EXISTS (SELECT 1 FROM tracks_artists WHERE trackId = changed_tracks.id)"),
+                                 QLatin1String("SELECT id FROM changed_albums "
+                                               "UNION SELECT albumId FROM tracks_albums WHERE trackId IN (SELECT id FROM changed_tracks) "
+                                               "UNION SELECT 0 FROM changed_tracks "
+                                               "WHERE NOT EXISTS (SELECT 1 FROM tracks_albums WHERE trackId = changed_tracks.id)"),
+                                 QLatin1String("SELECT id FROM changed_genres "
+                                               "UNION SELECT genreId FROM tracks_genres WHERE trackId IN (SELECT id FROM changed_tracks)"));
+
+        LibraryChanges changes;
+        collectChanges(query, QLatin1String("changed_tracks"), QLatin1String("added_tracks"), QLatin1String("tracks"), changes.tracks);
+        collectChanges(query, QLatin1String("changed_artists"), QLatin1String("added_artists"), QLatin1String("artists"), changes.artists);
+        collectChanges(query, QLatin1String("changed_album_artists"), QLatin1String("added_artists"), QLatin1String("artists"), changes.albumArtists);
+        collectChanges(query, QLatin1String("changed_albums"), QLatin1String("added_albums"), QLatin1String("albums"), changes.albums);
+        collectChanges(query, QLatin1String("changed_genres"), QLatin1String("added_genres"), QLatin1String("genres"), changes.genres);
+
+        for (const QLatin1String& table : {QLatin1String("changed_tracks"),
+                                           QLatin1String("changed_albums"),
+                                           QLatin1String("changed_album_artists"),
+                                           QLatin1String("changed_artists"),
+                                           QLatin1String("changed_genres"),
+                                           QLatin1String("added_tracks"),
+                                           QLatin1String("added_artists"),
+                                           QLatin1String("added_albums"),
+                                           QLatin1String("added_genres")}) {
+            if (!query.exec(QLatin1String("DELETE FROM ") % table)) {
+                qWarning() << "Failed to clear" << table << query.lastError();
+            }
+        }
+
+        return changes;
     }
 
-    void LibraryUtils::removeUnusedMediaArt(const QSqlDatabase& db, const std::atomic_bool& cancel)
+    std::vector<QString> LibraryUtils::takeUnusedMediaArt(const QSqlDatabase& db)
     {
         QSqlQuery query(db);
 
-        std::unordered_set<QString> allEmbeddedMediaArt;
-        if (query.exec(QLatin1String("SELECT DISTINCT embeddedMediaArt FROM tracks WHERE embeddedMediaArt IS NOT NULL"))) {
-            if (reserveFromQuery(allEmbeddedMediaArt, query) > 0) {
-                while (query.next()) {
-                    allEmbeddedMediaArt.insert(query.value(0).toString());
-                }
+        std::vector<QString> unusedMediaArt;
+        if (query.exec(QLatin1String("SELECT filePath FROM changed_media_art "
+                                     "WHERE NOT EXISTS (SELECT 1 FROM tracks WHERE embeddedMediaArt = changed_media_art.filePath) "
+                                     "AND NOT EXISTS (SELECT 1 FROM albums WHERE userMediaArt = changed_media_art.filePath)"))) {
+            while (query.next()) {
+                unusedMediaArt.push_back(query.value(0).toString());
             }
         } else {
             qWarning() << query.lastError();
-            return;
+            return {};
         }
 
-        if (cancel) {
-            return;
+        if (!query.exec(QLatin1String("DELETE FROM changed_media_art"))) {
+            qWarning() << "Failed to clear changed_media_art" << query.lastError();
         }
 
-        std::unordered_set<QString> allUserMediaArt;
-        if (query.exec(QLatin1String("SELECT DISTINCT userMediaArt FROM albums WHERE userMediaArt IS NOT NULL"))) {
-            if (reserveFromQuery(allUserMediaArt, query) > 0) {
-                while (query.next()) {
-                    allUserMediaArt.insert(query.value(0).toString());
-                }
+        return unusedMediaArt;
+    }
+
+    void LibraryUtils::removeMediaArtFiles(const std::vector<QString>& files)
+    {
+        for (const QString& filePath : files) {
+            if (QFile::exists(filePath) && !QFile::remove(filePath)) {
+                qWarning() << "Failed to remove file:" << filePath;
             }
-        } else {
-            qWarning() << query.lastError();
-            return;
+            MediaArtUtils::removeThumbnails(filePath);
         }
+    }
 
-        if (cancel) {
+    void LibraryUtils::removeOrphanedMediaArt(const QSqlDatabase& db, const std::atomic_bool& cancel)
+    {
+        bool ok = false;
+        const std::unordered_set<QString> usedMediaArt(queryUsedMediaArt(db, ok));
+        if (!ok) {
             return;
         }
 
+        std::vector<QString> orphanedMediaArt;
         const QFileInfoList files(QDir(MediaArtUtils::mediaArtDirectory()).entryInfoList(QDir::Files));
         for (const QFileInfo& info : files) {
             if (cancel) {
                 return;
             }
-            const QString filePath(info.filePath());
-            if (!contains(allEmbeddedMediaArt, filePath) && !contains(allUserMediaArt, filePath)) {
-                if (!QFile::remove(filePath)) {
-                    qWarning() << "Failed to remove file:" << info.filePath();
-                }
+            QString filePath(info.filePath());
+            if (!contains(usedMediaArt, filePath)) {
+                orphanedMediaArt.push_back(std::move(filePath));
             }
         }
+
+        if (!orphanedMediaArt.empty()) {
+            qInfo("Removing %zu orphaned media art files", orphanedMediaArt.size());
+            removeMediaArtFiles(orphanedMediaArt);
+        }
+
+        if (!cancel) {
+            MediaArtUtils::removeThumbnailsExcept(usedMediaArt);
+        }
+    }
+
+    bool LibraryUtils::setMediaArtCheckPending(const QSqlDatabase& db, bool pending)
+    {
+        QSqlQuery query(db);
+        if (!query.exec(pending ? QLatin1String("INSERT OR IGNORE INTO pending_media_art_check VALUES (1)")
+                                : QLatin1String("DELETE FROM pending_media_art_check"))) {
+            qWarning() << "Failed to change pending media art check" << query.lastError();
+            return false;
+        }
+        return true;
+    }
+
+    bool LibraryUtils::isMediaArtCheckPending(const QSqlDatabase& db)
+    {
+        QSqlQuery query(db);
+        if (!query.exec(QLatin1String("SELECT 1 FROM pending_media_art_check"))) {
+            qWarning() << "Failed to get pending media art check" << query.lastError();
+            return false;
+        }
+        return query.next();
+    }
+
+    bool LibraryUtils::updateMediaArtCandidates(const QSqlDatabase& db, const QString& artistIds, const QString& albumIds, const QString& genreIds)
+    {
+        QSqlQuery query(db);
+
+        const auto exec = [&](const QString& queryString) {
+            if (!query.exec(queryString)) {
+                qWarning() << "Failed to update media art candidates" << query.lastError();
+                return false;
+            }
+            return true;
+        };
+
+        const QLatin1String hasMediaArt("(directoryMediaArt IS NOT NULL OR embeddedMediaArt IS NOT NULL OR albums.userMediaArt IS NOT NULL)");
+
+        // User media art is not copied, it is taken from albums table by albumId
+        return exec(QString::fromLatin1("DELETE FROM media_art_candidates WHERE category = %1 AND categoryId IN (%2)")
+                    .arg(ArtistMediaArtCandidate).arg(artistIds)) &&
+               exec(QString::fromLatin1("INSERT INTO media_art_candidates "
+                                        "SELECT DISTINCT %1, tracks_artists.artistId, directoryMediaArt, embeddedMediaArt, tracks_albums.albumId "
+                                        "FROM tracks_artists "
+                                        "JOIN tracks ON tracks.id = tracks_artists.trackId "
+                                        "LEFT JOIN tracks_albums ON tracks_albums.trackId = tracks.id "
+                                        "LEFT JOIN albums ON albums.id = tracks_albums.albumId "
+                                        "WHERE tracks_artists.artistId IN (%2) AND %3")
+                    .arg(ArtistMediaArtCandidate).arg(artistIds, hasMediaArt)) &&
+               exec(QString::fromLatin1("INSERT INTO media_art_candidates "
+                                        "SELECT DISTINCT %1, 0, directoryMediaArt, embeddedMediaArt, tracks_albums.albumId "
+                                        "FROM tracks "
+                                        "LEFT JOIN tracks_albums ON tracks_albums.trackId = tracks.id "
+                                        "LEFT JOIN albums ON albums.id = tracks_albums.albumId "
+                                        "WHERE 0 IN (%2) "
+                                        "AND NOT EXISTS (SELECT 1 FROM tracks_artists WHERE tracks_artists.trackId = tracks.id) "
+                                        "AND %3")
+                    .arg(ArtistMediaArtCandidate).arg(artistIds, hasMediaArt)) &&
+
+               exec(QString::fromLatin1("DELETE FROM media_art_candidates WHERE category = %1 AND categoryId IN (%2)")
+                    .arg(AlbumMediaArtCandidate).arg(albumIds)) &&
+               exec(QString::fromLatin1("INSERT INTO media_art_candidates "
+                                        "SELECT DISTINCT %1, tracks_albums.albumId, directoryMediaArt, embeddedMediaArt, tracks_albums.albumId "
+                                        "FROM tracks_albums "
+                                        "JOIN tracks ON tracks.id = tracks_albums.trackId "
+                                        "JOIN albums ON albums.id = tracks_albums.albumId "
+                                        "WHERE tracks_albums.albumId IN (%2) AND %3")
+                    .arg(AlbumMediaArtCandidate).arg(albumIds, hasMediaArt)) &&
+               exec(QString::fromLatin1("INSERT INTO media_art_candidates "
+                                        "SELECT DISTINCT %1, 0, directoryMediaArt, embeddedMediaArt, NULL "
+                                        "FROM tracks "
+                                        "WHERE 0 IN (%2) "
+                                        "AND NOT EXISTS (SELECT 1 FROM tracks_albums WHERE tracks_albums.trackId = tracks.id) "
+                                        "AND (directoryMediaArt IS NOT NULL OR embeddedMediaArt IS NOT NULL)")
+                    .arg(AlbumMediaArtCandidate).arg(albumIds)) &&
+
+               exec(QString::fromLatin1("DELETE FROM media_art_candidates WHERE category = %1 AND categoryId IN (%2)")
+                    .arg(GenreMediaArtCandidate).arg(genreIds)) &&
+               exec(QString::fromLatin1("INSERT INTO media_art_candidates "
+                                        "SELECT DISTINCT %1, tracks_genres.genreId, directoryMediaArt, embeddedMediaArt, tracks_albums.albumId "
+                                        "FROM tracks_genres "
+                                        "JOIN tracks ON tracks.id = tracks_genres.trackId "
+                                        "LEFT JOIN tracks_albums ON tracks_albums.trackId = tracks.id "
+                                        "LEFT JOIN albums ON albums.id = tracks_albums.albumId "
+                                        "WHERE tracks_genres.genreId IN (%2) AND %3")
+                    .arg(GenreMediaArtCandidate).arg(genreIds, hasMediaArt));
     }
 
     bool LibraryUtils::createTables(QSqlDatabase& db)
@@ -417,169 +841,654 @@ namespace unplayer
             return false;
         }
 
-        return true;
-    }
+        // Categories and media art files that lost their references,
+        // processChanges() and takeUnusedMediaArt() check only them
 
-    bool LibraryUtils::createIndexes(QSqlDatabase& db)
-    {
-        QSqlQuery query(db);
+        if (!query.exec(QLatin1String("CREATE TABLE changed_artists (id INTEGER PRIMARY KEY)"))) {
+            qWarning() << "Failed to create 'changed_artists' table" << query.lastError();
+            return false;
+        }
 
-        if (!query.exec(QLatin1String("CREATE INDEX tracks_artists_trackIndex ON tracks_artists(trackId)"))) {
-            qWarning() << "Failed to create 'tracks_artists_trackIndex' index" << query.lastError();
+        if (!query.exec(QLatin1String("CREATE TABLE changed_albums (id INTEGER PRIMARY KEY)"))) {
+            qWarning() << "Failed to create 'changed_albums' table" << query.lastError();
             return false;
         }
 
-        if (!query.exec(QLatin1String("CREATE INDEX tracks_albums_trackIndex ON tracks_albums(trackId)"))) {
-            qWarning() << "Failed to create 'tracks_albums_trackIndex' index" << query.lastError();
+        if (!query.exec(QLatin1String("CREATE TABLE changed_genres (id INTEGER PRIMARY KEY)"))) {
+            qWarning() << "Failed to create 'changed_genres' table" << query.lastError();
             return false;
         }
 
-        if (!query.exec(QLatin1String("CREATE INDEX albums_artists_albumIndex ON albums_artists(albumId)"))) {
-            qWarning() << "Failed to create 'albums_artists_albumIndex' index" << query.lastError();
+        if (!query.exec(QLatin1String("CREATE TABLE changed_media_art (filePath TEXT PRIMARY KEY)"))) {
+            qWarning() << "Failed to create 'changed_media_art' table" << query.lastError();
             return false;
         }
 
-        if (!query.exec(QLatin1String("CREATE INDEX tracks_genres_trackIndex ON tracks_genres(trackId)"))) {
-            qWarning() << "Failed to create 'tracks_genres_trackIndex' index" << query.lastError();
+        if (!query.exec(QLatin1String("CREATE TABLE changed_album_artists (id INTEGER PRIMARY KEY)"))) {
+            qWarning() << "Failed to create 'changed_album_artists' table" << query.lastError();
             return false;
         }
 
-        return true;
-    }
+        if (!query.exec(QLatin1String("CREATE TRIGGER tracks_artists_deleted AFTER DELETE ON tracks_artists "
+                                      "BEGIN INSERT OR IGNORE INTO changed_artists VALUES (OLD.artistId); END"))) {
+            qWarning() << "Failed to create 'tracks_artists_deleted' trigger" << query.lastError();
+            return false;
+        }
 
-    bool LibraryUtils::dropIndexes(QSqlDatabase& db)
-    {
-        QSqlQuery query(db);
+        if (!query.exec(QLatin1String("CREATE TRIGGER albums_artists_deleted AFTER DELETE ON albums_artists "
+                                      "BEGIN INSERT OR IGNORE INTO changed_artists VALUES (OLD.artistId); END"))) {
+            qWarning() << "Failed to create 'albums_artists_deleted' trigger" << query.lastError();
+            return false;
+        }
 
-        if (!query.exec(QLatin1String("DROP INDEX tracks_artists_trackIndex"))) {
-            qWarning() << "Failed to drop 'tracks_artists_trackIndex' index" << query.lastError();
+        if (!query.exec(QLatin1String("CREATE TRIGGER tracks_albums_deleted AFTER DELETE ON tracks_albums "
+                                      "BEGIN INSERT OR IGNORE INTO changed_albums VALUES (OLD.albumId); END"))) {
+            qWarning() << "Failed to create 'tracks_albums_deleted' trigger" << query.lastError();
             return false;
         }
 
-        if (!query.exec(QLatin1String("DROP INDEX tracks_albums_trackIndex"))) {
-            qWarning() << "Failed to drop 'tracks_albums_trackIndex' index" << query.lastError();
+        if (!query.exec(QLatin1String("CREATE TRIGGER tracks_genres_deleted AFTER DELETE ON tracks_genres "
+                                      "BEGIN INSERT OR IGNORE INTO changed_genres VALUES (OLD.genreId); END"))) {
+            qWarning() << "Failed to create 'tracks_genres_deleted' trigger" << query.lastError();
             return false;
         }
 
-        if (!query.exec(QLatin1String("DROP INDEX albums_artists_albumIndex"))) {
-            qWarning() << "Failed to drop 'albums_artists_albumIndex' index" << query.lastError();
+        if (!query.exec(QLatin1String("CREATE TRIGGER tracks_artists_inserted AFTER INSERT ON tracks_artists "
+                                      "BEGIN INSERT OR IGNORE INTO changed_artists VALUES (NEW.artistId); END"))) {
+            qWarning() << "Failed to create 'tracks_artists_inserted' trigger" << query.lastError();
             return false;
         }
 
-        if (!query.exec(QLatin1String("DROP INDEX tracks_genres_trackIndex"))) {
-            qWarning() << "Failed to drop 'tracks_genres_trackIndex' index" << query.lastError();
+        if (!query.exec(QLatin1String("CREATE TRIGGER tracks_albums_inserted AFTER INSERT ON tracks_albums "
+                                      "BEGIN INSERT OR IGNORE INTO changed_albums VALUES (NEW.albumId); END"))) {
+            qWarning() << "Failed to create 'tracks_albums_inserted' trigger" << query.lastError();
             return false;
         }
 
-        return true;
-    }
+        if (!query.exec(QLatin1String("CREATE TRIGGER tracks_genres_inserted AFTER INSERT ON tracks_genres "
+                                      "BEGIN INSERT OR IGNORE INTO changed_genres VALUES (NEW.genreId); END"))) {
+            qWarning() << "Failed to create 'tracks_genres_inserted' trigger" << query.lastError();
+            return false;
+        }
 
-    void LibraryUtils::initDatabase()
-    {
-        qDebug() << "Initializing database";
+        // Id 0 means tracks without artists or albums. LibraryTracksAdder marks it when adding such tracks
+        if (!query.exec(QLatin1String("CREATE TRIGGER tracks_without_artists_deleted BEFORE DELETE ON tracks "
+                                      "WHEN NOT EXISTS (SELECT 1 FROM tracks_artists WHERE trackId = OLD.id) "
+                                      "BEGIN INSERT OR IGNORE INTO changed_artists VALUES (0); END"))) {
+            qWarning() << "Failed to create 'tracks_without_artists_deleted' trigger" << query.lastError();
+            return false;
+        }
 
-        const QString dataDir(QStandardPaths::writableLocation(QStandardPaths::DataLocation));
-        if (!QDir().mkpath(dataDir)) {
-            qWarning() << "failed to create data directory";
-            return;
+        if (!query.exec(QLatin1String("CREATE TRIGGER tracks_without_albums_deleted BEFORE DELETE ON tracks "
+                                      "WHEN NOT EXISTS (SELECT 1 FROM tracks_albums WHERE trackId = OLD.id) "
+                                      "BEGIN INSERT OR IGNORE INTO changed_albums VALUES (0); END"))) {
+            qWarning() << "Failed to create 'tracks_without_albums_deleted' trigger" << query.lastError();
+            return false;
         }
 
-        QSqlDatabase db(openDatabase());
-        if (!db.isOpen()) {
-            return;
+        if (!query.exec(QLatin1String("CREATE TRIGGER tracks_deleted AFTER DELETE ON tracks "
+                                      "WHEN OLD.embeddedMediaArt IS NOT NULL "
+                                      "BEGIN INSERT OR IGNORE INTO changed_media_art VALUES (OLD.embeddedMediaArt); END"))) {
+            qWarning() << "Failed to create 'tracks_deleted' trigger" << query.lastError();
+            return false;
         }
 
-        QSqlQuery query(db);
+        if (!query.exec(QLatin1String("CREATE TRIGGER tracks_embeddedMediaArt_updated AFTER UPDATE OF embeddedMediaArt ON tracks "
+                                      "WHEN OLD.embeddedMediaArt IS NOT NULL AND OLD.embeddedMediaArt IS NOT NEW.embeddedMediaArt "
+                                      "BEGIN INSERT OR IGNORE INTO changed_media_art VALUES (OLD.embeddedMediaArt); END"))) {
+            qWarning() << "Failed to create 'tracks_embeddedMediaArt_updated' trigger" << query.lastError();
+            return false;
+        }
 
-        if (db.tables().isEmpty()) {
-            qInfo("Creating tables");
+        if (!query.exec(QLatin1String("CREATE TRIGGER albums_deleted AFTER DELETE ON albums "
+                                      "WHEN OLD.userMediaArt IS NOT NULL "
+                                      "BEGIN INSERT OR IGNORE INTO changed_media_art VALUES (OLD.userMediaArt); END"))) {
+            qWarning() << "Failed to create 'albums_deleted' trigger" << query.lastError();
+            return false;
+        }
 
-            if (!createTables(db)) {
-                qWarning("Failed to create tables");
-                return;
-            }
+        if (!query.exec(QLatin1String("CREATE TRIGGER albums_userMediaArt_updated AFTER UPDATE OF userMediaArt ON albums "
+                                      "WHEN OLD.userMediaArt IS NOT NULL AND OLD.userMediaArt IS NOT NEW.userMediaArt "
+                                      "BEGIN INSERT OR IGNORE INTO changed_media_art VALUES (OLD.userMediaArt); END"))) {
+            qWarning() << "Failed to create 'albums_userMediaArt_updated' trigger" << query.lastError();
+            return false;
+        }
 
-            if (!createIndexes(db)) {
-                qWarning("Failed to create indexes");
-                return;
-            }
+        // Added and changed tracks and categories, reported by processChanges() as LibraryChanges
 
-            if (!query.exec(QString::fromLatin1("PRAGMA user_version = %1").arg(databaseVersion))) {
-                qWarning() << "Failed to set user_version" << query.lastError();
-                return;
-            }
+        if (!query.exec(QLatin1String("CREATE TABLE changed_tracks (id INTEGER PRIMARY KEY)"))) {
+            qWarning() << "Failed to create 'changed_tracks' table" << query.lastError();
+            return false;
+        }
 
-            mCreatedTables = true;
-        } else {
-            LibraryMigrator migrator(db);
-            if (!migrator.migrateIfNeeded(databaseVersion)) {
-                return;
-            }
+        if (!query.exec(QLatin1String("CREATE TABLE added_tracks (id INTEGER PRIMARY KEY)"))) {
+            qWarning() << "Failed to create 'added_tracks' table" << query.lastError();
+            return false;
         }
 
-        qInfo() << "Database initialized, file path:" << databasePath();
+        if (!query.exec(QLatin1String("CREATE TABLE added_artists (id INTEGER PRIMARY KEY)"))) {
+            qWarning() << "Failed to create 'added_artists' table" << query.lastError();
+            return false;
+        }
 
-        mDatabaseInitialized = true;
-    }
+        if (!query.exec(QLatin1String("CREATE TABLE added_albums (id INTEGER PRIMARY KEY)"))) {
+            qWarning() << "Failed to create 'added_albums' table" << query.lastError();
+            return false;
+        }
 
-    bool LibraryUtils::updateDatabase()
-    {
-        if (mLibraryUpdateRunnable || !mDatabaseInitialized) {
+        if (!query.exec(QLatin1String("CREATE TABLE added_genres (id INTEGER PRIMARY KEY)"))) {
+            qWarning() << "Failed to create 'added_genres' table" << query.lastError();
             return false;
         }
 
-        auto runnable = new LibraryUpdateRunnable();
-        QObject::connect(runnable, &LibraryUpdateRunnable::stageChanged, this, [this](UpdateStage newStage) {
-            mLibraryUpdateStage = newStage;
-            emit updateStageChanged();
-        });
-        QObject::connect(runnable, &LibraryUpdateRunnable::foundFilesChanged, this, [this](int found) {
-            mFoundTracks = found;
-            emit foundTracksChanged();
-        });
-        QObject::connect(runnable, &LibraryUpdateRunnable::extractedFilesChanged, this, [this](int extracted) {
-            mExtractedTracks = extracted;
-            emit extractedTracksChanged();
-        });
-        QObject::connect(runnable, &LibraryUpdateRunnable::finished, this, [this]() {
-            mLibraryUpdateRunnable = nullptr;
-            mLibraryUpdateStage = NoneStage;
-            mFoundTracks = 0;
-            mExtractedTracks = 0;
-            emit updatingChanged();
-            emit updateStageChanged();
-            emit foundTracksChanged();
-            emit extractedTracksChanged();
-            emit databaseChanged();
-        });
-        QObject::connect(qApp, &QCoreApplication::aboutToQuit, this, [this] {
-            if (mLibraryUpdateRunnable) {
-                static_cast<LibraryUpdateRunnable*>(mLibraryUpdateRunnable)->cancel();
-            }
-        });
-        mLibraryUpdateRunnable = runnable;
-        mLibraryUpdateStage = PreparingStage;
-        QThreadPool::globalInstance()->start(runnable);
-        emit updatingChanged();
-        emit updateStageChanged();
+        if (!query.exec(QLatin1String("CREATE TRIGGER tracks_inserted AFTER INSERT ON tracks "
+                                      "BEGIN INSERT OR IGNORE INTO added_tracks VALUES (NEW.id); END"))) {
+            qWarning() << "Failed to create 'tracks_inserted' trigger" << query.lastError();
+            return false;
+        }
 
-        return true;
-    }
+        if (!query.exec(QLatin1String("CREATE TRIGGER tracks_updated AFTER UPDATE ON tracks "
+                                      "BEGIN INSERT OR IGNORE INTO changed_tracks VALUES (NEW.id); END"))) {
+            qWarning() << "Failed to create 'tracks_updated' trigger" << query.lastError();
+            return false;
+        }
 
-    void LibraryUtils::cancelDatabaseUpdate()
-    {
-        if (mLibraryUpdateRunnable) {
-            static_cast<LibraryUpdateRunnable*>(mLibraryUpdateRunnable)->cancel();
+        if (!query.exec(QLatin1String("CREATE TRIGGER tracks_removed AFTER DELETE ON tracks "
+                                      "BEGIN INSERT OR IGNORE INTO changed_tracks VALUES (OLD.id); END"))) {
+            qWarning() << "Failed to create 'tracks_removed' trigger" << query.lastError();
+            return false;
         }
-    }
 
-    void LibraryUtils::resetDatabase()
-    {
-        qInfo("Resetting database");
+        if (!query.exec(QLatin1String("CREATE TRIGGER artists_inserted AFTER INSERT ON artists "
+                                      "BEGIN INSERT OR IGNORE INTO added_artists VALUES (NEW.id); END"))) {
+            qWarning() << "Failed to create 'artists_inserted' trigger" << query.lastError();
+            return false;
+        }
 
-        MediaArtUtils::deleteInstance();
+        if (!query.exec(QLatin1String("CREATE TRIGGER albums_inserted AFTER INSERT ON albums "
+                                      "BEGIN INSERT OR IGNORE INTO added_albums VALUES (NEW.id); END"))) {
+            qWarning() << "Failed to create 'albums_inserted' trigger" << query.lastError();
+            return false;
+        }
 
-        const QStringList connections(QSqlDatabase::connectionNames());
+        if (!query.exec(QLatin1String("CREATE TRIGGER genres_inserted AFTER INSERT ON genres "
+                                      "BEGIN INSERT OR IGNORE INTO added_genres VALUES (NEW.id); END"))) {
+            qWarning() << "Failed to create 'genres_inserted' trigger" << query.lastError();
+            return false;
+        }
+
+        // Locale of LOCALE collation that was used to build indexes, single row
+
+        if (!query.exec(QLatin1String("CREATE TABLE collation_locale (name TEXT NOT NULL)"))) {
+            qWarning() << "Failed to create 'collation_locale' table" << query.lastError();
+            return false;
+        }
+
+        // Single row is present while media art files may exist without tracks that reference them
+
+        if (!query.exec(QLatin1String("CREATE TABLE pending_media_art_check (id INTEGER PRIMARY KEY)"))) {
+            qWarning() << "Failed to create 'pending_media_art_check' table" << query.lastError();
+            return false;
+        }
+
+        // Statistics of categories, maintained by processChanges()
+
+        if (!query.exec(QLatin1String("CREATE TABLE artists_stats ("
+                                        "artistId INTEGER PRIMARY KEY,"
+                                        "albumsCount INTEGER NOT NULL,"
+                                        "tracksCount INTEGER NOT NULL,"
+                                        "duration INTEGER NOT NULL"
+                                      ")"))) {
+            qWarning() << "Failed to create 'artists_stats' table" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("CREATE TABLE album_artists_stats ("
+                                        "artistId INTEGER PRIMARY KEY,"
+                                        "albumsCount INTEGER NOT NULL,"
+                                        "tracksCount INTEGER NOT NULL,"
+                                        "duration INTEGER NOT NULL"
+                                      ")"))) {
+            qWarning() << "Failed to create 'album_artists_stats' table" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("CREATE TABLE albums_stats ("
+                                        "albumId INTEGER PRIMARY KEY,"
+                                        "artist TEXT COLLATE NOCASE,"
+                                        "year INTEGER,"
+                                        "tracksCount INTEGER NOT NULL,"
+                                        "duration INTEGER NOT NULL"
+                                      ")"))) {
+            qWarning() << "Failed to create 'albums_stats' table" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("CREATE TABLE genres_stats ("
+                                        "genreId INTEGER PRIMARY KEY,"
+                                        "tracksCount INTEGER NOT NULL,"
+                                        "duration INTEGER NOT NULL"
+                                      ")"))) {
+            qWarning() << "Failed to create 'genres_stats' table" << query.lastError();
+            return false;
+        }
+
+        // Distinct media art of each category, maintained by processChanges()
+
+        if (!query.exec(QLatin1String("CREATE TABLE media_art_candidates ("
+                                        "category INTEGER NOT NULL,"
+                                        "categoryId INTEGER NOT NULL,"
+                                        "directoryMediaArt TEXT,"
+                                        "embeddedMediaArt TEXT,"
+                                        "albumId INTEGER"
+                                      ")"))) {
+            qWarning() << "Failed to create 'media_art_candidates' table" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("CREATE INDEX media_art_candidates_categoryIndex ON media_art_candidates(category, categoryId)"))) {
+            qWarning() << "Failed to create 'media_art_candidates_categoryIndex' index" << query.lastError();
+            return false;
+        }
+
+        return createSearchTables(db);
+    }
+
+    bool LibraryUtils::createSearchTables(QSqlDatabase& db)
+    {
+        if (!isFts5Available(db)) {
+            qInfo("SQLite is built without FTS5, library search is disabled");
+            return true;
+        }
+
+        QSqlQuery query(db);
+
+        // External content tables, only index is stored. Rows are indexed by triggers,
+        // so tracks added by LibraryTracksAdder and removed by any path are always in sync
+        for (const QLatin1String& table : {QLatin1String("tracks"),
+                                           QLatin1String("artists"),
+                                           QLatin1String("albums"),
+                                           QLatin1String("genres")}) {
+            const QString searchTable(table % QLatin1String("_search"));
+
+            if (!query.exec(QLatin1String("CREATE VIRTUAL TABLE ") % searchTable %
+                            QLatin1String(" USING fts5(title, content = '") % table %
+                            QLatin1String("', content_rowid = 'id', tokenize = 'unicode61', prefix = '1 2 3')"))) {
+                qWarning() << "Failed to create" << searchTable << "table" << query.lastError();
+                return false;
+            }
+
+            if (!query.exec(QLatin1String("CREATE TRIGGER ") % searchTable % QLatin1String("_inserted AFTER INSERT ON ") % table %
+                            QLatin1String(" BEGIN INSERT INTO ") % searchTable % QLatin1String("(rowid, title) VALUES (NEW.id, NEW.title); END"))) {
+                qWarning() << "Failed to create" << searchTable << "insert trigger" << query.lastError();
+                return false;
+            }
+
+            if (!query.exec(QLatin1String("CREATE TRIGGER ") % searchTable % QLatin1String("_deleted AFTER DELETE ON ") % table %
+                            QLatin1String(" BEGIN INSERT INTO ") % searchTable % QLatin1String("(") % searchTable %
+                            QLatin1String(", rowid, title) VALUES ('delete', OLD.id, OLD.title); END"))) {
+                qWarning() << "Failed to create" << searchTable << "delete trigger" << query.lastError();
+                return false;
+            }
+
+            if (!query.exec(QLatin1String("CREATE TRIGGER ") % searchTable % QLatin1String("_updated AFTER UPDATE OF title ON ") % table %
+                            QLatin1String(" BEGIN INSERT INTO ") % searchTable % QLatin1String("(") % searchTable %
+                            QLatin1String(", rowid, title) VALUES ('delete', OLD.id, OLD.title); "
+                                          "INSERT INTO ") % searchTable % QLatin1String("(rowid, title) VALUES (NEW.id, NEW.title); END"))) {
+                qWarning() << "Failed to create" << searchTable << "update trigger" << query.lastError();
+                return false;
+            }
+
+            if (!query.exec(QLatin1String("INSERT INTO ") % searchTable % QLatin1String("(") % searchTable % QLatin1String(") VALUES ('rebuild')"))) {
+                qWarning() << "Failed to build" << searchTable << "index" << query.lastError();
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool LibraryUtils::createIndexes(QSqlDatabase& db)
+    {
+        QSqlQuery query(db);
+
+        if (!query.exec(QLatin1String("CREATE INDEX IF NOT EXISTS tracks_artists_trackIndex ON tracks_artists(trackId)"))) {
+            qWarning() << "Failed to create 'tracks_artists_trackIndex' index" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("CREATE INDEX IF NOT EXISTS tracks_albums_trackIndex ON tracks_albums(trackId)"))) {
+            qWarning() << "Failed to create 'tracks_albums_trackIndex' index" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("CREATE INDEX IF NOT EXISTS albums_artists_albumIndex ON albums_artists(albumId)"))) {
+            qWarning() << "Failed to create 'albums_artists_albumIndex' index" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("CREATE INDEX IF NOT EXISTS tracks_genres_trackIndex ON tracks_genres(trackId)"))) {
+            qWarning() << "Failed to create 'tracks_genres_trackIndex' index" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("CREATE INDEX IF NOT EXISTS artists_titleIndex ON artists(title COLLATE BINARY)"))) {
+            qWarning() << "Failed to create 'artists_titleIndex' index" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("CREATE INDEX IF NOT EXISTS albums_titleIndex ON albums(title COLLATE BINARY)"))) {
+            qWarning() << "Failed to create 'albums_titleIndex' index" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("CREATE INDEX IF NOT EXISTS genres_titleIndex ON genres(title COLLATE BINARY)"))) {
+            qWarning() << "Failed to create 'genres_titleIndex' index" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("CREATE INDEX IF NOT EXISTS tracks_artists_artistIndex ON tracks_artists(artistId)"))) {
+            qWarning() << "Failed to create 'tracks_artists_artistIndex' index" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("CREATE INDEX IF NOT EXISTS tracks_albums_albumIndex ON tracks_albums(albumId)"))) {
+            qWarning() << "Failed to create 'tracks_albums_albumIndex' index" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("CREATE INDEX IF NOT EXISTS albums_artists_artistIndex ON albums_artists(artistId)"))) {
+            qWarning() << "Failed to create 'albums_artists_artistIndex' index" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("CREATE INDEX IF NOT EXISTS tracks_genres_genreIndex ON tracks_genres(genreId)"))) {
+            qWarning() << "Failed to create 'tracks_genres_genreIndex' index" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("CREATE INDEX IF NOT EXISTS tracks_embeddedMediaArtIndex ON tracks(embeddedMediaArt)"))) {
+            qWarning() << "Failed to create 'tracks_embeddedMediaArtIndex' index" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("CREATE INDEX IF NOT EXISTS albums_userMediaArtIndex ON albums(userMediaArt)"))) {
+            qWarning() << "Failed to create 'albums_userMediaArtIndex' index" << query.lastError();
+            return false;
+        }
+
+        return createSortIndexes(db);
+    }
+
+    bool LibraryUtils::createSortIndexes(QSqlDatabase& db)
+    {
+        const QLatin1String collation(sqliteutils::sortCollation());
+        // Index name and indexed column
+        const std::initializer_list<std::pair<QLatin1String, QLatin1String>> indexes{
+            {QLatin1String("tracks_titleIndex"), QLatin1String("tracks(title")},
+            {QLatin1String("artists_localeTitleIndex"), QLatin1String("artists(title")},
+            {QLatin1String("albums_localeTitleIndex"), QLatin1String("albums(title")},
+            {QLatin1String("genres_localeTitleIndex"), QLatin1String("genres(title")},
+            {QLatin1String("albums_stats_artistIndex"), QLatin1String("albums_stats(artist")}
+        };
+        QSqlQuery query(db);
+        for (const auto& index : indexes) {
+            if (!query.exec(QString::fromLatin1("CREATE INDEX IF NOT EXISTS %1 ON %2 COLLATE %3)").arg(index.first, index.second, collation))) {
+                qWarning() << "Failed to create" << index.first << "index" << query.lastError();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool LibraryUtils::dropSortIndexes(QSqlDatabase& db)
+    {
+        QSqlQuery query(db);
+        for (const QLatin1String& index : {QLatin1String("tracks_titleIndex"),
+                                           QLatin1String("artists_localeTitleIndex"),
+                                           QLatin1String("albums_localeTitleIndex"),
+                                           QLatin1String("genres_localeTitleIndex"),
+                                           QLatin1String("albums_stats_artistIndex")}) {
+            // Indexes can be dropped even if their collation is not registered
+            if (!query.exec(QString::fromLatin1("DROP INDEX IF EXISTS %1").arg(index))) {
+                qWarning() << "Failed to drop" << index << "index" << query.lastError();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool LibraryUtils::dropIndexes(QSqlDatabase& db)
+    {
+        QSqlQuery query(db);
+
+        if (!query.exec(QLatin1String("DROP INDEX IF EXISTS tracks_artists_trackIndex"))) {
+            qWarning() << "Failed to drop 'tracks_artists_trackIndex' index" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("DROP INDEX IF EXISTS tracks_albums_trackIndex"))) {
+            qWarning() << "Failed to drop 'tracks_albums_trackIndex' index" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("DROP INDEX IF EXISTS albums_artists_albumIndex"))) {
+            qWarning() << "Failed to drop 'albums_artists_albumIndex' index" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("DROP INDEX IF EXISTS tracks_genres_trackIndex"))) {
+            qWarning() << "Failed to drop 'tracks_genres_trackIndex' index" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("DROP INDEX IF EXISTS artists_titleIndex"))) {
+            qWarning() << "Failed to drop 'artists_titleIndex' index" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("DROP INDEX IF EXISTS albums_titleIndex"))) {
+            qWarning() << "Failed to drop 'albums_titleIndex' index" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("DROP INDEX IF EXISTS genres_titleIndex"))) {
+            qWarning() << "Failed to drop 'genres_titleIndex' index" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("DROP INDEX IF EXISTS tracks_artists_artistIndex"))) {
+            qWarning() << "Failed to drop 'tracks_artists_artistIndex' index" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("DROP INDEX IF EXISTS tracks_albums_albumIndex"))) {
+            qWarning() << "Failed to drop 'tracks_albums_albumIndex' index" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("DROP INDEX IF EXISTS albums_artists_artistIndex"))) {
+            qWarning() << "Failed to drop 'albums_artists_artistIndex' index" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("DROP INDEX IF EXISTS tracks_genres_genreIndex"))) {
+            qWarning() << "Failed to drop 'tracks_genres_genreIndex' index" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("DROP INDEX IF EXISTS tracks_embeddedMediaArtIndex"))) {
+            qWarning() << "Failed to drop 'tracks_embeddedMediaArtIndex' index" << query.lastError();
+            return false;
+        }
+
+        if (!query.exec(QLatin1String("DROP INDEX IF EXISTS albums_userMediaArtIndex"))) {
+            qWarning() << "Failed to drop 'albums_userMediaArtIndex' index" << query.lastError();
+            return false;
+        }
+
+        return dropSortIndexes(db);
+    }
+
+    void LibraryUtils::initDatabase()
+    {
+        qDebug() << "Initializing database";
+
+        const QString dataDir(QStandardPaths::writableLocation(QStandardPaths::DataLocation));
+        if (!QDir().mkpath(dataDir)) {
+            qWarning() << "failed to create data directory";
+            return;
+        }
+
+        QSqlDatabase db(openDatabase());
+        if (!db.isOpen()) {
+            return;
+        }
+
+        QSqlQuery query(db);
+
+        if (db.tables().isEmpty()) {
+            qInfo("Creating tables");
+
+            if (!createTables(db)) {
+                qWarning("Failed to create tables");
+                return;
+            }
+
+            if (!createIndexes(db)) {
+                qWarning("Failed to create indexes");
+                return;
+            }
+
+            if (!query.exec(QString::fromLatin1("PRAGMA user_version = %1").arg(databaseVersion))) {
+                qWarning() << "Failed to set user_version" << query.lastError();
+                return;
+            }
+
+            mCreatedTables = true;
+        } else {
+            LibraryMigrator migrator(db);
+            if (!migrator.migrateIfNeeded(databaseVersion)) {
+                return;
+            }
+        }
+
+        updateCollationLocale(db);
+
+        mSearchAvailable = hasSearchTables(db);
+        if (!mSearchAvailable && isFts5Available(db)) {
+            // Database was created when FTS5 was not available
+            TransactionGuard transactionGuard(db);
+            if (createSearchTables(db) && transactionGuard.commit()) {
+                mSearchAvailable = true;
+            } else {
+                qWarning("Failed to create search tables");
+                transactionGuard.rollback();
+            }
+        }
+
+        // Apply changes left by migration or by interrupted update
+        {
+            TransactionGuard transactionGuard(db);
+            processChanges(db);
+            takeUnusedMediaArt(db);
+            if (!transactionGuard.commit()) {
+                qWarning() << "Failed to commit transaction:" << db.lastError();
+                transactionGuard.rollback();
+            }
+        }
+
+        const bool mediaArtCheckPending = isMediaArtCheckPending(db);
+
+        qInfo() << "Database initialized, file path:" << databasePath();
+
+        mDatabaseInitialized = true;
+
+        if (mediaArtCheckPending) {
+            // Queued as write job, so that it doesn't remove files extracted by running update
+            WriteJob job{};
+            job.type = WriteJob::RemoveOrphanedMediaArt;
+            enqueueWriteJob(std::move(job));
+        }
+    }
+
+    bool LibraryUtils::updateDatabase()
+    {
+        if (mLibraryUpdateRunnable || !mDatabaseInitialized) {
+            return false;
+        }
+
+        for (const WriteJob& job : mWriteJobs) {
+            if (job.type == WriteJob::Update) {
+                return false;
+            }
+        }
+
+        WriteJob job{};
+        job.type = WriteJob::Update;
+        return enqueueWriteJob(std::move(job)) != 0;
+    }
+
+    void LibraryUtils::startUpdate()
+    {
+        auto runnable = new LibraryUpdateRunnable();
+        QObject::connect(runnable, &LibraryUpdateRunnable::stageChanged, this, [this](UpdateStage newStage) {
+            mLibraryUpdateStage = newStage;
+            emit updateStageChanged();
+        });
+        QObject::connect(runnable, &LibraryUpdateRunnable::foundFilesChanged, this, [this](int found) {
+            mFoundTracks = found;
+            emit foundTracksChanged();
+        });
+        QObject::connect(runnable, &LibraryUpdateRunnable::extractedFilesChanged, this, [this](int extracted) {
+            mExtractedTracks = extracted;
+            emit extractedTracksChanged();
+        });
+        QObject::connect(runnable, &LibraryUpdateRunnable::finished, this, [this](const LibraryChanges& changes) {
+            mLibraryUpdateRunnable = nullptr;
+            mLibraryUpdateStage = NoneStage;
+            mFoundTracks = 0;
+            mExtractedTracks = 0;
+            emit updatingChanged();
+            emit updateStageChanged();
+            emit foundTracksChanged();
+            emit extractedTracksChanged();
+            emit databaseChanged();
+            emit libraryChanged(changes);
+            finishWriteJobs();
+            updateThumbnails();
+        });
+        QObject::connect(qApp, &QCoreApplication::aboutToQuit, this, [this] {
+            if (mLibraryUpdateRunnable) {
+                static_cast<LibraryUpdateRunnable*>(mLibraryUpdateRunnable)->cancel();
+            }
+        });
+        mLibraryUpdateRunnable = runnable;
+        mLibraryUpdateStage = PreparingStage;
+        ThreadPool::background()->start(runnable);
+        emit updatingChanged();
+        emit updateStageChanged();
+    }
+
+    void LibraryUtils::cancelDatabaseUpdate()
+    {
+        if (mLibraryUpdateRunnable) {
+            static_cast<LibraryUpdateRunnable*>(mLibraryUpdateRunnable)->cancel();
+        }
+    }
+
+    void LibraryUtils::resetDatabase()
+    {
+        if (!mWriteJobs.empty() || mWriteJobRunning) {
+            qWarning("Can't reset database while library is being modified");
+            return;
+        }
+
+        qInfo("Resetting database");
+
+        MediaArtUtils::deleteInstance();
+
+        const QStringList connections(QSqlDatabase::connectionNames());
         if (!connections.isEmpty()) {
             if (connections.size() > 1 || connections.first() != QSqlDatabase::defaultConnection) {
                 qWarning() << "There should be only default connection in resetDatabase(), connections:" << connections;
@@ -597,8 +1506,15 @@ namespace unplayer
         if (!QDir(MediaArtUtils::mediaArtDirectory()).removeRecursively()) {
             qWarning() << "Failed to remove media art directory:" << MediaArtUtils::mediaArtDirectory();
         }
+        if (!QDir(MediaArtUtils::thumbnailsDirectory()).removeRecursively()) {
+            qWarning() << "Failed to remove thumbnails directory:" << MediaArtUtils::thumbnailsDirectory();
+        }
 
         emit databaseChanged();
+
+        LibraryChanges changes;
+        changes.reset = true;
+        emit libraryChanged(changes);
     }
 
     bool LibraryUtils::isDatabaseInitialized() const
@@ -611,70 +1527,34 @@ namespace unplayer
         return mCreatedTables;
     }
 
+    bool LibraryUtils::isSearchAvailable() const
+    {
+        return mSearchAvailable;
+    }
+
+    quint64 LibraryUtils::databaseGeneration() const
+    {
+        return mDatabaseGeneration;
+    }
+
     int LibraryUtils::artistsCount() const
     {
-        if (mDatabaseInitialized) {
-            QLatin1String queryString;
-            if (Settings::instance()->useAlbumArtist()) {
-                queryString = QLatin1String("SELECT COUNT(DISTINCT artistId) FROM albums JOIN albums_artists ON albums_artists.albumId = albums.id");
-            } else {
-                queryString = QLatin1String("SELECT COUNT(*) FROM artists");
-            }
-            QSqlQuery query;
-            if (query.exec(queryString)) {
-                if (query.next()) {
-                    return query.value(0).toInt();
-                }
-            } else {
-                qWarning() << query.lastError();
-            }
-        }
-        return 0;
+        return mStats.artistsCount;
     }
 
     int LibraryUtils::albumsCount() const
     {
-        if (mDatabaseInitialized) {
-            QSqlQuery query;
-            if (query.exec(QLatin1String("SELECT COUNT(*) FROM albums"))) {
-                if (query.next()) {
-                    return query.value(0).toInt();
-                }
-            } else {
-                qWarning() << query.lastError();
-            }
-        }
-        return 0;
+        return mStats.albumsCount;
     }
 
     int LibraryUtils::tracksCount() const
     {
-        if (mDatabaseInitialized) {
-            QSqlQuery query;
-            if (query.exec(QLatin1String("SELECT COUNT(*) FROM tracks"))) {
-                if (query.next()) {
-                    return query.value(0).toInt();
-                }
-            } else {
-                qWarning() << query.lastError();
-            }
-        }
-        return 0;
+        return mStats.tracksCount;
     }
 
     int LibraryUtils::tracksDuration() const
     {
-        if (mDatabaseInitialized) {
-            QSqlQuery query;
-            if (query.exec(QLatin1String("SELECT SUM(duration) FROM tracks"))) {
-                if (query.next()) {
-                    return query.value(0).toInt();
-                }
-            } else {
-                qWarning() << query.lastError();
-            }
-        }
-        return 0;
+        return mStats.tracksDuration;
     }
 
     bool LibraryUtils::isUpdating() const
@@ -702,477 +1582,593 @@ namespace unplayer
         return mRemovingFiles;
     }
 
-    void LibraryUtils::removeArtists(std::vector<int>&& artists, bool deleteFiles)
+    int LibraryUtils::removeArtists(std::vector<int>&& artists, bool deleteFiles)
     {
-        if (mRemovingFiles || !mDatabaseInitialized || artists.empty()) {
-            return;
+        if (artists.empty()) {
+            return 0;
         }
+        WriteJob job{};
+        job.type = WriteJob::RemoveArtists;
+        job.ids = std::move(artists);
+        job.deleteFiles = deleteFiles;
+        return enqueueWriteJob(std::move(job));
+    }
 
-        mRemovingFiles = true;
-        emit removingFilesChanged();
-
-        auto future = QtConcurrent::run([deleteFiles, artists = std::move(artists)] {
-            qInfo("Start removing artists, count=%zu, deleteFiles=%d", artists.size(), deleteFiles);
+    int LibraryUtils::removeAlbums(std::vector<int>&& albums, bool deleteFiles)
+    {
+        if (albums.empty()) {
+            return 0;
+        }
+        WriteJob job{};
+        job.type = WriteJob::RemoveAlbums;
+        job.ids = std::move(albums);
+        job.deleteFiles = deleteFiles;
+        return enqueueWriteJob(std::move(job));
+    }
 
-            QElapsedTimer timer;
-            timer.start();
+    int LibraryUtils::removeGenres(std::vector<int>&& genres, bool deleteFiles)
+    {
+        if (genres.empty()) {
+            return 0;
+        }
+        WriteJob job{};
+        job.type = WriteJob::RemoveGenres;
+        job.ids = std::move(genres);
+        job.deleteFiles = deleteFiles;
+        return enqueueWriteJob(std::move(job));
+    }
 
-            // Open database
-            DatabaseConnectionGuard databaseGuard(removeFilesConnectionName);
-            if (!databaseGuard.db.isOpen()) {
-                return;
+    int LibraryUtils::removeTracks(std::vector<LibraryTrack>&& tracks, bool deleteFiles)
+    {
+        if (tracks.empty()) {
+            return 0;
+        }
+        WriteJob job{};
+        job.type = WriteJob::RemoveTracks;
+        job.ids.reserve(tracks.size());
+        if (deleteFiles) {
+            job.paths.reserve(tracks.size());
+        }
+        for (LibraryTrack& track : tracks) {
+            job.ids.push_back(track.id);
+            if (deleteFiles) {
+                job.paths.push_back(std::move(track.filePath));
             }
+        }
+        job.deleteFiles = deleteFiles;
+        return enqueueWriteJob(std::move(job));
+    }
 
-            const TransactionGuard transactionGuard(databaseGuard.db);
-
-            QSqlQuery query;
-            std::vector<QString> paths;
+    int LibraryUtils::removeTracksByPaths(std::vector<QString>&& paths, bool deleteFiles, bool deleteDirectories)
+    {
+        if (paths.empty()) {
+            return 0;
+        }
+        WriteJob job{};
+        job.type = WriteJob::RemoveTracksByPaths;
+        job.paths = std::move(paths);
+        job.deleteFiles = deleteFiles;
+        job.deleteDirectories = deleteDirectories;
+        return enqueueWriteJob(std::move(job));
+    }
 
-            bool abort = false;
-            batchedCount(artists.size(), maxDbVariableCount, [&](size_t first, size_t count) {
-                if (abort) {
-                    return;
-                }
-                if (!qApp) {
-                    abort = true;
-                    return;
-                }
+    bool LibraryUtils::isSavingTags() const
+    {
+        return mSavingTags;
+    }
 
-                bool addNull = false;
-                QString whereString(QLatin1String("WHERE artistId IN (") % makeInStringFromIds(artists, first, count, addNull));
-                if (addNull) {
-                    whereString += QLatin1String(" OR artistId IS NULL");
-                }
+    int LibraryUtils::saveTags(const QStringList& files, const QVariantMap& tags, bool incrementTrackNumber)
+    {
+        WriteJob job{};
+        job.type = WriteJob::SaveTags;
+        job.files = files;
+        job.tags = tags;
+        job.incrementTrackNumber = incrementTrackNumber;
+        return enqueueWriteJob(std::move(job));
+    }
 
-                if (deleteFiles) {
-                    if (query.exec(QLatin1String("SELECT filePath "
-                                                 "FROM tracks "
-                                                 "LEFT JOIN tracks_artists ON tracks_artists.trackId = id ") % whereString)) {
-                        if (reserveFromQueryAppend(paths, query) > 0) {
-                            while (query.next()) {
-                                paths.push_back(query.value(0).toString());
-                            }
-                        }
-                    } else {
-                        qWarning() << "Failed to get tracks for artists" << query.lastError();
-                        abort = true;
-                        return;
-                    }
-                }
+    int LibraryUtils::setUserMediaArt(int albumId, const QString& mediaArt)
+    {
+        WriteJob job{};
+        job.type = WriteJob::SetUserMediaArt;
+        job.albumId = albumId;
+        job.mediaArt = mediaArt;
+        return enqueueWriteJob(std::move(job));
+    }
 
-                if (!query.exec(QLatin1String("DELETE FROM tracks "
-                                              "WHERE id IN ("
-                                                "SELECT id FROM tracks "
-                                                "LEFT JOIN tracks_artists ON tracks_artists.trackId = id ") %
-                                                whereString %
-                                              QLatin1Char(')'))) {
-                    qWarning() << "Failed to remove tracks from database" << query.lastError();
-                    abort = true;
-                }
-            });
+    int LibraryUtils::writeJobsCount() const
+    {
+        return static_cast<int>(mWriteJobs.size() + mRunningWriteJobs.size());
+    }
 
-            if (!abort) {
-                if (deleteFiles) {
-                    deleteFilesFromFilesystem(paths);
-                }
+    int LibraryUtils::enqueueWriteJob(WriteJob&& job)
+    {
+        if (!mDatabaseInitialized) {
+            return 0;
+        }
 
-                removeUnusedCategories(databaseGuard.db);
-                removeUnusedMediaArt(databaseGuard.db);
+        job.id = ++mLastWriteJobId;
+        const int id = job.id;
+        mWriteJobs.push_back(std::move(job));
+        emit writeJobQueued(id);
+        updateWriteJobsState();
 
-                qInfo("Artists removing time: %lld ms", static_cast<long long>(timer.elapsed()));
-            }
-        });
+        if (!mWriteJobRunning) {
+            startNextWriteJobs();
+        }
 
-        onFutureFinished(future, this, [this] {
-            mRemovingFiles = false;
-            emit removingFilesChanged();
-            emit databaseChanged();
-        });
+        return id;
     }
 
-    void LibraryUtils::removeAlbums(std::vector<int>&& albums, bool deleteFiles)
+    void LibraryUtils::startNextWriteJobs()
     {
-        if (mRemovingFiles || !mDatabaseInitialized || albums.empty()) {
+        if (mWriteJobs.empty()) {
             return;
         }
 
-        mRemovingFiles = true;
-        emit removingFilesChanged();
-
-        auto future = QtConcurrent::run([deleteFiles, albums = std::move(albums)] {
-            qInfo("Start removing albums, count=%zu, deleteFiles=%d", albums.size(), deleteFiles);
+        mWriteJobRunning = true;
 
-            QElapsedTimer timer;
-            timer.start();
+        if (mWriteJobs.front().type == WriteJob::Update) {
+            mRunningWriteJobs.push_back(mWriteJobs.front().id);
+            mRunningJobsType = WriteJob::Update;
+            mWriteJobs.pop_front();
+            emit writeJobStarted(mRunningWriteJobs.back());
+            startUpdate();
+            return;
+        }
 
-            // Open database
-            DatabaseConnectionGuard databaseGuard(removeFilesConnectionName);
-            if (!databaseGuard.db.isOpen()) {
-                return;
+        // Adjacent removals are executed in one transaction
+        std::vector<WriteJob> jobs;
+        jobs.push_back(std::move(mWriteJobs.front()));
+        mWriteJobs.pop_front();
+        if (jobs.front().isRemoval()) {
+            while (!mWriteJobs.empty() && mWriteJobs.front().isRemoval()) {
+                jobs.push_back(std::move(mWriteJobs.front()));
+                mWriteJobs.pop_front();
             }
+        }
 
-            const TransactionGuard transactionGuard(databaseGuard.db);
-
-            QSqlQuery query;
-            std::vector<QString> paths;
-
-            bool abort = false;
-            batchedCount(albums.size(), maxDbVariableCount, [&](size_t first, size_t count) {
-                if (abort) {
-                    return;
-                }
-                if (!qApp) {
-                    abort = true;
-                    return;
-                }
-
-                bool addNull = false;
-                QString whereString(QLatin1String("WHERE albumId IN (") % makeInStringFromIds(albums, first, count, addNull));
-                if (addNull) {
-                    whereString += QLatin1String(" OR albumId IS NULL");
-                }
-
-                if (deleteFiles) {
-                    if (query.exec(QLatin1String("SELECT filePath "
-                                                 "FROM tracks "
-                                                 "LEFT JOIN tracks_albums ON tracks_albums.trackId = id ") % whereString)) {
-                        if (reserveFromQueryAppend(paths, query) > 0) {
-                            while (query.next()) {
-                                paths.push_back(query.value(0).toString());
-                            }
-                        }
-                    } else {
-                        qWarning() << "Failed to get tracks for albums" << query.lastError();
-                        abort = true;
-                        return;
-                    }
-                }
-
-                if (!query.exec(QLatin1String("DELETE FROM tracks "
-                                              "WHERE id IN ("
-                                                "SELECT id FROM tracks "
-                                                "LEFT JOIN tracks_albums ON tracks_albums.trackId = id ") %
-                                                whereString %
-                                              QLatin1Char(')'))) {
-                    qWarning() << "Failed to remove tracks from database" << query.lastError();
-                    abort = true;
-                }
-            });
-
-            if (!abort) {
-                if (deleteFiles) {
-                    deleteFilesFromFilesystem(paths);
-                }
-
-                removeUnusedCategories(databaseGuard.db);
-                removeUnusedMediaArt(databaseGuard.db);
+        mRunningJobsType = jobs.front().type;
+        for (const WriteJob& job : jobs) {
+            mRunningWriteJobs.push_back(job.id);
+            emit writeJobStarted(job.id);
+        }
 
-                qInfo("Albums removing time: %lld ms", static_cast<long long>(timer.elapsed()));
+        auto future = ThreadPool::background()->run([jobs = std::move(jobs)]() mutable {
+            switch (jobs.front().type) {
+            case WriteJob::SaveTags:
+                return executeSaveTagsJob(jobs.front());
+            case WriteJob::SetUserMediaArt:
+                return executeSetUserMediaArtJob(jobs.front());
+            case WriteJob::RemoveOrphanedMediaArt:
+                executeRemoveOrphanedMediaArtJob();
+                return LibraryChanges{};
+            default:
+                return executeRemoveJobs(jobs);
             }
         });
 
-        onFutureFinished(future, this, [this] {
-            mRemovingFiles = false;
-            emit removingFilesChanged();
-            emit databaseChanged();
+        // Removing orphaned media art doesn't change database
+        const bool changesDatabase = (mRunningJobsType != WriteJob::RemoveOrphanedMediaArt);
+        onFutureFinished(future, this, [this, changesDatabase](const LibraryChanges& changes) {
+            if (changesDatabase) {
+                emit databaseChanged();
+                emit libraryChanged(changes);
+            }
+            finishWriteJobs();
         });
     }
 
-    void LibraryUtils::removeGenres(std::vector<int>&& genres, bool deleteFiles)
+    void LibraryUtils::finishWriteJobs()
     {
-        if (mRemovingFiles || !mDatabaseInitialized || genres.empty()) {
-            return;
+        const std::vector<int> finished(std::move(mRunningWriteJobs));
+        mRunningWriteJobs.clear();
+        mWriteJobRunning = false;
+        for (int id : finished) {
+            emit writeJobFinished(id);
         }
+        updateWriteJobsState();
+        startNextWriteJobs();
+    }
 
-        mRemovingFiles = true;
-        emit removingFilesChanged();
+    void LibraryUtils::updateWriteJobsState()
+    {
+        bool removingFiles = false;
+        bool savingTags = false;
+        const auto check = [&](WriteJob::Type type) {
+            if (type == WriteJob::SaveTags) {
+                savingTags = true;
+            } else if (type != WriteJob::Update && type != WriteJob::SetUserMediaArt && type != WriteJob::RemoveOrphanedMediaArt) {
+                removingFiles = true;
+            }
+        };
+        for (const WriteJob& job : mWriteJobs) {
+            check(job.type);
+        }
+        if (mWriteJobRunning && !mRunningWriteJobs.empty()) {
+            check(mRunningJobsType);
+        }
 
-        auto future = QtConcurrent::run([deleteFiles, genres = std::move(genres)] {
-            qInfo("Start removing genres, count=%zu, deleteFiles=%d", genres.size(), deleteFiles);
+        if (removingFiles != mRemovingFiles) {
+            mRemovingFiles = removingFiles;
+            emit removingFilesChanged();
+        }
+        if (savingTags != mSavingTags) {
+            mSavingTags = savingTags;
+            emit savingTagsChanged();
+        }
+        emit writeJobsCountChanged();
+    }
 
-            QElapsedTimer timer;
-            timer.start();
+    LibraryChanges LibraryUtils::executeRemoveJobs(std::vector<WriteJob>& jobs)
+    {
+        qInfo("Start removing files, jobs=%zu", jobs.size());
 
-            // Open database
-            DatabaseConnectionGuard databaseGuard(removeFilesConnectionName);
-            if (!databaseGuard.db.isOpen()) {
-                return;
-            }
+        QElapsedTimer timer;
+        timer.start();
 
-            const TransactionGuard transactionGuard(databaseGuard.db);
+        // Open database
+        DatabaseConnectionGuard databaseGuard(writerConnectionName);
+        if (!databaseGuard.db.isOpen()) {
+            return {};
+        }
 
-            QSqlQuery query;
-            std::vector<QString> paths;
+        std::vector<QString> filesToDelete;
+        std::vector<QString> directoriesToDelete;
+        std::vector<QString> unusedMediaArt;
+        LibraryChanges changes;
 
-            bool abort = false;
-            batchedCount(genres.size(), maxDbVariableCount, [&](size_t first, size_t count) {
-                if (abort) {
-                    return;
-                }
+        {
+            TransactionGuard transactionGuard(databaseGuard.db);
+
+            for (WriteJob& job : jobs) {
                 if (!qApp) {
-                    abort = true;
-                    return;
+                    return {};
                 }
 
-                const QString whereString(QLatin1String("WHERE genreId IN (") % makeInStringFromIds(genres, first, count));
-
-                if (deleteFiles) {
-                    if (query.exec(QLatin1String("SELECT filePath "
-                                                 "FROM tracks "
-                                                 "JOIN tracks_genres ON tracks_genres.trackId = id ") % whereString)) {
-                        if (reserveFromQueryAppend(paths, query) > 0) {
-                            while (query.next()) {
-                                paths.push_back(query.value(0).toString());
+                std::vector<QString> files;
+                std::vector<QString> directories;
+                bool removed = false;
+
+                switch (job.type) {
+                case WriteJob::RemoveArtists:
+                    removed = removeTracksFromDbByCategories(job.ids, QLatin1String("tracks_artists"), QLatin1String("artistId"), job.deleteFiles, files, databaseGuard.db);
+                    break;
+                case WriteJob::RemoveAlbums:
+                    removed = removeTracksFromDbByCategories(job.ids, QLatin1String("tracks_albums"), QLatin1String("albumId"), job.deleteFiles, files, databaseGuard.db);
+                    break;
+                case WriteJob::RemoveGenres:
+                    removed = removeTracksFromDbByCategories(job.ids, QLatin1String("tracks_genres"), QLatin1String("genreId"), job.deleteFiles, files, databaseGuard.db);
+                    break;
+                case WriteJob::RemoveTracks:
+                    removed = removeTracksFromDbByIds(job.ids, databaseGuard.db);
+                    files = std::move(job.paths);
+                    break;
+                case WriteJob::RemoveTracksByPaths:
+                    if (job.deleteDirectories) {
+                        files.reserve(job.paths.size());
+                        for (QString& path : job.paths) {
+                            if (QFileInfo(path).isDir()) {
+                                directories.push_back(std::move(path));
+                            } else {
+                                files.push_back(std::move(path));
                             }
                         }
+                        removed = removeTracksFromDbByPaths(files, databaseGuard.db) &&
+                                  removeTracksFromDbByDirectories(directories, databaseGuard.db);
                     } else {
-                        qWarning() << "Failed to get tracks for genres" << query.lastError();
-                        abort = true;
-                        return;
+                        files = std::move(job.paths);
+                        removed = removeTracksFromDbByPaths(files, databaseGuard.db);
                     }
+                    break;
+                default:
+                    break;
                 }
 
-                if (!query.exec(QLatin1String("DELETE FROM tracks "
-                                              "WHERE id IN ("
-                                                "SELECT id FROM tracks "
-                                                "JOIN tracks_genres ON tracks_genres.trackId = id ") %
-                                                whereString %
-                                              QLatin1Char(')'))) {
-                    qWarning() << "Failed to remove tracks from database" << query.lastError();
-                    abort = true;
+                if (removed && job.deleteFiles) {
+                    filesToDelete.insert(filesToDelete.end(), std::make_move_iterator(files.begin()), std::make_move_iterator(files.end()));
+                    directoriesToDelete.insert(directoriesToDelete.end(), std::make_move_iterator(directories.begin()), std::make_move_iterator(directories.end()));
                 }
-            });
+            }
 
-            if (!abort) {
-                if (deleteFiles) {
-                    deleteFilesFromFilesystem(paths);
-                }
+            changes = processChanges(databaseGuard.db);
+            unusedMediaArt = takeUnusedMediaArt(databaseGuard.db);
+            if (!transactionGuard.commit()) {
+                qWarning() << "Failed to commit transaction:" << databaseGuard.db.lastError();
+                transactionGuard.rollback();
+                return {};
+            }
+        }
 
-                removeUnusedCategories(databaseGuard.db);
-                removeUnusedMediaArt(databaseGuard.db);
+        removeMediaArtFiles(unusedMediaArt);
 
-                qInfo("Genres removing time: %lld ms", static_cast<long long>(timer.elapsed()));
-            }
-        });
+        // Files are deleted only after their tracks are removed from database
+        deleteFilesFromFilesystem(filesToDelete);
+        deleteDirectoriesFromFilesystem(directoriesToDelete);
 
-        onFutureFinished(future, this, [this] {
-            mRemovingFiles = false;
-            emit removingFilesChanged();
-            emit databaseChanged();
-        });
+        qInfo("Files removing time: %lld ms", static_cast<long long>(timer.elapsed()));
+
+        return changes;
     }
 
-    void LibraryUtils::removeTracks(std::vector<LibraryTrack>&& tracks, bool deleteFiles)
+    LibraryChanges LibraryUtils::executeSaveTagsJob(const WriteJob& job)
     {
-        if (mRemovingFiles || !mDatabaseInitialized || tracks.empty()) {
-            return;
+        qInfo("Start saving tags");
+
+        QElapsedTimer timer;
+        timer.start();
+
+        QMimeDatabase mimeDb;
+
+        if (!QDir().mkpath(MediaArtUtils::mediaArtDirectory())) {
+            qWarning() << "failed to create media art directory:" << MediaArtUtils::mediaArtDirectory();
+        }
+        std::unordered_map<QByteArray, QString> embeddedMediaArtFiles(MediaArtUtils::getEmbeddedMediaArtFiles());
+
+        // Open database
+        DatabaseConnectionGuard databaseGuard(writerConnectionName);
+        if (!databaseGuard.db.isOpen()) {
+            return {};
         }
 
-        mRemovingFiles = true;
-        emit removingFilesChanged();
+        // Media art is extracted before tracks are added
+        setMediaArtCheckPending(databaseGuard.db, true);
 
-        auto future = QtConcurrent::run([deleteFiles, tracks = std::move(tracks)]() mutable {
-            qInfo("Start removing tracks, count=%zu, deleteFiles=%d", tracks.size(), deleteFiles);
+        std::vector<QString> embeddedMediaArt;
+        embeddedMediaArt.reserve(static_cast<size_t>(job.files.size()));
+        const auto callback = [&](tagutils::Info& info) {
+            QString path(MediaArtUtils::saveEmbeddedMediaArt(info.mediaArtData, embeddedMediaArtFiles, mimeDb));
+            embeddedMediaArt.push_back(std::move(path));
+            info.mediaArtData.clear();
+        };
+
+        std::vector<tagutils::Info> infos(job.incrementTrackNumber ? tagutils::saveTags<true>(job.files, job.tags, callback)
+                                                               : tagutils::saveTags<false>(job.files, job.tags, callback));
+        if (!qApp) {
+            return {};
+        }
 
-            QElapsedTimer timer;
-            timer.start();
+        TransactionGuard transactionGuard(databaseGuard.db);
 
-            // Open database
-            DatabaseConnectionGuard databaseGuard(removeFilesConnectionName);
-            if (!databaseGuard.db.isOpen()) {
+        batchedCount(infos.size(), LibraryUtils::maxDbVariableCount, [&](size_t first, size_t count) {
+            if (!qApp) {
                 return;
             }
 
-            const TransactionGuard transactionGuard(databaseGuard.db);
-
-            std::vector<int> ids;
-            ids.reserve(tracks.size());
-            if (deleteFiles) {
-                std::vector<QString> paths;
-                paths.reserve(tracks.size());
-                for (auto& track : tracks) {
-                    ids.push_back(track.id);
-                    paths.push_back(std::move(track.filePath));
-                }
-                if (removeTracksFromDbByIds(std::move(ids), databaseGuard.db)) {
-                    deleteFilesFromFilesystem(paths);
-                }
-            } else {
-                for (auto& track : tracks) {
-                    ids.push_back(track.id);
-                }
-                removeTracksFromDbByIds(std::move(ids), databaseGuard.db);
+            QString queryString(QLatin1String("DELETE FROM tracks WHERE filePath = ?"));
+            for (size_t i = first + 1, max = first + count; i < max; ++i) {
+                queryString.push_back(QLatin1String(" OR filePath = ?"));
             }
 
-            removeUnusedCategories(databaseGuard.db);
-            removeUnusedMediaArt(databaseGuard.db);
+            QSqlQuery query(databaseGuard.db);
+            query.prepare(queryString);
+            for (size_t i = first, max = first + count; i < max; ++i) {
+                query.addBindValue(emptyIfNull(infos[i].filePath));
+            }
 
-            qInfo("Tracks removing time: %lld ms", static_cast<long long>(timer.elapsed()));
+            if (!query.exec()) {
+                qWarning() << "failed to remove tracks:" << query.lastError();
+            }
         });
 
-        onFutureFinished(future, this, [this] {
-            mRemovingFiles = false;
-            emit removingFilesChanged();
-            emit databaseChanged();
-        });
+        std::unordered_map<QString, QString> mediaArtDirectoriesHash;
+
+        LibraryTracksAdder adder(databaseGuard.db, LibraryTracksAdder::shouldPreloadCategories(infos.size()));
+
+        for (size_t i = 0, max = infos.size(); i < max; ++i) {
+            tagutils::Info& info = infos[i];
+            QFileInfo fileInfo(info.filePath);
+            if (info.title.isEmpty()) {
+                info.title = fileInfo.fileName();
+            }
+            const QString directoryMediaArt(MediaArtUtils::findMediaArtForDirectory(fileInfo.path(), mediaArtDirectoriesHash));
+            adder.addTrackToDatabase(info.filePath, getLastModifiedTime(info.filePath), info, directoryMediaArt, embeddedMediaArt[i]);
+        }
+
+        LibraryChanges changes(processChanges(databaseGuard.db));
+        const std::vector<QString> unusedMediaArt(takeUnusedMediaArt(databaseGuard.db));
+        if (!transactionGuard.commit()) {
+            qWarning() << "Failed to commit transaction:" << databaseGuard.db.lastError();
+            transactionGuard.rollback();
+            return {};
+        }
+        removeMediaArtFiles(unusedMediaArt);
+        setMediaArtCheckPending(databaseGuard.db, false);
+
+        qInfo("Done saving tags, %lldms", timer.elapsed());
+
+        return changes;
     }
 
-    void LibraryUtils::removeTracksByPaths(std::vector<QString>&& paths, bool deleteFiles, bool deleteDirectories)
+    LibraryChanges LibraryUtils::executeSetUserMediaArtJob(const WriteJob& job)
     {
-        if (mRemovingFiles || !mDatabaseInitialized || paths.empty()) {
-            return;
+        if (!QDir().mkpath(MediaArtUtils::mediaArtDirectory())) {
+            qWarning() << "Failed to create media art directory:" << MediaArtUtils::mediaArtDirectory();
+            return {};
         }
 
-        mRemovingFiles = true;
-        emit removingFilesChanged();
+        QString id(QUuid::createUuid().toString());
+        id.remove(0, 1);
+        id.chop(1);
 
-        auto future = QtConcurrent::run([deleteFiles, deleteDirectories, paths = std::move(paths)]() mutable {
-            qInfo("Start removing files, count=%zu", paths.size());
+        const QString newFilePath(QString::fromLatin1("%1/%2.%3")
+                                  .arg(MediaArtUtils::mediaArtDirectory(), id, QFileInfo(job.mediaArt).suffix()));
 
-            QElapsedTimer timer;
-            timer.start();
+        if (!QFile::copy(job.mediaArt, newFilePath)) {
+            qWarning() << "Failed to copy file from" << job.mediaArt << "to" << newFilePath;
+            return {};
+        }
 
-            // Open database
-            DatabaseConnectionGuard databaseGuard(removeFilesConnectionName);
-            if (!databaseGuard.db.isOpen()) {
-                return;
+        const auto removeNewFile = [&] {
+            if (!QFile::remove(newFilePath)) {
+                qWarning() << "Failed to remove file:" << newFilePath;
             }
+        };
 
-            const TransactionGuard transactionGuard(databaseGuard.db);
+        DatabaseConnectionGuard databaseGuard(writerConnectionName);
+        if (!databaseGuard.db.isOpen()) {
+            removeNewFile();
+            return {};
+        }
 
-            if (deleteDirectories) {
-                std::vector<QString> files;
-                files.reserve(paths.size());
-                std::vector<QString> directories;
-                for (auto& path : paths) {
-                    if (QFileInfo(path).isDir()) {
-                        directories.push_back(std::move(path));
-                    } else {
-                        files.push_back(std::move(path));
-                    }
-                    //const bool isDir = QFileInfo(path).isDir();
-                    //files.emplace_back(std::move(path), isDir);
-                }
-                if (removeTracksFromDbByPaths(files, databaseGuard.db)) {
-                    if (removeTracksFromDbByDirectories(directories, databaseGuard.db)) {
-                        if (deleteFiles) {
-                            deleteFilesFromFilesystem(files);
-                            deleteDirectoriesFromFilesystem(directories);
-                        }
-                    }
-                }
-            } else {
-                if (removeTracksFromDbByPaths(paths, databaseGuard.db)) {
-                    if (deleteFiles) {
-                        deleteFilesFromFilesystem(paths);
-                    }
-                }
-            }
+        TransactionGuard transactionGuard(databaseGuard.db);
 
-            removeUnusedCategories(databaseGuard.db);
-            removeUnusedMediaArt(databaseGuard.db);
+        QSqlQuery query(databaseGuard.db);
+        if (!query.prepare(QLatin1String("UPDATE albums SET userMediaArt = ? WHERE id = ?"))) {
+            qWarning() << query.lastError();
+            removeNewFile();
+            return {};
+        }
+        query.addBindValue(newFilePath);
+        query.addBindValue(job.albumId);
+        if (!query.exec()) {
+            qWarning() << "Failed to update media art in the database:" << query.lastError();
+            removeNewFile();
+            return {};
+        }
 
-            qInfo("Files removing time: %lld ms", static_cast<long long>(timer.elapsed()));
-        });
+        const QString albumId(QString::number(job.albumId));
+        updateMediaArtCandidates(databaseGuard.db,
+                                 QString::fromLatin1("SELECT DISTINCT artistId FROM tracks_artists "
+                                                     "JOIN tracks_albums ON tracks_albums.trackId = tracks_artists.trackId "
+                                                     "WHERE albumId = %1").arg(albumId),
+                                 QString::fromLatin1("SELECT %1").arg(albumId),
+                                 QString::fromLatin1("SELECT DISTINCT genreId FROM tracks_genres "
+                                                     "JOIN tracks_albums ON tracks_albums.trackId = tracks_genres.trackId "
+                                                     "WHERE albumId = %1").arg(albumId));
+
+        LibraryChanges changes(processChanges(databaseGuard.db));
+        changes.albums.modified.insert(job.albumId);
+        // Previous user media art
+        const std::vector<QString> unusedMediaArt(takeUnusedMediaArt(databaseGuard.db));
+        if (!transactionGuard.commit()) {
+            qWarning() << "Failed to commit transaction:" << databaseGuard.db.lastError();
+            transactionGuard.rollback();
+            removeNewFile();
+            return {};
+        }
+        removeMediaArtFiles(unusedMediaArt);
 
-        onFutureFinished(future, this, [this] {
-            mRemovingFiles = false;
-            emit removingFilesChanged();
-            emit databaseChanged();
-        });
+        return changes;
     }
 
-    bool LibraryUtils::isSavingTags() const
+    void LibraryUtils::executeRemoveOrphanedMediaArtJob()
     {
-        return mSavingTags;
+        DatabaseConnectionGuard databaseGuard(writerConnectionName);
+        if (!databaseGuard.db.isOpen()) {
+            return;
+        }
+        removeOrphanedMediaArt(databaseGuard.db);
+        setMediaArtCheckPending(databaseGuard.db, false);
     }
 
-    void LibraryUtils::saveTags(const QStringList& files, const QVariantMap& tags, bool incrementTrackNumber)
+    void LibraryUtils::updateStats()
     {
-        if (mSavingTags || !mDatabaseInitialized) {
+        if (!mDatabaseInitialized) {
             return;
         }
 
-        mSavingTags = true;
-        emit savingTagsChanged();
-
-        auto future = QtConcurrent::run([files, tags, incrementTrackNumber]() {
-            qInfo("Start saving tags");
+        if (mUpdatingStats) {
+            mStatsUpdateQueued = true;
+            return;
+        }
 
-            QElapsedTimer timer;
-            timer.start();
+        mUpdatingStats = true;
 
-            QMimeDatabase mimeDb;
+        // Not needed to display pages, so it doesn't take threads from models' queries
+        auto future = ThreadPool::background()->run([useAlbumArtist = Settings::instance()->useAlbumArtist()] {
+            Stats stats{};
 
-            if (!QDir().mkpath(MediaArtUtils::mediaArtDirectory())) {
-                qWarning() << "failed to create media art directory:" << MediaArtUtils::mediaArtDirectory();
+            DatabaseConnectionGuard databaseGuard(statsConnectionName);
+            if (!databaseGuard.db.isOpen()) {
+                return stats;
             }
-            std::unordered_map<QByteArray, QString> embeddedMediaArtFiles(MediaArtUtils::getEmbeddedMediaArtFiles());
-
-            std::vector<QString> embeddedMediaArt;
-            embeddedMediaArt.reserve(static_cast<size_t>(files.size()));
-            const auto callback = [&](tagutils::Info& info) {
-                QString path(MediaArtUtils::saveEmbeddedMediaArt(info.mediaArtData, embeddedMediaArtFiles, mimeDb));
-                embeddedMediaArt.push_back(std::move(path));
-                info.mediaArtData.clear();
+
+            enum
+            {
+                ArtistsCountField,
+                AlbumsCountField,
+                TracksCountField,
+                TracksDurationField
             };
 
-            std::vector<tagutils::Info> infos(incrementTrackNumber ? tagutils::saveTags<true>(files, tags, callback)
-                                                                   : tagutils::saveTags<false>(files, tags, callback));
-            if (!qApp) {
-                return;
+            QSqlQuery query(databaseGuard.db);
+            if (query.exec(QString::fromLatin1("SELECT (SELECT COUNT(*) FROM %1 WHERE artistId != 0), "
+                                                      "(SELECT COUNT(*) FROM albums), "
+                                                      "COUNT(*), "
+                                                      "ifnull(SUM(duration), 0) "
+                                               "FROM tracks").arg(useAlbumArtist ? QLatin1String("album_artists_stats")
+                                                                                 : QLatin1String("artists_stats")))) {
+                if (query.next()) {
+                    stats.artistsCount = query.value(ArtistsCountField).toInt();
+                    stats.albumsCount = query.value(AlbumsCountField).toInt();
+                    stats.tracksCount = query.value(TracksCountField).toInt();
+                    stats.tracksDuration = query.value(TracksDurationField).toInt();
+                }
+            } else {
+                qWarning() << "Failed to get library stats" << query.lastError();
             }
 
-            // Open database
-            DatabaseConnectionGuard databaseGuard{saveTagsConnectionName};
-            if (!databaseGuard.db.isOpen()) {
-                return;
+            return stats;
+        });
+
+        onFutureFinished(future, this, [this](const Stats& stats) {
+            mUpdatingStats = false;
+            mStats = stats;
+            emit statsChanged();
+
+            if (mStatsUpdateQueued) {
+                mStatsUpdateQueued = false;
+                updateStats();
             }
+        });
+    }
 
-            const TransactionGuard transactionGuard(databaseGuard.db);
+    void LibraryUtils::updateThumbnails()
+    {
+        const int updateId = ++mThumbnailsUpdateId;
 
-            batchedCount(infos.size(), LibraryUtils::maxDbVariableCount, [&](size_t first, size_t count) {
-                if (!qApp) {
-                    return;
-                }
+        auto future = ThreadPool::background()->run([] {
+            std::vector<QString> files;
 
-                QString queryString(QLatin1String("DELETE FROM tracks WHERE filePath = ?"));
-                for (size_t i = first + 1, max = first + count; i < max; ++i) {
-                    queryString.push_back(QLatin1String(" OR filePath = ?"));
-                }
+            DatabaseConnectionGuard databaseGuard(thumbnailsConnectionName);
+            if (!databaseGuard.db.isOpen()) {
+                return files;
+            }
 
-                QSqlQuery query(databaseGuard.db);
-                query.prepare(queryString);
-                for (size_t i = first, max = first + count; i < max; ++i) {
-                    query.addBindValue(emptyIfNull(infos[i].filePath));
-                }
+            bool ok = false;
+            const std::unordered_set<QString> usedMediaArt(queryUsedMediaArt(databaseGuard.db, ok));
+            if (!ok) {
+                return files;
+            }
+            MediaArtUtils::removeThumbnailsExcept(usedMediaArt);
 
-                if (!query.exec()) {
-                    qWarning() << "failed to remove tracks:" << query.lastError();
-                }
-            });
+            files.assign(usedMediaArt.begin(), usedMediaArt.end());
+            return files;
+        });
 
-            std::unordered_map<QString, QString> mediaArtDirectoriesHash;
+        onFutureFinished(future, this, [this, updateId](std::vector<QString>&& files) {
+            createThumbnails(std::make_shared<const std::vector<QString>>(std::move(files)), 0, updateId);
+        });
+    }
 
-            LibraryTracksAdder adder(databaseGuard.db);
+    void LibraryUtils::createThumbnails(const std::shared_ptr<const std::vector<QString>>& files, size_t first, int updateId)
+    {
+        if (updateId != mThumbnailsUpdateId || first >= files->size()) {
+            return;
+        }
 
-            for (size_t i = 0, max = infos.size(); i < max; ++i) {
-                tagutils::Info& info = infos[i];
-                QFileInfo fileInfo(info.filePath);
-                if (info.title.isEmpty()) {
-                    info.title = fileInfo.fileName();
+        const size_t count = std::min(thumbnailsChunkSize, files->size() - first);
+        auto future = ThreadPool::background()->run([files, first, count] {
+            for (size_t i = first, max = first + count; i < max; ++i) {
+                for (int size : MediaArtUtils::pregeneratedThumbnailSizes()) {
+                    ThumbnailImageProvider::createThumbnail((*files)[i], size);
                 }
-                const QString directoryMediaArt(MediaArtUtils::findMediaArtForDirectory(fileInfo.path(), mediaArtDirectoriesHash));
-                adder.addTrackToDatabase(info.filePath, getLastModifiedTime(info.filePath), info, directoryMediaArt, embeddedMediaArt[i]);
             }
-
-            qInfo("Done saving tags, %lldms", timer.elapsed());
         });
 
-        onFutureFinished(future, this, [this] {
-            mSavingTags = false;
-            emit savingTagsChanged();
-            emit databaseChanged();
+        onFutureFinished(future, this, [this, files, first, count, updateId] {
+            createThumbnails(files, first + count, updateId);
         });
     }
 
@@ -1180,15 +2176,33 @@ namespace unplayer
         : QObject(parent),
           mDatabaseInitialized(false),
           mCreatedTables(false),
+          mSearchAvailable(false),
+          mDatabaseGeneration(0),
           mLibraryUpdateRunnable(nullptr),
           mLibraryUpdateStage(NoneStage),
           mFoundTracks(0),
           mExtractedTracks(0),
           mRemovingFiles(false),
-          mSavingTags(false)
+          mSavingTags(false),
+          mStats{},
+          mUpdatingStats(false),
+          mStatsUpdateQueued(false),
+          mThumbnailsUpdateId(0),
+          mLastWriteJobId(0),
+          mWriteJobRunning(false),
+          mRunningJobsType(WriteJob::Update)
     {
         qRegisterMetaType<UpdateStage>();
+        qRegisterMetaType<LibraryChanges>();
         initDatabase();
+        // Connected first so that generation is already incremented when other receivers are called
+        QObject::connect(this, &LibraryUtils::databaseChanged, this, [this] {
+            ++mDatabaseGeneration;
+        });
         QObject::connect(this, &LibraryUtils::databaseChanged, this, &LibraryUtils::mediaArtChanged);
+        QObject::connect(this, &LibraryUtils::databaseChanged, this, &LibraryUtils::updateStats);
+        // Artists count depends on it
+        QObject::connect(Settings::instance(), &Settings::useAlbumArtistChanged, this, &LibraryUtils::updateStats);
+        updateStats();
     }
 }
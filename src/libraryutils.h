@@ -20,6 +20,8 @@
 #define UNPLAYER_LIBRARYUTILS_H
 
 #include <atomic>
+#include <deque>
+#include <memory>
 #include <vector>
 
 #include <QObject>
@@ -27,6 +29,8 @@
 #include <QStringList>
 #include <QVariantMap>
 
+#include "librarychanges.h"
+
 class QRunnable;
 
 namespace unplayer
@@ -38,11 +42,12 @@ namespace unplayer
         Q_OBJECT
         Q_PROPERTY(bool databaseInitialized READ isDatabaseInitialized CONSTANT)
         Q_PROPERTY(bool createdTables READ isCreatedTables CONSTANT)
+        Q_PROPERTY(bool searchAvailable READ isSearchAvailable CONSTANT)
 
-        Q_PROPERTY(int artistsCount READ artistsCount NOTIFY databaseChanged)
-        Q_PROPERTY(int albumsCount READ albumsCount NOTIFY databaseChanged)
-        Q_PROPERTY(int tracksCount READ tracksCount NOTIFY databaseChanged)
-        Q_PROPERTY(int tracksDuration READ tracksDuration NOTIFY databaseChanged)
+        Q_PROPERTY(int artistsCount READ artistsCount NOTIFY statsChanged)
+        Q_PROPERTY(int albumsCount READ albumsCount NOTIFY statsChanged)
+        Q_PROPERTY(int tracksCount READ tracksCount NOTIFY statsChanged)
+        Q_PROPERTY(int tracksDuration READ tracksDuration NOTIFY statsChanged)
 
         Q_PROPERTY(bool updating READ isUpdating NOTIFY updatingChanged)
         Q_PROPERTY(UpdateStage updateStage READ updateStage NOTIFY updateStageChanged)
@@ -52,6 +57,8 @@ namespace unplayer
         Q_PROPERTY(bool removingFiles READ isRemovingFiles NOTIFY removingFilesChanged)
 
         Q_PROPERTY(bool savingTags READ isSavingTags NOTIFY savingTagsChanged)
+
+        Q_PROPERTY(int writeJobsCount READ writeJobsCount NOTIFY writeJobsCountChanged)
     public:
         enum UpdateStage {
             NoneStage,
@@ -69,12 +76,55 @@ namespace unplayer
         static LibraryUtils* instance();
 
         static bool removeTracksFromDbByIds(const std::vector<int>& ids, const QSqlDatabase& db, const std::atomic_bool& cancel = false);
-        static void removeUnusedCategories(const QSqlDatabase& db);
-        static void removeUnusedMediaArt(const QSqlDatabase& db, const std::atomic_bool& cancel = false);
+        /**
+         * @brief Removes categories that lost all their tracks, updates statistics of changed categories
+         * and returns what was changed since the last call
+         */
+        static LibraryChanges processChanges(const QSqlDatabase& db);
+        /**
+         * @brief Returns media art files that lost all their references and clears changed_media_art.
+         * Files must be removed with removeMediaArtFiles() only after transaction is committed
+         */
+        static std::vector<QString> takeUnusedMediaArt(const QSqlDatabase& db);
+        static void removeMediaArtFiles(const std::vector<QString>& files);
+        /**
+         * @brief Removes all files in media art directory that are not referenced in database,
+         * e.g. extracted by interrupted update, and thumbnails of files that are no longer used
+         */
+        static void removeOrphanedMediaArt(const QSqlDatabase& db, const std::atomic_bool& cancel = false);
+        /**
+         * @brief Flag that is set while media art is extracted before its tracks are committed.
+         * If it is still set on startup, removeOrphanedMediaArt() is executed
+         */
+        static bool setMediaArtCheckPending(const QSqlDatabase& db, bool pending);
+        static bool isMediaArtCheckPending(const QSqlDatabase& db);
+
+        // Values of category column of media_art_candidates table
+        enum MediaArtCandidateCategory
+        {
+            ArtistMediaArtCandidate,
+            AlbumMediaArtCandidate,
+            GenreMediaArtCandidate
+        };
+
+        /**
+         * @brief Rebuilds distinct media art of categories returned by given SELECT statements.
+         * Id 0 of artists and albums stands for tracks without artist or album
+         */
+        static bool updateMediaArtCandidates(const QSqlDatabase& db, const QString& artistIds, const QString& albumIds, const QString& genreIds);
 
         static bool createTables(QSqlDatabase& db);
+        /**
+         * @brief Creates FTS5 tables used by LibrarySearchModel, triggers that keep them in sync
+         * and indexes existing rows. Does nothing if FTS5 is not available
+         */
+        static bool createSearchTables(QSqlDatabase& db);
+        // Existing indexes are skipped, missing ones are dropped without error
         static bool createIndexes(QSqlDatabase& db);
         static bool dropIndexes(QSqlDatabase& db);
+        // Indexes that use sqliteutils::sortCollation()
+        static bool createSortIndexes(QSqlDatabase& db);
+        static bool dropSortIndexes(QSqlDatabase& db);
 
         void initDatabase();
         Q_INVOKABLE bool updateDatabase();
@@ -83,6 +133,11 @@ namespace unplayer
 
         bool isDatabaseInitialized() const;
         bool isCreatedTables() const;
+        // False if SQLite is built without FTS5
+        bool isSearchAvailable() const;
+
+        // Incremented each time database is changed
+        quint64 databaseGeneration() const;
 
         int artistsCount() const;
         int albumsCount() const;
@@ -94,21 +149,96 @@ namespace unplayer
         int foundTracks() const;
         int extractedTracks() const;
 
+        /*
+         * Library mutations (update, removals and tag saving) are queued and executed one at a time, in order.
+         * Functions below return id of queued job, or 0 if it wasn't queued
+         */
+
         bool isRemovingFiles() const;
-        void removeArtists(std::vector<int>&& artists, bool deleteFiles);
-        void removeAlbums(std::vector<int>&& albums, bool deleteFiles);
-        void removeGenres(std::vector<int>&& genres, bool deleteFiles);
+        int removeArtists(std::vector<int>&& artists, bool deleteFiles);
+        int removeAlbums(std::vector<int>&& albums, bool deleteFiles);
+        int removeGenres(std::vector<int>&& genres, bool deleteFiles);
 
-        void removeTracks(std::vector<LibraryTrack>&& tracks, bool deleteFiles);
-        void removeTracksByPaths(std::vector<QString>&& paths, bool deleteFiles, bool deleteDirectories);
+        int removeTracks(std::vector<LibraryTrack>&& tracks, bool deleteFiles);
+        int removeTracksByPaths(std::vector<QString>&& paths, bool deleteFiles, bool deleteDirectories);
 
         bool isSavingTags() const;
-        Q_INVOKABLE void saveTags(const QStringList& files, const QVariantMap& tags, bool incrementTrackNumber);
+        Q_INVOKABLE int saveTags(const QStringList& files, const QVariantMap& tags, bool incrementTrackNumber);
+
+        // Copies image to media art directory and sets it as album's media art
+        int setUserMediaArt(int albumId, const QString& mediaArt);
+
+        // Number of queued and running jobs
+        int writeJobsCount() const;
     private:
+        struct WriteJob
+        {
+            enum Type
+            {
+                Update,
+                RemoveArtists,
+                RemoveAlbums,
+                RemoveGenres,
+                RemoveTracks,
+                RemoveTracksByPaths,
+                SaveTags,
+                SetUserMediaArt,
+                RemoveOrphanedMediaArt
+            };
+
+            inline bool isRemoval() const
+            {
+                return type != Update && type != SaveTags && type != SetUserMediaArt && type != RemoveOrphanedMediaArt;
+            }
+
+            Type type;
+            int id;
+
+            std::vector<int> ids;
+            std::vector<QString> paths;
+            bool deleteFiles;
+            bool deleteDirectories;
+
+            QStringList files;
+            QVariantMap tags;
+            bool incrementTrackNumber;
+
+            int albumId;
+            QString mediaArt;
+        };
+
         LibraryUtils(QObject* parent = nullptr);
 
+        int enqueueWriteJob(WriteJob&& job);
+        /**
+         * @brief Starts first queued job. Adjacent removals are merged and executed in one transaction
+         */
+        void startNextWriteJobs();
+        void finishWriteJobs();
+        void updateWriteJobsState();
+        void startUpdate();
+
+        static LibraryChanges executeRemoveJobs(std::vector<WriteJob>& jobs);
+        static LibraryChanges executeSaveTagsJob(const WriteJob& job);
+        static LibraryChanges executeSetUserMediaArtJob(const WriteJob& job);
+        static void executeRemoveOrphanedMediaArtJob();
+
+        /**
+         * @brief Recalculates library statistics in background thread
+         */
+        void updateStats();
+
+        /**
+         * @brief Removes unused thumbnails and creates missing ones in background, in small chunks
+         * so that other background work is not blocked
+         */
+        void updateThumbnails();
+        void createThumbnails(const std::shared_ptr<const std::vector<QString>>& files, size_t first, int updateId);
+
         bool mDatabaseInitialized;
         bool mCreatedTables;
+        bool mSearchAvailable;
+        quint64 mDatabaseGeneration;
 
         QRunnable* mLibraryUpdateRunnable;
         UpdateStage mLibraryUpdateStage;
@@ -117,6 +247,26 @@ namespace unplayer
 
         bool mRemovingFiles;
         bool mSavingTags;
+
+        struct Stats
+        {
+            int artistsCount;
+            int albumsCount;
+            int tracksCount;
+            int tracksDuration;
+        };
+        Stats mStats;
+        bool mUpdatingStats;
+        bool mStatsUpdateQueued;
+
+        // Chunks of superseded thumbnails update are not started
+        int mThumbnailsUpdateId;
+
+        std::deque<WriteJob> mWriteJobs;
+        int mLastWriteJobId;
+        bool mWriteJobRunning;
+        std::vector<int> mRunningWriteJobs;
+        WriteJob::Type mRunningJobsType;
     signals:
         void updatingChanged();
         void updateStageChanged();
@@ -124,10 +274,17 @@ namespace unplayer
         void extractedTracksChanged();
 
         void databaseChanged();
+        void libraryChanged(const unplayer::LibraryChanges& changes);
         void mediaArtChanged();
+        void statsChanged();
 
         void removingFilesChanged();
         void savingTagsChanged();
+
+        void writeJobQueued(int id);
+        void writeJobStarted(int id);
+        void writeJobFinished(int id);
+        void writeJobsCountChanged();
     };
 }
 
@@ -25,6 +25,7 @@
 #include <sailfishapp.h>
 #include "queue.h"
 #include "player.h"
+#include "thumbnailimageprovider.h"
 #else
 #include <QCoreApplication>
 #endif
@@ -168,6 +169,7 @@ int main(int argc, char** argv)
     Utils::registerTypes();
 
     view->engine()->addImageProvider(QueueImageProvider::providerId, new QueueImageProvider(Player::instance()->queue()));
+    view->engine()->addImageProvider(ThumbnailImageProvider::providerId, new ThumbnailImageProvider());
 
     if (SignalHandler::exitRequested) {
         return EXIT_SUCCESS;
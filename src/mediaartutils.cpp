@@ -18,6 +18,11 @@
 
 #include "mediaartutils.h"
 
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <tuple>
 #include <unordered_set>
 
 #include <QCoreApplication>
@@ -33,7 +38,6 @@
 #include <QSqlQuery>
 #include <QStandardPaths>
 #include <QThread>
-#include <QUuid>
 
 #include "fileutils.h"
 #include "libraryutils.h"
@@ -44,11 +48,181 @@
 
 namespace unplayer
 {
+    /**
+     * @brief Pending media art requests, shared by MediaArtUtils and its worker thread.
+     * Identical requests are merged, and requests of the same category are processed in batches
+     */
+    class MediaArtRequestQueue
+    {
+    public:
+        using Type = MediaArtUtils::RequestType;
+
+        struct Request
+        {
+            Type type;
+            int id;
+            int albumId;
+
+            inline bool operator<(const Request& other) const
+            {
+                return std::tie(type, id, albumId) < std::tie(other.type, other.id, other.albumId);
+            }
+        };
+
+        struct FileRequest
+        {
+            QString filePath;
+            QString albumForUserMediaArt;
+            bool onlyExtractEmbedded;
+        };
+
+        // Functions below return true if worker needs to be started
+
+        bool addFileRequest(FileRequest&& request)
+        {
+            std::lock_guard<std::mutex> guard(mMutex);
+            if (mHasPrefetchRequest && mPrefetchRequest.filePath == request.filePath) {
+                mHasPrefetchRequest = false;
+            }
+            // Only the latest file matters, it is current track of the queue
+            mFileRequest = std::move(request);
+            mHasFileRequest = true;
+            return scheduleWorker();
+        }
+
+        bool addPrefetchRequest(FileRequest&& request)
+        {
+            std::lock_guard<std::mutex> guard(mMutex);
+            if (mHasFileRequest && mFileRequest.filePath == request.filePath) {
+                return false;
+            }
+            mPrefetchRequest = std::move(request);
+            mHasPrefetchRequest = true;
+            return scheduleWorker();
+        }
+
+        bool addRequest(const Request& request, const QObject* requester)
+        {
+            std::lock_guard<std::mutex> guard(mMutex);
+            std::vector<const QObject*>& requesters = mRequests[request];
+            if (std::find(requesters.begin(), requesters.end(), requester) == requesters.end()) {
+                requesters.push_back(requester);
+            }
+            return scheduleWorker();
+        }
+
+        // Returns true if request was pending
+        bool removeRequest(const Request& request, const QObject* requester)
+        {
+            std::lock_guard<std::mutex> guard(mMutex);
+            const auto found(mRequests.find(request));
+            if (found == mRequests.end()) {
+                return false;
+            }
+            std::vector<const QObject*>& requesters = found->second;
+            const auto foundRequester(std::find(requesters.begin(), requesters.end(), requester));
+            if (foundRequester == requesters.end()) {
+                return false;
+            }
+            requesters.erase(foundRequester);
+            if (requesters.empty()) {
+                mRequests.erase(found);
+            }
+            return true;
+        }
+
+        void removeRequester(const QObject* requester)
+        {
+            std::lock_guard<std::mutex> guard(mMutex);
+            for (auto i = mRequests.begin(); i != mRequests.end();) {
+                std::vector<const QObject*>& requesters = i->second;
+                requesters.erase(std::remove(requesters.begin(), requesters.end(), requester), requesters.end());
+                if (requesters.empty()) {
+                    i = mRequests.erase(i);
+                } else {
+                    ++i;
+                }
+            }
+        }
+
+        /**
+         * @brief Takes file request if there is one, otherwise up to maxCount requests of the same type,
+         * otherwise prefetch request. Returns false if there is nothing to do, worker must be started again for new requests
+         */
+        bool takeNext(FileRequest& fileRequest, bool& isFileRequest, std::vector<Request>& requests, size_t maxCount)
+        {
+            std::lock_guard<std::mutex> guard(mMutex);
+            if (mHasFileRequest) {
+                fileRequest = std::move(mFileRequest);
+                mHasFileRequest = false;
+                isFileRequest = true;
+                return true;
+            }
+            if (mRequests.empty()) {
+                if (mHasPrefetchRequest) {
+                    fileRequest = std::move(mPrefetchRequest);
+                    mHasPrefetchRequest = false;
+                    isFileRequest = true;
+                    return true;
+                }
+                mWorkerScheduled = false;
+                return false;
+            }
+            isFileRequest = false;
+            const Type type = mRequests.begin()->first.type;
+            auto i = mRequests.begin();
+            for (; i != mRequests.end() && i->first.type == type && requests.size() < maxCount; ++i) {
+                requests.push_back(i->first);
+            }
+            mRequests.erase(mRequests.begin(), i);
+            return true;
+        }
+
+    private:
+        bool scheduleWorker()
+        {
+            if (mWorkerScheduled) {
+                return false;
+            }
+            mWorkerScheduled = true;
+            return true;
+        }
+
+        std::mutex mMutex;
+        bool mHasFileRequest = false;
+        FileRequest mFileRequest;
+        bool mHasPrefetchRequest = false;
+        FileRequest mPrefetchRequest;
+        std::map<Request, std::vector<const QObject*>> mRequests;
+        bool mWorkerScheduled = false;
+    };
+
     class MediaArtUtilsWorker : public QObject
     {
         Q_OBJECT
     public:
-        Q_INVOKABLE void getMediaArtForFile(const QString& filePath, const QString& albumForUserMediaArt, bool onlyExtractEmbedded)
+        explicit MediaArtUtilsWorker(MediaArtRequestQueue* requestQueue)
+            : mRequestQueue(requestQueue)
+        {
+
+        }
+
+        Q_INVOKABLE void processRequests()
+        {
+            MediaArtRequestQueue::FileRequest fileRequest;
+            bool isFileRequest;
+            std::vector<MediaArtRequestQueue::Request> requests;
+            while (mRequestQueue->takeNext(fileRequest, isFileRequest, requests, LibraryUtils::maxDbVariableCount)) {
+                if (isFileRequest) {
+                    getMediaArtForFile(fileRequest.filePath, fileRequest.albumForUserMediaArt, fileRequest.onlyExtractEmbedded);
+                } else {
+                    getMediaArtForCategories(requests);
+                    requests.clear();
+                }
+            }
+        }
+
+        void getMediaArtForFile(const QString& filePath, const QString& albumForUserMediaArt, bool onlyExtractEmbedded)
         {
             if (!onlyExtractEmbedded) {
                 openDb();
@@ -110,79 +284,119 @@ namespace unplayer
                 return;
             }
 
-            execQuery(mRandomMediaArtQuery, {}, [&](QString&& mediaArt) {
-                emit gotRandomMediaArt(requestId, mediaArt);
-            });
-        }
-
-        Q_INVOKABLE void getRandomMediaArtForArtist(int artistId)
-        {
-            openDb();
-            if (!mDb.isOpen()) {
+            // Picks album candidate that follows random rowid
+            if (!mMaxCandidateRowIdQuery.exec() || !mMaxCandidateRowIdQuery.next()) {
+                qWarning() << mMaxCandidateRowIdQuery.lastError();
+                mMaxCandidateRowIdQuery.finish();
                 return;
             }
+            const qint64 maxRowId = mMaxCandidateRowIdQuery.value(0).toLongLong();
+            mMaxCandidateRowIdQuery.finish();
 
             const auto emitSignal = [&](QString&& mediaArt) {
-                emit gotRandomMediaArtForArtist(artistId, mediaArt);
+                emit gotRandomMediaArt(requestId, mediaArt);
             };
-
-            if (artistId > 0) {
-                execQuery(mArtistQuery, {artistId}, emitSignal);
-            } else {
-                execQuery(mNullArtistQuery, {}, emitSignal);
+            const qint64 rowId = std::uniform_int_distribution<qint64>(0, maxRowId)(mRandomEngine);
+            if (!execQuery(mRandomMediaArtQuery, {LibraryUtils::AlbumMediaArtCandidate, rowId}, emitSignal)) {
+                execQuery(mRandomMediaArtQuery, {LibraryUtils::AlbumMediaArtCandidate, 0}, emitSignal);
             }
         }
 
-        Q_INVOKABLE void getRandomMediaArtForAlbum(int albumId)
+        void getMediaArtForCategories(const std::vector<MediaArtRequestQueue::Request>& requests)
         {
             openDb();
             if (!mDb.isOpen()) {
                 return;
             }
 
-            const auto emitSignal = [&](QString&& mediaArt) {
-                emit gotRandomMediaArtForAlbum(albumId, mediaArt);
-            };
+            using Type = MediaArtUtils::RequestType;
+            const Type type = requests.front().type;
+
+            LibraryUtils::MediaArtCandidateCategory category;
+            switch (type) {
+            case Type::Album:
+                category = LibraryUtils::AlbumMediaArtCandidate;
+                break;
+            case Type::Genre:
+                category = LibraryUtils::GenreMediaArtCandidate;
+                break;
+            default:
+                category = LibraryUtils::ArtistMediaArtCandidate;
+            }
 
-            if (albumId > 0) {
-                execQuery(mAlbumQuery, {albumId}, emitSignal);
-            } else {
-                execQuery(mNullAlbumQuery, {}, emitSignal);
+            // Requests are sorted by id, artist can be repeated for several albums
+            QString ids(QString::number(requests.front().id));
+            for (size_t i = 1, max = requests.size(); i < max; ++i) {
+                if (requests[i].id != requests[i - 1].id) {
+                    ids += QLatin1Char(',');
+                    ids += QString::number(requests[i].id);
+                }
             }
-        }
 
-        Q_INVOKABLE void getRandomMediaArtForArtistAndAlbum(int artistId, int albumId)
-        {
-            openDb();
-            if (!mDb.isOpen()) {
-                return;
+            // Candidates of artist are filtered by album in C++, album id 0 stands for tracks without album
+            std::set<std::pair<int, int>> artistAlbums;
+            if (type == Type::ArtistAndAlbum) {
+                for (const auto& request : requests) {
+                    artistAlbums.emplace(request.id, request.albumId);
+                }
             }
 
-            const auto emitSignal = [&](QString&& mediaArt) {
-                emit gotRandomMediaArtForArtistAndAlbum(artistId, albumId, mediaArt);
+            enum
+            {
+                CategoryIdField = UserMediaArtField + 1,
+                CandidateAlbumIdField
             };
 
-            if (artistId > 0 && albumId > 0) {
-                execQuery(mArtistAlbumQuery, {artistId, albumId}, emitSignal);
-            } else if (artistId > 0) {
-                execQuery(mArtistNullAlbumQuery, {artistId}, emitSignal);
-            } else if (albumId > 0) {
-                execQuery(mNullArtistAlbumQuery, {albumId}, emitSignal);
-            } else {
-                execQuery(mNullArtistNullAlbumQuery, {}, emitSignal);
+            QSqlQuery query(mDb);
+            if (!query.exec(QString::fromLatin1("SELECT directoryMediaArt, embeddedMediaArt, albums.userMediaArt, categoryId, media_art_candidates.albumId "
+                                                "FROM media_art_candidates "
+                                                "LEFT JOIN albums ON albums.id = media_art_candidates.albumId "
+                                                "WHERE category = %1 AND categoryId IN (%2)").arg(category).arg(ids))) {
+                qWarning() << query.lastError();
+                return;
             }
-        }
 
-        Q_INVOKABLE void getRandomMediaArtForGenre(int genreId)
-        {
-            openDb();
-            if (!mDb.isOpen()) {
-                return;
+            // Random candidate for each request, picked by reservoir sampling
+            struct Picked
+            {
+                int count;
+                QString mediaArt;
+            };
+            std::map<std::pair<int, int>, Picked> picked;
+            while (query.next()) {
+                std::pair<int, int> key(query.value(CategoryIdField).toInt(), 0);
+                if (type == Type::ArtistAndAlbum) {
+                    key.second = query.value(CandidateAlbumIdField).toInt();
+                    if (artistAlbums.find(key) == artistAlbums.end()) {
+                        continue;
+                    }
+                }
+                Picked& item = picked[key];
+                ++item.count;
+                if (item.count == 1 || std::uniform_int_distribution<int>(1, item.count)(mRandomEngine) == 1) {
+                    item.mediaArt = mediaArtFromQuery(query);
+                }
             }
+            query.finish();
 
-            execQuery(mGenreQuery, {genreId}, [&](QString&& mediaArt) {
-                emit gotRandomMediaArtForGenre(genreId, mediaArt);
-            });
+            for (auto& i : picked) {
+                const int id = i.first.first;
+                const QString& mediaArt = i.second.mediaArt;
+                switch (type) {
+                case Type::Artist:
+                    emit gotRandomMediaArtForArtist(id, mediaArt);
+                    break;
+                case Type::Album:
+                    emit gotRandomMediaArtForAlbum(id, mediaArt);
+                    break;
+                case Type::ArtistAndAlbum:
+                    emit gotRandomMediaArtForArtistAndAlbum(id, i.first.second, mediaArt);
+                    break;
+                case Type::Genre:
+                    emit gotRandomMediaArtForGenre(id, mediaArt);
+                    break;
+                }
+            }
         }
 
     private:
@@ -213,76 +427,22 @@ namespace unplayer
                     }
                 }
 
-                const QString query(QLatin1String("SELECT * FROM ("
-                                                    "SELECT DISTINCT directoryMediaArt, embeddedMediaArt, albums.userMediaArt FROM tracks "
-                                                    "LEFT JOIN tracks_albums ON tracks_albums.trackId = tracks.id "
-                                                    "LEFT JOIN albums ON albums.id = tracks_albums.albumId "
-                                                    "%1 "
-                                                    "WHERE (directoryMediaArt IS NOT NULL OR embeddedMediaArt IS NOT NULL OR albums.userMediaArt IS NOT NULL) %2"
-                                                  ")"
-                                                  "ORDER BY RANDOM() "
-                                                  "LIMIT 1"));
-
+                // Candidates are maintained by LibraryUtils::processChanges(), user media art is taken from albums
                 {
+                    mMaxCandidateRowIdQuery = QSqlQuery(mDb);
+                    if (!mMaxCandidateRowIdQuery.prepare(QLatin1String("SELECT ifnull(MAX(rowid), 0) FROM media_art_candidates"))) {
+                        qWarning() << mMaxCandidateRowIdQuery.lastError();
+                    }
                     mRandomMediaArtQuery = QSqlQuery(mDb);
-                    if (!mRandomMediaArtQuery.prepare(query.arg(QString(), QString()))) {
+                    if (!mRandomMediaArtQuery.prepare(QLatin1String("SELECT directoryMediaArt, embeddedMediaArt, albums.userMediaArt "
+                                                                    "FROM media_art_candidates "
+                                                                    "LEFT JOIN albums ON albums.id = media_art_candidates.albumId "
+                                                                    "WHERE category = ? AND media_art_candidates.rowid >= ? "
+                                                                    "ORDER BY media_art_candidates.rowid "
+                                                                    "LIMIT 1"))) {
                         qWarning() << mRandomMediaArtQuery.lastError();
                     }
                 }
-
-                {
-                    const QLatin1String join("LEFT JOIN tracks_artists ON tracks_artists.trackId = tracks.id ");
-                    mArtistQuery = QSqlQuery(mDb);
-                    if (!mArtistQuery.prepare(query.arg(join, QLatin1String("AND artistId = ?")))) {
-                        qWarning() << mArtistQuery.lastError();
-                    }
-                    mNullArtistQuery = QSqlQuery(mDb);
-                    if (!mNullArtistQuery.prepare(query.arg(join, QLatin1String("AND artistId IS NULL")))) {
-                        qWarning() << mNullArtistQuery.lastError();
-                    }
-                }
-
-                {
-                    mAlbumQuery = QSqlQuery(mDb);
-                    if (!mAlbumQuery.prepare(query.arg(QString(), QLatin1String("AND albumId = ?")))) {
-                        qWarning() << mAlbumQuery.lastError();
-                    }
-                    mNullAlbumQuery = QSqlQuery(mDb);
-                    if (!mNullAlbumQuery.prepare(query.arg(QString(), QLatin1String("AND albumId IS NULL")))) {
-                        qWarning() << mNullAlbumQuery.lastError();
-                    }
-                }
-
-                {
-                    const QLatin1String join("LEFT JOIN tracks_artists ON tracks_artists.trackId = tracks.id ");
-                    mArtistAlbumQuery = QSqlQuery(mDb);
-                    if (!mArtistAlbumQuery.prepare(query.arg(join, QLatin1String("AND artistId = ? AND albumId = ? ")))) {
-                        qWarning() << mArtistAlbumQuery.lastError();
-                    }
-
-                    mArtistNullAlbumQuery = QSqlQuery(mDb);
-                    if (!mArtistNullAlbumQuery.prepare(query.arg(join, QLatin1String("AND artistId = ? AND albumId IS NULL ")))) {
-                        qWarning() << mArtistNullAlbumQuery.lastError();
-                    }
-
-                    mNullArtistAlbumQuery = QSqlQuery(mDb);
-                    if (!mNullArtistAlbumQuery.prepare(query.arg(join, QLatin1String("AND artistId IS NULL AND albumId = ? ")))) {
-                        qWarning() << mNullArtistAlbumQuery.lastError();
-                    }
-
-                    mNullArtistNullAlbumQuery = QSqlQuery(mDb);
-                    if (!mNullArtistNullAlbumQuery.prepare(query.arg(join, QLatin1String("AND artistId IS NULL AND albumId IS NULL ")))) {
-                        qWarning() << mNullArtistNullAlbumQuery.lastError();
-                    }
-                }
-
-                {
-                    mGenreQuery = QSqlQuery(mDb);
-                    if (!mGenreQuery.prepare(query.arg(QLatin1String("JOIN tracks_genres ON tracks_genres.trackId = tracks.id "),
-                                                       QLatin1String("AND genreId = ? ")))) {
-                        qWarning() << mGenreQuery.lastError();
-                    }
-                }
             }
         }
 
@@ -312,43 +472,45 @@ namespace unplayer
             return directoryMediaArt;
         }
 
+        // Emits one of the returned rows, picked at random. Returns false if there were no rows
         template<typename Func>
-        void execQuery(QSqlQuery& query, QVariantList&& bindValues, const Func& emitSignal)
+        bool execQuery(QSqlQuery& query, QVariantList&& bindValues, const Func& emitSignal)
         {
-            if (!bindValues.isEmpty()) {
-                for (const QVariant& value : bindValues) {
-                    query.addBindValue(value);
-                }
+            for (const QVariant& value : bindValues) {
+                query.addBindValue(value);
             }
+            QString mediaArt;
             if (query.exec()) {
-                if (query.next()) {
-                    emitSignal(mediaArtFromQuery(query));
+                // Reservoir sampling, candidates of one category are few
+                int count = 0;
+                while (query.next()) {
+                    ++count;
+                    if (count == 1 || std::uniform_int_distribution<int>(1, count)(mRandomEngine) == 1) {
+                        mediaArt = mediaArtFromQuery(query);
+                    }
                 }
             } else {
                 qWarning() << query.lastError();
             }
             query.finish();
+            if (mediaArt.isEmpty()) {
+                return false;
+            }
+            emitSignal(std::move(mediaArt));
+            return true;
         }
 
+        MediaArtRequestQueue* mRequestQueue;
+
         DatabaseConnectionGuard mDatabaseGuard{QLatin1String("MediaArtProviderWorker"), false};
         QSqlDatabase& mDb = mDatabaseGuard.db;
 
         QSqlQuery mFileMediaArtQuery;
 
+        QSqlQuery mMaxCandidateRowIdQuery;
         QSqlQuery mRandomMediaArtQuery;
 
-        QSqlQuery mArtistQuery;
-        QSqlQuery mNullArtistQuery;
-
-        QSqlQuery mAlbumQuery;
-        QSqlQuery mNullAlbumQuery;
-
-        QSqlQuery mArtistAlbumQuery;
-        QSqlQuery mArtistNullAlbumQuery;
-        QSqlQuery mNullArtistAlbumQuery;
-        QSqlQuery mNullArtistNullAlbumQuery;
-
-        QSqlQuery mGenreQuery;
+        std::mt19937 mRandomEngine{std::random_device{}()};
 
     signals:
         void gotMediaArtForFile(const QString& filePath, const QString& libraryMediaArt, const QString& directoryMediaArt, const QByteArray& embeddedMediaArtData);
@@ -362,6 +524,11 @@ namespace unplayer
     namespace
     {
         MediaArtUtils* pInstance = nullptr;
+
+        QString thumbnailFileName(const QString& mediaArt)
+        {
+            return QString::fromLatin1(QCryptographicHash::hash(mediaArt.toUtf8(), QCryptographicHash::Md5).toHex());
+        }
     }
 
     MediaArtUtils* MediaArtUtils::instance()
@@ -386,6 +553,69 @@ namespace unplayer
         return directory;
     }
 
+    const QString& MediaArtUtils::thumbnailsDirectory()
+    {
+        static const QString directory(QString::fromLatin1("%1/media-art-thumbnails").arg(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)));
+        return directory;
+    }
+
+    QString MediaArtUtils::thumbnailPath(const QString& mediaArt, int size)
+    {
+        return QString::fromLatin1("%1/%2/%3").arg(thumbnailsDirectory(),
+                                                  QString::number(size),
+                                                  thumbnailFileName(mediaArt));
+    }
+
+    void MediaArtUtils::removeThumbnails(const QString& mediaArt)
+    {
+        for (int size : thumbnailSizes()) {
+            const QString filePath(thumbnailPath(mediaArt, size));
+            if (QFile::exists(filePath) && !QFile::remove(filePath)) {
+                qWarning() << "Failed to remove thumbnail:" << filePath;
+            }
+        }
+    }
+
+    void MediaArtUtils::removeThumbnailsExcept(const std::unordered_set<QString>& mediaArt)
+    {
+        std::unordered_set<QString> names;
+        names.reserve(mediaArt.size());
+        for (const QString& filePath : mediaArt) {
+            names.insert(thumbnailFileName(filePath));
+        }
+
+        int removed = 0;
+        for (int size : thumbnailSizes()) {
+            const QFileInfoList files(QDir(QString::fromLatin1("%1/%2").arg(thumbnailsDirectory(), QString::number(size))).entryInfoList(QDir::Files));
+            for (const QFileInfo& info : files) {
+                if (!contains(names, info.fileName())) {
+                    if (QFile::remove(info.filePath())) {
+                        ++removed;
+                    } else {
+                        qWarning() << "Failed to remove thumbnail:" << info.filePath();
+                    }
+                }
+            }
+        }
+        if (removed > 0) {
+            qInfo("Removed %d orphaned thumbnails", removed);
+        }
+    }
+
+    const std::vector<int>& MediaArtUtils::thumbnailSizes()
+    {
+        // List items, grid cells, page headers and cover
+        static const std::vector<int> sizes{128, 256, 512, 1024};
+        return sizes;
+    }
+
+    const std::vector<int>& MediaArtUtils::pregeneratedThumbnailSizes()
+    {
+        // Grid cells and cover
+        static const std::vector<int> sizes{256, 1024};
+        return sizes;
+    }
+
     QString MediaArtUtils::findMediaArtForDirectory(const QString& directoryPath, std::unordered_map<QString, QString>& directoriesMediaArtCache)
     {
         {
@@ -480,45 +710,24 @@ namespace unplayer
 
     void MediaArtUtils::setUserMediaArt(int albumId, const QString& mediaArt)
     {
-        if (!LibraryUtils::instance()->isDatabaseInitialized()) {
-            return;
-        }
-
-        if (!QDir().mkpath(mediaArtDirectory())) {
-            qWarning() << "Failed to create media art directory:" << mediaArtDirectory();
-            return;
-        }
-
-        QString id(QUuid::createUuid().toString());
-        id.remove(0, 1);
-        id.chop(1);
-
-        const QString newFilePath(QString::fromLatin1("%1/%2.%3")
-                                  .arg(mediaArtDirectory(), id, QFileInfo(mediaArt).suffix()));
-
-        if (!QFile::copy(mediaArt, newFilePath)) {
-            qWarning() << "Failed to copy file from" << mediaArt << "to" << newFilePath;
-            return;
-        }
+        // Executed in background on writer connection, mediaArtChanged() is emitted when database is changed
+        LibraryUtils::instance()->setUserMediaArt(albumId, mediaArt);
+    }
 
-        QSqlQuery query;
-        if (query.prepare(QLatin1String("UPDATE albums SET userMediaArt = ? WHERE id = ?"))) {
-            query.addBindValue(newFilePath);
-            query.addBindValue(albumId);
-            if (query.exec()) {
-                emit mediaArtChanged();
-            } else {
-                qWarning() << "Failed to update media art in the database:" << query.lastError();
-            }
-        } else {
-            qWarning() << query.lastError();
+    void MediaArtUtils::getMediaArtForFile(const QString& filePath, const QString& albumForUserMediaArt, bool onlyExtractEmbedded)
+    {
+        createWorker();
+        if (mRequestQueue->addFileRequest({filePath, albumForUserMediaArt, onlyExtractEmbedded})) {
+            startWorker();
         }
     }
 
-    void MediaArtUtils::getMediaArtForFile(const QString& filePath, const QString& albumForUserMediaArt, bool onlyExtractEmbedded)
+    void MediaArtUtils::prefetchMediaArtForFile(const QString& filePath, const QString& albumForUserMediaArt, bool onlyExtractEmbedded)
     {
         createWorker();
-        mWorker->metaObject()->invokeMethod(mWorker, "getMediaArtForFile", Q_ARG(QString, filePath), Q_ARG(QString, albumForUserMediaArt), Q_ARG(bool, onlyExtractEmbedded));
+        if (mRequestQueue->addPrefetchRequest({filePath, albumForUserMediaArt, onlyExtractEmbedded})) {
+            startWorker();
+        }
     }
 
     void MediaArtUtils::getRandomMediaArt(uintptr_t requestId)
@@ -527,28 +736,44 @@ namespace unplayer
         mWorker->metaObject()->invokeMethod(mWorker, "getRandomMediaArt", Q_ARG(uintptr_t, requestId));
     }
 
-    void MediaArtUtils::getRandomMediaArtForArtist(int artistId)
+    void MediaArtUtils::getRandomMediaArtForArtist(int artistId, const QObject* requester)
     {
-        createWorker();
-        mWorker->metaObject()->invokeMethod(mWorker, "getRandomMediaArtForArtist", Q_ARG(int, artistId));
+        addRequest(RequestType::Artist, artistId, 0, requester);
     }
 
-    void MediaArtUtils::getRandomMediaArtForAlbum(int albumId)
+    void MediaArtUtils::getRandomMediaArtForAlbum(int albumId, const QObject* requester)
     {
-        createWorker();
-        mWorker->metaObject()->invokeMethod(mWorker, "getRandomMediaArtForAlbum", Q_ARG(int, albumId));
+        addRequest(RequestType::Album, albumId, 0, requester);
     }
 
-    void MediaArtUtils::getRandomMediaArtForArtistAndAlbum(int artistId, int albumId)
+    void MediaArtUtils::getRandomMediaArtForArtistAndAlbum(int artistId, int albumId, const QObject* requester)
     {
-        createWorker();
-        mWorker->metaObject()->invokeMethod(mWorker, "getRandomMediaArtForArtistAndAlbum", Q_ARG(int, artistId), Q_ARG(int, albumId));
+        addRequest(RequestType::ArtistAndAlbum, artistId, albumId, requester);
     }
 
-    void MediaArtUtils::getRandomMediaArtForGenre(int genreId)
+    void MediaArtUtils::getRandomMediaArtForGenre(int genreId, const QObject* requester)
     {
-        createWorker();
-        mWorker->metaObject()->invokeMethod(mWorker, "getRandomMediaArtForGenre", Qt::QueuedConnection, Q_ARG(int, genreId));
+        addRequest(RequestType::Genre, genreId, 0, requester);
+    }
+
+    bool MediaArtUtils::cancelRandomMediaArtForArtist(int artistId, const QObject* requester)
+    {
+        return cancelRequest(RequestType::Artist, artistId, 0, requester);
+    }
+
+    bool MediaArtUtils::cancelRandomMediaArtForAlbum(int albumId, const QObject* requester)
+    {
+        return cancelRequest(RequestType::Album, albumId, 0, requester);
+    }
+
+    bool MediaArtUtils::cancelRandomMediaArtForArtistAndAlbum(int artistId, int albumId, const QObject* requester)
+    {
+        return cancelRequest(RequestType::ArtistAndAlbum, artistId, albumId, requester);
+    }
+
+    bool MediaArtUtils::cancelRandomMediaArtForGenre(int genreId, const QObject* requester)
+    {
+        return cancelRequest(RequestType::Genre, genreId, 0, requester);
     }
 
     MediaArtUtils::MediaArtUtils(QObject* parent)
@@ -565,6 +790,35 @@ namespace unplayer
         }
     }
 
+    void MediaArtUtils::addRequest(RequestType type, int id, int albumId, const QObject* requester)
+    {
+        createWorker();
+        if (mRequesters.insert(requester).second) {
+            // Requests of destroyed models are not needed anymore
+            QObject::connect(requester, &QObject::destroyed, this, [=] {
+                mRequesters.erase(requester);
+                mRequestQueue->removeRequester(requester);
+            });
+        }
+        if (mRequestQueue->addRequest({type, id, albumId}, requester)) {
+            startWorker();
+        }
+    }
+
+    bool MediaArtUtils::cancelRequest(RequestType type, int id, int albumId, const QObject* requester)
+    {
+        if (!mRequestQueue) {
+            return false;
+        }
+        return mRequestQueue->removeRequest({type, id, albumId}, requester);
+    }
+
+    void MediaArtUtils::startWorker()
+    {
+        // Requests added until worker thread gets to it are processed together
+        mWorker->metaObject()->invokeMethod(mWorker, "processRequests", Qt::QueuedConnection);
+    }
+
     void MediaArtUtils::createWorker()
     {
         if (!mWorker) {
@@ -572,7 +826,8 @@ namespace unplayer
 
             mWorkerThread = new QThread(this);
 
-            mWorker = new MediaArtUtilsWorker();
+            mRequestQueue.reset(new MediaArtRequestQueue());
+            mWorker = new MediaArtUtilsWorker(mRequestQueue.get());
             mWorker->moveToThread(mWorkerThread);
             QObject::connect(mWorkerThread, &QThread::finished, mWorker, &QObject::deleteLater);
 
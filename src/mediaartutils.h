@@ -20,7 +20,10 @@
 #define UNPLAYER_MEDIAARTPROVIDER_H
 
 #include <cstdint>
+#include <memory>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include <QObject>
 #include <QString>
@@ -31,6 +34,7 @@ class QThread;
 
 namespace unplayer
 {
+    class MediaArtRequestQueue;
     class MediaArtUtilsWorker;
 
     class MediaArtUtils final : public QObject
@@ -41,6 +45,17 @@ namespace unplayer
         static void deleteInstance();
 
         static const QString& mediaArtDirectory();
+
+        // Downscaled copies of media art files, see ThumbnailImageProvider
+        static const QString& thumbnailsDirectory();
+        static QString thumbnailPath(const QString& mediaArt, int size);
+        static void removeThumbnails(const QString& mediaArt);
+        // Removes thumbnails of files that are not in mediaArt set
+        static void removeThumbnailsExcept(const std::unordered_set<QString>& mediaArt);
+        static const std::vector<int>& thumbnailSizes();
+        // Sizes that are created in advance after library update
+        static const std::vector<int>& pregeneratedThumbnailSizes();
+
         static QString findMediaArtForDirectory(const QString& directoryPath, std::unordered_map<QString, QString>& directoriesMediaArtCache);
         static bool isMediaArtFile(const QFileInfo& fileInfo);
         static bool isMediaArtFile(const QFileInfo& fileInfo, const QString& suffix);
@@ -51,21 +66,52 @@ namespace unplayer
         Q_INVOKABLE void setUserMediaArt(int albumId, const QString& mediaArt);
 
         void getMediaArtForFile(const QString& filePath, const QString& albumForUserMediaArt, bool onlyExtractEmbedded);
+        // Same as getMediaArtForFile(), but processed after all other requests
+        void prefetchMediaArtForFile(const QString& filePath, const QString& albumForUserMediaArt, bool onlyExtractEmbedded);
 
         void getRandomMediaArt(uintptr_t requestId);
-        void getRandomMediaArtForArtist(int artistId);
-        void getRandomMediaArtForAlbum(int albumId);
-        void getRandomMediaArtForArtistAndAlbum(int artistId, int albumId);
-        void getRandomMediaArtForGenre(int genreId);
+
+        /*
+         * Identical pending requests are merged and processed in batches. Pending requests
+         * are dropped when requester is destroyed. Results are delivered to all receivers of signals
+         */
+        void getRandomMediaArtForArtist(int artistId, const QObject* requester);
+        void getRandomMediaArtForAlbum(int albumId, const QObject* requester);
+        void getRandomMediaArtForArtistAndAlbum(int artistId, int albumId, const QObject* requester);
+        void getRandomMediaArtForGenre(int genreId, const QObject* requester);
+
+        /*
+         * Drop pending request of requester, e.g. when row was scrolled away.
+         * Return false if request is not pending, i.e. it is already processed or is being processed
+         */
+        bool cancelRandomMediaArtForArtist(int artistId, const QObject* requester);
+        bool cancelRandomMediaArtForAlbum(int albumId, const QObject* requester);
+        bool cancelRandomMediaArtForArtistAndAlbum(int artistId, int albumId, const QObject* requester);
+        bool cancelRandomMediaArtForGenre(int genreId, const QObject* requester);
 
     private:
         explicit MediaArtUtils(QObject* parent);
         ~MediaArtUtils();
 
         void createWorker();
+        enum class RequestType
+        {
+            Artist,
+            Album,
+            ArtistAndAlbum,
+            Genre
+        };
+        friend class MediaArtRequestQueue;
+        friend class MediaArtUtilsWorker;
+
+        void addRequest(RequestType type, int id, int albumId, const QObject* requester);
+        bool cancelRequest(RequestType type, int id, int albumId, const QObject* requester);
+        void startWorker();
 
         QThread* mWorkerThread = nullptr;
         MediaArtUtilsWorker* mWorker = nullptr;
+        std::unique_ptr<MediaArtRequestQueue> mRequestQueue;
+        std::unordered_set<const QObject*> mRequesters;
 
     signals:
         void gotMediaArtForFile(const QString& filePath, const QString& libraryMediaArt, const QString& directoryMediaArt, const QByteArray& embeddedMediaArtData);
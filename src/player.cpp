@@ -111,13 +111,8 @@ namespace unplayer
 
     void Player::saveState() const
     {
-        QStringList tracks;
-        tracks.reserve(static_cast<int>(mQueue->tracks().size()));
-        for (const auto& track : mQueue->tracks()) {
-            tracks.push_back(track->url.toString());
-        }
-        Settings::instance()->savePlayerState(tracks,
-                                              mQueue->currentIndex(),
+        mQueue->saveState();
+        Settings::instance()->savePlayerState(mQueue->currentIndex(),
                                               mQueue->isShuffle(),
                                               mQueue->repeatMode(),
                                               position(),
@@ -129,10 +124,16 @@ namespace unplayer
         mQueue->setShuffle(Settings::instance()->shuffle());
         mQueue->setRepeatMode(Settings::instance()->repeatMode());
         mStopAfterEos = Settings::instance()->stopAfterEos();
-        const auto tracks(Settings::instance()->queueTracks());
-        if (!tracks.isEmpty()) {
-            mRestoringTracks = true;
-            mQueue->addTracksFromUrls(tracks, true, Settings::instance()->queuePosition());
+        const int queuePosition = Settings::instance()->queuePosition();
+        mRestoringTracks = true;
+        if (!mQueue->restoreState(queuePosition)) {
+            // Queue is saved in settings by previous versions
+            const auto tracks(Settings::instance()->queueTracks());
+            if (tracks.isEmpty()) {
+                mRestoringTracks = false;
+            } else {
+                mQueue->addTracksFromUrls(tracks, true, queuePosition);
+            }
         }
     }
 
@@ -223,13 +224,13 @@ namespace unplayer
                 mpris->setCanGoNext(false);
                 mpris->setCanGoPrevious(false);
                 mpris->setCanSeek(false);
-                mpris->setMetadata(QVariantMap());
             } else {
-                const QueueTrack* track = mQueue->tracks()[static_cast<size_t>(mQueue->currentIndex())].get();
-                qInfo() << "track =" << track->url;
+                const QueueTrack* track = &mQueue->tracks()[static_cast<size_t>(mQueue->currentIndex())];
+                const QUrl url(track->url());
+                qInfo() << "track =" << url;
 
                 mSettingNewTrack = true;
-                setMedia(track->url);
+                setMedia(url);
                 mSettingNewTrack = false;
 
                 if (mRestoringTracks) {
@@ -247,6 +248,15 @@ namespace unplayer
                 mpris->setCanGoNext(true);
                 mpris->setCanGoPrevious(true);
                 mpris->setCanSeek(true);
+            }
+        });
+
+        // Metadata of current track can be resolved after playback has started
+        QObject::connect(mQueue, &Queue::currentTrackInfoChanged, this, [=]() {
+            if (mQueue->currentIndex() == -1) {
+                mpris->setMetadata(QVariantMap());
+            } else {
+                const QueueTrack* track = &mQueue->tracks()[static_cast<size_t>(mQueue->currentIndex())];
                 mpris->setMetadata({{Mpris::metadataToString(Mpris::TrackId), track->getTrackId()},
                                     {Mpris::metadataToString(Mpris::Title), track->title},
                                     {Mpris::metadataToString(Mpris::Length), track->duration * 1000000LL},
@@ -270,7 +280,7 @@ namespace unplayer
         QObject::connect(mpris, &MprisPlayer::setPositionRequested, this, [=](const QDBusObjectPath& trackId, qint64 position) {
             if (state() != StoppedState &&
                     mQueue->currentIndex() != -1 &&
-                    trackId.path() == mQueue->tracks()[static_cast<size_t>(mQueue->currentIndex())]->getTrackId()) {
+                    trackId.path() == mQueue->tracks()[static_cast<size_t>(mQueue->currentIndex())].getTrackId()) {
                 setPosition(position / 1000);
             }
         });
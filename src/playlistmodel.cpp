@@ -23,11 +23,11 @@
 #include <set>
 #include <unordered_map>
 
-#include <QtConcurrentRun>
 
 #include "modelutils.h"
 #include "playlistutils.h"
 #include "stdutils.h"
+#include "threadpool.h"
 #include "tracksquery.h"
 #include "utilsfunctions.h"
 
@@ -106,7 +106,7 @@ namespace unplayer
 
         removeRows(0, rowCount());
 
-        auto future = QtConcurrent::run([playlistFilePath]() {
+        auto future = ThreadPool::interactive()->run([playlistFilePath]() {
             auto tracks(std::make_shared<std::vector<PlaylistTrack>>(PlaylistUtils::parsePlaylist(playlistFilePath)));
 
             std::set<QString> tracksToQuery;
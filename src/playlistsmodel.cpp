@@ -22,11 +22,11 @@
 
 #include <QDir>
 #include <QFileInfo>
-#include <QtConcurrentRun>
 
 #include "modelutils.h"
 #include "playlistutils.h"
 #include "stdutils.h"
+#include "threadpool.h"
 #include "utilsfunctions.h"
 
 namespace unplayer
@@ -104,7 +104,7 @@ namespace unplayer
     {
         setLoading(true);
 
-        auto future = QtConcurrent::run([]() {
+        auto future = ThreadPool::interactive()->run([]() {
             std::vector<PlaylistsModelItem> playlists;
             const QList<QFileInfo> files(QDir(PlaylistUtils::instance()->playlistsDirectoryPath())
                                          .entryInfoList(PlaylistUtils::playlistsNameFilters(), QDir::Files));
@@ -0,0 +1,65 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2020 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "querycancellationtoken.h"
+
+#include <algorithm>
+
+#include <sqlite3.h>
+
+#include "sqliteutils.h"
+
+namespace unplayer
+{
+    bool QueryCancellationToken::isCancelled() const
+    {
+        return mCancelled;
+    }
+
+    void QueryCancellationToken::cancel()
+    {
+        const std::lock_guard<std::mutex> lock(mMutex);
+        mCancelled = true;
+        for (sqlite3* handle : mHandles) {
+            sqlite3_interrupt(handle);
+        }
+    }
+
+    bool QueryCancellationToken::attach(const QSqlDatabase& db)
+    {
+        sqlite3* handle = sqliteutils::handle(db);
+        const std::lock_guard<std::mutex> lock(mMutex);
+        if (mCancelled) {
+            return false;
+        }
+        if (handle) {
+            mHandles.push_back(handle);
+        }
+        return true;
+    }
+
+    void QueryCancellationToken::detach(const QSqlDatabase& db)
+    {
+        sqlite3* handle = sqliteutils::handle(db);
+        const std::lock_guard<std::mutex> lock(mMutex);
+        const auto found(std::find(mHandles.begin(), mHandles.end(), handle));
+        if (found != mHandles.end()) {
+            mHandles.erase(found);
+        }
+    }
+}
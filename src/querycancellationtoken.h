@@ -0,0 +1,58 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2020 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_QUERYCANCELLATIONTOKEN_H
+#define UNPLAYER_QUERYCANCELLATIONTOKEN_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+class QSqlDatabase;
+struct sqlite3;
+
+namespace unplayer
+{
+    /**
+     * @brief Shared between model and its background queries.
+     * Cancelling it interrupts SQLite statements that are executed on attached connections
+     */
+    class QueryCancellationToken
+    {
+    public:
+        bool isCancelled() const;
+        void cancel();
+
+        /**
+         * @brief Must be called from query thread after connection is opened
+         * @return false if token is already cancelled
+         */
+        bool attach(const QSqlDatabase& db);
+        /**
+         * @brief Must be called before connection is closed
+         */
+        void detach(const QSqlDatabase& db);
+
+    private:
+        std::atomic_bool mCancelled{false};
+        std::mutex mMutex;
+        std::vector<sqlite3*> mHandles;
+    };
+}
+
+#endif // UNPLAYER_QUERYCANCELLATIONTOKEN_H
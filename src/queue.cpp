@@ -19,6 +19,7 @@
 #include "queue.h"
 
 #include <algorithm>
+#include <atomic>
 #include <functional>
 #include <limits>
 #include <random>
@@ -26,15 +27,20 @@
 #include <unordered_map>
 #include <unordered_set>
 
+#include <QBuffer>
 #include <QCoreApplication>
+#include <QCryptographicHash>
 #include <QDateTime>
 #include <QDebug>
 #include <QElapsedTimer>
 #include <QFileInfo>
+#include <QGuiApplication>
+#include <QImageReader>
 #include <QMimeDatabase>
+#include <QRunnable>
+#include <QScreen>
+#include <QTimer>
 #include <QUrl>
-#include <QUuid>
-#include <QtConcurrentRun>
 
 #include "fileutils.h"
 #include "libraryutils.h"
@@ -43,6 +49,7 @@
 #include "settings.h"
 #include "stdutils.h"
 #include "tagutils.h"
+#include "threadpool.h"
 #include "tracksquery.h"
 #include "utilsfunctions.h"
 
@@ -51,6 +58,29 @@ namespace unplayer
     namespace
     {
         const QLatin1String dbConnectionName("unplayer_queue");
+        const QLatin1String validationDbConnectionName("unplayer_queue_validation");
+
+        // Current, previous and a few upcoming tracks
+        const size_t maxCachedMediaArtCount = 5;
+
+        // MD5 of embedded media art data, used as QueueImageProvider id
+        QString mediaArtDataId(const QByteArray& data)
+        {
+            if (data.isEmpty()) {
+                return {};
+            }
+            return QString::fromLatin1(QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex());
+        }
+
+        // Number of files which tags are extracted in one task and published in one batch
+        const size_t tagsExtractionChunkSize = 50;
+        const int maxRunningTagsExtractions = 1;
+
+        // If more contiguous ranges are removed, queue is compacted in one pass and model is reset
+        const size_t maxRemovedRangesCount = 10;
+
+        // Used to generate MPRIS track ids, tracks can be created in worker threads
+        std::atomic<quint32> lastTrackId(0);
 
         size_t randomIndex(size_t count)
         {
@@ -71,50 +101,63 @@ namespace unplayer
             return url;
         }
 
-        class TracksAdder
+        // Makes equal strings share the same data
+        class StringPool
         {
         public:
-            static std::vector<std::shared_ptr<QueueTrack>> addTracksFromUrls(const QStringList& trackUrls, std::unordered_map<QUrl, std::shared_ptr<QueueTrack>>&& oldTracks)
+            void intern(QString& string)
             {
-                qInfo("Start adding tracks from urls, count = %d, old tracks count = %zu", trackUrls.size(), oldTracks.size());
-                QElapsedTimer timer;
-                timer.start();
-
-                auto createTracksResult(createTracks(trackUrls, std::move(oldTracks)));
-
-                if (!queryTracksByPaths(std::move(createTracksResult.tracksToQuery), createTracksResult.tracksToQueryMap, dbConnectionName)) {
-                    return {};
+                if (string.isEmpty()) {
+                    return;
                 }
+                const auto inserted(mStrings.insert(string));
+                if (!inserted.second) {
+                    string = *inserted.first;
+                }
+            }
 
-                extractTrackInfos(std::move(createTracksResult.tracksToQueryMap));
-
-                qInfo("Finished adding tracks: %lldms", static_cast<long long>(timer.elapsed()));
-
-                return std::move(createTracksResult.newTracks);
+            void intern(QueueTrack& track)
+            {
+                intern(track.artist);
+                intern(track.album);
             }
 
         private:
-            struct CreateTracksResult
+            std::unordered_set<QString> mStrings;
+        };
+
+        class TracksAdder
+        {
+        public:
+            struct Result
             {
-                std::vector<std::shared_ptr<QueueTrack>> newTracks;
-                std::set<QString> tracksToQuery;
-                std::unordered_multimap<QString, QueueTrack*> tracksToQueryMap;
+                std::vector<QueueTrack> tracks;
+                // Local files which metadata is not known yet
+                std::vector<UnresolvedQueueTrack> unresolvedTracks;
             };
 
-            static CreateTracksResult createTracks(const QStringList& trackUrls, std::unordered_map<QUrl, std::shared_ptr<QueueTrack>> oldTracks)
+            struct LibraryQueryResult
             {
-                qInfo("Start creating tracks, count=%d", trackUrls.size());
+                std::vector<ResolvedQueueTrack> resolvedTracks;
+                // Tracks that are not in library, sorted by file path
+                std::vector<UnresolvedQueueTrack> unresolvedTracks;
+            };
+
+            /**
+             * @brief Creates tracks without querying their metadata. Local files get file name as title
+             * and are returned in unresolvedTracks
+             */
+            static Result addTracksFromUrls(const QStringList& trackUrls, std::unordered_map<QString, QueueTrack>&& oldTracks)
+            {
+                qInfo("Start creating tracks, count=%d, old tracks count=%zu", trackUrls.size(), oldTracks.size());
 
                 QElapsedTimer timer;
                 timer.start();
 
-                std::vector<std::shared_ptr<QueueTrack>> newTracks;
+                std::vector<QueueTrack> newTracks;
                 newTracks.reserve(static_cast<size_t>(trackUrls.size()));
 
-                std::set<QString> tracksToQuery;
-
-                std::unordered_multimap<QString, QueueTrack*> tracksToQueryMap;
-                tracksToQueryMap.reserve(static_cast<size_t>(trackUrls.size()));
+                std::vector<UnresolvedQueueTrack> unresolvedTracks;
 
                 std::unordered_set<QString> playlists;
 
@@ -134,12 +177,12 @@ namespace unplayer
                             if (playlistTrack.url.isLocalFile()) {
                                 processTrack(playlistTrack.url);
                             } else {
-                                newTracks.push_back(std::make_shared<QueueTrack>(playlistTrack.url,
-                                                                                 playlistTrack.title,
-                                                                                 playlistTrack.duration,
-                                                                                 playlistTrack.artist,
-                                                                                 playlistTrack.album,
-                                                                                 false));
+                                newTracks.emplace_back(playlistTrack.url,
+                                                       playlistTrack.title,
+                                                       playlistTrack.duration,
+                                                       playlistTrack.artist,
+                                                       playlistTrack.album,
+                                                       false);
                             }
                         }
                     }
@@ -151,21 +194,30 @@ namespace unplayer
                         if (PlaylistUtils::isPlaylistExtension(fileInfo.suffix())) {
                             processPlaylist(fileInfo);
                         } else {
-                            const auto found(oldTracks.find(url));
-                            if (found == oldTracksEnd) {
-                                if (fileInfo.isFile() && fileInfo.isReadable()) {
-                                    newTracks.push_back(std::make_shared<QueueTrack>(url, QString()));
-                                    const auto inserted(tracksToQuery.insert(url.path()));
-                                    tracksToQueryMap.emplace(*inserted.first, newTracks.back().get());
-                                } else {
-                                    qWarning() << "File is not readable:" << fileInfo.filePath();
+                            const auto found(oldTracks.find(url.path()));
+                            if (found != oldTracksEnd) {
+                                // New track is created instead of copying old one so that track ids stay ascending
+                                const QueueTrack& oldTrack = found->second;
+                                newTracks.emplace_back(url,
+                                                       oldTrack.title,
+                                                       oldTrack.duration,
+                                                       oldTrack.artist,
+                                                       oldTrack.album,
+                                                       oldTrack.filteredSingleAlbum,
+                                                       oldTrack.libraryId);
+                                // Metadata of old track may be still being resolved
+                                if (oldTrack.duration < 0) {
+                                    unresolvedTracks.push_back({newTracks.back().id(), oldTrack.filePath});
                                 }
+                            } else if (fileInfo.isFile() && fileInfo.isReadable()) {
+                                newTracks.emplace_back(url, fileInfo.fileName());
+                                unresolvedTracks.push_back({newTracks.back().id(), url.path()});
                             } else {
-                                newTracks.push_back(found->second);
+                                qWarning() << "File is not readable:" << fileInfo.filePath();
                             }
                         }
                     } else {
-                        newTracks.push_back(std::make_shared<QueueTrack>(url, url.toString()));
+                        newTracks.emplace_back(url, url.toString());
                     }
                 };
 
@@ -179,39 +231,75 @@ namespace unplayer
                     }
                 }
 
+                StringPool stringPool;
+                for (QueueTrack& track : newTracks) {
+                    stringPool.intern(track);
+                }
+
                 qInfo("Finished creating tracks: %lldms", static_cast<long long>(timer.elapsed()));
 
-                return {std::move(newTracks),
-                        std::move(tracksToQuery),
-                        std::move(tracksToQueryMap)};
+                return {std::move(newTracks), std::move(unresolvedTracks)};
             }
 
-            static void extractTrackInfos(std::unordered_multimap<QString, QueueTrack*> tracksToQueryMap)
+            static LibraryQueryResult queryLibrary(std::vector<UnresolvedQueueTrack>&& tracks)
             {
-                if (tracksToQueryMap.empty()) {
-                    return;
+                std::vector<ResolvedQueueTrack> resolvedTracks;
+                resolvedTracks.reserve(tracks.size());
+
+                std::set<QString> tracksToQuery;
+                std::unordered_multimap<QString, ResolvedQueueTrack*> tracksToQueryMap;
+                tracksToQueryMap.reserve(tracks.size());
+
+                for (UnresolvedQueueTrack& track : tracks) {
+                    resolvedTracks.push_back({track.id, QString(), -1, QString(), QString()});
+                    const auto inserted(tracksToQuery.insert(std::move(track.filePath)));
+                    tracksToQueryMap.emplace(*inserted.first, &resolvedTracks.back());
                 }
 
-                qInfo("Start extracting tags, count=%zu", tracksToQueryMap.size());
+                if (!queryTracksByPaths(std::move(tracksToQuery), tracksToQueryMap, dbConnectionName)) {
+                    return {};
+                }
 
-                QElapsedTimer timer;
-                timer.start();
+                // Tracks found in library were removed from the map
+                std::vector<UnresolvedQueueTrack> unresolvedTracks;
+                unresolvedTracks.reserve(tracksToQueryMap.size());
+                for (const auto& i : tracksToQueryMap) {
+                    unresolvedTracks.push_back({i.second->id, i.first});
+                }
+                std::sort(unresolvedTracks.begin(), unresolvedTracks.end(), [](const UnresolvedQueueTrack& first, const UnresolvedQueueTrack& second) {
+                    return first.filePath < second.filePath;
+                });
+
+                resolvedTracks.erase(std::remove_if(resolvedTracks.begin(), resolvedTracks.end(), [](const ResolvedQueueTrack& track) {
+                    return track.duration < 0;
+                }), resolvedTracks.end());
+
+                return {std::move(resolvedTracks), std::move(unresolvedTracks)};
+            }
+
+            // Tracks with the same file must be adjacent
+            static std::vector<ResolvedQueueTrack> extractTags(const std::vector<UnresolvedQueueTrack>& tracks)
+            {
+                std::vector<ResolvedQueueTrack> resolvedTracks;
+                resolvedTracks.reserve(tracks.size());
+
+                StringPool stringPool;
 
                 QString prevFilePath;
                 tagutils::Info info;
                 QString artist;
                 QString album;
-                for (const auto& i : tracksToQueryMap) {
+                for (const UnresolvedQueueTrack& track : tracks) {
                     if (!qApp) {
                         break;
                     }
 
-                    const QString& filePath = i.first;
-                    if (filePath != prevFilePath) {
-                        prevFilePath = filePath;
+                    if (track.filePath != prevFilePath) {
+                        prevFilePath = track.filePath;
 
-                        const QFileInfo fileInfo(filePath);
-                        info = tagutils::getTrackInfo(filePath, fileutils::extensionFromSuffix(fileInfo.suffix())).value_or(tagutils::Info{});
+                        const QFileInfo fileInfo(track.filePath);
+                        // Media art is extracted later only for current track
+                        info = tagutils::getTrackInfo(track.filePath, fileutils::extensionFromSuffix(fileInfo.suffix()), false).value_or(tagutils::Info{});
                         if (info.title.isEmpty()) {
                             info.title = fileInfo.fileName();
                         }
@@ -219,17 +307,67 @@ namespace unplayer
                         info.artists.removeDuplicates();
                         artist = joinStrings(info.artists);
                         album = joinStrings(info.albums);
+                        stringPool.intern(artist);
+                        stringPool.intern(album);
                     }
-                    QueueTrack* track = i.second;
-                    track->title = info.title;
-                    track->duration = info.duration;
-                    track->artist = std::move(artist);
-                    track->album = std::move(album);
+
+                    resolvedTracks.push_back({track.id, info.title, info.duration, artist, album});
                 }
 
-                qInfo("Finished extracting tags: %lldms", static_cast<long long>(timer.elapsed()));
+                return resolvedTracks;
             }
         };
+
+        struct RestoredTracksValidation
+        {
+            std::unordered_set<QString> missingFiles;
+            // Tracks which metadata in library differs from saved one
+            std::unordered_map<QString, QueueTrack> changedTracks;
+        };
+
+        RestoredTracksValidation checkRestoredTracks(std::vector<QueueTrack>&& tracks)
+        {
+            qInfo("Start validating restored tracks, count=%zu", tracks.size());
+
+            QElapsedTimer timer;
+            timer.start();
+
+            RestoredTracksValidation result;
+
+            std::set<QString> tracksToQuery;
+            std::unordered_multimap<QString, QueueTrack*> tracksToQueryMap;
+            tracksToQueryMap.reserve(tracks.size());
+
+            for (QueueTrack& track : tracks) {
+                if (!qApp) {
+                    return {};
+                }
+                if (QFileInfo::exists(track.filePath)) {
+                    const auto inserted(tracksToQuery.insert(track.filePath));
+                    tracksToQueryMap.emplace(*inserted.first, &track);
+                } else {
+                    result.missingFiles.insert(track.filePath);
+                }
+            }
+
+            const std::vector<QueueTrack> savedTracks(tracks);
+            if (queryTracksByPaths(std::move(tracksToQuery), tracksToQueryMap, validationDbConnectionName)) {
+                for (size_t i = 0, max = tracks.size(); i < max; ++i) {
+                    QueueTrack& track = tracks[i];
+                    const QueueTrack& saved = savedTracks[i];
+                    if (track.title != saved.title ||
+                            track.duration != saved.duration ||
+                            track.artist != saved.artist ||
+                            track.album != saved.album) {
+                        result.changedTracks.emplace(track.filePath, std::move(track));
+                    }
+                }
+            }
+
+            qInfo("Finished validating restored tracks: %lldms", static_cast<long long>(timer.elapsed()));
+
+            return result;
+        }
     }
 
     QueueTrack::QueueTrack(const QUrl& url,
@@ -237,13 +375,17 @@ namespace unplayer
                            int duration,
                            const QString& artist,
                            const QString& album,
-                           bool filteredSingleAlbum)
-        : url(url),
+                           bool filteredSingleAlbum,
+                           int libraryId)
+        : filePath(url.isLocalFile() ? url.path() : QString()),
+          remoteUrl(url.isLocalFile() ? QUrl() : url),
           title(title),
-          duration(duration),
           artist(artist),
           album(album),
-          filteredSingleAlbum(filteredSingleAlbum)
+          duration(duration),
+          libraryId(libraryId),
+          filteredSingleAlbum(filteredSingleAlbum),
+          mTrackId(++lastTrackId)
     {
     }
 
@@ -253,60 +395,103 @@ namespace unplayer
 
     }
 
-    void QueueTrack::initTrackId() const
+    QUrl QueueTrack::url() const
     {
-        mTrackId = QLatin1Char('/');
-        mTrackId += QUuid::createUuid().toString().remove(0, 1).remove(QLatin1Char('-'));
-        mTrackId.chop(1);
+        if (isLocalFile()) {
+            return QUrl::fromLocalFile(filePath);
+        }
+        return remoteUrl;
+    }
+
+    bool QueueTrack::hasUrl(const QUrl& url) const
+    {
+        if (isLocalFile()) {
+            return url.isLocalFile() && url.path() == filePath;
+        }
+        return url == remoteUrl;
+    }
+
+    QString QueueTrack::getTrackId() const
+    {
+        return QLatin1Char('/') + QString::number(mTrackId);
     }
 
     Queue::Queue(QObject* parent)
         : QObject(parent),
           mCurrentIndex(-1),
           mShuffle(false),
+          mShufflePosition(0),
+          mShuffleChosenCount(0),
           mRepeatMode(NoRepeat),
-          mAddingTracks(false)
+          mImageProvider(nullptr),
+          mAddingTracks(false),
+          mSavedTracksCount(0),
+          // State file may contain tracks of previous session until it is restored
+          mStateRewriteNeeded(true),
+          mStateRewriteTimer(new QTimer(this)),
+          mRunningTagsExtractions(0)
     {
+        QObject::connect(this, &Queue::currentTrackChanged, this, &Queue::currentTrackInfoChanged);
+
+        // Removals are coalesced, file is rewritten when queue stops changing
+        mStateRewriteTimer->setSingleShot(true);
+        mStateRewriteTimer->setInterval(1000);
+        QObject::connect(mStateRewriteTimer, &QTimer::timeout, this, &Queue::saveState);
+
         QObject::connect(this, &Queue::currentTrackChanged, this, [=] {
-            const QueueTrack* track = mTracks.empty() ? nullptr : mTracks[static_cast<size_t>(mCurrentIndex)].get();
-            if (track && track->url.isLocalFile()) {
-                if (track->libraryMediaArt.isEmpty()) {
-                    MediaArtUtils::instance()->getMediaArtForFile(track->url.path(),
+            QueueTrack* track = mTracks.empty() ? nullptr : &mTracks[static_cast<size_t>(mCurrentIndex)];
+            if (track && track->isLocalFile()) {
+                if (!track->libraryMediaArt.isEmpty()) {
+                    setCurrentMediaArt(track->libraryMediaArt, {}, {}, {});
+                } else if (const CachedMediaArt* cached = findCachedMediaArt(track->filePath)) {
+                    if (cached->embeddedMediaArtId.isEmpty() || (mImageProvider && mImageProvider->hasImage(cached->embeddedMediaArtId))) {
+                        setTrackMediaArt(track, cached->libraryMediaArt, cached->directoryMediaArt, cached->embeddedMediaArtId, {});
+                    } else {
+                        // Decoded image was evicted from provider, extract embedded media art again
+                        if (track->directoryMediaArt.isEmpty()) {
+                            track->directoryMediaArt = cached->directoryMediaArt;
+                        }
+                        MediaArtUtils::instance()->getMediaArtForFile(track->filePath,
+                                                                      track->filteredSingleAlbum ? track->album : QString(),
+                                                                      true);
+                    }
+                } else {
+                    MediaArtUtils::instance()->getMediaArtForFile(track->filePath,
                                                                   track->filteredSingleAlbum ? track->album : QString(),
                                                                   !track->directoryMediaArt.isEmpty());
-                } else {
-                    setCurrentMediaArt(track->libraryMediaArt, {}, {});
                 }
+                prefetchMediaArt();
             } else {
-                setCurrentMediaArt({}, {}, {});
+                setCurrentMediaArt({}, {}, {}, {});
             }
         });
 
         QObject::connect(MediaArtUtils::instance(), &MediaArtUtils::gotMediaArtForFile, this, [=](const QString& filePath, const QString& libraryMediaArt, const QString& directoryMediaArt, const QByteArray& embeddedMediaArtData) {
+            const QString embeddedMediaArtId(mediaArtDataId(embeddedMediaArtData));
+            cacheMediaArt(filePath, libraryMediaArt, directoryMediaArt, embeddedMediaArtId);
             if (filePath == currentFilePath()) {
-                const auto& track = mTracks[static_cast<size_t>(mCurrentIndex)].get();
-                if (track->libraryMediaArt.isEmpty()) {
-                    track->libraryMediaArt = libraryMediaArt;
-                }
-                if (track->directoryMediaArt.isEmpty()) {
-                    track->directoryMediaArt = directoryMediaArt;
-                }
-                setCurrentMediaArt(track->libraryMediaArt,
-                                   track->directoryMediaArt,
-                                   embeddedMediaArtData);
+                setTrackMediaArt(&mTracks[static_cast<size_t>(mCurrentIndex)],
+                                 libraryMediaArt,
+                                 directoryMediaArt,
+                                 embeddedMediaArtId,
+                                 embeddedMediaArtData);
+            } else if (!embeddedMediaArtId.isEmpty() && mImageProvider) {
+                // Prefetched file, decode its image now so that raw data is not kept
+                mImageProvider->prefetchImage(embeddedMediaArtId, embeddedMediaArtData);
             }
         });
 
         QObject::connect(LibraryUtils::instance(), &LibraryUtils::mediaArtChanged, this, [=]() {
+            mMediaArtCache.clear();
             if (!mTracks.empty()) {
-                for (auto& track : mTracks) {
-                    track->libraryMediaArt.clear();
-                    track->directoryMediaArt.clear();
-                }
-                setCurrentMediaArt({}, {}, {});
-                const QueueTrack* track = mTracks.empty() ? nullptr : mTracks[static_cast<size_t>(mCurrentIndex)].get();
-                if (track && track->url.isLocalFile()) {
-                    MediaArtUtils::instance()->getMediaArtForFile(track->url.path(),
+                for (QueueTrack& track : mTracks) {
+                    track.libraryMediaArt.clear();
+                    track.directoryMediaArt.clear();
+                }
+                setCurrentMediaArt({}, {}, {}, {});
+                const QueueTrack* track = mTracks.empty() ? nullptr : &mTracks[static_cast<size_t>(mCurrentIndex)];
+                if (track && track->isLocalFile()) {
+                    MediaArtUtils::instance()->getMediaArtForFile(track->filePath,
                                                                   track->filteredSingleAlbum ? track->album : QString(),
                                                                   false);
                 }
@@ -314,7 +499,7 @@ namespace unplayer
         });
     }
 
-    const std::vector<std::shared_ptr<QueueTrack>>& Queue::tracks() const
+    const std::vector<QueueTrack>& Queue::tracks() const
     {
         return mTracks;
     }
@@ -335,7 +520,7 @@ namespace unplayer
     QUrl Queue::currentUrl() const
     {
         if (mCurrentIndex >= 0) {
-            return mTracks[static_cast<size_t>(mCurrentIndex)]->url;
+            return mTracks[static_cast<size_t>(mCurrentIndex)].url();
         }
         return QUrl();
     }
@@ -343,7 +528,7 @@ namespace unplayer
     bool Queue::isCurrentLocalFile() const
     {
         if (mCurrentIndex >= 0) {
-            return mTracks[static_cast<size_t>(mCurrentIndex)]->url.isLocalFile();
+            return mTracks[static_cast<size_t>(mCurrentIndex)].isLocalFile();
         }
         return false;
     }
@@ -351,10 +536,7 @@ namespace unplayer
     QString Queue::currentFilePath() const
     {
         if (mCurrentIndex >= 0) {
-            const QUrl& url = mTracks[static_cast<size_t>(mCurrentIndex)]->url;
-            if (url.isLocalFile()) {
-                return url.path();
-            }
+            return mTracks[static_cast<size_t>(mCurrentIndex)].filePath;
         }
         return QString();
     }
@@ -362,7 +544,7 @@ namespace unplayer
     QString Queue::currentTitle() const
     {
         if (mCurrentIndex >= 0) {
-            return mTracks[static_cast<size_t>(mCurrentIndex)]->title;
+            return mTracks[static_cast<size_t>(mCurrentIndex)].title;
         }
         return QString();
     }
@@ -370,7 +552,7 @@ namespace unplayer
     QString Queue::currentArtist() const
     {
         if (mCurrentIndex >= 0) {
-            return mTracks[static_cast<size_t>(mCurrentIndex)]->artist;
+            return mTracks[static_cast<size_t>(mCurrentIndex)].artist;
         }
         return QString();
     }
@@ -378,7 +560,7 @@ namespace unplayer
     QString Queue::currentAlbum() const
     {
         if (mCurrentIndex >= 0) {
-            return mTracks[static_cast<size_t>(mCurrentIndex)]->album;
+            return mTracks[static_cast<size_t>(mCurrentIndex)].album;
         }
         return QString();
     }
@@ -386,13 +568,13 @@ namespace unplayer
     QString Queue::currentMediaArt() const
     {
         if (mCurrentIndex >= 0) {
-            const QueueTrack* track = mTracks[static_cast<size_t>(mCurrentIndex)].get();
-            if (track->url.isLocalFile()) {
+            const QueueTrack* track = &mTracks[static_cast<size_t>(mCurrentIndex)];
+            if (track->isLocalFile()) {
                 if (!mCurrentLibraryMediaArt.isEmpty()) {
                     return mCurrentLibraryMediaArt;
                 }
-                if (!mCurrentEmbeddedMediaArtData.isEmpty() && (!Settings::instance()->useDirectoryMediaArt() || mCurrentDirectoryMediaArt.isEmpty())) {
-                    return QString::fromLatin1("image://%1/%2").arg(QueueImageProvider::providerId, track->url.toString());
+                if (!mCurrentEmbeddedMediaArtId.isEmpty() && (!Settings::instance()->useDirectoryMediaArt() || mCurrentDirectoryMediaArt.isEmpty())) {
+                    return QString::fromLatin1("image://%1/%2").arg(QueueImageProvider::providerId, mCurrentEmbeddedMediaArtId);
                 }
                 return mCurrentDirectoryMediaArt;
             }
@@ -410,9 +592,7 @@ namespace unplayer
         if (shuffle != mShuffle) {
             mShuffle = shuffle;
             emit shuffleChanged();
-            if (!mShuffle) {
-                resetNotPlayedTracks();
-            }
+            resetNotPlayedTracks();
         }
     }
 
@@ -480,12 +660,12 @@ namespace unplayer
         }
 
 
-        std::unordered_map<QUrl, std::shared_ptr<QueueTrack>> oldTracks;
+        std::unordered_map<QString, QueueTrack> oldTracks;
         oldTracks.reserve(mTracks.size());
 
-        for (const auto& track : mTracks) {
-            if (track->url.isLocalFile()) {
-                oldTracks.emplace(track->url, track);
+        for (const QueueTrack& track : mTracks) {
+            if (track.isLocalFile()) {
+                oldTracks.emplace(track.filePath, track);
             }
         }
 
@@ -500,12 +680,13 @@ namespace unplayer
             return urlFromString(trackUrls[setAsCurrent]);
         }());
 
-        auto future = QtConcurrent::run([trackUrls, oldTracks = std::move(oldTracks)]() mutable {
+        auto future = ThreadPool::interactive()->run([trackUrls, oldTracks = std::move(oldTracks)]() mutable {
             return TracksAdder::addTracksFromUrls(trackUrls, std::move(oldTracks));
         });
 
-        onFutureFinished(future, this, [=](std::vector<std::shared_ptr<QueueTrack>>&& tracks) {
-            addingTracksCallback(std::move(tracks), setAsCurrent, setAsCurrentUrl);
+        onFutureFinished(future, this, [=](TracksAdder::Result&& result) {
+            addingTracksCallback(std::move(result.tracks), setAsCurrent, setAsCurrentUrl);
+            resolveTracks(std::move(result.unresolvedTracks));
         });
     }
 
@@ -538,24 +719,26 @@ namespace unplayer
             return QUrl::fromLocalFile(libraryTracks[static_cast<size_t>(setAsCurrent)].filePath);
         }());
 
-        auto future = QtConcurrent::run([libraryTracks]() {
-            std::vector<std::shared_ptr<QueueTrack>> newTracks;
+        auto future = ThreadPool::interactive()->run([libraryTracks]() {
+            std::vector<QueueTrack> newTracks;
             newTracks.reserve(libraryTracks.size());
 
+            StringPool stringPool;
             for (const LibraryTrack& libraryTrack : libraryTracks) {
-                const QString& filePath = libraryTrack.filePath;
-                newTracks.push_back(std::make_shared<QueueTrack>(QUrl::fromLocalFile(filePath),
-                                                                 libraryTrack.title,
-                                                                 libraryTrack.duration,
-                                                                 libraryTrack.artist,
-                                                                 libraryTrack.album,
-                                                                 libraryTrack.filteredSingleAlbum));
+                newTracks.emplace_back(QUrl::fromLocalFile(libraryTrack.filePath),
+                                       libraryTrack.title,
+                                       libraryTrack.duration,
+                                       libraryTrack.artist,
+                                       libraryTrack.album,
+                                       libraryTrack.filteredSingleAlbum,
+                                       libraryTrack.id);
+                stringPool.intern(newTracks.back());
             }
 
             return newTracks;
         });
 
-        onFutureFinished(future, this, [=](std::vector<std::shared_ptr<QueueTrack>>&& tracks) {
+        onFutureFinished(future, this, [=](std::vector<QueueTrack>&& tracks) {
             addingTracksCallback(std::move(tracks), setAsCurrent, setAsCurrentUrl);
         });
     }
@@ -567,9 +750,9 @@ namespace unplayer
 
     LibraryTrack Queue::getTrack(int index) const
     {
-        const QueueTrack* track = mTracks[static_cast<size_t>(index)].get();
-        return {0,
-                track->url.toString(),
+        const QueueTrack* track = &mTracks[static_cast<size_t>(index)];
+        return {track->libraryId,
+                track->url().toString(),
                 track->title,
                 track->artist,
                 track->album,
@@ -590,7 +773,7 @@ namespace unplayer
     bool Queue::hasLocalFileForTracks(const std::vector<int>& indexes) const
     {
         for (int index : indexes) {
-            if (mTracks[static_cast<decltype(mTracks)::size_type>(index)]->url.isLocalFile()) {
+            if (mTracks[static_cast<decltype(mTracks)::size_type>(index)].isLocalFile()) {
                 return true;
             }
         }
@@ -602,9 +785,9 @@ namespace unplayer
         QStringList tracks;
         tracks.reserve(static_cast<int>(indexes.size()));
         for (int index : indexes) {
-            const QueueTrack* track = mTracks[static_cast<decltype(mTracks)::size_type>(index)].get();
-            if (track->url.isLocalFile()) {
-                tracks.push_back(track->url.path());
+            const QueueTrack* track = &mTracks[static_cast<decltype(mTracks)::size_type>(index)];
+            if (track->isLocalFile()) {
+                tracks.push_back(track->filePath);
             }
         }
         return tracks;
@@ -612,46 +795,67 @@ namespace unplayer
 
     void Queue::removeTrack(int index)
     {
-        const std::shared_ptr<QueueTrack> current(mTracks[static_cast<size_t>(mCurrentIndex)]);
+        removeTracks({index});
+    }
+
+    void Queue::removeTracks(std::vector<int> indexes)
+    {
+        if (indexes.empty()) {
+            return;
+        }
 
-        emit trackAboutToBeRemoved(index);
+        std::sort(indexes.begin(), indexes.end());
+        indexes.erase(std::unique(indexes.begin(), indexes.end()), indexes.end());
+        scheduleStateRewrite();
 
-        erase_one(mNotPlayedTracks, mTracks[static_cast<size_t>(index)].get());
-        mTracks.erase(mTracks.begin() + index);
+        const bool currentRemoved = std::binary_search(indexes.begin(), indexes.end(), mCurrentIndex);
+        const int removedBeforeCurrent = static_cast<int>(std::lower_bound(indexes.begin(), indexes.end(), mCurrentIndex) - indexes.begin());
 
-        emit trackRemoved();
+        removeFromShuffleOrder(indexes);
 
-        if (index == mCurrentIndex) {
-            if (mCurrentIndex >= static_cast<int>(mTracks.size())) {
-                setCurrentIndex(static_cast<int>(mTracks.size() - 1));
-            } else {
-                emit currentIndexChanged();
+        size_t rangesCount = 1;
+        for (size_t i = 1, max = indexes.size(); i < max; ++i) {
+            if (indexes[i] != indexes[i - 1] + 1) {
+                ++rangesCount;
             }
-            emit currentTrackChanged();
-        } else {
-            setCurrentIndex(index_of_i(mTracks, current));
         }
-    }
-
-    void Queue::removeTracks(std::vector<int> indexes)
-    {
-        const std::shared_ptr<QueueTrack> current(mTracks[static_cast<size_t>(mCurrentIndex)]);
 
-        std::sort(indexes.begin(), indexes.end(), std::greater<int>());
-        for (int index : indexes) {
-            emit trackAboutToBeRemoved(index);
-            erase_one(mNotPlayedTracks, mTracks[static_cast<size_t>(index)].get());
-            mTracks.erase(mTracks.begin() + index);
-            emit trackRemoved();
+        if (rangesCount > maxRemovedRangesCount) {
+            emit aboutToBeRearranged();
+            // Tracks are examined before they are overwritten, so their address gives original index
+            const QueueTrack* const data = mTracks.data();
+            mTracks.erase(std::remove_if(mTracks.begin(), mTracks.end(), [&](const QueueTrack& track) {
+                return std::binary_search(indexes.begin(), indexes.end(), static_cast<int>(&track - data));
+            }), mTracks.end());
+            emit rearranged();
+        } else {
+            // Contiguous ranges are removed starting from the end, so that indexes of remaining ones stay valid
+            for (auto i = indexes.rbegin(), end = indexes.rend(); i != end;) {
+                const int last = *i;
+                int first = last;
+                for (++i; i != end && *i == first - 1; ++i) {
+                    first = *i;
+                }
+                emit tracksAboutToBeRemoved(first, last);
+                mTracks.erase(mTracks.begin() + first, mTracks.begin() + last + 1);
+                emit tracksRemoved();
+            }
         }
 
-        if (contains(indexes, mCurrentIndex)) {
-            if (mCurrentIndex >= static_cast<int>(mTracks.size())) {
+        if (currentRemoved) {
+            if (!mShuffleOrder.empty()) {
+                // Upcoming track in shuffle order took place of removed one
+                mCurrentIndex = mShuffleOrder[mShufflePosition];
+                emit currentIndexChanged();
+            } else if (mCurrentIndex - removedBeforeCurrent >= static_cast<int>(mTracks.size())) {
                 setCurrentIndex(static_cast<int>(mTracks.size()) - 1);
+            } else {
+                mCurrentIndex -= removedBeforeCurrent;
+                emit currentIndexChanged();
             }
             emit currentTrackChanged();
         } else {
-            setCurrentIndex(index_of_i(mTracks, current));
+            setCurrentIndex(mCurrentIndex - removedBeforeCurrent);
         }
     }
 
@@ -661,7 +865,12 @@ namespace unplayer
             emit aboutToBeCleared();
         }
         mTracks.clear();
-        mNotPlayedTracks.clear();
+        mShuffleOrder.clear();
+        mShufflePositions.clear();
+        mShufflePosition = 0;
+        mShuffleChosenCount = 0;
+        mTagsExtractionChunks.clear();
+        scheduleStateRewrite();
         emit cleared();
         setCurrentIndex(-1);
         emit currentTrackChanged();
@@ -670,12 +879,10 @@ namespace unplayer
     void Queue::next()
     {
         if (mShuffle) {
-            if (mNotPlayedTracks.size() == 1) {
+            if (mShufflePosition + 1 == mShuffleOrder.size()) {
                 resetNotPlayedTracks();
             }
-            erase_one(mNotPlayedTracks, mTracks[static_cast<size_t>(mCurrentIndex)].get());
-            mTracks.erase(mTracks.begin() + mCurrentIndex);
-            setCurrentIndex(index_of_i(mTracks, mNotPlayedTracks[randomIndex(mNotPlayedTracks.size())]));
+            advanceShuffleOrder();
         } else {
             if (mCurrentIndex == static_cast<int>(mTracks.size() - 1)) {
                 setCurrentIndex(0);
@@ -695,17 +902,14 @@ namespace unplayer
         }
 
         if (mShuffle) {
-            const std::shared_ptr<QueueTrack>& track = mTracks[static_cast<size_t>(mCurrentIndex)];
-            erase_one(mNotPlayedTracks, track.get());
-            if (mNotPlayedTracks.empty()) {
+            if (mShufflePosition + 1 == mShuffleOrder.size()) {
                 if (mRepeatMode == RepeatAll) {
                     resetNotPlayedTracks();
-                    erase_one(mNotPlayedTracks, track.get());
                 } else {
                     return;
                 }
             }
-            setCurrentIndex(index_of_i(mTracks, mNotPlayedTracks[randomIndex(mNotPlayedTracks.size())]));
+            advanceShuffleOrder();
         } else {
             if (mCurrentIndex == static_cast<int>(mTracks.size() - 1)) {
                 if (mRepeatMode == RepeatAll) {
@@ -724,6 +928,13 @@ namespace unplayer
     void Queue::previous()
     {
         if (mShuffle) {
+            // Go back through tracks played in this shuffle round
+            if (mShufflePosition == 0 || mShuffleOrder.empty()) {
+                return;
+            }
+            --mShufflePosition;
+            setCurrentIndex(mShuffleOrder[mShufflePosition]);
+            emit currentTrackChanged();
             return;
         }
 
@@ -746,10 +957,360 @@ namespace unplayer
 
     void Queue::resetNotPlayedTracks()
     {
-        mNotPlayedTracks.clear();
-        mNotPlayedTracks.reserve(mTracks.size());
-        for (const auto& track : mTracks) {
-            mNotPlayedTracks.push_back(track.get());
+        mShuffleOrder.clear();
+        mShufflePositions.clear();
+        mShufflePosition = 0;
+        mShuffleChosenCount = 0;
+        if (!mShuffle) {
+            mShuffleOrder.shrink_to_fit();
+            mShufflePositions.shrink_to_fit();
+            return;
+        }
+
+        appendToShuffleOrder(0, static_cast<int>(mTracks.size()));
+        if (mCurrentIndex >= 0) {
+            swapShuffleEntries(0, static_cast<size_t>(mShufflePositions[static_cast<size_t>(mCurrentIndex)]));
+            mShuffleChosenCount = 1;
+        }
+        chooseNextShuffleTrack();
+    }
+
+    void Queue::appendToShuffleOrder(int first, int count)
+    {
+        mShuffleOrder.reserve(mShuffleOrder.size() + static_cast<size_t>(count));
+        mShufflePositions.reserve(mShufflePositions.size() + static_cast<size_t>(count));
+        for (int index = first, max = first + count; index < max; ++index) {
+            mShufflePositions.push_back(static_cast<int>(mShuffleOrder.size()));
+            mShuffleOrder.push_back(index);
+        }
+    }
+
+    void Queue::removeFromShuffleOrder(const std::vector<int>& indexes)
+    {
+        if (mShuffleOrder.empty()) {
+            return;
+        }
+
+        // New indexes of tracks, -1 for removed ones
+        std::vector<int> newIndexes(mTracks.size());
+        {
+            auto removed(indexes.begin());
+            const auto removedEnd(indexes.end());
+            int newIndex = 0;
+            for (int index = 0, max = static_cast<int>(newIndexes.size()); index < max; ++index) {
+                if (removed != removedEnd && *removed == index) {
+                    newIndexes[static_cast<size_t>(index)] = -1;
+                    ++removed;
+                } else {
+                    newIndexes[static_cast<size_t>(index)] = newIndex;
+                    ++newIndex;
+                }
+            }
+        }
+
+        // Whether current or upcoming track was removed
+        bool chooseNext = false;
+        size_t newPosition = 0;
+        size_t newChosenCount = 0;
+        size_t newSize = 0;
+        for (size_t position = 0, max = mShuffleOrder.size(); position < max; ++position) {
+            const int newIndex = newIndexes[static_cast<size_t>(mShuffleOrder[position])];
+            if (newIndex == -1) {
+                if (position == mShufflePosition || position == mShufflePosition + 1) {
+                    chooseNext = true;
+                }
+            } else {
+                if (position < mShufflePosition) {
+                    ++newPosition;
+                }
+                if (position < mShuffleChosenCount) {
+                    ++newChosenCount;
+                }
+                mShuffleOrder[newSize] = newIndex;
+                ++newSize;
+            }
+        }
+        mShuffleOrder.resize(newSize);
+
+        mShufflePositions.resize(newSize);
+        for (size_t position = 0; position < newSize; ++position) {
+            mShufflePositions[static_cast<size_t>(mShuffleOrder[position])] = static_cast<int>(position);
+        }
+
+        mShufflePosition = newPosition;
+        mShuffleChosenCount = newChosenCount;
+        if (chooseNext) {
+            if (mShufflePosition == mShuffleOrder.size() && mShufflePosition > 0) {
+                --mShufflePosition;
+            }
+            // Track that took place of removed current one becomes chosen
+            mShuffleChosenCount = std::max(mShuffleChosenCount, std::min(mShufflePosition + 1, mShuffleOrder.size()));
+            chooseNextShuffleTrack();
+        }
+    }
+
+    void Queue::swapShuffleEntries(size_t first, size_t second)
+    {
+        std::swap(mShuffleOrder[first], mShuffleOrder[second]);
+        mShufflePositions[static_cast<size_t>(mShuffleOrder[first])] = static_cast<int>(first);
+        mShufflePositions[static_cast<size_t>(mShuffleOrder[second])] = static_cast<int>(second);
+    }
+
+    void Queue::chooseNextShuffleTrack()
+    {
+        const size_t next = mShufflePosition + 1;
+        // Track after current one may be already chosen if we went back
+        if (next < mShuffleOrder.size() && next >= mShuffleChosenCount) {
+            swapShuffleEntries(next, next + randomIndex(mShuffleOrder.size() - next));
+            mShuffleChosenCount = next + 1;
+        }
+    }
+
+    void Queue::advanceShuffleOrder()
+    {
+        if (mShufflePosition + 1 < mShuffleOrder.size()) {
+            ++mShufflePosition;
+            chooseNextShuffleTrack();
+        }
+        if (!mShuffleOrder.empty()) {
+            setCurrentIndex(mShuffleOrder[mShufflePosition]);
+        }
+    }
+
+    bool Queue::restoreState(int currentIndex)
+    {
+        if (mAddingTracks || !mTracks.empty() || !mStateFile.exists()) {
+            return false;
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+
+        std::vector<QueueTrack> tracks;
+        bool complete;
+        if (!mStateFile.load(tracks, complete) || tracks.empty()) {
+            return false;
+        }
+
+        StringPool stringPool;
+        for (QueueTrack& track : tracks) {
+            stringPool.intern(track);
+        }
+
+        qInfo("Restored %zu tracks from queue state file: %lldms", tracks.size(), static_cast<long long>(timer.elapsed()));
+
+        // Tracks are already in the file, but new ones can't be appended after invalid data
+        mSavedTracksCount = tracks.size();
+        mStateRewriteNeeded = !complete;
+
+        const QUrl currentUrl([&]() {
+            if (currentIndex < 0 || currentIndex >= static_cast<int>(tracks.size())) {
+                return QUrl();
+            }
+            return tracks[static_cast<size_t>(currentIndex)].url();
+        }());
+
+        mAddingTracks = true;
+        emit addingTracksChanged();
+        addingTracksCallback(std::move(tracks), currentIndex, currentUrl);
+
+        // Placeholders of tracks which metadata wasn't resolved before state was saved
+        std::vector<UnresolvedQueueTrack> unresolvedTracks;
+        for (const QueueTrack& track : mTracks) {
+            if (track.isLocalFile() && track.duration < 0) {
+                unresolvedTracks.push_back({track.id(), track.filePath});
+            }
+        }
+        resolveTracks(std::move(unresolvedTracks));
+
+        if (!complete) {
+            scheduleStateRewrite();
+        }
+
+        validateRestoredTracks();
+
+        return true;
+    }
+
+    void Queue::saveState()
+    {
+        mStateRewriteTimer->stop();
+        if (mStateRewriteNeeded && mStateFile.write(mTracks)) {
+            mSavedTracksCount = mTracks.size();
+            mStateRewriteNeeded = false;
+        }
+    }
+
+    void Queue::saveAddedTracks()
+    {
+        if (mStateRewriteNeeded) {
+            // Whole file will be rewritten anyway
+            scheduleStateRewrite();
+            return;
+        }
+        if (mStateFile.append(mTracks.data() + mSavedTracksCount, mTracks.size() - mSavedTracksCount)) {
+            mSavedTracksCount = mTracks.size();
+        } else {
+            scheduleStateRewrite();
+        }
+    }
+
+    void Queue::scheduleStateRewrite()
+    {
+        mStateRewriteNeeded = true;
+        mStateRewriteTimer->start();
+    }
+
+    void Queue::validateRestoredTracks()
+    {
+        std::vector<QueueTrack> tracks;
+        for (const QueueTrack& track : mTracks) {
+            if (track.isLocalFile()) {
+                tracks.push_back(track);
+            }
+        }
+
+        if (tracks.empty()) {
+            return;
+        }
+
+        auto future = ThreadPool::background()->run([tracks = std::move(tracks)]() mutable {
+            return checkRestoredTracks(std::move(tracks));
+        });
+
+        onFutureFinished(future, this, [=](RestoredTracksValidation&& result) {
+            if (!result.changedTracks.empty()) {
+                int first = -1;
+                int last = -1;
+                for (size_t i = 0, max = mTracks.size(); i < max; ++i) {
+                    QueueTrack& track = mTracks[i];
+                    if (!track.isLocalFile()) {
+                        continue;
+                    }
+                    const auto found(result.changedTracks.find(track.filePath));
+                    if (found != result.changedTracks.end()) {
+                        const QueueTrack& changed = found->second;
+                        track.title = changed.title;
+                        track.duration = changed.duration;
+                        track.artist = changed.artist;
+                        track.album = changed.album;
+                        if (first == -1) {
+                            first = static_cast<int>(i);
+                        }
+                        last = static_cast<int>(i);
+                    }
+                }
+                if (first != -1) {
+                    emit tracksChanged(first, last);
+                    scheduleStateRewrite();
+                    if (mCurrentIndex >= first && mCurrentIndex <= last) {
+                        emit currentTrackInfoChanged();
+                    }
+                }
+            }
+
+            if (!result.missingFiles.empty()) {
+                std::vector<int> indexes;
+                for (size_t i = 0, max = mTracks.size(); i < max; ++i) {
+                    const QueueTrack& track = mTracks[i];
+                    if (track.isLocalFile() && contains(result.missingFiles, track.filePath)) {
+                        indexes.push_back(static_cast<int>(i));
+                    }
+                }
+                if (!indexes.empty()) {
+                    qInfo("Removing %zu missing tracks from queue", indexes.size());
+                    removeTracks(std::move(indexes));
+                }
+            }
+        });
+    }
+
+    void Queue::resolveTracks(std::vector<UnresolvedQueueTrack>&& tracks)
+    {
+        if (tracks.empty()) {
+            return;
+        }
+
+        auto future = ThreadPool::interactive()->run([tracks = std::move(tracks)]() mutable {
+            return TracksAdder::queryLibrary(std::move(tracks));
+        });
+
+        onFutureFinished(future, this, [=](TracksAdder::LibraryQueryResult&& result) {
+            applyResolvedTracks(result.resolvedTracks);
+
+            auto& unresolved = result.unresolvedTracks;
+            auto chunkBegin(unresolved.begin());
+            const auto end(unresolved.end());
+            while (chunkBegin != end) {
+                auto chunkEnd(chunkBegin + std::min(tagsExtractionChunkSize, static_cast<size_t>(end - chunkBegin)));
+                // Don't split tracks of the same file
+                while (chunkEnd != end && chunkEnd->filePath == (chunkEnd - 1)->filePath) {
+                    ++chunkEnd;
+                }
+                mTagsExtractionChunks.emplace_back(std::make_move_iterator(chunkBegin), std::make_move_iterator(chunkEnd));
+                chunkBegin = chunkEnd;
+            }
+            startTagsExtraction();
+        });
+    }
+
+    void Queue::startTagsExtraction()
+    {
+        // Chunks are extracted one at a time, leaving other background thread for library writes
+        while (!mTagsExtractionChunks.empty() && mRunningTagsExtractions < maxRunningTagsExtractions) {
+            auto future = ThreadPool::background()->run([tracks = std::move(mTagsExtractionChunks.front())]() {
+                return TracksAdder::extractTags(tracks);
+            });
+            mTagsExtractionChunks.pop_front();
+            ++mRunningTagsExtractions;
+
+            onFutureFinished(future, this, [=](std::vector<ResolvedQueueTrack>&& tracks) {
+                --mRunningTagsExtractions;
+                applyResolvedTracks(tracks);
+                startTagsExtraction();
+            });
+        }
+    }
+
+    void Queue::applyResolvedTracks(const std::vector<ResolvedQueueTrack>& tracks)
+    {
+        int first = -1;
+        int last = -1;
+        bool currentChanged = false;
+        for (const ResolvedQueueTrack& resolved : tracks) {
+            // Tracks are always sorted by id
+            const auto found(std::lower_bound(mTracks.begin(), mTracks.end(), resolved.id, [](const QueueTrack& track, quint32 id) {
+                return track.id() < id;
+            }));
+            if (found == mTracks.end() || found->id() != resolved.id) {
+                // Track was removed
+                continue;
+            }
+
+            QueueTrack& track = *found;
+            track.title = resolved.title;
+            track.duration = resolved.duration;
+            track.artist = resolved.artist;
+            track.album = resolved.album;
+
+            const int index = static_cast<int>(found - mTracks.begin());
+            if (first == -1 || index < first) {
+                first = index;
+            }
+            if (index > last) {
+                last = index;
+            }
+            if (index == mCurrentIndex) {
+                currentChanged = true;
+            }
+        }
+
+        if (first != -1) {
+            emit tracksChanged(first, last);
+            scheduleStateRewrite();
+            if (currentChanged) {
+                emit currentTrackInfoChanged();
+            }
         }
     }
 
@@ -760,22 +1321,30 @@ namespace unplayer
         emit currentTrackChanged();
     }
 
-    void Queue::addingTracksCallback(std::vector<std::shared_ptr<QueueTrack>>&& tracks, int setAsCurrent, const QUrl& setAsCurrentUrl)
+    void Queue::addingTracksCallback(std::vector<QueueTrack>&& tracks, int setAsCurrent, const QUrl& setAsCurrentUrl)
     {
         emit tracksAboutToBeAdded(static_cast<int>(tracks.size()));
 
         // If queue was not cleared
         setAsCurrent += static_cast<int>(mTracks.size());
 
-        mNotPlayedTracks.reserve(mNotPlayedTracks.size() + tracks.size());
+        if (mShuffle) {
+            const bool chooseNext = mShufflePosition + 1 >= mShuffleOrder.size();
+            appendToShuffleOrder(static_cast<int>(mTracks.size()), static_cast<int>(tracks.size()));
+            if (chooseNext) {
+                chooseNextShuffleTrack();
+            }
+        }
+
         mTracks.reserve(mTracks.size() + tracks.size());
         for (auto& track : tracks) {
-            mNotPlayedTracks.push_back(track.get());
             mTracks.push_back(std::move(track));
         }
 
         emit tracksAdded();
 
+        saveAddedTracks();
+
         if (mCurrentIndex == -1 && !mTracks.empty()) {
             bool set = false;
             if (setAsCurrentUrl.isEmpty()) {
@@ -783,12 +1352,12 @@ namespace unplayer
             } else {
                 if (setAsCurrent >= 0 &&
                         setAsCurrent < static_cast<int>(mTracks.size()) &&
-                        mTracks[static_cast<size_t>(setAsCurrent)]->url == setAsCurrentUrl) {
+                        mTracks[static_cast<size_t>(setAsCurrent)].hasUrl(setAsCurrentUrl)) {
                     setCurrentIndex(setAsCurrent);
                     set = true;
                 } else {
-                    const auto found(std::find_if(mTracks.begin(), mTracks.end(), [&setAsCurrentUrl](const std::shared_ptr<QueueTrack>& track) {
-                        return track->url == setAsCurrentUrl;
+                    const auto found(std::find_if(mTracks.begin(), mTracks.end(), [&setAsCurrentUrl](const QueueTrack& track) {
+                        return track.hasUrl(setAsCurrentUrl);
                     }));
                     if (found == mTracks.end()) {
                         setCurrentIndex(0);
@@ -798,6 +1367,8 @@ namespace unplayer
                     }
                 }
             }
+            // Start shuffle order from first track
+            resetNotPlayedTracks();
             emit currentTrackChanged(set);
         }
 
@@ -805,7 +1376,87 @@ namespace unplayer
         emit addingTracksChanged();
     }
 
-    void Queue::setCurrentMediaArt(const QString& libraryMediaArt, const QString& directoryMediaArt, const QByteArray& embeddedMediaArtData)
+    int Queue::upcomingIndex() const
+    {
+        if (mShuffle) {
+            if (mShufflePosition + 1 < mShuffleOrder.size()) {
+                return mShuffleOrder[mShufflePosition + 1];
+            }
+            return -1;
+        }
+        if (mCurrentIndex < 0 || mTracks.size() < 2) {
+            return -1;
+        }
+        if (mCurrentIndex == static_cast<int>(mTracks.size()) - 1) {
+            return 0;
+        }
+        return mCurrentIndex + 1;
+    }
+
+    void Queue::prefetchMediaArt()
+    {
+        const int index = upcomingIndex();
+        if (index < 0) {
+            return;
+        }
+        const QueueTrack* track = &mTracks[static_cast<size_t>(index)];
+        if (track->isLocalFile() && track->libraryMediaArt.isEmpty() && !findCachedMediaArt(track->filePath)) {
+            MediaArtUtils::instance()->prefetchMediaArtForFile(track->filePath,
+                                                               track->filteredSingleAlbum ? track->album : QString(),
+                                                               !track->directoryMediaArt.isEmpty());
+        }
+    }
+
+    const Queue::CachedMediaArt* Queue::findCachedMediaArt(const QString& filePath)
+    {
+        const auto found(std::find_if(mMediaArtCache.begin(), mMediaArtCache.end(), [&](const CachedMediaArt& mediaArt) {
+            return mediaArt.filePath == filePath;
+        }));
+        if (found == mMediaArtCache.end()) {
+            return nullptr;
+        }
+        std::rotate(found, found + 1, mMediaArtCache.end());
+        return &mMediaArtCache.back();
+    }
+
+    void Queue::cacheMediaArt(const QString& filePath, const QString& libraryMediaArt, const QString& directoryMediaArt, const QString& embeddedMediaArtId)
+    {
+        const auto found(std::find_if(mMediaArtCache.begin(), mMediaArtCache.end(), [&](const CachedMediaArt& mediaArt) {
+            return mediaArt.filePath == filePath;
+        }));
+        CachedMediaArt mediaArt{filePath, libraryMediaArt, directoryMediaArt, embeddedMediaArtId};
+        if (found != mMediaArtCache.end()) {
+            // Only embedded media art may have been extracted again
+            if (mediaArt.directoryMediaArt.isEmpty()) {
+                mediaArt.directoryMediaArt = std::move(found->directoryMediaArt);
+            }
+            mMediaArtCache.erase(found);
+        } else if (mMediaArtCache.size() == maxCachedMediaArtCount) {
+            mMediaArtCache.erase(mMediaArtCache.begin());
+        }
+        mMediaArtCache.push_back(std::move(mediaArt));
+    }
+
+    void Queue::setImageProvider(QueueImageProvider* provider)
+    {
+        mImageProvider = provider;
+    }
+
+    void Queue::setTrackMediaArt(QueueTrack* track, const QString& libraryMediaArt, const QString& directoryMediaArt, const QString& embeddedMediaArtId, const QByteArray& embeddedMediaArtData)
+    {
+        if (track->libraryMediaArt.isEmpty()) {
+            track->libraryMediaArt = libraryMediaArt;
+        }
+        if (track->directoryMediaArt.isEmpty()) {
+            track->directoryMediaArt = directoryMediaArt;
+        }
+        setCurrentMediaArt(track->libraryMediaArt,
+                           track->directoryMediaArt,
+                           embeddedMediaArtId,
+                           embeddedMediaArtData);
+    }
+
+    void Queue::setCurrentMediaArt(const QString& libraryMediaArt, const QString& directoryMediaArt, const QString& embeddedMediaArtId, const QByteArray& embeddedMediaArtData)
     {
         bool changed = false;
         if (libraryMediaArt != mCurrentLibraryMediaArt) {
@@ -816,9 +1467,11 @@ namespace unplayer
             mCurrentDirectoryMediaArt = directoryMediaArt;
             changed = true;
         }
-        if (embeddedMediaArtData != mCurrentEmbeddedMediaArtData) {
-            mCurrentEmbeddedMediaArtData = embeddedMediaArtData;
-            emit mediaArtDataChanged(mCurrentEmbeddedMediaArtData);
+        if (embeddedMediaArtId != mCurrentEmbeddedMediaArtId) {
+            mCurrentEmbeddedMediaArtId = embeddedMediaArtId;
+            if (!mCurrentEmbeddedMediaArtId.isEmpty()) {
+                emit mediaArtDataChanged(mCurrentEmbeddedMediaArtId, embeddedMediaArtData);
+            }
             changed = true;
         }
         if (changed) {
@@ -826,49 +1479,184 @@ namespace unplayer
         }
     }
 
+    namespace
+    {
+        // Number of decoded images kept by QueueImageProvider
+        const size_t maxQueueImagesCount = 5;
+
+        class QueueImageResponse final : public QQuickImageResponse, public QRunnable
+        {
+        public:
+            QueueImageResponse(QueueImageProvider* provider, const QString& id, const QSize& requestedSize)
+                : mProvider(provider),
+                  mId(id),
+                  mRequestedSize(requestedSize)
+            {
+                // Deleted by QML engine
+                setAutoDelete(false);
+            }
+
+            QQuickTextureFactory* textureFactory() const override
+            {
+                return QQuickTextureFactory::textureFactoryForImage(mImage);
+            }
+
+            void run() override
+            {
+                mImage = mProvider->image(mId, mRequestedSize);
+                emit finished();
+            }
+
+        private:
+            QueueImageProvider* mProvider;
+            QString mId;
+            QSize mRequestedSize;
+            QImage mImage;
+        };
+    }
+
     const QLatin1String QueueImageProvider::providerId("queue");
 
-    QueueImageProvider::QueueImageProvider(const Queue* queue)
-        : QQuickImageProvider(QQuickImageProvider::Pixmap)
+    QueueImageProvider::QueueImageProvider(Queue* queue)
+        : mQueue(queue),
+          mMaxSize(0)
     {
-        QObject::connect(queue, &Queue::mediaArtDataChanged, this, [=](const QByteArray& mediaArtData) {
+        queue->setImageProvider(this);
+
+        if (const QScreen* screen = QGuiApplication::primaryScreen()) {
+            const QSize screenSize(screen->size());
+            mMaxSize = std::min(screenSize.width(), screenSize.height());
+        }
+
+        QObject::connect(queue, &Queue::mediaArtDataChanged, this, [=](const QString& id, const QByteArray& mediaArtData) {
             std::lock_guard<std::mutex> guard(mMutex);
-            mMediaArtData = mediaArtData;
-            if (mMediaArtData.isEmpty() && !mPixmap.isNull()) {
-                mPixmap = QPixmap();
+            const bool decoded = std::any_of(mImages.begin(), mImages.end(), [&](const std::pair<QString, QImage>& image) {
+                return image.first == id;
+            });
+            if (decoded) {
+                mPendingId.clear();
+                mPendingData.clear();
+            } else if (!mediaArtData.isEmpty()) {
+                mPendingId = id;
+                mPendingData = mediaArtData;
             }
         });
     }
 
-    QPixmap QueueImageProvider::requestPixmap(const QString&, QSize* size, const QSize& requestedSize)
+    QueueImageProvider::~QueueImageProvider()
     {
-        QPixmap pixmap;
-        {
-            QByteArray mediaArtData;
-            std::lock_guard<std::mutex> loadingGuard(mLoadingMutex);
-            {
-                std::lock_guard<std::mutex> guard(mMutex);
-                pixmap = mPixmap;
-                mediaArtData = mMediaArtData;
+        if (mQueue) {
+            mQueue->setImageProvider(nullptr);
+        }
+    }
+
+    bool QueueImageProvider::hasImage(const QString& id)
+    {
+        std::lock_guard<std::mutex> guard(mMutex);
+        return id == mPendingId || std::any_of(mImages.begin(), mImages.end(), [&](const std::pair<QString, QImage>& image) {
+            return image.first == id;
+        });
+    }
+
+    void QueueImageProvider::prefetchImage(const QString& id, const QByteArray& data)
+    {
+        if (hasImage(id)) {
+            return;
+        }
+        ThreadPool::background()->run([=] {
+            std::lock_guard<std::mutex> decodingGuard(mDecodingMutex);
+            if (findImage(id).isNull()) {
+                const QImage image(decodeImage(data));
+                if (!image.isNull()) {
+                    addImage(id, image);
+                }
             }
-            if (!mediaArtData.isEmpty()) {
-                pixmap.loadFromData(mediaArtData);
+        });
+    }
+
+    QQuickImageResponse* QueueImageProvider::requestImageResponse(const QString& id, const QSize& requestedSize)
+    {
+        auto response = new QueueImageResponse(this, id, requestedSize);
+        ThreadPool::interactive()->start(response);
+        return response;
+    }
+
+    QImage QueueImageProvider::image(const QString& id, const QSize& requestedSize)
+    {
+        QImage image(findImage(id));
+        if (image.isNull()) {
+            // Only one thread decodes, others wait for it and then find decoded image
+            std::lock_guard<std::mutex> decodingGuard(mDecodingMutex);
+            image = findImage(id);
+            if (image.isNull()) {
+                QByteArray data;
                 {
                     std::lock_guard<std::mutex> guard(mMutex);
-                    mPixmap = pixmap;
-                    mMediaArtData.clear();
+                    if (id == mPendingId) {
+                        data = mPendingData;
+                    }
+                }
+                if (data.isEmpty()) {
+                    return image;
                 }
+                image = decodeImage(data);
+                if (image.isNull()) {
+                    return image;
+                }
+                addImage(id, image);
             }
         }
 
-        if (!pixmap.isNull()) {
-            *size = pixmap.size();
-            if (requestedSize.isValid() && !requestedSize.isNull()) {
-                return pixmap.scaled(requestedSize.width() > 0 ? requestedSize.width() : std::numeric_limits<int>::max(),
-                                     requestedSize.height() > 0 ? requestedSize.height() : std::numeric_limits<int>::max(),
-                                     Qt::KeepAspectRatio);
+        if (requestedSize.isValid() && !requestedSize.isNull()) {
+            const QSize size(requestedSize.width() > 0 ? requestedSize.width() : std::numeric_limits<int>::max(),
+                             requestedSize.height() > 0 ? requestedSize.height() : std::numeric_limits<int>::max());
+            if (image.width() > size.width() || image.height() > size.height()) {
+                return image.scaled(size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
             }
         }
-        return pixmap;
+        return image;
+    }
+
+    QImage QueueImageProvider::findImage(const QString& id)
+    {
+        std::lock_guard<std::mutex> guard(mMutex);
+        const auto found(std::find_if(mImages.begin(), mImages.end(), [&](const std::pair<QString, QImage>& image) {
+            return image.first == id;
+        }));
+        if (found == mImages.end()) {
+            return QImage();
+        }
+        std::rotate(found, found + 1, mImages.end());
+        return mImages.back().second;
+    }
+
+    void QueueImageProvider::addImage(const QString& id, const QImage& image)
+    {
+        std::lock_guard<std::mutex> guard(mMutex);
+        if (id == mPendingId) {
+            mPendingId.clear();
+            mPendingData.clear();
+        }
+        if (mImages.size() == maxQueueImagesCount) {
+            mImages.erase(mImages.begin());
+        }
+        mImages.emplace_back(id, image);
+    }
+
+    QImage QueueImageProvider::decodeImage(const QByteArray& data) const
+    {
+        QBuffer buffer;
+        buffer.setData(data);
+        QImageReader reader(&buffer);
+        // Embedded art is often much larger than the screen, decode it directly at reduced size
+        const QSize imageSize(reader.size());
+        if (mMaxSize > 0 && imageSize.isValid() && std::min(imageSize.width(), imageSize.height()) > mMaxSize) {
+            reader.setScaledSize(imageSize.scaled(mMaxSize, mMaxSize, Qt::KeepAspectRatioByExpanding));
+        }
+        const QImage image(reader.read());
+        if (image.isNull()) {
+            qWarning() << "Failed to decode embedded media art" << reader.errorString();
+        }
+        return image;
     }
 }
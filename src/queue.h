@@ -19,20 +19,26 @@
 #ifndef UNPLAYER_QUEUE_H
 #define UNPLAYER_QUEUE_H
 
-#include <memory>
+#include <deque>
 #include <mutex>
 #include <vector>
 
+#include <QImage>
 #include <QObject>
+#include <QPointer>
 #include <QQuickImageProvider>
-#include <QPixmap>
 #include <QStringList>
 #include <QUrl>
 
 #include "librarytrack.h"
+#include "queuestatefile.h"
+
+class QTimer;
 
 namespace unplayer
 {
+    class QueueImageProvider;
+
     struct QueueTrack
     {
         explicit QueueTrack(const QUrl& url,
@@ -40,32 +46,62 @@ namespace unplayer
                             int duration,
                             const QString& artist,
                             const QString& album,
-                            bool filteredSingleAlbum);
+                            bool filteredSingleAlbum,
+                            int libraryId = 0);
 
         explicit QueueTrack(const QUrl& url,
                             const QString& title);
 
-        inline const QString& getTrackId() const
+        inline bool isLocalFile() const
+        {
+            return remoteUrl.isEmpty();
+        }
+
+        QUrl url() const;
+        bool hasUrl(const QUrl& url) const;
+
+        // Ids are ascending in the order tracks are created
+        inline quint32 id() const
         {
-            if (mTrackId.isEmpty()) {
-                initTrackId();
-            }
             return mTrackId;
         }
 
-        QUrl url;
+        QString getTrackId() const;
+
+        // Only one of them is set
+        QString filePath;
+        QUrl remoteUrl;
+
         QString title;
-        int duration;
+        // Artist and album strings are shared between tracks of the same artist or album
         QString artist;
         QString album;
+        int duration;
+        // Id of library track, or 0 if track was not added from library
+        int libraryId;
         bool filteredSingleAlbum;
 
         QString libraryMediaArt;
         QString directoryMediaArt;
 
     private:
-        void initTrackId() const;
-        mutable QString mTrackId;
+        quint32 mTrackId;
+    };
+
+    // Local file added to the queue before its metadata is known
+    struct UnresolvedQueueTrack
+    {
+        quint32 id;
+        QString filePath;
+    };
+
+    struct ResolvedQueueTrack
+    {
+        quint32 id;
+        QString title;
+        int duration;
+        QString artist;
+        QString album;
     };
 
     class Queue final : public QObject
@@ -77,9 +113,9 @@ namespace unplayer
         Q_PROPERTY(QUrl currentUrl READ currentUrl NOTIFY currentTrackChanged)
         Q_PROPERTY(bool currentIsLocalFile READ isCurrentLocalFile NOTIFY currentTrackChanged)
         Q_PROPERTY(QString currentFilePath READ currentFilePath NOTIFY currentTrackChanged)
-        Q_PROPERTY(QString currentTitle READ currentTitle NOTIFY currentTrackChanged)
-        Q_PROPERTY(QString currentArtist READ currentArtist NOTIFY currentTrackChanged)
-        Q_PROPERTY(QString currentAlbum READ currentAlbum NOTIFY currentTrackChanged)
+        Q_PROPERTY(QString currentTitle READ currentTitle NOTIFY currentTrackInfoChanged)
+        Q_PROPERTY(QString currentArtist READ currentArtist NOTIFY currentTrackInfoChanged)
+        Q_PROPERTY(QString currentAlbum READ currentAlbum NOTIFY currentTrackInfoChanged)
         Q_PROPERTY(QUrl currentMediaArt READ currentMediaArt NOTIFY mediaArtChanged)
 
         Q_PROPERTY(bool shuffle READ isShuffle WRITE setShuffle NOTIFY shuffleChanged)
@@ -97,7 +133,7 @@ namespace unplayer
 
         explicit Queue(QObject* parent);
 
-        const std::vector<std::shared_ptr<QueueTrack>>& tracks() const;
+        const std::vector<QueueTrack>& tracks() const;
 
         int currentIndex() const;
         void setCurrentIndex(int index);
@@ -138,30 +174,99 @@ namespace unplayer
         Q_INVOKABLE void previous();
 
         Q_INVOKABLE void setCurrentToFirstIfNeeded();
+        // Starts new shuffle round from current track
         Q_INVOKABLE void resetNotPlayedTracks();
 
+        // Shows tracks from queue state file and validates them in background. Returns false if state file doesn't exist
+        bool restoreState(int currentIndex);
+        // Writes pending changes to queue state file
+        void saveState();
+
+        void setImageProvider(QueueImageProvider* provider);
+
     private:
         void reset();
-        void addingTracksCallback(std::vector<std::shared_ptr<QueueTrack>>&& tracks, int setAsCurrent, const QUrl& setAsCurrentUrl);
-        void setCurrentMediaArt(const QString& libraryMediaArt, const QString& directoryMediaArt, const QByteArray& embeddedMediaArtData);
+        void addingTracksCallback(std::vector<QueueTrack>&& tracks, int setAsCurrent, const QUrl& setAsCurrentUrl);
+        void appendToShuffleOrder(int first, int count);
+        // Indexes must be sorted
+        void removeFromShuffleOrder(const std::vector<int>& indexes);
+        void swapShuffleEntries(size_t first, size_t second);
+        void chooseNextShuffleTrack();
+        void advanceShuffleOrder();
+
+        void saveAddedTracks();
+        void scheduleStateRewrite();
+        void validateRestoredTracks();
+
+        // Queries library and then extracts tags of remaining files in parallel
+        void resolveTracks(std::vector<UnresolvedQueueTrack>&& tracks);
+        void startTagsExtraction();
+        void applyResolvedTracks(const std::vector<ResolvedQueueTrack>& tracks);
+
+        // embeddedMediaArtData is passed only when it is extracted, to be decoded by QueueImageProvider
+        void setCurrentMediaArt(const QString& libraryMediaArt, const QString& directoryMediaArt, const QString& embeddedMediaArtId, const QByteArray& embeddedMediaArtData);
+        void setTrackMediaArt(QueueTrack* track, const QString& libraryMediaArt, const QString& directoryMediaArt, const QString& embeddedMediaArtId, const QByteArray& embeddedMediaArtData);
+
+        // Index of track that will be played after current one, or -1 if it is not known in advance
+        int upcomingIndex() const;
+        void prefetchMediaArt();
+
+        struct CachedMediaArt
+        {
+            QString filePath;
+            QString libraryMediaArt;
+            QString directoryMediaArt;
+            // Decoded image is kept by QueueImageProvider
+            QString embeddedMediaArtId;
+        };
+        const CachedMediaArt* findCachedMediaArt(const QString& filePath);
+        void cacheMediaArt(const QString& filePath, const QString& libraryMediaArt, const QString& directoryMediaArt, const QString& embeddedMediaArtId);
 
     private:
-        std::vector<std::shared_ptr<QueueTrack>> mTracks;
-        std::vector<const QueueTrack*> mNotPlayedTracks;
+        std::vector<QueueTrack> mTracks;
 
         int mCurrentIndex;
         bool mShuffle;
+
+        /*
+         * Shuffle order is a permutation of track indexes. Tracks before mShufflePosition were played
+         * in this round, track after it is chosen in advance, the rest are not played yet.
+         * mShufflePositions maps track index to its position in mShuffleOrder.
+         * Entries before mShuffleChosenCount are fixed, so that after going back with previous()
+         * the same tracks are played again, the rest are randomized when they are reached
+         */
+        std::vector<int> mShuffleOrder;
+        std::vector<int> mShufflePositions;
+        size_t mShufflePosition;
+        size_t mShuffleChosenCount;
         RepeatMode mRepeatMode;
 
         QString mCurrentLibraryMediaArt;
         QString mCurrentDirectoryMediaArt;
-        QByteArray mCurrentEmbeddedMediaArtData;
+        // MD5 of embedded media art data, used as QueueImageProvider id
+        QString mCurrentEmbeddedMediaArtId;
+
+        // Media art of recently played and upcoming files, most recently used last
+        std::vector<CachedMediaArt> mMediaArtCache;
+        QueueImageProvider* mImageProvider;
 
         bool mAddingTracks;
+
+        QueueStateFile mStateFile;
+        // Number of first tracks that are already saved in state file
+        size_t mSavedTracksCount;
+        bool mStateRewriteNeeded;
+        QTimer* mStateRewriteTimer;
+
+        // Tracks waiting for tag extraction, split in chunks
+        std::deque<std::vector<UnresolvedQueueTrack>> mTagsExtractionChunks;
+        int mRunningTagsExtractions;
     signals:
         void currentTrackChanged(bool setAsCurrentWasSet = false);
+        // Emitted when current track is changed or its metadata is resolved
+        void currentTrackInfoChanged();
 
-        void mediaArtDataChanged(const QByteArray& mediaArtData);
+        void mediaArtDataChanged(const QString& id, const QByteArray& mediaArtData);
         void mediaArtChanged();
 
         void currentIndexChanged();
@@ -170,31 +275,57 @@ namespace unplayer
 
         void tracksAboutToBeAdded(int count);
         void tracksAdded();
+        void tracksChanged(int first, int last);
 
-        void trackAboutToBeRemoved(int index);
-        void trackRemoved();
+        void tracksAboutToBeRemoved(int first, int last);
+        void tracksRemoved();
 
         void aboutToBeCleared();
         void cleared();
 
+        // Emitted instead of per range signals when many tracks are removed at once
+        void aboutToBeRearranged();
+        void rearranged();
+
         void addingTracksChanged();
     };
 
-    class QueueImageProvider final : public QQuickImageProvider, QObject
+    /**
+     * @brief Decodes embedded media art of current track in worker thread, at size not larger than the screen.
+     * Last decoded images are kept in memory, so that requests of different sizes don't decode data again
+     */
+    class QueueImageProvider final : public QQuickAsyncImageProvider, QObject
     {
     public:
         static const QLatin1String providerId;
-        explicit QueueImageProvider(const Queue* queue);
+        explicit QueueImageProvider(Queue* queue);
+        ~QueueImageProvider() override;
         QueueImageProvider(const QueueImageProvider& other) = delete;
         QueueImageProvider(QueueImageProvider&& other) = delete;
         QueueImageProvider& operator=(const QueueImageProvider& other) = delete;
         QueueImageProvider& operator=(QueueImageProvider&& other) = delete;
-        QPixmap requestPixmap(const QString& id, QSize*, const QSize& requestedSize) override;
+        QQuickImageResponse* requestImageResponse(const QString& id, const QSize& requestedSize) override;
+
+        // Thread safe
+        QImage image(const QString& id, const QSize& requestedSize);
+        // Returns true if image is decoded or its data is pending
+        bool hasImage(const QString& id);
+        // Decodes image in background
+        void prefetchImage(const QString& id, const QByteArray& data);
     private:
+        QImage findImage(const QString& id);
+        void addImage(const QString& id, const QImage& image);
+        QImage decodeImage(const QByteArray& data) const;
+
+        QPointer<Queue> mQueue;
+        int mMaxSize;
+
         std::mutex mMutex;
-        std::mutex mLoadingMutex;
-        QPixmap mPixmap;
-        QByteArray mMediaArtData;
+        std::mutex mDecodingMutex;
+        QString mPendingId;
+        QByteArray mPendingData;
+        // Most recently used last
+        std::vector<std::pair<QString, QImage>> mImages;
     };
 }
 
@@ -28,15 +28,15 @@ namespace unplayer
             return QVariant();
         }
 
-        const QueueTrack* track = mQueue->tracks()[static_cast<size_t>(index.row())].get();
+        const QueueTrack* track = &mQueue->tracks()[static_cast<size_t>(index.row())];
 
         switch (role) {
         case UrlRole:
-            return track->url;
+            return track->url();
         case IsLocalFileRole:
-            return track->url.isLocalFile();
+            return track->isLocalFile();
         case FilePathRole:
-            return track->url.path();
+            return track->filePath;
         case TitleRole:
             return track->title;
         case ArtistRole:
@@ -81,11 +81,15 @@ namespace unplayer
             endInsertRows();
         });
 
-        QObject::connect(mQueue, &Queue::trackAboutToBeRemoved, this, [=](int index) {
-            beginRemoveRows(QModelIndex(), index, index);
+        QObject::connect(mQueue, &Queue::tracksChanged, this, [=](int first, int last) {
+            emit dataChanged(index(first), index(last));
         });
 
-        QObject::connect(mQueue, &Queue::trackRemoved, this, [=]() {
+        QObject::connect(mQueue, &Queue::tracksAboutToBeRemoved, this, [=](int first, int last) {
+            beginRemoveRows(QModelIndex(), first, last);
+        });
+
+        QObject::connect(mQueue, &Queue::tracksRemoved, this, [=]() {
             endRemoveRows();
         });
 
@@ -96,6 +100,14 @@ namespace unplayer
         QObject::connect(mQueue, &Queue::cleared, this, [=]() {
             endRemoveRows();
         });
+
+        QObject::connect(mQueue, &Queue::aboutToBeRearranged, this, [=]() {
+            beginResetModel();
+        });
+
+        QObject::connect(mQueue, &Queue::rearranged, this, [=]() {
+            endResetModel();
+        });
     }
 
     QHash<int, QByteArray> QueueModel::roleNames() const
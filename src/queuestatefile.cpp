@@ -0,0 +1,254 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2020 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "queuestatefile.h"
+
+#include <QBuffer>
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include "queue.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        /*
+         * File starts with magic and format version, followed by blocks of tracks.
+         * Each block is prefixed with its size in bytes and contains tracks count and tracks
+         */
+        const quint32 fileMagic = 0x55515354;
+        const quint32 fileFormatVersion = 1;
+        const qint64 headerSize = 2 * sizeof(quint32);
+        const QDataStream::Version streamVersion = QDataStream::Qt_5_6;
+
+        // libraryId, duration, flags and sizes of four strings
+        const qint64 minTrackSize = 2 * sizeof(qint32) + sizeof(quint8) + 4 * sizeof(quint32);
+
+        enum TrackFlag : quint8
+        {
+            LocalFileFlag = 1,
+            FilteredSingleAlbumFlag = 2
+        };
+
+        QByteArray makeBlock(const QueueTrack* tracks, size_t count)
+        {
+            QByteArray block;
+            QBuffer buffer(&block);
+            buffer.open(QIODevice::WriteOnly);
+            QDataStream stream(&buffer);
+            stream.setVersion(streamVersion);
+
+            stream << quint32(0) << static_cast<quint32>(count);
+            for (const QueueTrack* track = tracks, *end = tracks + count; track != end; ++track) {
+                quint8 flags = 0;
+                if (track->isLocalFile()) {
+                    flags |= LocalFileFlag;
+                }
+                if (track->filteredSingleAlbum) {
+                    flags |= FilteredSingleAlbumFlag;
+                }
+                stream << static_cast<qint32>(track->libraryId)
+                       << static_cast<qint32>(track->duration)
+                       << flags
+                       << (track->isLocalFile() ? track->filePath : track->remoteUrl.toString())
+                       << track->title
+                       << track->artist
+                       << track->album;
+            }
+
+            // Size doesn't include size field itself
+            buffer.seek(0);
+            stream << static_cast<quint32>(block.size() - static_cast<int>(sizeof(quint32)));
+
+            return block;
+        }
+
+        bool readBlock(QDataStream& stream, qint64 blockEnd, std::vector<QueueTrack>& tracks)
+        {
+            quint32 count;
+            stream >> count;
+            if (stream.status() != QDataStream::Ok) {
+                return false;
+            }
+            // Corrupted count must not make us reserve huge amount of memory
+            if (count > (blockEnd - stream.device()->pos()) / minTrackSize) {
+                return false;
+            }
+
+            tracks.reserve(tracks.size() + count);
+            qint32 libraryId;
+            qint32 duration;
+            quint8 flags;
+            QString location;
+            QString title;
+            QString artist;
+            QString album;
+            for (quint32 i = 0; i < count; ++i) {
+                stream >> libraryId >> duration >> flags >> location >> title >> artist >> album;
+                if (stream.status() != QDataStream::Ok) {
+                    return false;
+                }
+                if (flags & LocalFileFlag) {
+                    // Avoid parsing URL of every local file
+                    tracks.emplace_back(QUrl(), title, duration, artist, album, flags & FilteredSingleAlbumFlag, libraryId);
+                    tracks.back().filePath = location;
+                } else {
+                    tracks.emplace_back(QUrl(location), title, duration, artist, album, false, libraryId);
+                }
+            }
+            return true;
+        }
+
+        void writeHeader(QIODevice& device)
+        {
+            QDataStream stream(&device);
+            stream.setVersion(streamVersion);
+            stream << fileMagic << fileFormatVersion;
+        }
+    }
+
+    QueueStateFile::QueueStateFile()
+        : mFilePath(QString::fromLatin1("%1/queue").arg(QStandardPaths::writableLocation(QStandardPaths::DataLocation)))
+    {
+
+    }
+
+    bool QueueStateFile::exists() const
+    {
+        return QFile::exists(mFilePath);
+    }
+
+    bool QueueStateFile::load(std::vector<QueueTrack>& tracks, bool& complete) const
+    {
+        complete = false;
+
+        QFile file(mFilePath);
+        if (!file.open(QIODevice::ReadOnly)) {
+            qWarning() << "Failed to open queue state file" << file.errorString();
+            return false;
+        }
+
+        const qint64 size = file.size();
+        if (size < headerSize) {
+            qWarning("Queue state file is too small");
+            return false;
+        }
+
+        uchar* data = file.map(0, size);
+        if (!data) {
+            qWarning() << "Failed to map queue state file" << file.errorString();
+            return false;
+        }
+
+        const QByteArray bytes(QByteArray::fromRawData(reinterpret_cast<const char*>(data), static_cast<int>(size)));
+        QDataStream stream(bytes);
+        stream.setVersion(streamVersion);
+
+        bool ok = true;
+
+        quint32 magic;
+        quint32 version;
+        stream >> magic >> version;
+        if (magic != fileMagic || version != fileFormatVersion) {
+            qWarning("Unsupported queue state file format");
+            ok = false;
+        }
+
+        complete = ok;
+        while (ok && !stream.atEnd()) {
+            quint32 blockSize;
+            stream >> blockSize;
+            const qint64 blockEnd = stream.device()->pos() + blockSize;
+            if (stream.status() != QDataStream::Ok || blockEnd > size) {
+                qWarning("Queue state file ends with incomplete block");
+                complete = false;
+                break;
+            }
+
+            const size_t oldCount = tracks.size();
+            if (!readBlock(stream, blockEnd, tracks)) {
+                qWarning("Queue state file is corrupted");
+                tracks.erase(tracks.begin() + static_cast<std::ptrdiff_t>(oldCount), tracks.end());
+                complete = false;
+                break;
+            }
+            stream.device()->seek(blockEnd);
+        }
+
+        file.unmap(data);
+
+        return ok;
+    }
+
+    bool QueueStateFile::append(const QueueTrack* tracks, size_t count) const
+    {
+        if (count == 0) {
+            return true;
+        }
+
+        QFile file(mFilePath);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+            qWarning() << "Failed to open queue state file" << file.errorString();
+            return false;
+        }
+
+        if (file.size() < headerSize) {
+            file.resize(0);
+            writeHeader(file);
+        }
+
+        if (file.write(makeBlock(tracks, count)) < 0) {
+            qWarning() << "Failed to write queue state file" << file.errorString();
+            return false;
+        }
+
+        return true;
+    }
+
+    bool QueueStateFile::write(const std::vector<QueueTrack>& tracks) const
+    {
+        if (!QDir().mkpath(QFileInfo(mFilePath).path())) {
+            qWarning("Failed to create data directory");
+            return false;
+        }
+
+        QSaveFile file(mFilePath);
+        if (!file.open(QIODevice::WriteOnly)) {
+            qWarning() << "Failed to open queue state file" << file.errorString();
+            return false;
+        }
+
+        writeHeader(file);
+        if (!tracks.empty()) {
+            file.write(makeBlock(tracks.data(), tracks.size()));
+        }
+
+        if (!file.commit()) {
+            qWarning() << "Failed to write queue state file" << file.errorString();
+            return false;
+        }
+
+        return true;
+    }
+}
@@ -0,0 +1,57 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2020 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_QUEUESTATEFILE_H
+#define UNPLAYER_QUEUESTATEFILE_H
+
+#include <vector>
+
+#include <QString>
+
+namespace unplayer
+{
+    struct QueueTrack;
+
+    /**
+     * @brief Binary file with tracks of the queue and their display metadata.
+     * New tracks are appended to the end of the file, so adding tracks doesn't
+     * require rewriting it. Must be used only from main thread
+     */
+    class QueueStateFile
+    {
+    public:
+        QueueStateFile();
+
+        bool exists() const;
+
+        /**
+         * @brief Maps file into memory and reads its tracks.
+         * Incomplete block left by interrupted append and everything after it is ignored
+         * @param complete Set to false if file has invalid data, then it must be rewritten
+         * before anything is appended to it
+         */
+        bool load(std::vector<QueueTrack>& tracks, bool& complete) const;
+        bool append(const QueueTrack* tracks, size_t count) const;
+        bool write(const std::vector<QueueTrack>& tracks) const;
+
+    private:
+        QString mFilePath;
+    };
+}
+
+#endif // UNPLAYER_QUEUESTATEFILE_H
@@ -106,7 +106,10 @@ namespace unplayer
 
     void Settings::setUseAlbumArtist(bool use)
     {
-        mSettings->setValue(useAlbumArtistKey, use);
+        if (use != useAlbumArtist()) {
+            mSettings->setValue(useAlbumArtistKey, use);
+            emit useAlbumArtistChanged(use);
+        }
     }
 
     QStringList Settings::blacklistedDirectories() const
@@ -314,14 +317,14 @@ namespace unplayer
         return mSettings->value(stopAfterEosKey).toBool();
     }
 
-    void Settings::savePlayerState(const QStringList& tracks,
-                                   int queuePosition,
+    void Settings::savePlayerState(int queuePosition,
                                    bool shuffle,
                                    int repeatMode,
                                    long long playerPosition,
                                    bool stopAfterEos)
     {
-        mSettings->setValue(queueTracksKey, tracks);
+        // Queue itself is saved in separate file
+        mSettings->remove(queueTracksKey);
         mSettings->setValue(queuePositionKey, queuePosition);
         mSettings->setValue(shuffleKey, shuffle);
         mSettings->setValue(repeatModeKey, repeatMode);
@@ -32,7 +32,7 @@ namespace unplayer
         Q_OBJECT
         Q_PROPERTY(bool hasLibraryDirectories READ hasLibraryDirectories NOTIFY libraryDirectoriesChanged)
         Q_PROPERTY(bool openLibraryOnStartup READ openLibraryOnStartup WRITE setOpenLibraryOnStartup)
-        Q_PROPERTY(bool useAlbumArtist READ useAlbumArtist WRITE setUseAlbumArtist)
+        Q_PROPERTY(bool useAlbumArtist READ useAlbumArtist WRITE setUseAlbumArtist NOTIFY useAlbumArtistChanged)
         Q_PROPERTY(QString defaultDirectory READ defaultDirectory WRITE setDefaultDirectory)
         Q_PROPERTY(bool useDirectoryMediaArt READ useDirectoryMediaArt WRITE setUseDirectoryMediaArt)
         Q_PROPERTY(bool restorePlayerState READ restorePlayerState WRITE setRestorePlayerState)
@@ -98,14 +98,14 @@ namespace unplayer
         bool genresSortDescending() const;
         void setGenresSortDescending(bool descending);
 
+        // Queue saved by previous versions, now it is stored in QueueStateFile
         QStringList queueTracks() const;
         int queuePosition() const;
         bool shuffle() const;
         int repeatMode() const;
         long long playerPosition() const;
         bool stopAfterEos() const;
-        void savePlayerState(const QStringList& tracks,
-                             int queuePosition,
+        void savePlayerState(int queuePosition,
                              bool shuffle,
                              int repeatMode,
                              long long playerPosition,
@@ -117,6 +117,7 @@ namespace unplayer
     signals:
         void showNowPlayingCodecInfoChanged(bool show);
         void libraryDirectoriesChanged();
+        void useAlbumArtistChanged(bool use);
     };
 }
 
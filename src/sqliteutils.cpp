@@ -0,0 +1,143 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2020 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sqliteutils.h"
+
+#include <QCollator>
+#include <QDebug>
+#include <QLocale>
+#include <QSqlDatabase>
+#include <QSqlDriver>
+#include <QSqlQuery>
+#include <QVariant>
+
+#include <atomic>
+
+#include <sqlite3.h>
+
+namespace unplayer
+{
+    namespace sqliteutils
+    {
+        namespace
+        {
+            QCollator makeCollator()
+            {
+                QCollator collator;
+                collator.setNumericMode(true);
+                return collator;
+            }
+
+            // Strings are passed as UTF-16 in native byte order, so they are compared without conversion
+            int compareLocale(void* collator, int leftLength, const void* left, int rightLength, const void* right)
+            {
+                return static_cast<const QCollator*>(collator)->compare(static_cast<const QChar*>(left),
+                                                                        leftLength / static_cast<int>(sizeof(QChar)),
+                                                                        static_cast<const QChar*>(right),
+                                                                        rightLength / static_cast<int>(sizeof(QChar)));
+            }
+
+            void destroyCollator(void* collator)
+            {
+                delete static_cast<QCollator*>(collator);
+            }
+
+            enum class LibraryCheck
+            {
+                NotChecked,
+                Same,
+                Different
+            };
+
+            std::atomic<LibraryCheck> libraryCheck(LibraryCheck::NotChecked);
+
+            // Cleared when LOCALE collation can't be registered, then NOCASE is used instead
+            std::atomic_bool localeCollationAvailable(true);
+
+            // Native handle can be passed to our sqlite3_* functions only if QtSql is linked
+            // with the same SQLite library, and doesn't use its bundled copy
+            bool isSameLibrary(const QSqlDatabase& db)
+            {
+                LibraryCheck check = libraryCheck;
+                if (check == LibraryCheck::NotChecked) {
+                    QSqlQuery query(db);
+                    if (!query.exec(QLatin1String("SELECT sqlite_source_id()")) || !query.next()) {
+                        return false;
+                    }
+                    const QString sourceId(query.value(0).toString());
+                    if (sourceId == QLatin1String(sqlite3_sourceid())) {
+                        check = LibraryCheck::Same;
+                    } else {
+                        qWarning() << "QtSql and Unplayer use different SQLite libraries, native SQLite functions are disabled:"
+                                   << sourceId << sqlite3_sourceid();
+                        check = LibraryCheck::Different;
+                    }
+                    libraryCheck = check;
+                }
+                return check == LibraryCheck::Same;
+            }
+        }
+
+        sqlite3* handle(const QSqlDatabase& db)
+        {
+            const QVariant handle(db.driver()->handle());
+            if (handle.isValid() && qstrcmp(handle.typeName(), "sqlite3*") == 0 && isSameLibrary(db)) {
+                return *static_cast<sqlite3* const*>(handle.constData());
+            }
+            return nullptr;
+        }
+
+        bool registerLocaleCollation(const QSqlDatabase& db)
+        {
+            sqlite3* const sqlite = handle(db);
+            if (!sqlite) {
+                qWarning("Failed to get SQLite handle, NOCASE collation will be used instead of LOCALE");
+                localeCollationAvailable = false;
+                return false;
+            }
+
+            // Each connection has its own collator, since connections are used from different threads
+            const auto collator = new QCollator(makeCollator());
+            const int result = sqlite3_create_collation_v2(sqlite, "LOCALE", SQLITE_UTF16, collator, compareLocale, destroyCollator);
+            if (result != SQLITE_OK) {
+                // SQLite doesn't call destroyCollator() in this case
+                delete collator;
+                qWarning() << "Failed to register LOCALE collation:" << sqlite3_errstr(result);
+                localeCollationAvailable = false;
+                return false;
+            }
+            return true;
+        }
+
+        QLatin1String sortCollation()
+        {
+            if (localeCollationAvailable) {
+                return QLatin1String("LOCALE");
+            }
+            return QLatin1String("NOCASE");
+        }
+
+        QString sortCollationName()
+        {
+            if (localeCollationAvailable) {
+                return makeCollator().locale().name();
+            }
+            return sortCollation();
+        }
+    }
+}
@@ -0,0 +1,58 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2020 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_SQLITEUTILS_H
+#define UNPLAYER_SQLITEUTILS_H
+
+class QLatin1String;
+class QSqlDatabase;
+class QString;
+struct sqlite3;
+
+namespace unplayer
+{
+    namespace sqliteutils
+    {
+        /**
+         * @brief Returns native handle of QSQLITE connection, or nullptr.
+         * Returns nullptr if QtSql is not linked with the same SQLite library as Unplayer
+         */
+        sqlite3* handle(const QSqlDatabase& db);
+
+        /**
+         * @brief Registers LOCALE collation that compares strings with QCollator,
+         * using the same rules as FilterProxyModel (numeric mode, default locale).
+         * Must be called for every connection, since indexes depend on it
+         */
+        bool registerLocaleCollation(const QSqlDatabase& db);
+
+        /**
+         * @brief Collation used for locale-aware sorting and its indexes.
+         * LOCALE, or NOCASE if LOCALE collation could not be registered for a connection
+         */
+        QLatin1String sortCollation();
+
+        /**
+         * @brief Name of locale used by LOCALE collation, or NOCASE if it is not available.
+         * Indexes that use sortCollation() must be rebuilt when it changes
+         */
+        QString sortCollationName();
+    }
+}
+
+#endif // UNPLAYER_SQLITEUTILS_H
@@ -88,7 +88,22 @@ namespace unplayer
 
         inline ~TransactionGuard()
         {
-            db.commit();
+            if (!finished) {
+                db.commit();
+            }
+        }
+
+        // Commits before guard is destroyed
+        inline bool commit()
+        {
+            finished = true;
+            return db.commit();
+        }
+
+        inline bool rollback()
+        {
+            finished = true;
+            return db.rollback();
         }
 
         TransactionGuard(const TransactionGuard&) = delete;
@@ -97,6 +112,7 @@ namespace unplayer
         TransactionGuard& operator=(TransactionGuard&&) = delete;
 
         QSqlDatabase& db;
+        bool finished = false;
     };
 
     template<typename C>
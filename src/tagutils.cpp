@@ -234,6 +234,13 @@ namespace unplayer
 
             class ExtractProcessor : public Processor<Info>
             {
+            public:
+                explicit ExtractProcessor(bool extractMediaArt = true)
+                    : mExtractMediaArt(extractMediaArt)
+                {
+
+                }
+
             protected:
                 using Processor::processFile;
 
@@ -333,12 +340,14 @@ namespace unplayer
                     if (info) {
                         info->bitDepth = file.audioProperties()->bitsPerSample();
 
-                        const TagLib::MP4::ItemMap& items = file.tag()->itemMap();
-                        const auto found(items.find("covr"));
-                        if (found != items.end()) {
-                            const TagLib::MP4::CoverArtList covers(found->second.toCoverArtList());
-                            if (!covers.isEmpty()) {
-                                setMediaArt(*info, covers.front().data());
+                        if (mExtractMediaArt) {
+                            const TagLib::MP4::ItemMap& items = file.tag()->itemMap();
+                            const auto found(items.find("covr"));
+                            if (found != items.end()) {
+                                const TagLib::MP4::CoverArtList covers(found->second.toCoverArtList());
+                                if (!covers.isEmpty()) {
+                                    setMediaArt(*info, covers.front().data());
+                                }
                             }
                         }
                     }
@@ -456,7 +465,7 @@ namespace unplayer
 
                 void setMediaArtFromFlacPictures(Info& info, const TagLib::List<TagLib::FLAC::Picture*>& pictures) const
                 {
-                    if (!pictures.isEmpty()) {
+                    if (mExtractMediaArt && !pictures.isEmpty()) {
                         const TagLib::FLAC::Picture* backCover = nullptr;
                         for (const TagLib::FLAC::Picture* picture : pictures) {
                             if (picture->type() == TagLib::FLAC::Picture::FrontCover) {
@@ -477,6 +486,9 @@ namespace unplayer
 
                 void setMediaArtFromIDv2Tag(Info& info, const TagLib::ID3v2::Tag* tag) const
                 {
+                    if (!mExtractMediaArt) {
+                        return;
+                    }
                     const TagLib::ID3v2::FrameListMap& frameListMap = tag->frameListMap();
                     const auto setFromFrames = [&](const char* framesTag) {
                         const auto framesFound(frameListMap.find(framesTag));
@@ -510,6 +522,9 @@ namespace unplayer
 
                 void setMediaArtFromApeTag(Info& info, const TagLib::APE::Tag* tag) const
                 {
+                    if (!mExtractMediaArt) {
+                        return;
+                    }
                     const TagLib::APE::ItemListMap& items = tag->itemListMap();
                     const auto setFromItem = [&](const char* itemTag) {
                         const auto found(items.find(itemTag));
@@ -526,6 +541,8 @@ namespace unplayer
                         setFromItem("COVER ART (BACK)");
                     }
                 }
+
+                bool mExtractMediaArt;
             };
 
             class AudioFormatProcessor final : public Processor<AudioCodecInfo>
@@ -660,9 +677,9 @@ namespace unplayer
             };
         }
 
-        std::optional<Info> getTrackInfo(const QString& filePath, fileutils::Extension extension)
+        std::optional<Info> getTrackInfo(const QString& filePath, fileutils::Extension extension, bool extractMediaArt)
         {
-            return ExtractProcessor().process(filePath, extension);
+            return ExtractProcessor(extractMediaArt).process(filePath, extension);
         }
 
         std::optional<QByteArray> getTackMediaArtData(const QString &filePath, fileutils::Extension extension)
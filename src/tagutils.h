@@ -98,7 +98,8 @@ namespace unplayer
             int bitrate{};
         };
 
-        std::optional<Info> getTrackInfo(const QString& filePath, fileutils::Extension extension);
+        // Info::mediaArtData is left empty if extractMediaArt is false
+        std::optional<Info> getTrackInfo(const QString& filePath, fileutils::Extension extension, bool extractMediaArt = true);
         std::optional<QByteArray> getTackMediaArtData(const QString& filePath, fileutils::Extension extension);
         std::optional<AudioCodecInfo> getTrackAudioCodecInfo(const QString& filePath, fileutils::Extension extension);
 
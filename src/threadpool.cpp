@@ -0,0 +1,152 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2020 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "threadpool.h"
+
+#include <algorithm>
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <QCoreApplication>
+#include <QDebug>
+
+namespace unplayer
+{
+    namespace
+    {
+        // Interactive task that waited longer than that in queue is logged
+        const long long slowQueuedTime = 100;
+
+        const unsigned long yieldSleepTime = 10;
+        const long long maxYieldTime = 1000;
+
+        const int backgroundNiceness = 10;
+
+        // Threads are owned by one pool, so nice value is set once per thread
+        thread_local bool threadNicenessSet = false;
+    }
+
+    ThreadPool* ThreadPool::interactive()
+    {
+        static ThreadPool pool("interactive", std::max(QThread::idealThreadCount(), 2), 0);
+        return &pool;
+    }
+
+    ThreadPool* ThreadPool::background()
+    {
+        // Library mutations are serialized by database locks anyway, so few threads are enough
+        static ThreadPool pool("background", 2, backgroundNiceness);
+        return &pool;
+    }
+
+    void ThreadPool::yieldToInteractive(long long& yieldedTime)
+    {
+        const ThreadPool* pool = interactive();
+        if (yieldedTime >= maxYieldTime || !pool->isSaturated()) {
+            return;
+        }
+        QElapsedTimer timer;
+        timer.start();
+        while (pool->isSaturated() && (yieldedTime + timer.elapsed()) < maxYieldTime) {
+            QThread::msleep(yieldSleepTime);
+        }
+        yieldedTime += timer.elapsed();
+    }
+
+    void ThreadPool::start(QRunnable* runnable)
+    {
+        run([runnable] {
+            runnable->run();
+            if (runnable->autoDelete()) {
+                delete runnable;
+            }
+        });
+    }
+
+    void ThreadPool::logStats() const
+    {
+        const long long tasks = mTasks;
+        if (tasks == 0) {
+            return;
+        }
+        qInfo("Thread pool '%s': %lld tasks, peak %d of %d threads busy, peak %d tasks queued, "
+              "queued for %lld ms on average (%lld ms max), ran for %lld ms on average",
+              mName,
+              tasks,
+              mPeakActive.load(),
+              mPool.maxThreadCount(),
+              mPeakQueued.load(),
+              mQueuedTime / tasks,
+              mMaxQueuedTime.load(),
+              mRunTime / tasks);
+    }
+
+    ThreadPool::ThreadPool(const char* name, int maxThreadCount, int niceness)
+        : mName(name),
+          mNiceness(niceness)
+    {
+        mPool.setMaxThreadCount(maxThreadCount);
+        QObject::connect(qApp, &QCoreApplication::aboutToQuit, [this] {
+            logStats();
+        });
+    }
+
+    ThreadPool::TaskGuard::TaskGuard(ThreadPool* pool, const QElapsedTimer& queuedTimer)
+        : mPool(pool)
+    {
+        mRunTimer.start();
+
+        const long long queuedTime = queuedTimer.elapsed();
+        --mPool->mQueued;
+        ++mPool->mTasks;
+        mPool->mQueuedTime += queuedTime;
+        updateMaximum(mPool->mMaxQueuedTime, queuedTime);
+        updateMaximum(mPool->mPeakActive, ++mPool->mActive);
+
+        if (queuedTime > slowQueuedTime && mPool->mNiceness == 0) {
+            qInfo("Task waited for %lld ms in '%s' thread pool, %d more tasks queued, %d of %d threads busy",
+                  queuedTime,
+                  mPool->mName,
+                  mPool->mQueued.load(),
+                  mPool->mActive.load(),
+                  mPool->mPool.maxThreadCount());
+        }
+
+        if (mPool->mNiceness != 0 && !threadNicenessSet) {
+            // On Linux nice value is per thread
+            if (setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), mPool->mNiceness) != 0) {
+                qWarning("Failed to set nice value of '%s' thread pool's thread", mPool->mName);
+            }
+            threadNicenessSet = true;
+        }
+    }
+
+    ThreadPool::TaskGuard::~TaskGuard()
+    {
+        --mPool->mActive;
+        mPool->mRunTime += mRunTimer.elapsed();
+    }
+
+    bool ThreadPool::isSaturated() const
+    {
+        // Free threads will pick up interactive tasks anyway
+        return mActive >= mPool.maxThreadCount();
+    }
+}
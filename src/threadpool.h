@@ -0,0 +1,120 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2020 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_THREADPOOL_H
+#define UNPLAYER_THREADPOOL_H
+
+#include <atomic>
+#include <utility>
+
+#include <QElapsedTimer>
+#include <QFuture>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrentRun>
+
+namespace unplayer
+{
+    /**
+     * @brief QThreadPool wrapper that counts how its threads are used
+     */
+    class ThreadPool final
+    {
+    public:
+        /**
+         * @brief Pool for short reads that user waits for: model queries, directory listings, track info
+         */
+        static ThreadPool* interactive();
+        /**
+         * @brief Pool for library updates, removals, tag saving and other maintenance work
+         */
+        static ThreadPool* background();
+
+        /**
+         * @brief Called by long background tasks between units of work.
+         * Blocks while all threads of interactive pool are busy, until yieldedTime reaches maxYieldTime
+         * @param yieldedTime Time already spent here by current batch of work, updated by this function
+         */
+        static void yieldToInteractive(long long& yieldedTime);
+
+        template<typename Function>
+        auto run(Function&& function) -> QFuture<decltype(function())>
+        {
+            QElapsedTimer queuedTimer;
+            queuedTimer.start();
+            updateMaximum(mPeakQueued, ++mQueued);
+            return QtConcurrent::run(&mPool, [this, queuedTimer, function = std::forward<Function>(function)]() mutable {
+                const TaskGuard guard(this, queuedTimer);
+                return function();
+            });
+        }
+
+        // Takes ownership of runnable if its autoDelete() is true
+        void start(QRunnable* runnable);
+
+        void logStats() const;
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool(ThreadPool&&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+        ThreadPool& operator=(ThreadPool&&) = delete;
+
+    private:
+        /**
+         * @param niceness Nice value of pool's threads. QThread priorities are ignored
+         * by Linux for normal scheduling policy, so nice value is set directly
+         */
+        ThreadPool(const char* name, int maxThreadCount, int niceness);
+
+        template<typename T>
+        static void updateMaximum(std::atomic<T>& maximum, T value)
+        {
+            T current = maximum;
+            while (value > current && !maximum.compare_exchange_weak(current, value)) {}
+        }
+
+        class TaskGuard
+        {
+        public:
+            TaskGuard(ThreadPool* pool, const QElapsedTimer& queuedTimer);
+            ~TaskGuard();
+            TaskGuard(const TaskGuard&) = delete;
+            TaskGuard& operator=(const TaskGuard&) = delete;
+        private:
+            ThreadPool* mPool;
+            QElapsedTimer mRunTimer;
+        };
+
+        bool isSaturated() const;
+
+        QThreadPool mPool;
+        const char* mName;
+        int mNiceness;
+
+        std::atomic_int mQueued{0};
+        std::atomic_int mPeakQueued{0};
+        std::atomic_int mActive{0};
+        std::atomic_int mPeakActive{0};
+        std::atomic<long long> mTasks{0};
+        std::atomic<long long> mQueuedTime{0};
+        std::atomic<long long> mMaxQueuedTime{0};
+        std::atomic<long long> mRunTime{0};
+    };
+}
+
+#endif // UNPLAYER_THREADPOOL_H
@@ -0,0 +1,140 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2020 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "thumbnailimageprovider.h"
+
+#include <algorithm>
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QSaveFile>
+#include <QUrl>
+
+#include "mediaartutils.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        // Decodes image at reduced resolution, so that its smaller side is not less than size
+        QImage readScaledImage(const QString& filePath, int size)
+        {
+            QImageReader reader(filePath);
+            const QSize imageSize(reader.size());
+            if (size > 0 && imageSize.isValid() && std::min(imageSize.width(), imageSize.height()) > size) {
+                reader.setScaledSize(imageSize.scaled(size, size, Qt::KeepAspectRatioByExpanding));
+            }
+            const QImage image(reader.read());
+            if (image.isNull()) {
+                qWarning() << "Failed to read image" << filePath << reader.errorString();
+            }
+            return image;
+        }
+
+        bool isThumbnailUpToDate(const QFileInfo& fileInfo, const QString& thumbnailPath)
+        {
+            const QFileInfo thumbnailInfo(thumbnailPath);
+            return thumbnailInfo.isFile() && thumbnailInfo.lastModified() >= fileInfo.lastModified();
+        }
+
+        QImage saveThumbnail(const QString& filePath, const QString& thumbnailPath, int size)
+        {
+            const QImage image(readScaledImage(filePath, size));
+            if (image.isNull()) {
+                return image;
+            }
+
+            if (!QDir().mkpath(QFileInfo(thumbnailPath).path())) {
+                qWarning() << "Failed to create thumbnails directory for" << thumbnailPath;
+                return image;
+            }
+            // Written to temporary file first, because the same thumbnail can be requested from several threads
+            QSaveFile file(thumbnailPath);
+            if (!file.open(QIODevice::WriteOnly) ||
+                    !image.save(&file, image.hasAlphaChannel() ? "PNG" : "JPEG", 90) ||
+                    !file.commit()) {
+                qWarning() << "Failed to save thumbnail" << thumbnailPath << file.errorString();
+            }
+            return image;
+        }
+
+        QImage loadThumbnail(const QString& filePath, int size)
+        {
+            const QFileInfo fileInfo(filePath);
+            if (!fileInfo.isFile()) {
+                return QImage();
+            }
+
+            const QString thumbnailPath(MediaArtUtils::thumbnailPath(filePath, size));
+            if (isThumbnailUpToDate(fileInfo, thumbnailPath)) {
+                const QImage thumbnail(thumbnailPath);
+                if (!thumbnail.isNull()) {
+                    return thumbnail;
+                }
+            }
+
+            return saveThumbnail(filePath, thumbnailPath, size);
+        }
+    }
+
+    const QLatin1String ThumbnailImageProvider::providerId("thumbnail");
+
+    ThumbnailImageProvider::ThumbnailImageProvider()
+        : QQuickImageProvider(QQuickImageProvider::Image)
+    {
+
+    }
+
+    QImage ThumbnailImageProvider::requestImage(const QString& id, QSize* size, const QSize& requestedSize)
+    {
+        const QString filePath(QUrl::fromPercentEncoding(id.toUtf8()));
+        const int requested = std::max(requestedSize.width(), requestedSize.height());
+
+        const std::vector<int>& sizes = MediaArtUtils::thumbnailSizes();
+        const auto found(std::find_if(sizes.begin(), sizes.end(), [&](int thumbnailSize) {
+            return thumbnailSize >= requested;
+        }));
+
+        QImage image;
+        if (requested > 0 && found != sizes.end()) {
+            image = loadThumbnail(filePath, *found);
+        } else {
+            image = readScaledImage(filePath, requested);
+        }
+
+        if (size) {
+            *size = image.size();
+        }
+        return image;
+    }
+
+    void ThumbnailImageProvider::createThumbnail(const QString& filePath, int size)
+    {
+        const QFileInfo fileInfo(filePath);
+        if (!fileInfo.isFile()) {
+            return;
+        }
+        const QString thumbnailPath(MediaArtUtils::thumbnailPath(filePath, size));
+        if (!isThumbnailUpToDate(fileInfo, thumbnailPath)) {
+            saveThumbnail(filePath, thumbnailPath, size);
+        }
+    }
+}
@@ -0,0 +1,43 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2020 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_THUMBNAILIMAGEPROVIDER_H
+#define UNPLAYER_THUMBNAILIMAGEPROVIDER_H
+
+#include <QQuickImageProvider>
+
+namespace unplayer
+{
+    /**
+     * @brief Serves media art files downscaled to the nearest of MediaArtUtils::thumbnailSizes().
+     * Id is percent encoded file path. Thumbnails are stored on disk and recreated when file is modified
+     */
+    class ThumbnailImageProvider final : public QQuickImageProvider
+    {
+    public:
+        static const QLatin1String providerId;
+
+        ThumbnailImageProvider();
+        QImage requestImage(const QString& id, QSize* size, const QSize& requestedSize) override;
+
+        // Creates thumbnail if it doesn't exist or is outdated, can be called from any thread
+        static void createThumbnail(const QString& filePath, int size);
+    };
+}
+
+#endif // UNPLAYER_THUMBNAILIMAGEPROVIDER_H
@@ -21,9 +21,9 @@
 #include <QCoreApplication>
 #include <QFileInfo>
 #include <QMimeDatabase>
-#include <QtConcurrentRun>
 
 #include "fileutils.h"
+#include "threadpool.h"
 #include "utilsfunctions.h"
 
 namespace unplayer
@@ -210,7 +210,7 @@ namespace unplayer
                 emit loadedChanged(mLoaded);
             }
             if (!filePath.isEmpty()) {
-                const auto future(QtConcurrent::run([filePath] {
+                const auto future(ThreadPool::interactive()->run([filePath] {
                     return tagutils::getTrackAudioCodecInfo(filePath, fileutils::extensionFromSuffix(QFileInfo(filePath).suffix()));
                 }));
                 onFutureFinished(future, this, [=](const std::optional<tagutils::AudioCodecInfo>& info) {
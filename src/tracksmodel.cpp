@@ -18,19 +18,67 @@
 
 #include "tracksmodel.h"
 
+#include <algorithm>
+
 #include <QCoreApplication>
+#include <QDebug>
+#include <QJSEngine>
+#include <QSqlError>
 #include <QSqlQuery>
+#include <QStringBuilder>
+#include <QTimer>
+#include <QUuid>
 
 #include "libraryutils.h"
-#include "modelutils.h"
+#include "qscopeguard.h"
 #include "settings.h"
+#include "sqliteutils.h"
+#include "sqlutils.h"
+#include "stdutils.h"
+#include "threadpool.h"
+#include "utilsfunctions.h"
 
 #include "abstractlibrarymodel.cpp"
 
 namespace unplayer
 {
+    namespace
+    {
+        // Smaller libraries are loaded entirely, so that they can be filtered in memory
+        const int windowingThreshold = 5000;
+        const int titleFilterDelay = 300;
+
+        QStringList trackPaths(const std::vector<LibraryTrack>& tracks)
+        {
+            QStringList paths;
+            paths.reserve(static_cast<int>(tracks.size()));
+            for (const LibraryTrack& track : tracks) {
+                paths.push_back(track.filePath);
+            }
+            return paths;
+        }
+    }
+
+    TracksModel::TracksModel()
+        : mTitleFilterTimer(new QTimer(this))
+    {
+        mTitleFilterTimer->setSingleShot(true);
+        mTitleFilterTimer->setInterval(titleFilterDelay);
+        QObject::connect(mTitleFilterTimer, &QTimer::timeout, this, [this] {
+            if (mWindowed && mComponentCompleted) {
+                clearWindows();
+                setLoading(true);
+                loadWindowedModel(false);
+            }
+        });
+    }
+
     TracksModel::~TracksModel()
     {
+        if (mWindowsCancellationToken) {
+            mWindowsCancellationToken->cancel();
+        }
+
         switch (mQueryMode) {
         case QueryAllTracks:
             Settings::instance()->setAllTracksSortSettings(mSortDescending, mSortMode, mInsideAlbumSortMode);
@@ -83,9 +131,25 @@ namespace unplayer
         execQuery();
     }
 
+    int TracksModel::rowCount(const QModelIndex& parent) const
+    {
+        if (mWindowed) {
+            return mRowCount;
+        }
+        return AbstractLibraryModel::rowCount(parent);
+    }
+
     QVariant TracksModel::data(const QModelIndex& index, int role) const
     {
-        const LibraryTrack& track = mTracks[static_cast<size_t>(index.row())];
+        const LibraryTrack* loadedTrack = nullptr;
+        if (mWindowed) {
+            // Window will be loaded in background and dataChanged() will be emitted
+            loadedTrack = windowedTrack(index.row());
+            if (!loadedTrack) {
+                return QVariant();
+            }
+        }
+        const LibraryTrack& track = mWindowed ? *loadedTrack : mTracks[static_cast<size_t>(index.row())];
 
         switch (role) {
         case FilePathRole:
@@ -193,29 +257,64 @@ namespace unplayer
         }
     }
 
-    std::vector<LibraryTrack> TracksModel::getTracks(const std::vector<int>& indexes) const
+    bool TracksModel::isWindowed() const
     {
-        std::vector<LibraryTrack> tracks;
-        tracks.reserve(indexes.size());
-        for (int index : indexes) {
-            tracks.push_back(mTracks[static_cast<size_t>(index)]);
+        return mWindowed;
+    }
+
+    QString TracksModel::titleFilter() const
+    {
+        return mTitleFilter;
+    }
+
+    void TracksModel::setTitleFilter(const QString& filter)
+    {
+        if (filter != mTitleFilter) {
+            mTitleFilter = filter;
+            // Restarted on each keystroke
+            mTitleFilterTimer->start();
         }
-        return tracks;
+    }
+
+    std::vector<LibraryTrack> TracksModel::getTracks(const std::vector<int>& indexes) const
+    {
+        return loadedTracksAt(indexes);
     }
 
     LibraryTrack TracksModel::getTrack(int index) const
     {
-        return mTracks[static_cast<size_t>(index)];
+        std::vector<LibraryTrack> tracks(loadedTracksAt({index}));
+        if (tracks.empty()) {
+            return {};
+        }
+        return std::move(tracks.front());
     }
 
     QStringList TracksModel::getTrackPaths(const std::vector<int>& indexes) const
     {
-        QStringList tracks;
-        tracks.reserve(static_cast<int>(indexes.size()));
-        for (int index : indexes) {
-            tracks.push_back(mTracks[static_cast<size_t>(index)].filePath);
-        }
-        return tracks;
+        return trackPaths(loadedTracksAt(indexes));
+    }
+
+    void TracksModel::requestTracks(const std::vector<int>& indexes, const QJSValue& callback) const
+    {
+        tracksAt(indexes, [this, callback](std::vector<LibraryTrack>&& tracks) {
+            QJSEngine* engine = qjsEngine(this);
+            if (engine) {
+                QJSValue function(callback);
+                function.call({engine->toScriptValue(tracks)});
+            }
+        });
+    }
+
+    void TracksModel::requestTrackPaths(const std::vector<int>& indexes, const QJSValue& callback) const
+    {
+        tracksAt(indexes, [this, callback](std::vector<LibraryTrack>&& tracks) {
+            QJSEngine* engine = qjsEngine(this);
+            if (engine) {
+                QJSValue function(callback);
+                function.call({engine->toScriptValue(trackPaths(tracks))});
+            }
+        });
     }
 
     void TracksModel::removeTrack(int index, bool deleteFile)
@@ -225,21 +324,8 @@ namespace unplayer
 
     void TracksModel::removeTracks(const std::vector<int>& indexes, bool deleteFiles)
     {
-        if (LibraryUtils::instance()->isRemovingFiles()) {
-            return;
-        }
-
-        std::vector<LibraryTrack> files;
-        files.reserve(indexes.size());
-        for (int index : indexes) {
-            files.push_back(mTracks[static_cast<size_t>(index)]);
-        }
-        LibraryUtils::instance()->removeTracks(std::move(files), deleteFiles);
-        QObject::connect(LibraryUtils::instance(), &LibraryUtils::removingFilesChanged, this, [this, indexes] {
-            if (!LibraryUtils::instance()->isRemovingFiles()) {
-                ModelBatchRemover::removeIndexes(this, indexes);
-                QObject::disconnect(LibraryUtils::instance(), &LibraryUtils::removingFilesChanged, this, nullptr);
-            }
+        tracksAt(indexes, [deleteFiles](std::vector<LibraryTrack>&& tracks) {
+            LibraryUtils::instance()->removeTracks(std::move(tracks), deleteFiles);
         });
     }
 
@@ -355,6 +441,8 @@ namespace unplayer
                   TracksModel::InsideAlbumSortMode insideAlbumSortMode,
                   bool sortDescending)
         {
+            const QLatin1String order(sortDescending ? "DESC" : "ASC");
+
             QString sortString;
 
             bool sortInsideAlbum = false;
@@ -368,19 +456,20 @@ namespace unplayer
             default:
                 switch (sortMode) {
                 case TracksModel::SortMode::Title:
-                    sortString = QLatin1String("ORDER BY tracks.title %1");
+                    sortString = QLatin1String("ORDER BY tracks.title COLLATE %2 %1");
                     break;
                 case TracksModel::SortMode::AddedDate:
-                    sortString = QLatin1String("ORDER BY tracks.id %1");
-                    break;
+                    // No collation placeholder
+                    queryString += QString::fromLatin1("ORDER BY tracks.id %1").arg(order);
+                    return;
                 case TracksModel::SortMode::Artist_AlbumTitle:
                 case TracksModel::SortMode::Artist_AlbumYear:
                 {
-                    sortString = QLatin1String("ORDER BY artists.title IS NULL %1, artists.title %1, albums.title IS NULL %1, ");
+                    sortString = QLatin1String("ORDER BY artists.title IS NULL %1, artists.title COLLATE %2 %1, albums.title IS NULL %1, ");
                     if (sortMode == TracksModel::SortMode::Artist_AlbumTitle) {
-                        sortString += QLatin1String("albums.title %1, ");
+                        sortString += QLatin1String("albums.title COLLATE %2 %1, ");
                     } else {
-                        sortString += QLatin1String("year %1, albums.title %1, ");
+                        sortString += QLatin1String("year %1, albums.title COLLATE %2 %1, ");
                     }
                     sortInsideAlbum = true;
                     break;
@@ -392,22 +481,270 @@ namespace unplayer
             if (sortInsideAlbum) {
                 switch (insideAlbumSortMode) {
                 case TracksModel::InsideAlbumSortMode::Title:
-                    sortString += QLatin1String("tracks.title %1");
+                    sortString += QLatin1String("tracks.title COLLATE %2 %1");
                     break;
                 case TracksModel::InsideAlbumSortMode::DiscNumber_Title:
-                    sortString += QLatin1String("discNumber IS NULL %1, discNumber %1, tracks.title %1");
+                    sortString += QLatin1String("discNumber IS NULL %1, discNumber %1, tracks.title COLLATE %2 %1");
                     break;
                 case TracksModel::InsideAlbumSortMode::DiscNumber_TrackNumber:
-                    sortString += QLatin1String("discNumber IS NULL %1, discNumber %1, trackNumber %1, tracks.title %1");
+                    sortString += QLatin1String("discNumber IS NULL %1, discNumber %1, trackNumber %1, tracks.title COLLATE %2 %1");
                     break;
                 }
             }
 
-            queryString += sortString.arg(sortDescending ? QLatin1String("DESC") : QLatin1String("ASC"));
+            queryString += sortString.arg(order, sqliteutils::sortCollation());
         }
         }
     }
 
+    namespace
+    {
+        // Number of tracks in window and number of windows kept in memory
+        const int windowSize = 100;
+        const size_t maxWindowsCount = 10;
+
+        struct WindowQueryParameters
+        {
+            TracksModel::SortMode sortMode;
+            bool sortDescending;
+            bool useAlbumArtist;
+            QString titleFilter;
+            // Null if query is executed synchronously
+            std::shared_ptr<QueryCancellationToken> cancellationToken;
+        };
+
+        QString windowOrder(const WindowQueryParameters& parameters)
+        {
+            const QLatin1String order(parameters.sortDescending ? "DESC" : "ASC");
+            if (parameters.sortMode == TracksModel::SortMode::Title) {
+                // Id makes order unique, so that windows can start from (title, id) key
+                return QString::fromLatin1("tracks.title COLLATE %2 %1, tracks.id %1").arg(order, sqliteutils::sortCollation());
+            }
+            return QString::fromLatin1("tracks.id %1").arg(order);
+        }
+
+        void addTitleFilter(QStringList& conditions, QVariantList& values, const QString& titleFilter)
+        {
+            if (titleFilter.isEmpty()) {
+                return;
+            }
+            QString pattern(titleFilter);
+            pattern.replace(QLatin1Char('\\'), QLatin1String("\\\\"));
+            pattern.replace(QLatin1Char('%'), QLatin1String("\\%"));
+            pattern.replace(QLatin1Char('_'), QLatin1String("\\_"));
+            conditions.push_back(QLatin1String("tracks.title LIKE ? ESCAPE '\\'"));
+            values.push_back(QString(QLatin1Char('%') % pattern % QLatin1Char('%')));
+        }
+
+        bool execWindowQuery(QSqlQuery& query, const QString& queryString, const QVariantList& values, const WindowQueryParameters& parameters)
+        {
+            query.setForwardOnly(true);
+            if (!query.prepare(queryString)) {
+                qWarning() << "Prepare failed:" << query.lastError();
+                qWarning() << "Query:" << queryString;
+                return false;
+            }
+            for (const QVariant& value : values) {
+                query.addBindValue(value);
+            }
+            if (!query.exec()) {
+                if (!parameters.cancellationToken || !parameters.cancellationToken->isCancelled()) {
+                    qWarning() << "Exec failed:" << query.lastError();
+                    qWarning() << "Query:" << queryString;
+                }
+                return false;
+            }
+            return true;
+        }
+
+        template<typename Function>
+        auto runWindowQuery(const WindowQueryParameters& parameters, const Function& function)
+        {
+            return ThreadPool::interactive()->run([parameters, function] {
+                using Result = decltype(function(QSqlDatabase()));
+                const auto& cancellationToken = parameters.cancellationToken;
+                if (cancellationToken->isCancelled()) {
+                    return Result();
+                }
+                const DatabaseConnectionGuard databaseGuard(QUuid::createUuid().toString());
+                if (!databaseGuard.db.isOpen() || !cancellationToken->attach(databaseGuard.db)) {
+                    return Result();
+                }
+                const auto detachGuard(qScopeGuard([&] {
+                    cancellationToken->detach(databaseGuard.db);
+                }));
+                return function(databaseGuard.db);
+            });
+        }
+
+        int queryRowCount(const QSqlDatabase& db, const WindowQueryParameters& parameters)
+        {
+            QStringList conditions;
+            QVariantList values;
+            addTitleFilter(conditions, values, parameters.titleFilter);
+
+            QString queryString(QLatin1String("SELECT COUNT(*) FROM tracks "));
+            if (!conditions.isEmpty()) {
+                queryString += QLatin1String("WHERE ") % conditions.join(QLatin1String(" AND "));
+            }
+
+            QSqlQuery query(db);
+            if (!execWindowQuery(query, queryString, values, parameters) || !query.next()) {
+                return 0;
+            }
+            return query.value(0).toInt();
+        }
+
+        // Selects rows starting from key, inclusive
+        void addKeyCondition(QStringList& conditions, QVariantList& values, const WindowQueryParameters& parameters, const std::pair<QVariant, int>& key)
+        {
+            if (parameters.sortMode == TracksModel::SortMode::Title) {
+                // Written this way instead of (title, id) > (?, ?) so that SQLite can seek in title index
+                if (parameters.sortDescending) {
+                    conditions.push_back(QString::fromLatin1("tracks.title COLLATE %1 <= ? AND (tracks.title COLLATE %1 < ? OR tracks.id <= ?)").arg(sqliteutils::sortCollation()));
+                } else {
+                    conditions.push_back(QString::fromLatin1("tracks.title COLLATE %1 >= ? AND (tracks.title COLLATE %1 > ? OR tracks.id >= ?)").arg(sqliteutils::sortCollation()));
+                }
+                values.push_back(key.first);
+                values.push_back(key.first);
+            } else {
+                conditions.push_back(parameters.sortDescending ? QLatin1String("tracks.id <= ?") : QLatin1String("tracks.id >= ?"));
+            }
+            values.push_back(key.second);
+        }
+
+        // Key can't be used for seeking if title is NULL, window is selected using OFFSET then
+        bool isUsableKey(const std::pair<QVariant, int>& key, const WindowQueryParameters& parameters)
+        {
+            return parameters.sortMode != TracksModel::SortMode::Title || !key.first.isNull();
+        }
+
+        const std::pair<QVariant, int>* findWindowKey(const std::vector<std::pair<QVariant, int>>& keys, int window, const WindowQueryParameters& parameters)
+        {
+            // First window doesn't need a key
+            if (window == 0 || window >= static_cast<int>(keys.size())) {
+                return nullptr;
+            }
+            const auto& key = keys[static_cast<size_t>(window)];
+            if (!isUsableKey(key, parameters)) {
+                return nullptr;
+            }
+            return &key;
+        }
+
+        // Returns title and id of first track of each window.
+        // Each key is found by seeking from the previous one, so that only window boundaries are read
+        std::vector<std::pair<QVariant, int>> queryWindowKeys(const QSqlDatabase& db, const WindowQueryParameters& parameters)
+        {
+            QStringList filterConditions;
+            QVariantList filterValues;
+            addTitleFilter(filterConditions, filterValues, parameters.titleFilter);
+
+            const auto prepare = [&](QSqlQuery& query, bool fromKey) {
+                QStringList conditions;
+                if (fromKey) {
+                    QVariantList keyValues;
+                    addKeyCondition(conditions, keyValues, parameters, {});
+                }
+                conditions.append(filterConditions);
+                QString queryString(QLatin1String("SELECT tracks.title, tracks.id FROM tracks "));
+                if (!conditions.isEmpty()) {
+                    queryString += QLatin1String("WHERE (") % conditions.join(QLatin1String(") AND (")) % QLatin1String(") ");
+                }
+                queryString += QLatin1String("ORDER BY ") % windowOrder(parameters) % QLatin1String(" LIMIT 1 OFFSET ?");
+
+                query.setForwardOnly(true);
+                if (!query.prepare(queryString)) {
+                    qWarning() << "Prepare failed:" << query.lastError();
+                    qWarning() << "Query:" << queryString;
+                    return false;
+                }
+                return true;
+            };
+
+            std::vector<std::pair<QVariant, int>> keys;
+
+            QSqlQuery seekQuery(db);
+            QSqlQuery offsetQuery(db);
+            if (!prepare(seekQuery, true) || !prepare(offsetQuery, false)) {
+                return keys;
+            }
+
+            while (true) {
+                // Window starts windowSize rows after the previous key
+                const bool seek = !keys.empty() && isUsableKey(keys.back(), parameters);
+                QSqlQuery& query = seek ? seekQuery : offsetQuery;
+
+                QVariantList values;
+                if (seek) {
+                    QStringList keyConditions;
+                    addKeyCondition(keyConditions, values, parameters, keys.back());
+                }
+                values.append(filterValues);
+                values.push_back(seek ? windowSize : static_cast<int>(keys.size()) * windowSize);
+                for (int i = 0, max = values.size(); i < max; ++i) {
+                    query.bindValue(i, values[i]);
+                }
+
+                if (!query.exec()) {
+                    if (!parameters.cancellationToken || !parameters.cancellationToken->isCancelled()) {
+                        qWarning() << "Exec failed:" << query.lastError();
+                        qWarning() << "Query:" << query.lastQuery();
+                    }
+                    return {};
+                }
+                if (!query.next()) {
+                    break;
+                }
+                keys.emplace_back(query.value(0), query.value(1).toInt());
+                query.finish();
+            }
+
+            return keys;
+        }
+
+        // If key is null, window is selected using OFFSET
+        std::vector<LibraryTrack> queryWindow(const QSqlDatabase& db,
+                                              const WindowQueryParameters& parameters,
+                                              int window,
+                                              const std::pair<QVariant, int>* key)
+        {
+            QStringList conditions;
+            QVariantList values;
+            if (key) {
+                addKeyCondition(conditions, values, parameters, *key);
+            }
+            addTitleFilter(conditions, values, parameters.titleFilter);
+
+            const QString order(windowOrder(parameters));
+
+            QString queryString(QLatin1String("SELECT tracks.id, filePath, tracks.title, duration, "
+                                              "group_concat(artists.title, '\n'), group_concat(albums.title, '\n') "
+                                              "FROM (SELECT * FROM tracks "));
+            if (!conditions.isEmpty()) {
+                queryString += QLatin1String("WHERE (") % conditions.join(QLatin1String(") AND (")) % QLatin1String(") ");
+            }
+            queryString += QLatin1String("ORDER BY ") % order % QLatin1String(" LIMIT ") % QString::number(windowSize);
+            if (!key && window > 0) {
+                queryString += QLatin1String(" OFFSET ") % QString::number(window * windowSize);
+            }
+            queryString += QLatin1String(") AS tracks ");
+            query::join(queryString, TracksModel::QueryAllTracks, parameters.useAlbumArtist);
+            queryString += QLatin1String("GROUP BY tracks.id ORDER BY ") % order;
+
+            std::vector<LibraryTrack> tracks;
+            QSqlQuery query(db);
+            if (!execWindowQuery(query, queryString, values, parameters)) {
+                return tracks;
+            }
+            tracks.reserve(windowSize);
+            while (query.next()) {
+                tracks.push_back(TracksModel::trackFromQuery(query, true));
+            }
+            return tracks;
+        }
+    }
+
     QString TracksModel::makeQueryString(QueryMode queryMode,
                                          SortMode sortMode,
                                          InsideAlbumSortMode insideAlbumSortMode,
@@ -489,6 +826,398 @@ namespace unplayer
         return new ItemFactory(mGroupTracks);
     }
 
+    bool TracksModel::isAffectedBy(const LibraryChanges& changes) const
+    {
+        switch (mQueryMode) {
+        case QueryAllTracks:
+            return !changes.tracks.isEmpty();
+        case QueryArtistTracks:
+            return (Settings::instance()->useAlbumArtist() ? changes.albumArtists : changes.artists).contains(mArtistId);
+        case QueryAlbumTracksForAllArtists:
+        case QueryAlbumTracksForSingleArtist:
+            return changes.albums.contains(mAlbumId);
+        case QueryGenreTracks:
+            return changes.genres.contains(mGenreId);
+        }
+        return true;
+    }
+
+    const LibraryChanges::Ids& TracksModel::changedItemIds(const LibraryChanges& changes) const
+    {
+        return changes.tracks;
+    }
+
+    void TracksModel::execQuery()
+    {
+        mTitleFilterTimer->stop();
+
+        if (mWindowed) {
+            clearWindows();
+        } else {
+            cancelWindowQueries();
+        }
+
+        if (!canBeWindowed()) {
+            setWindowed(false);
+            AbstractLibraryModel::execQuery();
+            return;
+        }
+
+        // Mode is chosen by number of all tracks, so that it doesn't change while filtering
+        setLoading(true);
+        const int queryId = mWindowsQueryId;
+        const WindowQueryParameters parameters{mSortMode, mSortDescending, Settings::instance()->useAlbumArtist(), QString(), mWindowsCancellationToken};
+        auto future(runWindowQuery(parameters, [parameters](const QSqlDatabase& db) {
+            return queryRowCount(db, parameters);
+        }));
+        onFutureFinished(future, this, [this, queryId](int count) {
+            if (queryId != mWindowsQueryId) {
+                return;
+            }
+            if (shouldBeWindowed(count)) {
+                if (!mWindowed) {
+                    cancelQuery();
+                    removeRows(0, rowCount());
+                    setWindowed(true);
+                }
+                loadWindowedModel(false);
+            } else {
+                setWindowed(false);
+                AbstractLibraryModel::execQuery();
+            }
+        });
+    }
+
+    void TracksModel::setWindowed(bool windowed)
+    {
+        if (windowed != mWindowed) {
+            mWindowed = windowed;
+            emit windowedChanged();
+        }
+    }
+
+    void TracksModel::updateItems(std::unordered_set<int>&& changedIds)
+    {
+        if (mWindowed) {
+            loadWindowedModel(true, changedIds);
+        } else {
+            AbstractLibraryModel::updateItems(std::move(changedIds));
+        }
+    }
+
+    bool TracksModel::shouldBeWindowed(int rowCount) const
+    {
+        return rowCount >= windowingThreshold && canBeWindowed();
+    }
+
+    bool TracksModel::canBeWindowed() const
+    {
+        // Windows are selected by keys from tracks table, so each track should be listed once
+        // and sorted only by its own columns
+        return mQueryMode == QueryAllTracks &&
+               (mSortMode == SortMode::Title || mSortMode == SortMode::AddedDate);
+    }
+
+    void TracksModel::cancelWindowQueries()
+    {
+        ++mWindowsQueryId;
+        if (mWindowsCancellationToken) {
+            mWindowsCancellationToken->cancel();
+        }
+        mWindowsCancellationToken = std::make_shared<QueryCancellationToken>();
+    }
+
+    void TracksModel::clearWindows()
+    {
+        cancelWindowQueries();
+        if (mRowCount > 0) {
+            beginRemoveRows(QModelIndex(), 0, mRowCount - 1);
+            mRowCount = 0;
+            mWindows.clear();
+            endRemoveRows();
+        }
+        mWindows.clear();
+        mRequestedWindows.clear();
+        mPendingWindows.clear();
+        mWindowKeys.clear();
+        mWindowKeysLoaded = false;
+    }
+
+    void TracksModel::loadWindowedModel(bool keepRows, const std::unordered_set<int>& changedIds)
+    {
+        cancelWindowQueries();
+        const int queryId = mWindowsQueryId;
+        // Used to find windows that have not changed
+        std::vector<std::pair<QVariant, int>> oldKeys;
+        if (mWindowKeysLoaded) {
+            oldKeys = std::move(mWindowKeys);
+        }
+        mWindowKeys.clear();
+        mWindowKeysLoaded = false;
+        // Windows that were requested but not loaded are requested again with new keys
+        const std::unordered_set<int> requestedWindows(std::move(mRequestedWindows));
+        mRequestedWindows.clear();
+        mPendingWindows.clear();
+
+        const WindowQueryParameters parameters{mSortMode, mSortDescending, Settings::instance()->useAlbumArtist(), mTitleFilter, mWindowsCancellationToken};
+
+        if (keepRows) {
+            for (int window : requestedWindows) {
+                requestWindow(window);
+            }
+        } else {
+            auto countFuture(runWindowQuery(parameters, [parameters](const QSqlDatabase& db) {
+                return queryRowCount(db, parameters);
+            }));
+            onFutureFinished(countFuture, this, [this, queryId](int count) {
+                if (queryId != mWindowsQueryId) {
+                    return;
+                }
+                if (count > 0) {
+                    beginInsertRows(QModelIndex(), 0, count - 1);
+                    mRowCount = count;
+                    endInsertRows();
+                }
+                setLoading(false);
+            });
+        }
+
+        auto keysFuture(runWindowQuery(parameters, [parameters, keepRows](const QSqlDatabase& db) {
+            // Kept rows are updated using new count and keys at once
+            const int count = keepRows ? queryRowCount(db, parameters) : 0;
+            return std::make_pair(count, queryWindowKeys(db, parameters));
+        }));
+        onFutureFinished(keysFuture, this, [this, queryId, keepRows, changedIds, oldKeys = std::move(oldKeys)](std::pair<int, std::vector<std::pair<QVariant, int>>>&& result) {
+            if (queryId != mWindowsQueryId) {
+                return;
+            }
+            mWindowKeys = std::move(result.second);
+            mWindowKeysLoaded = true;
+
+            if (keepRows) {
+                // Rows are inserted or removed at the end
+                const int count = result.first;
+                const int oldCount = mRowCount;
+                if (count > oldCount) {
+                    beginInsertRows(QModelIndex(), oldCount, count - 1);
+                    mRowCount = count;
+                    endInsertRows();
+                } else if (count < oldCount) {
+                    beginRemoveRows(QModelIndex(), count, oldCount - 1);
+                    mRowCount = count;
+                    endRemoveRows();
+                }
+                updateWindows(changedIds, oldKeys);
+            }
+
+            const std::unordered_set<int> pending(std::move(mPendingWindows));
+            mPendingWindows.clear();
+            for (int window : pending) {
+                mRequestedWindows.erase(window);
+                requestWindow(window);
+            }
+        });
+    }
+
+    void TracksModel::updateWindows(const std::unordered_set<int>& changedIds, const std::vector<std::pair<QVariant, int>>& oldKeys)
+    {
+        const auto boundaryId = [](const std::vector<std::pair<QVariant, int>>& keys, int window) {
+            return window < static_cast<int>(keys.size()) ? keys[static_cast<size_t>(window)].second : -1;
+        };
+
+        // Window is kept only if it still starts and ends at the same tracks and none of its tracks were changed.
+        // Track that was inserted or removed inside window would have moved its end
+        std::vector<int> removedWindows;
+        for (auto i = mWindows.begin(); i != mWindows.end();) {
+            const int window = i->first;
+            const int first = window * windowSize;
+            const std::vector<LibraryTrack>& tracks = i->second.tracks;
+            bool keep = (first < mRowCount) &&
+                        (static_cast<int>(tracks.size()) == std::min(windowSize, mRowCount - first)) &&
+                        (tracks.front().id == boundaryId(mWindowKeys, window)) &&
+                        (boundaryId(oldKeys, window) == boundaryId(mWindowKeys, window)) &&
+                        (boundaryId(oldKeys, window + 1) == boundaryId(mWindowKeys, window + 1));
+            for (size_t j = 0, max = tracks.size(); keep && j < max; ++j) {
+                keep = !contains(changedIds, tracks[j].id);
+            }
+            if (keep) {
+                ++i;
+            } else {
+                if (first < mRowCount) {
+                    removedWindows.push_back(i->first);
+                }
+                i = mWindows.erase(i);
+            }
+        }
+
+        // Views will request removed windows again when they need them
+        for (int window : removedWindows) {
+            const int first = window * windowSize;
+            emit dataChanged(index(first), index(std::min(first + windowSize, mRowCount) - 1));
+        }
+    }
+
+    const std::pair<QVariant, int>* TracksModel::windowKey(int window) const
+    {
+        // If keys are not loaded yet or are outdated OFFSET is used instead
+        if (!mWindowKeysLoaded) {
+            return nullptr;
+        }
+        return findWindowKey(mWindowKeys, window, {mSortMode, mSortDescending, false, QString(), nullptr});
+    }
+
+    const LibraryTrack* TracksModel::windowedTrack(int index) const
+    {
+        const int window = index / windowSize;
+        const auto found(mWindows.find(window));
+        if (found == mWindows.end()) {
+            requestWindow(window);
+            return nullptr;
+        }
+        Window& loaded = found->second;
+        loaded.lastUsed = ++mWindowsUseCounter;
+        const auto i = static_cast<size_t>(index % windowSize);
+        if (i >= loaded.tracks.size()) {
+            return nullptr;
+        }
+        return &loaded.tracks[i];
+    }
+
+    void TracksModel::requestWindow(int window) const
+    {
+        if (mRequestedWindows.find(window) != mRequestedWindows.end()) {
+            return;
+        }
+        mRequestedWindows.insert(window);
+
+        // Wait for keys, otherwise window will be selected using slow OFFSET
+        if (window > 0 && !mWindowKeysLoaded) {
+            mPendingWindows.insert(window);
+            return;
+        }
+
+        const WindowQueryParameters parameters{mSortMode, mSortDescending, Settings::instance()->useAlbumArtist(), mTitleFilter, mWindowsCancellationToken};
+        const std::pair<QVariant, int>* keyPointer = windowKey(window);
+        const bool hasKey = (keyPointer != nullptr);
+        const std::pair<QVariant, int> key(hasKey ? *keyPointer : std::pair<QVariant, int>());
+
+        auto future(runWindowQuery(parameters, [parameters, window, hasKey, key](const QSqlDatabase& db) {
+            return queryWindow(db, parameters, window, hasKey ? &key : nullptr);
+        }));
+
+        // Loading windows doesn't change logical state of the model
+        const auto model = const_cast<TracksModel*>(this);
+        onFutureFinished(future, model, [model, queryId = mWindowsQueryId, window](std::vector<LibraryTrack>&& tracks) {
+            if (queryId != model->mWindowsQueryId) {
+                return;
+            }
+            model->mRequestedWindows.erase(window);
+            model->addWindow(window, std::move(tracks));
+        });
+    }
+
+    void TracksModel::addWindow(int window, std::vector<LibraryTrack>&& tracks)
+    {
+        const int first = window * windowSize;
+        if (first >= mRowCount) {
+            return;
+        }
+
+        mWindows[window] = {std::move(tracks), ++mWindowsUseCounter};
+
+        while (mWindows.size() > maxWindowsCount) {
+            const auto leastRecentlyUsed(std::min_element(mWindows.begin(), mWindows.end(), [](const auto& first, const auto& second) {
+                return first.second.lastUsed < second.second.lastUsed;
+            }));
+            mWindows.erase(leastRecentlyUsed);
+        }
+
+        emit dataChanged(index(first), index(std::min(first + windowSize, mRowCount) - 1));
+    }
+
+    std::vector<LibraryTrack> TracksModel::loadedTracksAt(const std::vector<int>& indexes) const
+    {
+        std::vector<LibraryTrack> tracks;
+        tracks.reserve(indexes.size());
+        if (mWindowed) {
+            for (int index : indexes) {
+                if (const LibraryTrack* track = loadedTrack(index)) {
+                    tracks.push_back(*track);
+                }
+            }
+        } else {
+            for (int index : indexes) {
+                tracks.push_back(mTracks[static_cast<size_t>(index)]);
+            }
+        }
+        return tracks;
+    }
+
+    void TracksModel::tracksAt(const std::vector<int>& indexes, std::function<void(std::vector<LibraryTrack>&&)>&& callback) const
+    {
+        std::vector<int> missingWindows;
+        if (mWindowed) {
+            for (int index : indexes) {
+                const int window = index / windowSize;
+                if (!loadedTrack(index) && !contains(missingWindows, window)) {
+                    missingWindows.push_back(window);
+                }
+            }
+        }
+        if (missingWindows.empty()) {
+            callback(loadedTracksAt(indexes));
+            return;
+        }
+
+        // Windows that are not in memory are queried once, without adding them to the model
+        const WindowQueryParameters parameters{mSortMode, mSortDescending, Settings::instance()->useAlbumArtist(), mTitleFilter, mWindowsCancellationToken};
+        auto future(runWindowQuery(parameters, [parameters, missingWindows, keysLoaded = mWindowKeysLoaded, loadedKeys = mWindowKeys](const QSqlDatabase& db) {
+            const std::vector<std::pair<QVariant, int>> keys(keysLoaded ? loadedKeys : queryWindowKeys(db, parameters));
+            std::unordered_map<int, std::vector<LibraryTrack>> windows;
+            for (int window : missingWindows) {
+                windows.emplace(window, queryWindow(db, parameters, window, findWindowKey(keys, window, parameters)));
+            }
+            return windows;
+        }));
+
+        const auto model = const_cast<TracksModel*>(this);
+        onFutureFinished(future, model, [model, queryId = mWindowsQueryId, indexes, callback = std::move(callback)](std::unordered_map<int, std::vector<LibraryTrack>>&& windows) {
+            // Rows have changed, indexes are no longer valid
+            if (queryId != model->mWindowsQueryId) {
+                callback({});
+                return;
+            }
+            std::vector<LibraryTrack> tracks;
+            tracks.reserve(indexes.size());
+            for (int index : indexes) {
+                if (const LibraryTrack* track = model->loadedTrack(index)) {
+                    tracks.push_back(*track);
+                } else {
+                    const auto found(windows.find(index / windowSize));
+                    const auto i = static_cast<size_t>(index % windowSize);
+                    if (found != windows.end() && i < found->second.size()) {
+                        tracks.push_back(found->second[i]);
+                    }
+                }
+            }
+            callback(std::move(tracks));
+        });
+    }
+
+    const LibraryTrack* TracksModel::loadedTrack(int index) const
+    {
+        const auto found(mWindows.find(index / windowSize));
+        if (found == mWindows.end()) {
+            return nullptr;
+        }
+        const std::vector<LibraryTrack>& tracks = found->second.tracks;
+        const auto i = static_cast<size_t>(index % windowSize);
+        if (i >= tracks.size()) {
+            return nullptr;
+        }
+        return &tracks[i];
+    }
+
     LibraryTrack TracksModel::ItemFactory::itemFromQuery(const QSqlQuery& query)
     {
         return TracksModel::trackFromQuery(query, groupTracks);
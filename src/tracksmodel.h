@@ -19,11 +19,19 @@
 #ifndef UNPLAYER_TRACKSMODEL_H
 #define UNPLAYER_TRACKSMODEL_H
 
+#include <functional>
+#include <unordered_map>
+#include <utility>
+
+#include <QJSValue>
 #include <QQmlParserStatus>
+#include <QVariant>
 
 #include "abstractlibrarymodel.h"
 #include "librarytrack.h"
 
+class QTimer;
+
 namespace unplayer
 {
     struct TracksModelSortMode
@@ -78,6 +86,9 @@ namespace unplayer
         Q_PROPERTY(bool sortDescending READ sortDescending WRITE setSortDescending)
         Q_PROPERTY(unplayer::TracksModelSortMode::Mode sortMode READ sortMode WRITE setSortMode NOTIFY sortModeChanged)
         Q_PROPERTY(unplayer::TracksModelInsideAlbumSortMode::Mode insideAlbumSortMode READ insideAlbumSortMode WRITE setInsideAlbumSortMode NOTIFY insideAlbumSortModeChanged)
+
+        Q_PROPERTY(bool windowed READ isWindowed NOTIFY windowedChanged)
+        Q_PROPERTY(QString titleFilter READ titleFilter WRITE setTitleFilter)
     public:
         enum Role
         {
@@ -112,10 +123,12 @@ namespace unplayer
         using SortMode = TracksModelSortMode::Mode;
         using InsideAlbumSortMode = TracksModelInsideAlbumSortMode::Mode;
 
+        TracksModel();
         ~TracksModel() override;
         void classBegin() override;
         void componentComplete() override;
 
+        int rowCount(const QModelIndex& parent = QModelIndex()) const override;
         QVariant data(const QModelIndex& index, int role) const override;
 
         QueryMode queryMode() const;
@@ -147,10 +160,23 @@ namespace unplayer
 
         bool isRemovingFiles() const;
 
+        // In windowed mode only tracks around visible rows are kept in memory,
+        // it is used only for large libraries
+        bool isWindowed() const;
+
+        // Filter by track title, applied in database. Used only in windowed mode
+        QString titleFilter() const;
+        void setTitleFilter(const QString& filter);
+
+        // In windowed mode these return only tracks that are in memory
         Q_INVOKABLE std::vector<unplayer::LibraryTrack> getTracks(const std::vector<int>& indexes) const;
         Q_INVOKABLE unplayer::LibraryTrack getTrack(int index) const;
         Q_INVOKABLE QStringList getTrackPaths(const std::vector<int>& indexes) const;
 
+        // Call callback with tracks or their paths. In windowed mode tracks that are not in memory are queried in background
+        Q_INVOKABLE void requestTracks(const std::vector<int>& indexes, const QJSValue& callback) const;
+        Q_INVOKABLE void requestTrackPaths(const std::vector<int>& indexes, const QJSValue& callback) const;
+
         Q_INVOKABLE void removeTrack(int index, bool deleteFile);
         Q_INVOKABLE void removeTracks(const std::vector<int>& indexes, bool deleteFiles);
 
@@ -175,9 +201,14 @@ namespace unplayer
 
         QHash<int, QByteArray> roleNames() const override;
 
+        void execQuery() override;
+        void updateItems(std::unordered_set<int>&& changedIds) override;
         QString makeQueryString() override;
         AbstractItemFactory* createItemFactory() override;
 
+        bool isAffectedBy(const LibraryChanges& changes) const override;
+        const LibraryChanges::Ids& changedItemIds(const LibraryChanges& changes) const override;
+
     private:
         std::vector<LibraryTrack>& mTracks = mItems;
 
@@ -194,10 +225,60 @@ namespace unplayer
 
         bool mGroupTracks;
 
+        struct Window
+        {
+            std::vector<LibraryTrack> tracks;
+            unsigned int lastUsed;
+        };
+
+        bool canBeWindowed() const;
+        bool shouldBeWindowed(int rowCount) const;
+        void setWindowed(bool windowed);
+        /**
+         * @brief Interrupts window queries that are executed and makes results of finished ones ignored
+         */
+        void cancelWindowQueries();
+        void clearWindows();
+        /**
+         * @brief Loads row count and keys of windows' first rows
+         * @param keepRows If true, current rows are kept and only count difference is inserted or removed
+         * @param changedIds Ids of tracks which data has changed, used only with keepRows
+         */
+        void loadWindowedModel(bool keepRows, const std::unordered_set<int>& changedIds = {});
+        /**
+         * @brief Drops windows which tracks were moved or changed and emits dataChanged() only for them
+         * @param oldKeys Keys of windows before change, empty if they were not loaded
+         */
+        void updateWindows(const std::unordered_set<int>& changedIds, const std::vector<std::pair<QVariant, int>>& oldKeys);
+        const std::pair<QVariant, int>* windowKey(int window) const;
+        const LibraryTrack* windowedTrack(int index) const;
+        void requestWindow(int window) const;
+        void addWindow(int window, std::vector<LibraryTrack>&& tracks);
+        std::vector<LibraryTrack> loadedTracksAt(const std::vector<int>& indexes) const;
+        void tracksAt(const std::vector<int>& indexes, std::function<void(std::vector<LibraryTrack>&&)>&& callback) const;
+        // Returns track if its window is in memory, without requesting it
+        const LibraryTrack* loadedTrack(int index) const;
+
+        bool mWindowed = false;
+        QString mTitleFilter;
+        QTimer* mTitleFilterTimer;
+        int mRowCount = 0;
+        // Results of superseded window queries are ignored
+        int mWindowsQueryId = 0;
+        std::shared_ptr<QueryCancellationToken> mWindowsCancellationToken;
+        bool mWindowKeysLoaded = false;
+        // Title and id of first track of each window
+        std::vector<std::pair<QVariant, int>> mWindowKeys;
+        mutable std::unordered_map<int, Window> mWindows;
+        mutable std::unordered_set<int> mRequestedWindows;
+        mutable std::unordered_set<int> mPendingWindows;
+        mutable unsigned int mWindowsUseCounter = 0;
+
     signals:
         void queryModeChanged(QueryMode queryMode);
         void sortModeChanged();
         void insideAlbumSortModeChanged();
+        void windowedChanged();
     };
 }
 
@@ -38,6 +38,7 @@
 #include "filterproxymodel.h"
 #include "genresmodel.h"
 #include "librarydirectoriesmodel.h"
+#include "librarysearchmodel.h"
 #include "libraryutils.h"
 #include "mediaartutils.h"
 #include "player.h"
@@ -51,9 +52,6 @@
 #include "trackinfo.h"
 #include "tracksmodel.h"
 
-Q_DECLARE_METATYPE(unplayer::LibraryTrack)
-Q_DECLARE_METATYPE(std::vector<unplayer::LibraryTrack>)
-
 namespace unplayer
 {
     void Utils::registerTypes()
@@ -85,6 +83,8 @@ namespace unplayer
 
         qmlRegisterType<GenresModel>(url, major, minor, "GenresModel");
 
+        qmlRegisterType<LibrarySearchModel>(url, major, minor, "LibrarySearchModel");
+
         qmlRegisterSingletonType<PlaylistUtils>(url, major, minor, "PlaylistUtils", [](QQmlEngine*, QJSEngine*) -> QObject* { return PlaylistUtils::instance(); });
         qmlRegisterType<PlaylistsModel>(url, major, minor, "PlaylistsModel");
         qmlRegisterType<PlaylistModel>(url, major, minor, "PlaylistModel");